@@ -29,13 +29,38 @@ struct configuration {
     int endpoint_out : 8;
     int interface_no : 8;
     std::string device;
+    std::string device_id;  // vid:pid, set if the device was found by scan
     std::string pac_path;
-    std::string usb_physical_port;
+    std::string usb_physical_port;  // one port, a comma separated list or "all" to flash several at once
     bool reset_normal;
+    uint32_t pipeline_depth;  // frames encoded ahead, less than 2 for stop-and-wait
+    uint32_t midst_window;    // midst frames out before the oldest ack, less than 2 for stop-and-wait
+    std::string profile;      // link parameters learned per device
+    std::string manifest;     // parsed pac kept here, <pac>.manifest if empty, "off" for none
+    uint32_t baud_max;        // tty rate tried after fdl1 is up, 115200 or less keeps it
+    bool low_latency;         // tty only, low latency driver flag and no usb autosuspend
+    bool tty_uring;           // tty only, drive it through io_uring
+    uint32_t usbfs_out_urbs;  // OUT urbs queued on usbfs, 0 for blocking bulk transfers
+    uint32_t usbfs_in_urbs;   // IN urbs queued on usbfs, 0 for blocking bulk transfers
+    uint32_t sessions_max;    // devices flashed at once with several ports, 0 for all of them
+    bool framesz_probe;       // try larger midst and read_midst frames once fdl2 is up
     std::vector<usbdev_info> edl_devs;
     std::vector<usbdev_info> normal_devs;
 
-    configuration() : endpoint_in(0), endpoint_out(0), interface_no(0), reset_normal(true) {}
+    configuration()
+        : endpoint_in(0),
+          endpoint_out(0),
+          interface_no(0),
+          reset_normal(true),
+          pipeline_depth(0),
+          midst_window(0),
+          baud_max(0),
+          low_latency(false),
+          tty_uring(false),
+          usbfs_out_urbs(0),
+          usbfs_in_urbs(0),
+          sessions_max(0),
+          framesz_probe(false) {}
 };
 
 #endif  //__CONFIG__
\ No newline at end of file
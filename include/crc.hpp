@@ -0,0 +1,64 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-17 10:12:40
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-17 10:12:40
+ * @Description: checksums used by bootcode, fdl and nv image
+ */
+#ifndef __CRC__
+#define __CRC__
+
+#include <cstdint>
+
+enum class CRC_IMPL {
+    CRC_IMPL_BITWISE,  // reference implementation, one bit per step
+    CRC_IMPL_TABLE,    // one table lookup per byte
+    CRC_IMPL_SLICE8,   // slicing-by-8, eight table lookups per 8 bytes
+    CRC_IMPL_CLMUL,    // carry-less multiply folding, needs PCLMULQDQ
+};
+
+enum class SUM_IMPL {
+    SUM_IMPL_SCALAR,  // reference implementation, one word per step
+    SUM_IMPL_SWAR,    // 4 words per step in a 64bit register
+    SUM_IMPL_SSE2,    // 8 words per step
+    SUM_IMPL_AVX2,    // 32 words per step, two registers
+};
+
+/**
+ * bootcode: CRC-16/XMODEM, poly 0x1021, msb first
+ * nv:       CRC-16/ARC, poly 0x8005, lsb first (reflected)
+ * fdl:      ones' complement sum of big endian 16bit words
+ *
+ * the fastest implementation supported by cpu is chosen on first use,
+ * set env CRC_IMPL=bitwise|table|slice8|clmul or SUM_IMPL=scalar|swar|sse2|avx2
+ * to force one. src needs no alignment.
+ */
+class CRC16 final {
+   public:
+    CRC16() = delete;
+
+    static uint16_t bootcode(const uint8_t *src, uint32_t len, uint16_t crc = 0);
+    static uint16_t nv(uint16_t crc, const uint8_t *src, uint32_t len);
+    static uint16_t fdl(const uint8_t *src, uint32_t len);
+
+    // fdl in two steps, sums of parts split at even offsets can be added up
+    static uint64_t fdlSum(const uint8_t *src, uint32_t len);
+    static uint16_t fdlFold(uint64_t sum);
+
+    static uint16_t bootcode(CRC_IMPL impl, const uint8_t *src, uint32_t len, uint16_t crc = 0);
+    static uint16_t nv(CRC_IMPL impl, uint16_t crc, const uint8_t *src, uint32_t len);
+    static uint16_t fdl(SUM_IMPL impl, const uint8_t *src, uint32_t len);
+
+    static bool supported(CRC_IMPL impl);
+    // return false if impl is not supported by cpu, current one is kept
+    static bool select(CRC_IMPL impl);
+    static CRC_IMPL selected();
+    static const char *toString(CRC_IMPL impl);
+
+    static bool supported(SUM_IMPL impl);
+    static bool select(SUM_IMPL impl);
+    static SUM_IMPL selectedSum();
+    static const char *toString(SUM_IMPL impl);
+};
+
+#endif  //__CRC__
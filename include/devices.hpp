@@ -8,8 +8,10 @@
 #ifndef __DEVICE__
 #define __DEVICE__
 
+#include <cstdint>
 #include <string>
 #include <vector>
+#include <unordered_map>
 
 struct interface {
     int cls;
@@ -20,7 +22,7 @@ struct interface {
     int endpoint_out;
     std::string modalias;
     std::string ttyusb;
-    interface() : cls(0), subcls(0), proto(0), interface_no(0) {}
+    interface() : cls(0), subcls(0), proto(0), interface_no(0), endpoint_in(0), endpoint_out(0) {}
 };
 
 struct usbdev {
@@ -34,25 +36,66 @@ struct usbdev {
     usbdev() : vid(0), pid(0), busno(0), devno(0) {}
 };
 
+/**
+ * sysfs is walked with openat against the directory fds, one read per
+ * attribute, and devices are scanned by several threads once there are many
+ * of them. lookups go through indexes built after the scan, pointers handed
+ * out stay valid until the next reset or scan.
+ */
 class Device final {
    private:
+    std::string sysfs;  // /sys, or a copy of it elsewhere
     std::vector<usbdev> m_usbdevs;
+    std::unordered_map<uint64_t, uint32_t> by_id;                          // vid:pid, first one found
+    std::unordered_map<uint64_t, std::pair<uint32_t, uint32_t>> by_iface;  // vid:pid:ifno, device and interface
+    std::unordered_map<std::string, uint32_t> by_port;                     // devpath
 
    private:
-    int scan_iface(int vid, int pid, std::string usbport, std::string rootdir);
+    void index();
 
    public:
-    Device() { reset(); }
+    Device(const std::string &sysfs = "/sys");
     ~Device() {}
 
     void reset();
-    int scan(const std::string& usbport);
+    int scan(const std::string &usbport);
+    // in scan order
+    const std::vector<usbdev> &devices() const { return m_usbdevs; }
     bool exist(int vid, int pid);
     bool exist(int vid, int pid, int ifno);
     bool exist(int vid, int pid, int cls, int scls, int proto);
-    usbdev get_usbdevice(int vid, int pid);
-    interface get_interface(int vid, int pid, int ifno);
-    interface get_interface(int vid, int pid, int cls, int scls, int proto);
+    // nullptr if not found
+    const usbdev *get_usbdevice(int vid, int pid);
+    const usbdev *get_usbdevice(const std::string &usbport);
+    const interface *get_interface(int vid, int pid, int ifno);
+    const interface *get_interface(int vid, int pid, int cls, int scls, int proto);
+};
+
+/**
+ * kernel uevents, so a device is picked up the moment it shows instead of on
+ * the next poll. only adds of watched vid:pid (or any tty, which has no ids)
+ * on the port wake wait(), the caller scans sysfs to see what came.
+ */
+class Hotplug final {
+   private:
+    int nlfd;
+    std::vector<std::pair<int, int>> ids;
+    std::string usbport;
+
+   private:
+    // one uevent, "action@devpath" then "key=value" strings
+    bool relevant(const char *msg, size_t len);
+
+   public:
+    Hotplug();
+    ~Hotplug();
+
+    bool isOpened();
+    void watch(int vid, int pid);
+    // same form as the devpath file in sysfs, empty for all ports
+    void setPort(const std::string &port);
+    // true once a relevant uevent comes, false at timeout ms
+    bool wait(int timeout);
 };
 
 #endif  //__DEVICE__
\ No newline at end of file
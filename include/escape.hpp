@@ -0,0 +1,108 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-17 14:02:18
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-17 14:02:18
+ * @Description: 0x7e/0x7d escape codec of bootcode and fdl frames
+ */
+#ifndef __ESCAPE__
+#define __ESCAPE__
+
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+#include <sys/uio.h>
+}
+
+const static uint8_t MAGIC_7e = 0x7e;
+const static uint8_t MAGIC_7d = 0x7d;
+const static uint8_t MAGIC_5e = 0x5e;
+const static uint8_t MAGIC_5d = 0x5d;
+
+// runs shorter than this are copied, longer ones are referenced by iovec
+#define ESCAPE_REF_MIN 64
+
+/**
+ * 7e -> 7d 5e
+ * 7d -> 7d 5d
+ */
+class EscapeCodec final {
+   public:
+    EscapeCodec() = delete;
+
+    // first 0x7e or 0x7d in [src, end), end if none
+    static const uint8_t *find(const uint8_t *src, const uint8_t *end);
+    // first 0x7e in [src, end), end if none
+    static const uint8_t *findFlag(const uint8_t *src, const uint8_t *end);
+    static uint32_t count(const uint8_t *src, uint32_t len);
+    // dst should have room for 2 * len bytes, return bytes written
+    static uint32_t escape(const uint8_t *src, uint32_t len, uint8_t *dst);
+};
+
+/**
+ * build a frame as a list of segments, either copied into a scratch buffer
+ * or pointing at the caller's memory, so large payloads are never moved.
+ * NOTICE: referenced memory must stay valid until the frame is sent.
+ */
+class EscapeEncoder final {
+   private:
+    struct segment {
+        const uint8_t *ref;  // nullptr if the bytes live in scratch
+        uint32_t offset;
+        uint32_t len;
+    };
+
+    std::vector<segment> segments;
+    std::vector<uint8_t> scratch;  // only grows, reused by later frames
+    std::vector<uint8_t> flat;
+    std::vector<struct iovec> iovs;
+    uint32_t used;
+    uint32_t total;
+    bool dirty;
+
+   private:
+    uint8_t *reserve(uint32_t len);
+    void copy(const uint8_t *src, uint32_t len);
+    void reference(const uint8_t *src, uint32_t len);
+
+   public:
+    EscapeEncoder();
+    ~EscapeEncoder() {}
+
+    void reset();
+    void append(const uint8_t *src, uint32_t len);
+    void appendRef(const uint8_t *src, uint32_t len);
+    void escape(const uint8_t *src, uint32_t len);
+
+    const struct iovec *iov();
+    int iovcnt();
+    uint32_t length();
+    // contiguous copy of the frame, only gathers if there is more than one segment
+    const uint8_t *flatten();
+};
+
+/**
+ * 7d 5e -> 7e
+ * 7d 5d -> 7d
+ * a 0x7d at the end of a chunk is remembered until the next one.
+ */
+class EscapeDecoder final {
+   private:
+    bool pending;
+
+   public:
+    EscapeDecoder() : pending(false) {}
+
+    void reset() { pending = false; }
+    bool isPending() { return pending; }
+
+    /**
+     * unescape src into dst, stop before a 0x7e or at the end of src.
+     * dst should have room for len bytes. used is set to the bytes consumed
+     * from src, the return value is the bytes written to dst.
+     */
+    uint32_t decode(const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t &used);
+};
+
+#endif  //__ESCAPE__
@@ -13,12 +13,9 @@
 #include <vector>
 
 #include "serial.hpp"
+#include "escape.hpp"
 #include "protocol.hpp"
 
-const static uint8_t MAGIC_7e = 0x7e;
-const static uint8_t MAGIC_7d = 0x7d;
-const static uint8_t MAGIC_5e = 0x5e;
-const static uint8_t MAGIC_5d = 0x5d;
 #define FRAMEHDR(p) (reinterpret_cast<cmd_header *>(p))
 #define FRAMEDATA(p, n, t) (reinterpret_cast<t *>(p + n))
 #define FRAMEDATAHDR(p) (p + sizeof(cmd_header))
@@ -87,18 +84,28 @@ struct partition_info {
 // NOTICE: make sure it not less than data len in Midst message
 #define MAX_DATA_LEN 0x4000
 
+// see FrameEncoder, frame is header plus args, payload follows it
+typedef void (*frame_encode_t)(EscapeEncoder &enc, const uint8_t *frame, uint32_t len, const uint8_t *payload,
+                               uint32_t payloadlen, bool padded);
+
 class FDLRequest final : public CMDRequest {
    private:
     uint8_t *_data;
     uint32_t _reallen;
+    const uint8_t *_payload;  // midst data, referenced instead of copied
+    uint32_t _payloadlen;
     CRC_MODLE crc_modle;
     bool crc_escape_flag;
     bool data_escape_flag;
     std::string _argstr;
+    EscapeEncoder encoder;  // frame on the wire
+    frame_encode_t _encode;  // picked by crc modle and escape flags
 
    private:
     void reinit(REQTYPE);
     void finishup();
+    // frames without argument, already built at compile time
+    void constframe(REQTYPE);
 
     template <typename T>
     void push_back(T);
@@ -117,22 +124,26 @@ class FDLRequest final : public CMDRequest {
     uint32_t dataLen();
     uint8_t *rawData();
     uint32_t rawDataLen();
+    const struct iovec *rawIov();
+    int rawIovCnt();
+    uint32_t replyLength();
 
-    bool isDuplicate();
     bool onWrite();
     bool onRead();
 
     void setEscapeFlag(bool data_es_flag, bool crc_es_flag);
     void setCrcModle(CRC_MODLE);
-    uint16_t crc16BootCode(const char *src, uint32_t len);
-    uint16_t crc16FDL(const uint16_t *src, uint32_t len);
-    uint16_t crc16NV(uint16_t crc, const uint8_t *src, uint32_t len);
 
     void newCheckBaud();
     void newConnect();
     void newStartData(uint32_t addr, uint32_t len, uint32_t cs = 0);
-    void newStartData(const std::string &idstr, uint32_t len, uint32_t cs = 0);
-    void newMidstData(uint8_t *buf, uint32_t len);
+    /**
+     * len of 4 GB or more goes in the 64-bit form, that is its high half and
+     * 8 reserved bytes follow the low one. there is no checksum then, only nv has one
+     */
+    void newStartData(const std::string &idstr, uint64_t len, uint32_t cs = 0);
+    // NOTICE: buf is not copied, keep it untouched until the frame is sent
+    void newMidstData(const uint8_t *buf, uint32_t len);
     void newEndData();
     void newExecData();
     void newNormalReset();
@@ -150,8 +161,9 @@ class FDLRequest final : public CMDRequest {
     void newRePartition(const std::vector<partition_info> &table);
 
     void newChangeBaud(BAUD);
-    void newStartRead(const std::string &partition, uint32_t len);
-    void newReadMidst(uint32_t rxsz, uint32_t offset);
+    // same 64-bit forms as newStartData, offset has its high half appended from 4 GB on
+    void newStartRead(const std::string &partition, uint64_t len);
+    void newReadMidst(uint32_t rxsz, uint64_t offset);
     void newEndRead();
     void newExecNandInit();
 };
@@ -162,17 +174,36 @@ class FDLRequest final : public CMDRequest {
 /*************************** RESPONSE ***************************/
 /*************************** RESPONSE ***************************/
 
-enum class RESP_STATE {
-    RESP_STATE_OK,
-    RESP_STATE_INCOMPLETE,
-    RESP_STATE_VARIFY_FAIL,
-    RESP_STATE_MALFORMED,
+enum class DEFRAME_STAGE {
+    DEFRAME_HUNT,    // look for the leading 0x7e
+    DEFRAME_HEADER,  // cmd_type and data_length
+    DEFRAME_DATA,
+    DEFRAME_CRC,
+    DEFRAME_TAIL,  // the trailing 0x7e
 };
 
+/**
+ * frames are cut by data_length rather than by the trailing 0x7e, so data and
+ * crc sent without escape may carry 0x7e. _data holds the unescaped frame.
+ */
 class FDLResponse final : public CMDResponse {
    private:
     uint8_t *_data;
     uint32_t _reallen;
+    uint8_t *_left;  // bytes received behind the last frame
+    uint32_t _leftlen;
+    uint32_t _need;  // bytes missing in current stage
+    DEFRAME_STAGE stage;
+    EscapeDecoder decoder;
+    CRC_MODLE crc_modle;
+    bool crc_fallback;  // the other modle is taken too
+    bool crc_escape_flag;
+    bool data_escape_flag;
+
+   private:
+    RESP_STATE deframe(const uint8_t *d, uint32_t len, uint32_t &used);
+    RESP_STATE verify();
+    void keep(const uint8_t *d, uint32_t len);
 
    public:
     FDLResponse();
@@ -183,14 +214,20 @@ class FDLResponse final : public CMDResponse {
     std::string toString();
 
     void reset();
-    void push_back(uint8_t *d, uint32_t len);
+    // reset, and bytes left behind the last frame are dropped too
+    void discard();
+    RESP_STATE push_back(uint8_t *d, uint32_t len);
+
+    // should match the request, responses are framed the same way
+    void setEscapeFlag(bool data_es_flag, bool crc_es_flag);
+    void setCrcModle(CRC_MODLE);
+    // bootcode and fdl1 answer with either crc at times, fdl2 never does
+    void setCrcFallback(bool on);
 
     uint8_t *data();
     uint32_t dataLen();
     uint8_t *rawData();
     uint32_t rawDataLen();
-    uint32_t expectLength();
-    uint32_t minLength();
 };
 
 #endif  //__FDL__
@@ -12,10 +12,14 @@
 #include <string>
 #include <fstream>
 #include <vector>
+#include <unordered_map>
 
-#include "tinyxml2/tinyxml2.h"
+extern "C" {
+#include <sys/stat.h>
+}
 
 #include "fdl.hpp"
+#include "xmlscan.hpp"
 
 struct pac_header_t {
     uint16_t szVersion[22];      // packet struct version; V1->V2 : 24*2 -> 22*2
@@ -73,12 +77,12 @@ struct XMLFileInfo {
     std::string type;
     std::string fpath;
     uint32_t base;
-    uint32_t size;
-    uint32_t realsize;
+    uint64_t size;
+    uint64_t realsize;
     uint32_t flag;
     uint32_t checkflag;
-    uint32_t checksum;
-    uint16_t crc16;
+    uint32_t checksum;  // nv only, filled by xmlparser
+    uint16_t crc16;     // nv only, goes over its first 2 bytes
     bool use_pac_file;
     bool use_old_proto;
     bool isBackup;
@@ -96,20 +100,86 @@ struct XMLFileInfo {
           isBackup(false) {}
 };
 
+// bytes of a pac member or a local file, read-only, nullptr data if there is none
+struct byte_span {
+    const uint8_t* data;
+    uint64_t size;
+
+    byte_span() : data(nullptr), size(0) {}
+    byte_span(const uint8_t* d, uint64_t sz) : data(d), size(sz) {}
+};
+
+// pages asked ahead at the start of a span, the rest come in by sequential readahead.
+// senders unmap what is acked in steps of it, see FileMap::drop
+#define MAP_WINDOW (16 * 1024 * 1024)
+
+/**
+ * a whole file mapped read-only. every reader of the file shares its pages
+ * in the page cache instead of copying them out with read().
+ */
+class FileMap {
+   private:
+    const uint8_t* base;
+    size_t len;
+    struct stat st;  // of the file mapped
+
+   public:
+    FileMap() : base(nullptr), len(0) {}
+    ~FileMap() { unmap(); }
+    FileMap(const FileMap&) = delete;
+    FileMap& operator=(const FileMap&) = delete;
+
+    bool map(const std::string& path);
+    void unmap();
+    bool isMapped() const { return base != nullptr; }
+    const uint8_t* data() const { return base; }
+    size_t size() const { return len; }
+    // inode, size and mtime of what is mapped, taken when it was
+    const struct stat& status() const { return st; }
+    // sz bytes at off, hinted to be read once from start to end, only its head is asked ahead
+    byte_span span(uint64_t off, uint64_t sz) const;
+    // whole pages in [from, to) are read, unmap them. the page cache keeps them for other readers
+    static void drop(const uint8_t* from, const uint8_t* to);
+};
+
+struct xml_find;  // one element looked for as the xml streams by
+
+/**
+ * the pac is mapped once by pacparser, members are handed out as spans into
+ * the mapping. once parsed a Firmware is only read, any number of sessions
+ * may share it.
+ */
 class Firmware {
    private:
+    // a bin_header_t decoded once by pacparser
+    struct member_info {
+        std::string fileid;
+        std::string filename;
+        uint64_t offset;
+        uint64_t size;
+    };
+
     std::string pac_file;
+    FileMap pacmap;
     pac_header_t* pachdr;
     bin_header_t* binhdr;
+    std::string product_name;
+    std::string product_version;
+    std::vector<member_info> members;
+    std::unordered_map<std::string, int> id_index;  // upper case fileid to index, the first one wins
     std::vector<XMLFileInfo> xmlfilevec;
     std::vector<partition_info> xmlpartitonvec;
 
    private:
-    tinyxml2::XMLNode* xmltree_find_node(tinyxml2::XMLNode*, const std::string&);
-    int xmlparser_file(tinyxml2::XMLNode*);
-    int xmlparser_partition(tinyxml2::XMLNode*);
-    int xmlparser_nv(tinyxml2::XMLNode*);
+    // a file element is read, its fields go to fvec. member index, -1 if skipped
+    int xmlparser_file(xml_find* fields, const std::string& backup, std::vector<XMLFileInfo>& fvec);
+    // a partition element at xs
+    void xmlparser_partition(const XMLScanner& xs, std::vector<partition_info>& pvec);
+    // crc16 and checksum of nv member idx, its first 2 bytes left out
+    void nv_checksum(XMLFileInfo& info, int idx);
     bool is_index_valid(int idx);
+    // index the members, offsets from the headers or packed one after another
+    void build_index();
 
    public:
     Firmware(const std::string pacf);
@@ -120,31 +190,42 @@ class Firmware {
     // should parser pac fisrt before all operations
     int pacparser();
 
+    const std::string& pacPath() const { return pac_file; }
+
     // file counts including file that has size of 0
     uint32_t pac_file_count();
-    const std::string productName();
-    const std::string productVersion();
+    const std::string& productName() const { return product_name; }
+    const std::string& productVersion() const { return product_version; }
 
     int unpack(int idx, const std::string& extdir = "packets");
     int unpack(const std::string& idstr, const std::string& extdir = "packets");
     int unpack_all(const std::string& extdir = "packets");
 
-    // xml has a empty fileid, that is ""
+    // xml has a empty fileid, that is "". ids match in any case, all lookups below are O(1)
     int fileid_to_index(const std::string& idstr);
-    size_t member_file_size(int idx);
-    size_t member_file_size(const std::string& idstr);
-    size_t member_file_offset(int idx);
-    size_t member_file_offset(const std::string& idstr);
+    // 64-bit, the high halves of the headers are used
+    uint64_t member_file_size(int idx);
+    uint64_t member_file_size(const std::string& idstr);
+    uint64_t member_file_offset(int idx);
+    uint64_t member_file_offset(const std::string& idstr);
 
     int xmlparser();
+
+    /**
+     * the parsed pac, file list, partitions, member offsets and nv checksums,
+     * from a manifest saved by a run before. it is only taken if made from
+     * this very pac, same inode, size, mtime and header crc. otherwise -1,
+     * pacparser and xmlparser are up to the caller
+     */
+    int manifest_load(const std::string& path);
+    // after xmlparser, written aside and renamed over path
+    int manifest_save(const std::string& path);
     const std::vector<XMLFileInfo>& get_file_vec() const;
     const std::vector<partition_info>& get_partition_vec() const;
 
-    std::ifstream open_pac(const std::string& idstr);
-    std::ifstream open_file(const std::string& fpath);
-    void close(std::ifstream& fin);
-    bool read(std::ifstream& fin, uint8_t* buf, uint32_t sz);
-    uint32_t local_file_size(const std::string& fpath);
+    // data is nullptr for an unknown member
+    byte_span member(int idx);
+    byte_span member(const std::string& idstr);
 };
 
 #endif  //__FIRMWARE__
\ No newline at end of file
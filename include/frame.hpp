@@ -0,0 +1,160 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-17 16:20:05
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-17 16:20:05
+ * @Description: fdl frame encoder specialized at compile time
+ */
+#ifndef __FRAME__
+#define __FRAME__
+
+#include "crc.hpp"
+#include "escape.hpp"
+#include "fdl.hpp"
+
+/**
+ * one encoder per crc modle and escape policy, no flag is tested while
+ * a frame is built. crc is escaped only if data is, like before.
+ */
+template <CRC_MODLE M>
+struct FrameCRC;
+
+template <>
+struct FrameCRC<CRC_MODLE::CRC_BOOTCODE> {
+    static uint16_t calc(const uint8_t *body, uint32_t bodylen, const uint8_t *payload, uint32_t payloadlen,
+                         bool padded) {
+        const uint8_t pad = 0;
+        uint16_t crc16 = CRC16::bootcode(body, bodylen);
+
+        crc16 = CRC16::bootcode(payload, payloadlen, crc16);
+        if (padded) crc16 = CRC16::bootcode(&pad, sizeof(pad), crc16);
+        return crc16;
+    }
+};
+
+template <>
+struct FrameCRC<CRC_MODLE::CRC_FDL> {
+    // body is 4 bytes header plus args, so the sums can be added up
+    static uint16_t calc(const uint8_t *body, uint32_t bodylen, const uint8_t *payload, uint32_t payloadlen,
+                         bool padded) {
+        uint64_t sum = CRC16::fdlSum(body, bodylen);
+
+        sum += CRC16::fdlSum(payload, payloadlen & ~1U);
+        if (payloadlen & 1) sum += payload[payloadlen - 1] << (padded ? 8 : 0);
+        return CRC16::fdlFold(sum);
+    }
+};
+
+template <CRC_MODLE M, bool DATA_ES, bool CRC_ES>
+struct FrameEncoder {
+    static void encode(EscapeEncoder &enc, const uint8_t *frame, uint32_t len, const uint8_t *payload,
+                       uint32_t payloadlen, bool padded) {
+        const uint8_t pad = 0;
+        uint16_t crc16 = FrameCRC<M>::calc(frame + 1, len - 1, payload, payloadlen, padded);
+        uint8_t crc[sizeof(uint16_t)] = {static_cast<uint8_t>(crc16 >> 8), static_cast<uint8_t>(crc16 & 0xff)};
+
+        enc.reset();
+        enc.append(frame, 1);
+
+        if (DATA_ES) {
+            enc.escape(frame + 1, len - 1);
+            enc.escape(payload, payloadlen);
+            if (padded) enc.escape(&pad, sizeof(pad));
+        } else {
+            enc.append(frame + 1, len - 1);
+            enc.appendRef(payload, payloadlen);
+            if (padded) enc.append(&pad, sizeof(pad));
+        }
+
+        if (DATA_ES && CRC_ES)
+            enc.escape(crc, sizeof(crc));
+        else
+            enc.append(crc, sizeof(crc));
+        enc.append(&MAGIC_7e, 1);
+    }
+};
+
+/*************************** CONSTANT FRAMES ***************************/
+/**
+ * frames without argument, 7e | type | 00 00 | crc | 7e, are worked out
+ * by the compiler, escape included. C++11 constexpr allows no loop, so
+ * everything is a recursion over byte positions.
+ */
+#define FRAME_CONST_MAX 14  // 8 bytes, header and crc may double
+
+struct const_frame {
+    uint8_t len;
+    uint8_t bytes[FRAME_CONST_MAX];
+};
+
+namespace constframe {
+constexpr uint16_t xmodem_bits(uint16_t crc, int n) {
+    return n ? xmodem_bits(static_cast<uint16_t>((crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1), n - 1) : crc;
+}
+
+constexpr uint16_t xmodem(uint16_t crc, uint8_t b) { return xmodem_bits(static_cast<uint16_t>(crc ^ (b << 8)), 8); }
+
+constexpr uint32_t fold_once(uint32_t sum) { return (sum >> 16) + (sum & 0xffff); }
+
+constexpr uint16_t fold(uint32_t sum) { return static_cast<uint16_t>(~fold_once(fold_once(sum))); }
+
+// header only, the body is the words type and 0
+constexpr uint16_t crc(CRC_MODLE m, uint16_t type) {
+    return m == CRC_MODLE::CRC_BOOTCODE ? xmodem(xmodem(xmodem(xmodem(0, type >> 8), type & 0xff), 0), 0)
+                                        : fold(type);
+}
+
+// byte at pos before escape, 8 in total
+constexpr uint8_t raw(uint16_t type, uint16_t crc, int pos) {
+    return pos == 1   ? type >> 8
+           : pos == 2 ? type & 0xff
+           : pos == 5 ? crc >> 8
+           : pos == 6 ? crc & 0xff
+           : pos == 3 || pos == 4 ? 0
+                                  : MAGIC_7e;
+}
+
+constexpr bool escaped(bool data_es, bool crc_es, uint16_t type, uint16_t crc, int pos) {
+    return (raw(type, crc, pos) == MAGIC_7e || raw(type, crc, pos) == MAGIC_7d) &&
+           ((pos >= 1 && pos <= 4 && data_es) || ((pos == 5 || pos == 6) && data_es && crc_es));
+}
+
+constexpr uint8_t len(bool data_es, bool crc_es, uint16_t type, uint16_t crc, int pos = 0) {
+    return pos == 8 ? 0 : 1 + escaped(data_es, crc_es, type, crc, pos) + len(data_es, crc_es, type, crc, pos + 1);
+}
+
+// i-th byte on the wire, walking raw bytes from pos
+constexpr uint8_t at(bool data_es, bool crc_es, uint16_t type, uint16_t crc, int i, int pos = 0) {
+    return pos == 8 ? 0
+           : escaped(data_es, crc_es, type, crc, pos)
+               ? (i == 0   ? MAGIC_7d
+                  : i == 1 ? raw(type, crc, pos) ^ 0x20
+                           : at(data_es, crc_es, type, crc, i - 2, pos + 1))
+               : (i == 0 ? raw(type, crc, pos) : at(data_es, crc_es, type, crc, i - 1, pos + 1));
+}
+}  // namespace constframe
+
+template <REQTYPE T, CRC_MODLE M, bool DATA_ES, bool CRC_ES>
+struct ConstFrame {
+#define CONSTFRAME_AT(i) constframe::at(DATA_ES, CRC_ES, static_cast<uint16_t>(T), crc, i)
+    static constexpr uint16_t crc = constframe::crc(M, static_cast<uint16_t>(T));
+    static constexpr const_frame frame = {
+        constframe::len(DATA_ES, CRC_ES, static_cast<uint16_t>(T), crc),
+        {CONSTFRAME_AT(0), CONSTFRAME_AT(1), CONSTFRAME_AT(2), CONSTFRAME_AT(3), CONSTFRAME_AT(4), CONSTFRAME_AT(5),
+         CONSTFRAME_AT(6), CONSTFRAME_AT(7), CONSTFRAME_AT(8), CONSTFRAME_AT(9), CONSTFRAME_AT(10), CONSTFRAME_AT(11),
+         CONSTFRAME_AT(12), CONSTFRAME_AT(13)}};
+#undef CONSTFRAME_AT
+};
+
+template <REQTYPE T, CRC_MODLE M, bool DATA_ES, bool CRC_ES>
+constexpr uint16_t ConstFrame<T, M, DATA_ES, CRC_ES>::crc;
+
+template <REQTYPE T, CRC_MODLE M, bool DATA_ES, bool CRC_ES>
+constexpr const_frame ConstFrame<T, M, DATA_ES, CRC_ES>::frame;
+
+// check values, CRC-16/XMODEM of 00 00 00 00 and 00 03 00 00
+static_assert(ConstFrame<REQTYPE::BSL_CMD_CONNECT, CRC_MODLE::CRC_BOOTCODE, true, true>::crc == 0x0000, "xmodem");
+static_assert(ConstFrame<REQTYPE::BSL_CMD_END_DATA, CRC_MODLE::CRC_BOOTCODE, true, true>::crc == 0x5950, "xmodem");
+static_assert(ConstFrame<REQTYPE::BSL_CMD_END_DATA, CRC_MODLE::CRC_FDL, true, true>::crc == 0xfffc, "fdl sum");
+
+#endif  //__FRAME__
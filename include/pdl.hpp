@@ -76,10 +76,12 @@ class PDLRequest final : public CMDRequest {
    private:
     uint8_t *_data;
     uint32_t _reallen;
+    struct iovec _iov[3];
+    uint32_t midst_index;  // sequence of midst frames, from 0 at each start
 
    private:
     void reinit(PDLREQ cmd);
-    void push_back(uint8_t *data, uint32_t len);
+    void push_back(const uint8_t *data, uint32_t len);
 
    public:
     PDLRequest();
@@ -87,19 +89,21 @@ class PDLRequest final : public CMDRequest {
 
     void newPDLConnect();
     void newPDLStart(uint32_t addr, uint32_t size);
-    void newPDLMidst(uint8_t *data, uint32_t len);
+    void newPDLMidst(const uint8_t *data, uint32_t len);
     void newPDLEnd();
     void newPDLExec();
 
     uint8_t *rawData();
     uint32_t rawDataLen();
+    // header, tag and payload, sent at once or one by one for picky chipsets
+    const struct iovec *rawIov();
+    int rawIovCnt();
 
     PDLREQ type();
     int value();
     std::string toString();
     std::string argString();
 
-    bool isDuplicate();
     bool onWrite();
     bool onRead();
 };
@@ -123,7 +127,7 @@ class PDLResponse final : public CMDResponse {
     uint32_t minLength();
 
     void reset();
-    void push_back(uint8_t *d, uint32_t len);
+    RESP_STATE push_back(uint8_t *d, uint32_t len);
 };
 
 #endif  //__PDL__
\ No newline at end of file
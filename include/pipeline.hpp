@@ -0,0 +1,93 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-17 17:05:31
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-17 17:05:31
+ * @Description: encode midst frames ahead of the link
+ */
+#ifndef __PIPELINE__
+#define __PIPELINE__
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "fdl.hpp"
+#include "firmware.hpp"
+
+enum class SLOT_STATE {
+    SLOT_FREE,
+    SLOT_READY,     // frame built, waiting for the link
+    SLOT_INFLIGHT,  // handed out by next(), until release()
+};
+
+/**
+ * an encoder thread builds midst frames straight on the mapped file, the
+ * caller only sends and waits for ack. slots go round a ring, so at most
+ * depth frames are ahead of the oldest unacked. frames reference the
+ * mapping, see FDLRequest::newMidstData, only a first chunk with its crc
+ * replaced is a copy.
+ */
+class TransferPipeline {
+   private:
+    struct slot {
+        SLOT_STATE state;
+        FDLRequest request;
+
+        slot() : state(SLOT_STATE::SLOT_FREE) {}
+    };
+
+    slot *slots;
+    uint32_t depth;
+    uint8_t *first;  // the first chunk, when crc16 replaces its 2 bytes
+    uint32_t firstsz;
+
+    std::mutex lock;
+    std::condition_variable cond;
+    std::thread encoder;
+
+    byte_span src;
+    uint32_t maxlen;
+    uint16_t crc16;  // replaces first 2 bytes if not 0, nv only
+    uint32_t chunks;
+    uint32_t handed;  // frames given out by next()
+    uint32_t sent;    // frames released
+    uint32_t head;    // oldest frame not released
+    uint32_t cursor;  // next slot for the link
+    bool aborted;
+
+    CRC_MODLE crc_modle;
+    bool data_escape_flag;
+    bool crc_escape_flag;
+    std::string argstr;
+
+   private:
+    // wait until slot i reaches state, false if aborted
+    bool wait(uint32_t i, SLOT_STATE state);
+    void moveon(uint32_t i, SLOT_STATE state);
+    void encode_loop();
+
+   public:
+    TransferPipeline(uint32_t depth);
+    ~TransferPipeline();
+
+    void setFrameModle(CRC_MODLE mod, bool data_es_flag, bool crc_es_flag);
+    void setArgString(const std::string &);
+
+    // send src in frames of maxlen, same as transfer() does. src must stay mapped until stop()
+    bool start(const byte_span &src, uint32_t maxlen, uint16_t crc16);
+    uint32_t size() { return depth; }
+
+    /**
+     * next frame to send, nullptr if all sent or failed. up to depth frames
+     * may be out before release(), frames are released in order.
+     */
+    FDLRequest *next();
+    // oldest frame from next() is acked, its slot can be reused
+    void release();
+    // join the encoder
+    void stop();
+};
+
+#endif  //__PIPELINE__
@@ -0,0 +1,42 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-17 18:12:44
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-17 18:12:44
+ * @Description: link parameters learned per device, kept on disk
+ */
+#ifndef __PROFILE__
+#define __PROFILE__
+
+#include <map>
+#include <set>
+#include <string>
+
+#define DEFAULT_PROFILE "/var/lib/dloader.profile"
+
+/**
+ * one "device.key=value" per line, device is what the caller picks to tell
+ * devices apart, such as the product name. comments are not kept on save.
+ * save only writes the keys set here over what is on disk then, so several
+ * sessions sharing the file keep what the others learned.
+ */
+class Profile {
+   private:
+    std::string path;
+    std::map<std::string, std::string> values;
+    std::set<std::string> changed;  // keys set since load or save
+
+   public:
+    Profile(const std::string &path = DEFAULT_PROFILE);
+    ~Profile() {}
+
+    void setPath(const std::string &path);
+    bool load();
+    // only writes if anything changed
+    bool save();
+
+    int get(const std::string &dev, const std::string &key, int defval = 0);
+    void set(const std::string &dev, const std::string &key, int val);
+};
+
+#endif  //__PROFILE__
@@ -8,14 +8,26 @@
 #ifndef __PROTOCOL__
 #define __PROTOCOL__
 
+extern "C" {
+#include <sys/uio.h>
+}
+
 enum class PROTOCOL {
     PROTO_PDL,
     PROTO_FDL,
 };
 
+enum class RESP_STATE {
+    RESP_STATE_OK,
+    RESP_STATE_INCOMPLETE,
+    RESP_STATE_VARIFY_FAIL,
+    RESP_STATE_MALFORMED,
+};
+
 class CMDRequest {
    protected:
     PROTOCOL proto;
+    struct iovec _rawiov;
 
    public:
     CMDRequest(PROTOCOL pro) : proto(pro) {}
@@ -24,6 +36,16 @@ class CMDRequest {
     virtual uint8_t *rawData() = 0;
     virtual uint32_t rawDataLen() = 0;
 
+    // frame as a gather list, one segment of rawData() by default
+    virtual const struct iovec *rawIov() {
+        _rawiov.iov_base = rawData();
+        _rawiov.iov_len = rawDataLen();
+        return &_rawiov;
+    }
+    virtual int rawIovCnt() { return 1; }
+    // bytes the reply takes on the wire at least, 0 if not known
+    virtual uint32_t replyLength() { return 0; }
+
     virtual std::string toString() = 0;
     virtual std::string argString() = 0;
 
@@ -31,7 +53,6 @@ class CMDRequest {
 
     virtual bool onWrite() = 0;
     virtual bool onRead() = 0;
-    virtual bool isDuplicate() = 0;
     virtual PROTOCOL protocol() final { return proto; }
 };
 
@@ -45,13 +66,17 @@ class CMDResponse {
 
     virtual uint8_t *rawData() = 0;
     virtual uint32_t rawDataLen() = 0;
-    virtual uint32_t expectLength() = 0;
-    virtual uint32_t minLength() = 0;
 
     virtual void reset() = 0;
     virtual std::string toString() = 0;
     virtual int value() = 0;
-    virtual void push_back(uint8_t *d, uint32_t len) = 0;
+
+    /**
+     * feed a chunk from the wire, return RESP_STATE_OK once a whole response
+     * is in. bytes behind it are kept for the next call, d may be nullptr to
+     * only work on those.
+     */
+    virtual RESP_STATE push_back(uint8_t *d, uint32_t len) = 0;
     virtual PROTOCOL protocol() final { return proto; }
 };
 
@@ -8,6 +8,7 @@
 #ifndef __SERIAL__
 #define __SERIAL__
 
+#include <chrono>
 #include <iostream>
 #include <string>
 
@@ -19,28 +20,64 @@
     _VAL(57600), _VAL(115200), _VAL(230400), _VAL(460800), _VAL(500000), _VAL(576000), _VAL(921600), _VAL(1000000), \
         _VAL(1152000), _VAL(1500000), _VAL(2000000), _VAL(2500000), _VAL(3000000), _VAL(3500000), _VAL(4000000),
 
+#define SERIAL_RX_BUF (64 * 1024)  // one read drains what the tty has, up to this
+#define SERIAL_RX_IDLE 10          // ms of silence after which a short frame is taken as whole
+#define SERIAL_RX_BATCH 2048       // bytes to let pile up between reads, half of what n_tty holds
+
 #define _VAL(v) BAUD##v
 enum class BAUD { _VALUES };
 #undef _VAL
 
-class SerialPort final : public USBStream {
-   private:
+class SerialPort : public USBStream {
+   protected:
     int ttyfd;
     int epfd;
+    BAUD cur_baud;
+    uint64_t tx_bytes;
+    uint64_t tx_stalls;  // writes the tty could not take at once
+    std::chrono::steady_clock::duration tx_time;
+    uint8_t* rxbuf;
+    uint64_t rx_bytes;
+    uint64_t rx_reads;
+    double rx_rate;  // bytes/us seen inside replies, paces the reads
+    int saved_flags;  // serial_struct flags before setLowLatency, -1 if untouched
+    std::string power_control;  // power/control of the usb device, if setLowLatency wrote it
+    std::string saved_power;
+
+   protected:
+    // links driving the tty fd on their own, see UringPort
+    SerialPort(const std::string& tty, USBLINK phy);
+    // wait for EPOLLOUT on epfd, EPOLLIN is off meanwhile
+    bool wait_writable(int timeout);
+    // keep the usb device the tty hangs off from autosuspend, or give it back
+    bool keepAwake(bool on);
 
    public:
     SerialPort(const std::string& tty);
-    ~SerialPort();
+    virtual ~SerialPort();
 
     void setBaud(BAUD);
+    /**
+     * ASYNC_LOW_LATENCY on the tty where the driver takes it, and no autosuspend
+     * on its usb device. both are put back on close. false if any is missing
+     */
+    bool setLowLatency(bool on);
+    BAUD baud() { return cur_baud; }
     void init();
     bool isOpened();
     bool sendSync(uint8_t* data, uint32_t len, uint32_t timeout);
+    bool sendvSync(const struct iovec* iov, int iovcnt, uint32_t timeout);
     bool recvSync(uint32_t timeout);
+    bool recvAtLeast(uint32_t len, uint32_t timeout);
+    // bytes/s while sending and stalls so far, bytes per read while receiving
+    virtual void reportIo();
 
    public:
     static const int BaudARR[];
     static const char* BaudARRSTR[];
+    static const speed_t BaudSPEED[];
+    // highest one not above rate, BAUD57600 if none
+    static BAUD fromRate(uint32_t rate);
 };
 
 #endif  // __SERIAL__
\ No newline at end of file
@@ -0,0 +1,43 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 07:20:05
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 07:20:05
+ * @Description: std::cerr shared by sessions, whole lines tagged with the session
+ */
+#ifndef __SESSIONLOG__
+#define __SESSIONLOG__
+
+#include <mutex>
+#include <streambuf>
+#include <string>
+
+/**
+ * put on std::cerr while several sessions run. each thread keeps its own
+ * line and writes it whole once it ends, the tag of its session in front,
+ * so lines never mix and each tells whose it is. folded '>' and '<' come
+ * out with the line that ends them. one at a time, the old buffer of
+ * std::cerr is put back on destruction.
+ */
+class SessionLog : public std::streambuf {
+   private:
+    std::streambuf *out;  // where whole lines go
+    std::mutex lock;
+
+    // line of the calling thread so far, with its tag in front
+    std::string &line();
+    void put(std::string &l);
+
+   protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char *s, std::streamsize n) override;
+
+   public:
+    SessionLog();
+    ~SessionLog();
+
+    // lines of the calling thread get "[tag] " in front, none if empty. a line not ended yet goes out first
+    void setTag(const std::string &tag);
+};
+
+#endif  //__SESSIONLOG__
@@ -9,12 +9,16 @@
 #define __UPDATE__
 
 #include <string>
+#include <map>
 #include <memory>
+#include <chrono>
 
 #include "fdl.hpp"
 #include "pdl.hpp"
 #include "usbcom.hpp"
 #include "firmware.hpp"
+#include "pipeline.hpp"
+#include "profile.hpp"
 
 /**
  * MAX_DATA_LEN defines in packets.hpp should not less than those lens
@@ -22,33 +26,111 @@
 #define FRAMESZ_BOOTCODE 0x210  // frame size for bootcode
 #define FRAMESZ_PDL 0x800       // frame size for PDL
 #define FRAMESZ_FDL 0x840       // frame size for fdl1
-#define FRAMESZ_DATA 0x3000     // frame size for others
+#define FRAMESZ_DATA 0x3000     // frame size for others, or the negotiated one
+#define FRAMESZ_STEP 0x800      // larger midst and read_midst frames are probed by this
+#define FRAMESZ_MAX 0x3ff0      // read_flash reply must fit in MAX_DATA_LEN
+
+#define WINDOW_PROBE_ACKS 32  // acks in a row before the midst window doubles
+#define RTT_PROBES 8          // connects timed before and after the low latency tty profile
 
 class UpgradeManager {
    private:
     std::shared_ptr<USBStream> usbstream;
     FDLRequest request;
     FDLResponse response;
-    Firmware firmware;
-    std::string pac;
+    std::shared_ptr<Firmware> fwref;  // parsed once, shared by all sessions of a pac
+    Firmware &firmware;
+    std::string backup_tag;  // tells backups of several devices apart, empty for one
     uint8_t *_data;
+    uint32_t _datalen;
+    std::unique_ptr<TransferPipeline> pipeline;  // nullptr for stop-and-wait
+    Profile profile;
+    uint32_t window_max;      // midst frames out at once, from option
+    uint32_t window_ceiling;  // window_max, or less if a larger one failed before
+    uint32_t window;          // current one, grows up to window_ceiling
+    // bytes and time spent on them, per window
+    std::map<uint32_t, std::pair<uint64_t, std::chrono::steady_clock::duration>> window_stats;
+    std::string device_id;     // vid:pid, profile key with the product name
+    uint32_t midst_size;       // largest midst frame known to work
+    uint32_t midst_size_fail;  // smallest one that failed, 0 if none
+    uint32_t read_size;        // same for read_midst
+    uint32_t read_size_fail;
+    bool framesz_probe;  // from option, larger frames are tried once fdl2 is up
+    BAUD baud_max;  // tty only, highest rate asked of fdl1
+    bool pdl_split;  // pdl frames go as header, tag and payload apart, learned per chipset
+    bool low_latency;     // tty only, from option
+    bool latency_tuned;   // low_latency is applied once, at the first connect
+    // log of repeated requests is folded into one line
+    uint32_t last_posted;  // protocol and value of the last request logged
+    bool folding;          // the last one repeated the one before
 
    private:
     void hexdump(const std::string &prefix, uint8_t *buf, uint32_t len, uint32_t dumplen = 20);
     void verbose(CMDRequest *req);
     void verbose(CMDResponse *resp, bool ondata);
+    // request and response are framed alike, crc_fallback only while bootcode or fdl1 answers
+    void setFrameModle(CRC_MODLE mod, bool data_es_flag, bool crc_es_flag, bool crc_fallback = false);
+    // talk is post and wait, split to queue frames before acks are in
+    bool post(CMDRequest *req, int tx_timeout = 5000);
+    bool wait(CMDRequest *req, CMDResponse *resp, int rx_timeout = 5000);
     bool talk(CMDRequest *req, CMDResponse *resp, int rx_timeout = 5000, int tx_timeout = 5000);
     int connect();
-    int transfer(const XMLFileInfo &info, uint32_t maxlen);
+    // raise tty baud rate as high as fdl1 goes, up to baud_max
+    int change_baud();
+    // median connect round trip in us, 0 if any got no ack
+    uint32_t measure_rtt();
+    // apply the low latency tty profile and report what it saved
+    void tune_latency();
+    // windowed only applies if fdl tolerates queued frames, see setMidstWindow
+    int transfer(const XMLFileInfo &info, uint32_t maxlen, bool windowed = false);
+    int transfer_once(const XMLFileInfo &info, uint32_t maxlen, bool windowed, bool &queued);
+    int transfer_pipelined(const XMLFileInfo &info, const byte_span &src, uint32_t maxlen, bool windowed,
+                           bool &queued);
+    void init_window();
+    std::string profile_key();
+    // pick up frame sizes learned before
+    void init_framesz();
+    // next size to probe above good, good itself if none is left
+    uint32_t probe_framesz(uint32_t good, uint32_t fail);
+    // try larger frames on a partition the update rewrites anyway, see framesz_probe
+    int negotiate_framesz(const std::vector<XMLFileInfo> &filevec);
+    int probe_read_size(const XMLFileInfo &info);
+    int probe_midst_size(const XMLFileInfo &info);
+    // wait for the link to go quiet and drop whatever came, a late reply is no answer to the next
+    void drain();
+    // _data holds at least len bytes
+    bool reserve(uint32_t len);
+    void report_window();
+    // nullptr unless the link is a tty, whatever drives it
+    SerialPort *tty();
+    void report_tty();
     int exec();
-    void checksum(XMLFileInfo &info);
 
    public:
-    UpgradeManager(const std::string &tty, const std::string &pac, std::shared_ptr<USBStream> &us);
+    // fw is parsed already, it is only read from here on
+    UpgradeManager(const std::string &tty, std::shared_ptr<Firmware> &fw, std::shared_ptr<USBStream> &us);
     ~UpgradeManager();
 
-    // do some preparetion, parser xml, init tty or something
+    // do some preparetion, init tty or something
     bool prepare();
+    // encode up to depth midst frames ahead of the link, less than 2 disables it
+    void setPipelineDepth(uint32_t depth);
+    /**
+     * keep up to max midst frames out before the oldest ack is in, less than 2
+     * disables it. the largest safe window is learned per chipset into profile
+     */
+    void setMidstWindow(uint32_t max);
+    void setProfile(const std::string &path);
+    // vid:pid of the device, frame sizes are learned for it and the product
+    void setDeviceId(const std::string &id);
+    // tty baud rate to try after fdl1 is up, 115200 or less keeps it
+    void setBaudCeiling(uint32_t rate);
+    // see SerialPort::setLowLatency, round trips are measured around it
+    void setLowLatency(bool on);
+    // negotiate midst and read_midst frame sizes once fdl2 is up, see negotiate_framesz
+    void setFrameProbe(bool on);
+    // backups go to <fileid>.<tag>.bak instead of <fileid>.bak
+    void setBackupTag(const std::string &tag);
 
     int backup_partition(XMLFileInfo &info);
     int flash_pdl(const XMLFileInfo &info);
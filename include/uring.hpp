@@ -0,0 +1,80 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-17 21:40:12
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-17 21:40:12
+ * @Description: tty driven through io_uring
+ */
+#ifndef __URING__
+#define __URING__
+
+#include <string>
+
+extern "C" {
+#include <linux/io_uring.h>
+}
+
+#include "serial.hpp"
+
+#define URING_ENTRIES 8
+#define URING_TXBUF (64 * 1024)  // one frame, escaped MAX_DATA_LEN fits
+
+/**
+ * a write is only queued by sendSync, it goes into the kernel with the read
+ * of its reply, so a round trip is one io_uring_enter instead of writev,
+ * epoll_wait and read. both have a linked timeout and use buffers registered
+ * with the ring. a send that finds the last one still queued completes that
+ * one first, a write error shows up on the next send or receive.
+ * everything else, baud rate included, is SerialPort's. if the kernel has no
+ * io_uring it is a plain SerialPort.
+ */
+class UringPort final : public SerialPort {
+   private:
+    int ringfd;
+    bool fixed;  // buffers are registered
+    void *sqmap;
+    size_t sqmap_sz;
+    void *cqmap;
+    size_t cqmap_sz;
+    struct io_uring_sqe *sqes;
+    size_t sqes_sz;
+    uint32_t *sq_tail;
+    uint32_t *sq_mask;
+    uint32_t *sq_array;
+    uint32_t *cq_head;
+    uint32_t *cq_tail;
+    uint32_t *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    uint8_t *txbuf;
+    uint32_t txlen;       // write queued or in flight, 0 if none
+    uint32_t to_submit;   // sqes prepared since the last enter
+    uint32_t inflight;    // sqes submitted, cqe not reaped
+    int tx_res;           // result of the write, reaped
+    int rx_res;           // result of the read, reaped
+    struct __kernel_timespec tx_ts;
+    struct __kernel_timespec rx_ts;
+    uint64_t enters;
+
+   private:
+    bool setup();
+    void teardown();
+    struct io_uring_sqe *prep(uint8_t op, uint64_t tag);
+    // op on fd with a timeout of ms linked to it
+    void prep_timed(uint8_t op, uint64_t tag, uint8_t *buf, uint32_t len, int bufidx, struct __kernel_timespec *ts,
+                    uint32_t ms);
+    // submit what is prepared, then reap until nothing is in flight
+    bool enter();
+    // the queued write is done, false if it failed
+    bool flush();
+
+   public:
+    UringPort(const std::string &tty);
+    ~UringPort();
+
+    bool sendvSync(const struct iovec *iov, int iovcnt, uint32_t timeout);
+    bool recvAtLeast(uint32_t len, uint32_t timeout);
+    void reportIo();
+};
+
+#endif  // __URING__
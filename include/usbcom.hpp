@@ -9,10 +9,16 @@
 #define __USBCOM__
 
 #include <string>
+#include <vector>
+
+extern "C" {
+#include <sys/uio.h>
+}
 
 enum class USBLINK {
     USBLINK_TTY,
     USBLINK_USBFS,
+    USBLINK_TTY_URING,  // tty driven through io_uring, see UringPort
 };
 
 class USBStream {
@@ -20,12 +26,15 @@ class USBStream {
     const int max_buf_size = 4 * 1024;
     std::string usb_device;
     uint8_t *_data;
+    uint8_t *_rxdata;  // what data() gives, _data unless the link lends its own memory
     uint32_t _reallen;
     USBLINK phylink;
+    std::vector<uint8_t> _txbuf;
 
    public:
     USBStream(const std::string &dev, USBLINK phy) : usb_device(dev), _reallen(0), phylink(phy) {
         _data = new (std::nothrow) uint8_t[max_buf_size];
+        _rxdata = _data;
     }
 
     virtual ~USBStream() {
@@ -38,7 +47,27 @@ class USBStream {
     virtual bool sendSync(uint8_t *data, uint32_t len, uint32_t timeout) = 0;
     virtual bool recvSync(uint32_t timeout) = 0;
 
-    virtual uint8_t *data() final { return _data; };
+    /**
+     * keep receiving until len bytes are in, the link goes quiet after some
+     * data or timeout. a hint only, links that get whole transfers ignore it
+     */
+    virtual bool recvAtLeast(uint32_t len, uint32_t timeout) { return recvSync(timeout); }
+
+    // gather into one buffer and send it at once, links that can do better override it
+    virtual bool sendvSync(const struct iovec *iov, int iovcnt, uint32_t timeout) {
+        if (iovcnt == 1) return sendSync(static_cast<uint8_t *>(iov[0].iov_base), iov[0].iov_len, timeout);
+
+        _txbuf.clear();
+        for (int i = 0; i < iovcnt; i++) {
+            auto p = static_cast<uint8_t *>(iov[i].iov_base);
+            _txbuf.insert(_txbuf.end(), p, p + iov[i].iov_len);
+        }
+
+        return sendSync(_txbuf.data(), _txbuf.size(), timeout);
+    }
+
+    // valid until the next recvSync
+    virtual uint8_t *data() final { return _rxdata; };
     virtual uint32_t datalen() final { return _reallen; };
 };
 
@@ -8,11 +8,14 @@
 #ifndef __USBFS__
 #define __USBFS__
 
+#include <deque>
 #include <iostream>
 #include <string>
 
 #include "usbcom.hpp"
 
+struct usbdevfs_urb;
+
 class USBFS final : public USBStream {
    private:
     int usbfd;
@@ -20,6 +23,30 @@ class USBFS final : public USBStream {
     uint8_t endpoint_in;
     uint8_t endpoint_out;
 
+    // async mode only, see setAsync
+    int epfd;
+    uint32_t nout;
+    uint32_t nin;
+    struct usbdevfs_urb *urbs;                  // nout OUT ones, then nin IN ones, nullptr until first use
+    uint8_t *urbmem;                            // urb buffers, mmap of usbfd if the kernel can
+    bool urbmem_mapped;
+    std::deque<struct usbdevfs_urb *> out_free;  // OUT urbs not submitted
+    std::deque<struct usbdevfs_urb *> in_done;   // IN urbs reaped, data not handed out yet
+    struct usbdevfs_urb *in_lent;               // IN urb data() points to, until next recvSync
+    uint32_t pending;                           // submitted, not reaped
+    bool urb_failed;                            // a resubmit failed, the next reap reports it
+
+   private:
+    bool submit(struct usbdevfs_urb *urb);
+    /**
+     * reap all completed urbs, waiting up to timeout ms for the first one.
+     * false if any of them failed, that fails only the transfer it belongs to
+     */
+    bool reap(uint32_t timeout);
+    // falls back to blocking transfers if urbs cannot be set up
+    void async_start();
+    void async_stop();
+
    public:
     USBFS(const std::string &devpath, int ifno, int epin, int epout);
     ~USBFS();
@@ -29,8 +56,18 @@ class USBFS final : public USBStream {
 
     bool isOpened();
     bool sendSync(uint8_t *data, uint32_t len, uint32_t timeout);
+    bool sendvSync(const struct iovec *iov, int iovcnt, uint32_t timeout);
     bool recvSync(uint32_t timeout);
 
+    /**
+     * keep outurbs OUT and inurbs IN urbs queued instead of one blocking
+     * USBDEVFS_BULK at a time, 0 keeps that direction blocking. urbs are set
+     * up on first transfer, so control messages before it do not kill them.
+     * sends return once submitted, completions are signaled by EPOLLOUT on fd().
+     */
+    void setAsync(uint32_t outurbs, uint32_t inurbs);
+    int fd() { return usbfd; }
+
     bool usbfs_is_kernel_driver_alive();
     void usbfs_detach_kernel_driver();
     int usbfs_claim_interface();
@@ -0,0 +1,74 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-17 22:10:05
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-17 22:10:05
+ * @Description: xml read token by token, no document is built
+ */
+#ifndef __XMLSCAN__
+#define __XMLSCAN__
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define XMLSCAN_MAX_DEPTH 100  // as TINYXML2_MAX_ELEMENT_DEPTH
+
+enum class XMLTOKEN {
+    XML_START,  // <name attr="v" ...>, <name/> is a start and an end
+    XML_END,    // </name>
+    XML_TEXT,   // text or cdata, whitespace only text is skipped
+    XML_OTHER,  // comment, declaration or doctype, text() is what is between the markers
+    XML_EOF,
+    XML_ERROR,
+};
+
+/**
+ * a pull tokenizer over xml in memory, it reads what tinyxml2 reads the
+ * same way: entities and line ends are converted in text and attribute
+ * values, end tags must match. buffers are reused from token to token, so
+ * the strings returned are only valid until the next one.
+ */
+class XMLScanner final {
+   private:
+    const char *p;
+    const char *end;
+    std::string _name;
+    std::string _text;
+    std::vector<std::pair<std::string, std::string>> _attrs;
+    uint32_t nattrs;
+    std::vector<std::string> open;  // names of the elements not closed yet, reused
+    uint32_t depth;                 // of open
+    uint32_t _level;
+    bool closing;  // the end of an empty element is next
+    bool prolog;   // nothing but declarations so far
+    std::string _error;
+
+   private:
+    XMLTOKEN fail(const std::string &why);
+    bool name(std::string &out);
+    // raw bytes to out, line ends converted and entities too if asked
+    void decode(const char *from, const char *to, std::string &out, bool entities);
+    // the marker at p is matched already, text() is up to close_marker
+    XMLTOKEN markup(const char *open_marker, const char *close_marker, XMLTOKEN token);
+    // start or end tag, end tags may carry attributes as in tinyxml2
+    XMLTOKEN element();
+
+   public:
+    XMLScanner(const char *data, size_t len);
+    ~XMLScanner() {}
+
+    XMLTOKEN next();
+    // elements around the token, for a start or an end the element itself included
+    uint32_t level() const { return _level; }
+    const std::string &name() const { return _name; }
+    const std::string &text() const { return _text; }
+    uint32_t attrCount() const { return nattrs; }
+    const std::string &attrName(uint32_t i) const { return _attrs[i].first; }
+    const std::string &attrValue(uint32_t i) const { return _attrs[i].second; }
+    // what went wrong and where, after XML_ERROR
+    const std::string &error() const { return _error; }
+};
+
+#endif  // __XMLSCAN__
@@ -0,0 +1,608 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-17 10:12:40
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-17 10:12:40
+ * @Description: checksums used by bootcode, fdl and nv image
+ */
+#include <iostream>
+#include <string>
+
+#include <cstdlib>
+#include <cstring>
+
+extern "C" {
+#include <endian.h>
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define CRC_ARCH_X86
+#endif
+
+#include "crc.hpp"
+
+#define CRC_BOOTCODE_POLY 0x1021
+#define CRC_NV_POLY 0x8005
+#define CRC_NV_POLY_REFLECTED 0xa001
+
+struct crc_tables {
+    uint16_t bootcode[8][256];
+    uint16_t nv[8][256];
+    uint64_t bootcode_fold[2];  // x^128, x^192 mod P
+    uint64_t nv_fold[2];        // x^191, x^127 mod P, reflected
+
+    crc_tables();
+};
+
+struct crc_dispatch {
+    CRC_IMPL impl;
+    uint16_t (*bootcode)(const uint8_t *, uint32_t, uint16_t);
+    uint16_t (*nv)(uint16_t, const uint8_t *, uint32_t);
+};
+
+struct sum_dispatch {
+    SUM_IMPL impl;
+    uint64_t (*fdl)(const uint8_t *, uint32_t);
+};
+
+// x^n mod P, P has an implicit x^16 term
+static uint16_t xpow_mod(uint32_t n, uint16_t poly) {
+    uint32_t r = 1;
+
+    while (n--) {
+        r <<= 1;
+        if (r & 0x10000) r ^= 0x10000 | poly;
+    }
+
+    return r;
+}
+
+// reflected 64bit layout used by clmul: bit i is the coefficient of x^(63-i)
+static uint64_t reflect64(uint16_t k) {
+    uint64_t r = 0;
+
+    for (int d = 0; d < 16; d++)
+        if (k & (1 << d)) r |= uint64_t(1) << (63 - d);
+
+    return r;
+}
+
+crc_tables::crc_tables() {
+    for (uint32_t b = 0; b < 256; b++) {
+        uint16_t crc = b << 8;
+        for (int i = 0; i < 8; i++) crc = (crc & 0x8000) ? (crc << 1) ^ CRC_BOOTCODE_POLY : crc << 1;
+        bootcode[0][b] = crc;
+
+        crc = b;
+        for (int i = 0; i < 8; i++) crc = (crc & 1) ? (crc >> 1) ^ CRC_NV_POLY_REFLECTED : crc >> 1;
+        nv[0][b] = crc;
+    }
+
+    // table k is the crc of byte b followed by k zero bytes
+    for (int k = 1; k < 8; k++) {
+        for (uint32_t b = 0; b < 256; b++) {
+            uint16_t prev = bootcode[k - 1][b];
+            bootcode[k][b] = (prev << 8) ^ bootcode[0][prev >> 8];
+
+            prev = nv[k - 1][b];
+            nv[k][b] = (prev >> 8) ^ nv[0][prev & 0xff];
+        }
+    }
+
+    bootcode_fold[0] = xpow_mod(128, CRC_BOOTCODE_POLY);
+    bootcode_fold[1] = xpow_mod(192, CRC_BOOTCODE_POLY);
+
+    // clmul of two reflected operands is short of one degree, pre-divide by x
+    nv_fold[0] = reflect64(xpow_mod(191, CRC_NV_POLY));
+    nv_fold[1] = reflect64(xpow_mod(127, CRC_NV_POLY));
+}
+
+static const crc_tables &tables() {
+    static crc_tables t;
+    return t;
+}
+
+/**
+ * the original bootcode crc, which feeds the data bit after the shift.
+ * that is exactly CRC-16/XMODEM.
+ */
+static uint16_t crc16_bootcode_bitwise(const uint8_t *src, uint32_t len, uint16_t crc) {
+    while (len-- != 0) {
+        for (uint32_t i = 0x80; i != 0; i = i >> 1) {
+            if ((crc & 0x8000) != 0)
+                crc = (crc << 1) ^ CRC_BOOTCODE_POLY;
+            else
+                crc = crc << 1;
+            if ((*src & i) != 0) crc = crc ^ CRC_BOOTCODE_POLY;
+        }
+        src++;
+    }
+
+    return crc;
+}
+
+static uint16_t crc16_bootcode_table(const uint8_t *src, uint32_t len, uint16_t crc) {
+    auto &t = tables().bootcode[0];
+
+    while (len--) crc = (crc << 8) ^ t[(crc >> 8) ^ *src++];
+    return crc;
+}
+
+static uint16_t crc16_bootcode_slice8(const uint8_t *src, uint32_t len, uint16_t crc) {
+    auto &t = tables().bootcode;
+
+    for (; len >= 8; len -= 8, src += 8) {
+        crc = t[7][src[0] ^ (crc >> 8)] ^ t[6][src[1] ^ (crc & 0xff)] ^ t[5][src[2]] ^ t[4][src[3]] ^ t[3][src[4]] ^
+              t[2][src[5]] ^ t[1][src[6]] ^ t[0][src[7]];
+    }
+
+    return crc16_bootcode_table(src, len, crc);
+}
+
+static uint16_t crc16_nv_bitwise(uint16_t crc, const uint8_t *src, uint32_t len) {
+    while (len--) {
+        crc ^= *src++;
+        for (int i = 0; i < 8; i++) crc = (crc & 1) ? (crc >> 1) ^ CRC_NV_POLY_REFLECTED : crc >> 1;
+    }
+
+    return crc;
+}
+
+static uint16_t crc16_nv_table(uint16_t crc, const uint8_t *src, uint32_t len) {
+    auto &t = tables().nv[0];
+
+    while (len--) crc = (crc >> 8) ^ t[(crc ^ *src++) & 0xff];
+    return crc;
+}
+
+static uint16_t crc16_nv_slice8(uint16_t crc, const uint8_t *src, uint32_t len) {
+    auto &t = tables().nv;
+
+    for (; len >= 8; len -= 8, src += 8) {
+        crc = t[7][src[0] ^ (crc & 0xff)] ^ t[6][src[1] ^ (crc >> 8)] ^ t[5][src[2]] ^ t[4][src[3]] ^ t[3][src[4]] ^
+              t[2][src[5]] ^ t[1][src[6]] ^ t[0][src[7]];
+    }
+
+    return crc16_nv_table(crc, src, len);
+}
+
+#ifdef CRC_ARCH_X86
+/**
+ * fold 16 bytes a time: A * x^128 = H * (x^192 mod P) + L * (x^128 mod P).
+ * the products never exceed 80 bits, so the accumulator stays 128 bits and
+ * is reduced by the table at the end, together with the tail.
+ */
+__attribute__((target("pclmul,ssse3"))) static uint16_t crc16_bootcode_clmul(const uint8_t *src, uint32_t len,
+                                                                              uint16_t crc) {
+    auto &t = tables();
+    const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m128i k = _mm_set_epi64x(t.bootcode_fold[1], t.bootcode_fold[0]);
+    uint8_t acc[16];
+    __m128i x;
+
+    if (len < 32) return crc16_bootcode_slice8(src, len, crc);
+
+    // bit i of x is the coefficient of x^i
+    x = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)), bswap);
+    x = _mm_xor_si128(x, _mm_set_epi64x(uint64_t(crc) << 48, 0));
+    src += 16;
+    len -= 16;
+
+    for (; len >= 16; len -= 16, src += 16) {
+        __m128i next = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)), bswap);
+        __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+        __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+        x = _mm_xor_si128(_mm_xor_si128(hi, lo), next);
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(acc), _mm_shuffle_epi8(x, bswap));
+    crc = crc16_bootcode_slice8(acc, sizeof(acc), 0);
+
+    return crc16_bootcode_slice8(src, len, crc);
+}
+
+// reflected variant, bit i of the accumulator is the coefficient of x^(127-i)
+__attribute__((target("pclmul"))) static uint16_t crc16_nv_clmul(uint16_t crc, const uint8_t *src, uint32_t len) {
+    auto &t = tables();
+    const __m128i k = _mm_set_epi64x(t.nv_fold[1], t.nv_fold[0]);
+    uint8_t acc[16];
+    __m128i x;
+
+    if (len < 32) return crc16_nv_slice8(crc, src, len);
+
+    x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+    x = _mm_xor_si128(x, _mm_cvtsi32_si128(crc));
+    src += 16;
+    len -= 16;
+
+    for (; len >= 16; len -= 16, src += 16) {
+        __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+        __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+        x = _mm_xor_si128(_mm_xor_si128(hi, lo), next);
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(acc), x);
+    crc = crc16_nv_slice8(0, acc, sizeof(acc));
+
+    return crc16_nv_slice8(crc, src, len);
+}
+#endif
+
+/**
+ * fdl sum is computed exactly in 64 bits and then truncated to the 32 bits
+ * the original loop accumulated in, so the folded result stays bit-exact.
+ * a big endian word is (even byte << 8) + odd byte, so every variant sums
+ * the even and odd offset bytes apart and never needs a byte swap.
+ */
+static uint16_t sum_fold(uint64_t total) {
+    uint32_t sum = total;
+
+    sum = (sum >> 16) + (sum & 0x0FFFF);
+    sum += (sum >> 16);
+
+    return (~sum);
+}
+
+static uint64_t sum_tail(const uint8_t *src, uint32_t len) {
+    uint64_t total = 0;
+
+    while (len > 1) {
+        total += (src[0] << 8) | src[1];
+        src += 2;
+        len -= 2;
+    }
+
+    // NOTICE: an odd tail byte is added as the low byte of a word
+    if (len == 1) total += *src;
+
+    return total;
+}
+
+static uint64_t fdl_sum_scalar(const uint8_t *src, uint32_t len) { return sum_tail(src, len); }
+
+static uint64_t fdl_sum_swar(const uint8_t *src, uint32_t len) {
+    const uint64_t mask = 0x00ff00ff00ff00ffULL;
+    uint64_t even = 0;
+    uint64_t odd = 0;
+
+    while (len >= 8) {
+        // 16bit lanes hold at most 257 bytes of 0xff
+        uint32_t n = (len / 8 > 256) ? 256 : len / 8;
+        uint64_t even_lanes = 0;
+        uint64_t odd_lanes = 0;
+
+        for (uint32_t i = 0; i < n; i++, src += 8) {
+            uint64_t v;
+            memcpy(&v, src, sizeof(v));
+            v = le64toh(v);
+            even_lanes += v & mask;
+            odd_lanes += (v >> 8) & mask;
+        }
+        len -= n * 8;
+
+        even_lanes = (even_lanes & 0x0000ffff0000ffffULL) + ((even_lanes >> 16) & 0x0000ffff0000ffffULL);
+        odd_lanes = (odd_lanes & 0x0000ffff0000ffffULL) + ((odd_lanes >> 16) & 0x0000ffff0000ffffULL);
+        even += (even_lanes & 0xffffffff) + (even_lanes >> 32);
+        odd += (odd_lanes & 0xffffffff) + (odd_lanes >> 32);
+    }
+
+    return (even << 8) + odd + sum_tail(src, len);
+}
+
+#ifdef CRC_ARCH_X86
+// psadbw adds 8 bytes into a 64bit lane, no carry to care about
+__attribute__((target("sse2"))) static uint64_t fdl_sum_sse2(const uint8_t *src, uint32_t len) {
+    const __m128i even_mask = _mm_set1_epi16(0x00ff);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i even = zero;
+    __m128i odd = zero;
+    uint64_t lanes[4];
+
+    for (; len >= 16; len -= 16, src += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        even = _mm_add_epi64(even, _mm_sad_epu8(_mm_and_si128(v, even_mask), zero));
+        odd = _mm_add_epi64(odd, _mm_sad_epu8(_mm_andnot_si128(even_mask, v), zero));
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), even);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes + 2), odd);
+
+    return ((lanes[0] + lanes[1]) << 8) + lanes[2] + lanes[3] + sum_tail(src, len);
+}
+
+__attribute__((target("avx2"))) static uint64_t fdl_sum_avx2(const uint8_t *src, uint32_t len) {
+    const __m256i even_mask = _mm256_set1_epi16(0x00ff);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i even = zero;
+    __m256i odd = zero;
+    uint64_t lanes[8];
+
+    for (; len >= 64; len -= 64, src += 64) {
+        __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+        __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 32));
+        even = _mm256_add_epi64(even, _mm256_sad_epu8(_mm256_and_si256(v0, even_mask), zero));
+        odd = _mm256_add_epi64(odd, _mm256_sad_epu8(_mm256_andnot_si256(even_mask, v0), zero));
+        even = _mm256_add_epi64(even, _mm256_sad_epu8(_mm256_and_si256(v1, even_mask), zero));
+        odd = _mm256_add_epi64(odd, _mm256_sad_epu8(_mm256_andnot_si256(even_mask, v1), zero));
+    }
+
+    for (; len >= 32; len -= 32, src += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+        even = _mm256_add_epi64(even, _mm256_sad_epu8(_mm256_and_si256(v, even_mask), zero));
+        odd = _mm256_add_epi64(odd, _mm256_sad_epu8(_mm256_andnot_si256(even_mask, v), zero));
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), even);
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes + 4), odd);
+
+    return ((lanes[0] + lanes[1] + lanes[2] + lanes[3]) << 8) + lanes[4] + lanes[5] + lanes[6] + lanes[7] +
+           sum_tail(src, len);
+}
+#endif
+
+static bool sum_make_dispatch(SUM_IMPL impl, sum_dispatch &d) {
+    d.impl = impl;
+    switch (impl) {
+        case SUM_IMPL::SUM_IMPL_SCALAR:
+            d.fdl = fdl_sum_scalar;
+            return true;
+        case SUM_IMPL::SUM_IMPL_SWAR:
+            d.fdl = fdl_sum_swar;
+            return true;
+        case SUM_IMPL::SUM_IMPL_SSE2:
+#ifdef CRC_ARCH_X86
+            if (!__builtin_cpu_supports("sse2")) return false;
+            d.fdl = fdl_sum_sse2;
+            return true;
+#else
+            return false;
+#endif
+        case SUM_IMPL::SUM_IMPL_AVX2:
+#ifdef CRC_ARCH_X86
+            if (!__builtin_cpu_supports("avx2")) return false;
+            d.fdl = fdl_sum_avx2;
+            return true;
+#else
+            return false;
+#endif
+    }
+
+    return false;
+}
+
+static bool cpu_has_clmul() {
+#ifdef CRC_ARCH_X86
+    static bool has_clmul = []() {
+        unsigned int eax, ebx, ecx, edx;
+
+        if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) return false;
+        return (ecx & bit_PCLMUL) && (ecx & bit_SSSE3) ? true : false;
+    }();
+
+    return has_clmul;
+#else
+    return false;
+#endif
+}
+
+static bool crc_make_dispatch(CRC_IMPL impl, crc_dispatch &d) {
+    d.impl = impl;
+    switch (impl) {
+        case CRC_IMPL::CRC_IMPL_BITWISE:
+            d.bootcode = crc16_bootcode_bitwise;
+            d.nv = crc16_nv_bitwise;
+            return true;
+        case CRC_IMPL::CRC_IMPL_TABLE:
+            d.bootcode = crc16_bootcode_table;
+            d.nv = crc16_nv_table;
+            return true;
+        case CRC_IMPL::CRC_IMPL_SLICE8:
+            d.bootcode = crc16_bootcode_slice8;
+            d.nv = crc16_nv_slice8;
+            return true;
+        case CRC_IMPL::CRC_IMPL_CLMUL:
+#ifdef CRC_ARCH_X86
+            if (!cpu_has_clmul()) return false;
+            d.bootcode = crc16_bootcode_clmul;
+            d.nv = crc16_nv_clmul;
+            return true;
+#else
+            return false;
+#endif
+    }
+
+    return false;
+}
+
+// compare with the bitwise reference before trusting a faster one
+static bool crc_self_check(const crc_dispatch &d) {
+    uint8_t buf[1021];
+    uint32_t seed = 0x2021;
+
+    for (uint32_t i = 0; i < sizeof(buf); i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = seed >> 16;
+    }
+
+    for (uint32_t len = 0; len <= sizeof(buf); len += (len < 64) ? 1 : 97) {
+        if (d.bootcode(buf, len, 0x1234) != crc16_bootcode_bitwise(buf, len, 0x1234)) return false;
+        if (d.nv(0x5678, buf, len) != crc16_nv_bitwise(0x5678, buf, len)) return false;
+    }
+
+    return true;
+}
+
+static crc_dispatch crc_resolve() {
+    crc_dispatch d;
+    const char *env = getenv("CRC_IMPL");
+    const CRC_IMPL order[] = {CRC_IMPL::CRC_IMPL_CLMUL, CRC_IMPL::CRC_IMPL_SLICE8, CRC_IMPL::CRC_IMPL_TABLE};
+
+    if (env) {
+        for (auto impl : {CRC_IMPL::CRC_IMPL_BITWISE, CRC_IMPL::CRC_IMPL_TABLE, CRC_IMPL::CRC_IMPL_SLICE8,
+                          CRC_IMPL::CRC_IMPL_CLMUL}) {
+            if (std::string(env) == CRC16::toString(impl) && crc_make_dispatch(impl, d)) return d;
+        }
+        std::cerr << "crc implementation '" << env << "' is not supported, ignore it" << std::endl;
+    }
+
+    for (auto impl : order) {
+        if (!crc_make_dispatch(impl, d)) continue;
+
+        if (crc_self_check(d)) return d;
+        std::cerr << "crc implementation " << CRC16::toString(impl) << " fails self check, skip it" << std::endl;
+    }
+
+    crc_make_dispatch(CRC_IMPL::CRC_IMPL_BITWISE, d);
+    return d;
+}
+
+static crc_dispatch &dispatcher() {
+    static crc_dispatch d = crc_resolve();
+    return d;
+}
+
+static bool sum_self_check(const sum_dispatch &d) {
+    uint8_t buf[1021];
+    uint32_t seed = 0x2021;
+
+    for (uint32_t i = 0; i < sizeof(buf); i++) {
+        seed = seed * 1103515245 + 12345;
+        buf[i] = seed >> 16;
+    }
+
+    // every length and every start offset around the vector width
+    for (uint32_t off = 0; off < 4; off++) {
+        for (uint32_t len = 0; len + off <= sizeof(buf); len += (len < 160) ? 1 : 61) {
+            if (d.fdl(buf + off, len) != fdl_sum_scalar(buf + off, len)) return false;
+        }
+    }
+
+    return true;
+}
+
+static sum_dispatch sum_resolve() {
+    sum_dispatch d;
+    const char *env = getenv("SUM_IMPL");
+    const SUM_IMPL order[] = {SUM_IMPL::SUM_IMPL_AVX2, SUM_IMPL::SUM_IMPL_SSE2, SUM_IMPL::SUM_IMPL_SWAR};
+
+    if (env) {
+        for (auto impl :
+             {SUM_IMPL::SUM_IMPL_SCALAR, SUM_IMPL::SUM_IMPL_SWAR, SUM_IMPL::SUM_IMPL_SSE2, SUM_IMPL::SUM_IMPL_AVX2}) {
+            if (std::string(env) == CRC16::toString(impl) && sum_make_dispatch(impl, d)) return d;
+        }
+        std::cerr << "sum implementation '" << env << "' is not supported, ignore it" << std::endl;
+    }
+
+    for (auto impl : order) {
+        if (!sum_make_dispatch(impl, d)) continue;
+
+        if (sum_self_check(d)) return d;
+        std::cerr << "sum implementation " << CRC16::toString(impl) << " fails self check, skip it" << std::endl;
+    }
+
+    sum_make_dispatch(SUM_IMPL::SUM_IMPL_SCALAR, d);
+    return d;
+}
+
+static sum_dispatch &sum_dispatcher() {
+    static sum_dispatch d = sum_resolve();
+    return d;
+}
+
+uint16_t CRC16::bootcode(const uint8_t *src, uint32_t len, uint16_t crc) {
+    return dispatcher().bootcode(src, len, crc);
+}
+
+uint16_t CRC16::nv(uint16_t crc, const uint8_t *src, uint32_t len) { return dispatcher().nv(crc, src, len); }
+
+uint16_t CRC16::fdl(const uint8_t *src, uint32_t len) { return sum_fold(sum_dispatcher().fdl(src, len)); }
+
+uint64_t CRC16::fdlSum(const uint8_t *src, uint32_t len) { return sum_dispatcher().fdl(src, len); }
+
+uint16_t CRC16::fdlFold(uint64_t sum) { return sum_fold(sum); }
+
+uint16_t CRC16::bootcode(CRC_IMPL impl, const uint8_t *src, uint32_t len, uint16_t crc) {
+    crc_dispatch d;
+
+    if (!crc_make_dispatch(impl, d)) return bootcode(src, len, crc);
+    return d.bootcode(src, len, crc);
+}
+
+uint16_t CRC16::nv(CRC_IMPL impl, uint16_t crc, const uint8_t *src, uint32_t len) {
+    crc_dispatch d;
+
+    if (!crc_make_dispatch(impl, d)) return nv(crc, src, len);
+    return d.nv(crc, src, len);
+}
+
+bool CRC16::supported(CRC_IMPL impl) {
+    crc_dispatch d;
+    return crc_make_dispatch(impl, d);
+}
+
+bool CRC16::select(CRC_IMPL impl) {
+    crc_dispatch d;
+
+    if (!crc_make_dispatch(impl, d)) return false;
+
+    dispatcher() = d;
+    return true;
+}
+
+CRC_IMPL CRC16::selected() { return dispatcher().impl; }
+
+uint16_t CRC16::fdl(SUM_IMPL impl, const uint8_t *src, uint32_t len) {
+    sum_dispatch d;
+
+    if (!sum_make_dispatch(impl, d)) return fdl(src, len);
+    return sum_fold(d.fdl(src, len));
+}
+
+bool CRC16::supported(SUM_IMPL impl) {
+    sum_dispatch d;
+    return sum_make_dispatch(impl, d);
+}
+
+bool CRC16::select(SUM_IMPL impl) {
+    sum_dispatch d;
+
+    if (!sum_make_dispatch(impl, d)) return false;
+
+    sum_dispatcher() = d;
+    return true;
+}
+
+SUM_IMPL CRC16::selectedSum() { return sum_dispatcher().impl; }
+
+const char *CRC16::toString(CRC_IMPL impl) {
+    switch (impl) {
+        case CRC_IMPL::CRC_IMPL_BITWISE:
+            return "bitwise";
+        case CRC_IMPL::CRC_IMPL_TABLE:
+            return "table";
+        case CRC_IMPL::CRC_IMPL_SLICE8:
+            return "slice8";
+        case CRC_IMPL::CRC_IMPL_CLMUL:
+            return "clmul";
+        default:
+            return "unknow";
+    }
+}
+
+const char *CRC16::toString(SUM_IMPL impl) {
+    switch (impl) {
+        case SUM_IMPL::SUM_IMPL_SCALAR:
+            return "scalar";
+        case SUM_IMPL::SUM_IMPL_SWAR:
+            return "swar";
+        case SUM_IMPL::SUM_IMPL_SSE2:
+            return "sse2";
+        case SUM_IMPL::SUM_IMPL_AVX2:
+            return "avx2";
+        default:
+            return "unknow";
+    }
+}
@@ -1,163 +1,202 @@
+#include <algorithm>
+#include <chrono>
 #include <iostream>
-#include <sstream>
-#include <fstream>
+#include <thread>
 
 extern "C" {
 #include <dirent.h>
 #include <cstdlib>
 #include <errno.h>
+#include <fcntl.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
 }
 
 #include "devices.hpp"
 
-static std::string find_file_with_prefix(const std::string &_dirname, const std::string &_prefix) {
-    DIR *pdir = NULL;
-    struct dirent *ent = NULL;
-    std::string dirname(_dirname);
-    std::string filename("");
+#define SCAN_PARALLEL_MIN 32  // devices below this are not worth a thread
+#define SCAN_THREADS_MAX 8
 
-    pdir = opendir(dirname.c_str());
-    if (!pdir) return filename;
+// index keys, vid:pid and vid:pid:ifno
+#define ID_KEY(vid, pid) ((static_cast<uint64_t>(vid & 0xffff) << 16) | (pid & 0xffff))
+#define IFACE_KEY(vid, pid, ifno) ((ID_KEY(vid, pid) << 16) | (ifno & 0xffff))
 
-    while ((ent = readdir(pdir)) != NULL) {
-        if (ent->d_name[0] == '.') continue;
+// small sysfs attribute below dirfd, one read and no stream, empty if missing
+static std::string attr_at(int dirfd, const char *name) {
+    char buf[256];
+    ssize_t len;
+    int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
 
-        if (!strncmp(ent->d_name, _prefix.c_str(), _prefix.length())) {
-            filename = ent->d_name;
-            break;
-        }
-    }
-    closedir(pdir);
+    if (fd < 0) return "";
 
-    return filename;
-}
+    len = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (len <= 0) return "";
 
-static std::string find_tty_device(const std::string &_dirname) {
-    std::string dirname(_dirname + "/tty");
-    std::string ttydev;
+    // first word only, as ifstream >> did
+    buf[len] = '\0';
+    return std::string(buf, strcspn(buf, " \t\n"));
+}
 
-    if (access(dirname.c_str(), F_OK)) dirname = _dirname;
+static int attr_int_at(int dirfd, const char *name, int base) {
+    std::string val = attr_at(dirfd, name);
+    char *end = nullptr;
+    long v;
 
-    ttydev = find_file_with_prefix(dirname, "ttyUSB");
-    if (ttydev.empty()) ttydev = find_file_with_prefix(dirname, "ttyACM");
+    if (val.empty()) return -1;
 
-    return ttydev;
+    v = strtol(val.c_str(), &end, base);
+    return *end ? -1 : v;
 }
 
-static std::string file_get_line(const std::string &file) {
-    std::string line;
-    std::ifstream fin(file);
+// names in the directory below dirfd, "." ones left out
+static std::vector<std::string> list_at(int dirfd, const char *name) {
+    std::vector<std::string> names;
+    int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *pdir = fd < 0 ? nullptr : fdopendir(fd);
+    struct dirent *ent;
 
-    if (!fin.is_open()) return "";
+    if (!pdir) {
+        if (fd >= 0) close(fd);
+        return names;
+    }
+
+    while ((ent = readdir(pdir)) != NULL) {
+        if (ent->d_name[0] != '.') names.push_back(ent->d_name);
+    }
+    closedir(pdir);
 
-    fin >> line;
-    fin.close();
-    return line;
+    return names;
 }
 
-static int file_get_xint(const std::string &file) {
-    int line;
-    std::ifstream fin(file);
+static bool has_prefix(const std::string &name, const char *prefix) { return !name.compare(0, strlen(prefix), prefix); }
 
-    if (!fin.is_open()) return -1;
+Device::Device(const std::string &sysfs) : sysfs(sysfs) { reset(); }
 
-    fin >> std::hex >> line;
-    fin.close();
-    return line;
+void Device::reset() {
+    m_usbdevs.clear();
+    by_id.clear();
+    by_iface.clear();
+    by_port.clear();
 }
 
-static int file_get_int(const std::string &file) {
-    int line;
-    std::ifstream fin(file);
+/**
+ * endpoints and the tty are picked in one pass over the interface, the tty
+ * is in its tty/ subdirectory if there is one (acm), else right in it
+ */
+static bool scan_iface(int devfd, const std::string &name, interface &iface) {
+    int fd = openat(devfd, name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    bool has_tty_dir = false;
+
+    if (fd < 0) return false;
+
+    iface.cls = attr_int_at(fd, "bInterfaceClass", 16);
+    iface.subcls = attr_int_at(fd, "bInterfaceSubClass", 16);
+    iface.proto = attr_int_at(fd, "bInterfaceProtocol", 16);
+    iface.interface_no = attr_int_at(fd, "bInterfaceNumber", 16);
+    iface.modalias = attr_at(fd, "modalias");
+
+    std::string usb, acm;
+    for (auto &ent : list_at(fd, ".")) {
+        if (ent == "tty") has_tty_dir = true;
+        if (has_prefix(ent, "ep_8") && !iface.endpoint_in) iface.endpoint_in = strtoul(ent.c_str() + 3, NULL, 16);
+        if (has_prefix(ent, "ep_0") && !iface.endpoint_out) iface.endpoint_out = strtoul(ent.c_str() + 3, NULL, 16);
+        if (has_prefix(ent, "ttyUSB") && usb.empty()) usb = ent;
+        if (has_prefix(ent, "ttyACM") && acm.empty()) acm = ent;
+    }
 
-    if (!fin.is_open()) return -1;
+    if (has_tty_dir) {
+        usb.clear();
+        acm.clear();
+        for (auto &ent : list_at(fd, "tty")) {
+            if (has_prefix(ent, "ttyUSB") && usb.empty()) usb = ent;
+            if (has_prefix(ent, "ttyACM") && acm.empty()) acm = ent;
+        }
+    }
+    iface.ttyusb = usb.empty() ? acm : usb;
+    close(fd);
 
-    fin >> std::dec >> line;
-    fin.close();
-    return line;
+    return iface.cls != -1 && iface.subcls != -1 && iface.proto != -1 && iface.interface_no != -1;
 }
 
-void Device::reset() { m_usbdevs.clear(); }
+static bool scan_device(int rootfd, const std::string &rootdir, const std::string &name, const std::string &usbport,
+                        usbdev &udev) {
+    int fd = openat(rootfd, name.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
 
-int Device::scan_iface(int vid, int pid, std::string usbport, std::string rootdir) {
-    struct dirent *ent = NULL;
-    DIR *pdir = NULL;
-    usbdev udev;
+    if (fd < 0) return false;
 
-    udev.vid = vid;
-    udev.pid = pid;
-    udev.usbport = usbport;
-    udev.devpath = rootdir;
-    udev.busno = file_get_int(rootdir + "/busnum");
-    udev.devno = file_get_int(rootdir + "/devnum");
+    udev.usbport = attr_at(fd, "devpath");
+    udev.vid = attr_int_at(fd, "idVendor", 16);
+    udev.pid = attr_int_at(fd, "idProduct", 16);
+    if ((!usbport.empty() && usbport != udev.usbport) || udev.vid == -1 || udev.pid == -1) {
+        close(fd);
+        return false;
+    }
 
-    pdir = opendir(rootdir.c_str());
-    if (!pdir) return -1;
+    udev.devpath = rootdir + "/" + name;
+    udev.busno = attr_int_at(fd, "busnum", 10);
+    udev.devno = attr_int_at(fd, "devnum", 10);
 
-    while ((ent = readdir(pdir)) != NULL) {
-        std::string file;
+    // interfaces are the bus-port:config.ifno entries, nothing else is looked into
+    for (auto &ent : list_at(fd, ".")) {
         interface iface;
-        std::string path(rootdir);
-        std::string endpoint;
-        if (ent->d_name[0] == '.') continue;
-
-        path += "/" + std::string(ent->d_name);
 
-        iface.cls = file_get_xint(path + "/bInterfaceClass");
-        iface.subcls = file_get_xint(path + "/bInterfaceSubClass");
-        iface.proto = file_get_xint(path + "/bInterfaceProtocol");
-        iface.interface_no = file_get_xint(path + "/bInterfaceNumber");
-        iface.modalias = file_get_line(path + "/modalias");
-
-        iface.ttyusb = find_tty_device(path);
-
-        endpoint = find_file_with_prefix(path, "ep_8");
-        if (!endpoint.empty()) iface.endpoint_in = strtoul(endpoint.substr(3).c_str(), NULL, 16);
+        if (ent.find(':') != std::string::npos && scan_iface(fd, ent, iface)) udev.ifaces.push_back(iface);
+    }
+    close(fd);
 
-        endpoint = find_file_with_prefix(path, "ep_0");
-        if (!endpoint.empty()) iface.endpoint_out = strtoul(endpoint.substr(3).c_str(), NULL, 16);
+    return !udev.ifaces.empty();
+}
 
-        if (iface.cls == -1 || iface.subcls == -1 || iface.proto == -1 || iface.interface_no == -1) continue;
+void Device::index() {
+    for (uint32_t i = 0; i < m_usbdevs.size(); i++) {
+        auto &udev = m_usbdevs[i];
 
-        udev.ifaces.push_back(iface);
+        by_id.emplace(ID_KEY(udev.vid, udev.pid), i);
+        by_port.emplace(udev.usbport, i);
+        for (uint32_t j = 0; j < udev.ifaces.size(); j++)
+            by_iface.emplace(IFACE_KEY(udev.vid, udev.pid, udev.ifaces[j].interface_no), std::make_pair(i, j));
     }
-    closedir(pdir);
-
-    if (udev.ifaces.size()) m_usbdevs.push_back(udev);
-
-    return 0;
 }
 
 int Device::scan(const std::string &usbport) {
-    struct dirent *ent = NULL;
-    DIR *pdir = NULL;
-    const char *rootdir = "/sys/bus/usb/devices";
-
-    pdir = opendir(rootdir);
-    if (!pdir) return -1;
-
-    while ((ent = readdir(pdir)) != NULL) {
-        std::string path(rootdir);
-        std::string file;
-        std::string _usbport;
-        int _vid;
-        int _pid;
-        if (ent->d_name[0] == '.' || ent->d_name[0] == 'u') continue;
+    std::string rootdir(sysfs + "/bus/usb/devices");
+    std::vector<std::string> names;
+    int rootfd = open(rootdir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
 
-        path += "/" + std::string(ent->d_name);
+    if (rootfd < 0) return -1;
 
-        _vid = file_get_xint(path + "/idVendor");
-        _pid = file_get_xint(path + "/idProduct");
-        _usbport = file_get_line(path + "/devpath");
+    // usbN are root hubs
+    for (auto &ent : list_at(rootfd, ".")) {
+        if (ent[0] != 'u') names.push_back(ent);
+    }
 
-        if (!usbport.empty() && usbport != _usbport) continue;
+    // each thread fills its own slots, so the order stays the one of readdir
+    std::vector<usbdev> found(names.size());
+    std::vector<char> ok(names.size(), 0);
+    uint32_t nthreads = std::min<uint32_t>(std::thread::hardware_concurrency(), SCAN_THREADS_MAX);
+    auto work = [&](uint32_t from, uint32_t step) {
+        for (uint32_t i = from; i < names.size(); i += step) ok[i] = scan_device(rootfd, rootdir, names[i], usbport, found[i]);
+    };
+
+    if (names.size() < SCAN_PARALLEL_MIN || nthreads < 2) {
+        work(0, 1);
+    } else {
+        std::vector<std::thread> threads;
+
+        for (uint32_t t = 0; t < nthreads; t++) threads.emplace_back(work, t, nthreads);
+        for (auto &th : threads) th.join();
+    }
+    close(rootfd);
 
-        if (_vid != -1 && _pid != -1) scan_iface(_vid, _pid, _usbport, path);
+    for (uint32_t i = 0; i < names.size(); i++) {
+        if (ok[i]) m_usbdevs.push_back(std::move(found[i]));
     }
-    closedir(pdir);
+    index();
 
     for (auto iter = m_usbdevs.begin(); iter != m_usbdevs.end(); iter++) {
         std::cerr << "Bus " << std::dec << iter->busno << ".Port " << iter->usbport << ", Dev " << iter->devno
@@ -176,64 +215,142 @@ int Device::scan(const std::string &usbport) {
     return 0;
 }
 
-bool Device::exist(int vid, int pid) {
-    for (auto iter = m_usbdevs.begin(); iter != m_usbdevs.end(); iter++) {
-        if (iter->vid != vid || iter->pid != pid) continue;
+bool Device::exist(int vid, int pid) { return by_id.count(ID_KEY(vid, pid)); }
 
-        return true;
-    }
-    return false;
+bool Device::exist(int vid, int pid, int ifno) { return by_iface.count(IFACE_KEY(vid, pid, ifno)); }
+
+bool Device::exist(int vid, int pid, int cls, int scls, int proto) {
+    return get_interface(vid, pid, cls, scls, proto) != nullptr;
+}
+
+const usbdev *Device::get_usbdevice(int vid, int pid) {
+    auto iter = by_id.find(ID_KEY(vid, pid));
+
+    return iter == by_id.end() ? nullptr : &m_usbdevs[iter->second];
+}
+
+const usbdev *Device::get_usbdevice(const std::string &usbport) {
+    auto iter = by_port.find(usbport);
+
+    return iter == by_port.end() ? nullptr : &m_usbdevs[iter->second];
 }
 
-bool Device::exist(int vid, int pid, int ifno) {
+const interface *Device::get_interface(int vid, int pid, int ifno) {
+    auto iter = by_iface.find(IFACE_KEY(vid, pid, ifno));
+
+    return iter == by_iface.end() ? nullptr : &m_usbdevs[iter->second.first].ifaces[iter->second.second];
+}
+
+// by class is rare, not indexed
+const interface *Device::get_interface(int vid, int pid, int cls, int scls, int proto) {
     for (auto iter = m_usbdevs.begin(); iter != m_usbdevs.end(); iter++) {
         if (iter->vid != vid || iter->pid != pid) continue;
 
         for (auto iter1 = iter->ifaces.begin(); iter1 != iter->ifaces.end(); iter1++) {
-            if (iter1->interface_no == ifno) return true;
+            if (iter1->cls == cls && iter1->subcls == scls && iter1->proto == proto) return &*iter1;
         }
     }
-    return false;
+    return nullptr;
 }
 
-bool Device::exist(int vid, int pid, int cls, int scls, int proto) {
-    for (auto iter = m_usbdevs.begin(); iter != m_usbdevs.end(); iter++) {
-        if (iter->vid != vid || iter->pid != pid) continue;
+Hotplug::Hotplug() : nlfd(-1) {
+    struct sockaddr_nl addr;
+    int rcvbuf = 1024 * 1024;
 
-        for (auto iter1 = iter->ifaces.begin(); iter1 != iter->ifaces.end(); iter1++) {
-            if (iter1->cls == cls && iter1->subcls == scls && iter1->proto == proto) return true;
-        }
+    nlfd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if (nlfd < 0) {
+        std::cerr << "uevent socket fails, error=" << strerror(errno) << std::endl;
+        return;
+    }
+
+    // a hub coming up sends a burst, do not drop the one we wait for
+    setsockopt(nlfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = 1;  // kernel events, not the ones udev sends on
+    if (bind(nlfd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr))) {
+        std::cerr << "uevent bind fails, error=" << strerror(errno) << std::endl;
+        close(nlfd);
+        nlfd = -1;
     }
-    return false;
 }
 
-usbdev Device::get_usbdevice(int vid, int pid) {
-    for (auto iter = m_usbdevs.begin(); iter != m_usbdevs.end(); iter++) {
-        if (iter->vid != vid || iter->pid != pid) continue;
+Hotplug::~Hotplug() {
+    if (nlfd >= 0) close(nlfd);
+    nlfd = -1;
+}
+
+bool Hotplug::isOpened() { return nlfd >= 0; }
 
-        return *iter;
+void Hotplug::watch(int vid, int pid) { ids.emplace_back(vid, pid); }
+
+void Hotplug::setPort(const std::string &port) { usbport = port; }
+
+// devices are named bus-port, their interfaces bus-port:config.ifno, ttys are below those
+static bool on_port(const std::string &devpath, const std::string &port) {
+    std::string name("-" + port);
+
+    for (size_t pos = devpath.find(name); pos != std::string::npos; pos = devpath.find(name, pos + 1)) {
+        size_t end = pos + name.size();
+
+        if (end == devpath.size() || devpath[end] == ':' || devpath[end] == '/') return true;
     }
-    return usbdev();
+
+    return false;
 }
 
-interface Device::get_interface(int vid, int pid, int ifno) {
-    for (auto iter = m_usbdevs.begin(); iter != m_usbdevs.end(); iter++) {
-        if (iter->vid != vid || iter->pid != pid) continue;
+bool Hotplug::relevant(const char *msg, size_t len) {
+    std::string action, devpath, subsystem, product;
 
-        for (auto iter1 = iter->ifaces.begin(); iter1 != iter->ifaces.end(); iter1++) {
-            if (iter1->interface_no == ifno) return *iter1;
-        }
+    for (size_t off = strnlen(msg, len) + 1; off < len; off += strnlen(msg + off, len - off) + 1) {
+        std::string kv(msg + off, strnlen(msg + off, len - off));
+
+        if (!kv.compare(0, 7, "ACTION=")) action = kv.substr(7);
+        if (!kv.compare(0, 8, "DEVPATH=")) devpath = kv.substr(8);
+        if (!kv.compare(0, 10, "SUBSYSTEM=")) subsystem = kv.substr(10);
+        if (!kv.compare(0, 8, "PRODUCT=")) product = kv.substr(8);
     }
-    return interface();
+
+    if (action != "add" && action != "bind") return false;
+    if (subsystem != "usb" && subsystem != "tty") return false;
+
+    if (!usbport.empty() && !on_port(devpath, usbport)) return false;
+
+    // ttys carry no ids, the scan tells whose they are
+    if (subsystem == "tty") return devpath.find("/usb") != std::string::npos;
+
+    for (auto &id : ids) {
+        int vid = -1, pid = -1;
+
+        sscanf(product.c_str(), "%x/%x", &vid, &pid);
+        if (vid == id.first && pid == id.second) return true;
+    }
+
+    return false;
 }
 
-interface Device::get_interface(int vid, int pid, int cls, int scls, int proto) {
-    for (auto iter = m_usbdevs.begin(); iter != m_usbdevs.end(); iter++) {
-        if (iter->vid != vid || iter->pid != pid) continue;
+bool Hotplug::wait(int timeout) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    struct pollfd pfd = {nlfd, POLLIN, 0};
+    char buf[8192];
 
-        for (auto iter1 = iter->ifaces.begin(); iter1 != iter->ifaces.end(); iter1++) {
-            if (iter1->cls == cls && iter1->subcls == scls && iter1->proto == proto) return *iter1;
+    if (nlfd < 0) return false;
+
+    while (true) {
+        auto left = deadline - std::chrono::steady_clock::now();
+        int ms = std::chrono::duration_cast<std::chrono::milliseconds>(left).count();
+        bool found = false;
+        ssize_t len;
+
+        if (ms < 0 || poll(&pfd, 1, ms) <= 0) return false;
+
+        // take all that is queued, the scan after us sees it all anyway
+        while ((len = recv(nlfd, buf, sizeof(buf) - 1, 0)) > 0) {
+            buf[len] = '\0';
+            if (relevant(buf, len)) found = true;
         }
+
+        if (found) return true;
     }
-    return interface();
 }
@@ -5,12 +5,19 @@
  * @LastEditTime: 2021-02-26 16:48:24
  * @Description: file content
  */
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <fstream>
 #include <memory>
+#include <sstream>
+#include <thread>
+
+#include <cstring>
 
 extern "C" {
 #include <getopt.h>
+#include <strings.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <sys/types.h>
@@ -22,10 +29,12 @@ extern "C" {
 #include "upgrade_manager.hpp"
 #include "usbfs.hpp"
 #include "serial.hpp"
+#include "uring.hpp"
 #include "devices.hpp"
 #include "config.hpp"
 #include "common.hpp"
 #include "scopeguard.hpp"
+#include "sessionlog.hpp"
 
 using namespace std;
 
@@ -44,9 +53,12 @@ static configuration config;
     _VAL('x', "exract", required_argument, "pacfile [dir]", "exract pac_file only")                       \
     _VAL('l', "list", no_argument, "", "list devices")                                                    \
     _VAL('q', "quiet", no_argument, "[logfile]", "sync log into a file instead of terminal")              \
+    _VAL('P', "pipeline", required_argument, "depth", "frames encoded ahead of the link")                 \
+    _VAL('w', "window", required_argument, "frames", "midst frames sent before the oldest ack is in")     \
+    _VAL('j', "jobs", required_argument, "sessions", "devices flashed at once, with several ports")       \
     _VAL('h', "help", no_argument, "", "help message")
 
-static const char* shortopts = "f:d:p:x:Flqh";
+static const char* shortopts = "f:d:p:x:FlqP:w:j:h";
 #define _VAL(sarg, larg, haspara, ind, desc) option{larg, haspara, 0, sarg},
 const static struct option longopts[] = {ARGUMENTS};
 #undef _VAL
@@ -111,26 +123,68 @@ string auto_find_pac(const string path) {
 }
 
 static bool flag_force_update = false;
+#define FIND_DEV_TIMEOUT 15000  // ms for a supported device to show up
+
+static int ms(std::chrono::steady_clock::duration d) {
+    return static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(d).count());
+}
+
+// link of intf on udev, and the id the profile keeps it by
+static void set_target(configuration& cfg, const usbdev& udev, const interface& intf) {
+    char id[16] = {'\0'};
+
+    snprintf(id, sizeof(id), "%04x:%04x", udev.vid, udev.pid);
+    cfg.device_id = id;
+    if (intf.ttyusb.empty()) {
+        char buf[128] = {'\0'};
+
+        snprintf(buf, sizeof(buf), "/dev/bus/usb/%03d/%03d", udev.busno, udev.devno);
+        cfg.device = buf;
+        cfg.endpoint_in = intf.endpoint_in;
+        cfg.endpoint_out = intf.endpoint_out;
+        cfg.interface_no = intf.interface_no;
+    } else
+        cfg.device = "/dev/" + intf.ttyusb;
+}
+
+/**
+ * sysfs is scanned once, then again on each uevent that may be the device.
+ * without uevents it is polled each second as before.
+ */
 void auto_find_dev(const string& port) {
     Device dev;
-    int try_time = 0;
-    int max_try_time = 15;
+    Hotplug hotplug;  // listening before the first scan, nothing slips in between
+    auto begin = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point switched;
+    bool switching = false;
+
+    for (auto& edl : config.edl_devs) hotplug.watch(edl.vid, edl.pid);
+    hotplug.setPort(port);
+
+    while (true) {
+        bool normal = false;
+        int left;
 
-    for (; try_time < max_try_time; try_time++) {
         dev.reset();
         dev.scan(port);
 
         // find normal device, try switch mode if set '--force'
         for (auto iter = config.normal_devs.begin(); iter != config.normal_devs.end(); iter++) {
-            if (dev.exist(iter->vid, iter->pid, iter->ifno) && flag_force_update) {
-                auto intf = dev.get_interface(iter->vid, iter->pid, iter->ifno);
+            auto intf = dev.get_interface(iter->vid, iter->pid, iter->ifno);
 
-                if (!intf.ttyusb.empty()) {
+            if (intf && flag_force_update) {
+                normal = true;
+                // again each second if it is still there, it may have missed one
+                if (switching && ms(std::chrono::steady_clock::now() - switched) < 1000) break;
+
+                if (!intf->ttyusb.empty()) {
                     std::string ttydev("/dev");
                     std::string edl_command("at+qdownload=1\r\n");
-                    SerialPort serial(ttydev + intf.ttyusb);
+                    SerialPort serial(ttydev + intf->ttyusb);
 
                     serial.sendSync((uint8_t*)(edl_command.c_str()), edl_command.length(), 5000);
+                    switched = std::chrono::steady_clock::now();
+                    switching = true;
                     break;
                 }
             }
@@ -138,28 +192,117 @@ void auto_find_dev(const string& port) {
 
         // find edl device
         for (auto iter = config.edl_devs.begin(); iter != config.edl_devs.end(); iter++) {
-            if (dev.exist(iter->vid, iter->pid, iter->ifno)) {
-                auto intf = dev.get_interface(iter->vid, iter->pid, iter->ifno);
-
-                if (intf.ttyusb.empty()) {
-                    char buf[128] = {'\0'};
-                    auto usbdev = dev.get_usbdevice(iter->vid, iter->pid);
+            auto intf = dev.get_interface(iter->vid, iter->pid, iter->ifno);
 
-                    snprintf(buf, sizeof(buf), "/dev/bus/usb/%03d/%03d", usbdev.busno, usbdev.devno);
-                    config.device = buf;
-                    config.endpoint_in = intf.endpoint_in;
-                    config.endpoint_out = intf.endpoint_out;
-                    config.interface_no = intf.interface_no;
-                } else
-                    config.device = "/dev/" + intf.ttyusb;
+            if (intf) {
+                auto now = std::chrono::steady_clock::now();
 
+                set_target(config, *dev.get_usbdevice(iter->vid, iter->pid), *intf);
+                cerr << "find " << config.device_id << " in " << ms(now - begin) << " ms";
+                if (switching) cerr << ", " << ms(now - switched) << " ms after mode switch";
+                cerr << (hotplug.isOpened() ? " (uevent)" : " (poll)") << endl;
                 return;
             }
         }
 
+        left = FIND_DEV_TIMEOUT - ms(std::chrono::steady_clock::now() - begin);
+        if (left <= 0) break;
+
         cerr << "find no support device" << endl;
-        sleep(1);
+        if (normal && left > 1000) left = 1000;
+        if (!hotplug.isOpened())
+            usleep((left > 1000 ? 1000 : left) * 1000);
+        else
+            hotplug.wait(left);
+    }
+}
+
+// one device of a multi-device run
+struct session {
+    std::string name;  // sysfs name, bus-port
+    configuration cfg;
+    int result;
+    int ms;
+};
+
+static bool multi_device(const string& ports) { return ports == "all" || ports.find(',') != string::npos; }
+
+// interface to flash udev through, nullptr unless it is an edl device
+static const interface* edl_interface(const usbdev& udev) {
+    for (auto& edl : config.edl_devs) {
+        if (edl.vid != udev.vid || edl.pid != udev.pid) continue;
+
+        for (auto& intf : udev.ifaces) {
+            if (intf.interface_no == edl.ifno) return &intf;
+        }
     }
+    return nullptr;
+}
+
+/**
+ * one sysfs scan for all ports, again on uevents until each port listed has
+ * an edl device or FIND_DEV_TIMEOUT passes. "all" takes the edl devices of
+ * the first scan that finds any. devices in normal mode are not switched.
+ */
+static std::vector<session> find_devs(const string& ports) {
+    std::vector<session> sessions;
+    std::vector<string> wanted;
+    Device dev;
+    Hotplug hotplug;
+    auto begin = std::chrono::steady_clock::now();
+
+    if (ports != "all") {
+        std::stringstream ss(ports);
+        string port;
+
+        while (std::getline(ss, port, ',')) {
+            if (!port.empty()) wanted.push_back(port);
+        }
+    }
+    for (auto& edl : config.edl_devs) hotplug.watch(edl.vid, edl.pid);
+
+    while (true) {
+        int left;
+
+        sessions.clear();
+        dev.reset();
+        dev.scan("");
+
+        if (wanted.empty()) {
+            for (auto& udev : dev.devices()) {
+                auto intf = edl_interface(udev);
+
+                if (!intf) continue;
+                sessions.push_back(session{udev.devpath.substr(udev.devpath.rfind('/') + 1), config, -1, 0});
+                set_target(sessions.back().cfg, udev, *intf);
+            }
+        } else {
+            for (auto& port : wanted) {
+                auto udev = dev.get_usbdevice(port);
+                auto intf = udev ? edl_interface(*udev) : nullptr;
+
+                if (!intf) continue;
+                sessions.push_back(session{udev->devpath.substr(udev->devpath.rfind('/') + 1), config, -1, 0});
+                set_target(sessions.back().cfg, *udev, *intf);
+            }
+        }
+
+        if (wanted.empty() ? !sessions.empty() : sessions.size() == wanted.size()) break;
+
+        left = FIND_DEV_TIMEOUT - ms(std::chrono::steady_clock::now() - begin);
+        if (left <= 0) break;
+
+        if (!hotplug.isOpened())
+            usleep((left > 1000 ? 1000 : left) * 1000);
+        else
+            hotplug.wait(left);
+    }
+
+    cerr << "find " << sessions.size() << " edl devices in " << ms(std::chrono::steady_clock::now() - begin) << " ms";
+    if (!wanted.empty()) cerr << ", " << wanted.size() << " ports asked";
+    cerr << endl;
+
+    return sessions;
 }
 
 #define DEFAULT_CONFIG "/etc/dloader.conf"
@@ -200,6 +343,28 @@ void load_config(const string& conf) {
             config.usb_physical_port = line.substr(line.find_first_of('=') + 1);
         } else if (key == "reset_normal") {
             config.reset_normal = atoi(line.substr(line.find_first_of('=') + 1).c_str());
+        } else if (key == "pipeline_depth") {
+            config.pipeline_depth = atoi(val.c_str());
+        } else if (key == "midst_window") {
+            config.midst_window = atoi(val.c_str());
+        } else if (key == "profile") {
+            config.profile = val;
+        } else if (key == "manifest") {
+            config.manifest = val;
+        } else if (key == "baud_max") {
+            config.baud_max = strtoul(val.c_str(), nullptr, 0);
+        } else if (key == "tty_uring") {
+            config.tty_uring = atoi(val.c_str());
+        } else if (key == "low_latency") {
+            config.low_latency = atoi(val.c_str());
+        } else if (key == "usbfs_out_urbs") {
+            config.usbfs_out_urbs = atoi(val.c_str());
+        } else if (key == "usbfs_in_urbs") {
+            config.usbfs_in_urbs = atoi(val.c_str());
+        } else if (key == "sessions_max") {
+            config.sessions_max = atoi(val.c_str());
+        } else if (key == "framesz_probe") {
+            config.framesz_probe = atoi(val.c_str());
         }
     }
 
@@ -209,20 +374,109 @@ void load_config(const string& conf) {
     config.edl_devs.emplace_back(usbdev_info{0x0525, 0xa4a7, 1, PHYLINK::PHYLINK_USB});
 }
 
-int do_update(shared_ptr<USBStream>& us) {
-    UpgradeManager upmgr(config.device, config.pac_path, us);
+// empty if the parsed pac is not to be kept
+static string manifest_path(const string& pac) {
+    if (config.manifest == "off") return "";
+    return config.manifest.empty() ? pac + ".manifest" : config.manifest;
+}
+
+// parsed once, every session reads the same one. the same pac next time is taken from its manifest
+static shared_ptr<Firmware> load_pac(const string& path) {
+    shared_ptr<Firmware> fw(new (std::nothrow) Firmware(path));
+    string manifest = manifest_path(path);
+
+    if (!fw) return nullptr;
+    if (!manifest.empty() && !fw->manifest_load(manifest)) return fw;
+
+    if (fw->pacparser() || fw->xmlparser()) return nullptr;
+    if (!manifest.empty()) fw->manifest_save(manifest);
+    return fw;
+}
+
+static shared_ptr<USBStream> open_link(const configuration& cfg) {
+    shared_ptr<USBStream> us;
+
+    if (cfg.device.find("/dev/bus/usb") != std::string::npos) {
+        auto usbfs = new USBFS(cfg.device, cfg.interface_no, cfg.endpoint_in, cfg.endpoint_out);
+
+        us.reset(usbfs);
+        usbfs->setAsync(cfg.usbfs_out_urbs, cfg.usbfs_in_urbs);
+    } else if (cfg.tty_uring) {
+        us.reset(new UringPort(cfg.device));
+    } else {
+        us.reset(new SerialPort(cfg.device));
+    }
+
+    return us;
+}
+
+int do_update(const configuration& cfg, shared_ptr<Firmware>& fw, const string& tag) {
+    auto us = open_link(cfg);
+    UpgradeManager upmgr(cfg.device, fw, us);
 
     if (!upmgr.prepare()) return -1;
+    upmgr.setPipelineDepth(cfg.pipeline_depth);
+    upmgr.setMidstWindow(cfg.midst_window);
+    if (!cfg.profile.empty()) upmgr.setProfile(cfg.profile);
+    upmgr.setDeviceId(cfg.device_id);
+    upmgr.setBaudCeiling(cfg.baud_max);
+    upmgr.setLowLatency(cfg.low_latency);
+    upmgr.setFrameProbe(cfg.framesz_probe);
+    upmgr.setBackupTag(tag);
 
     return upmgr.upgrade(true);
 }
 
+/**
+ * a session is one thread blocked on its link most of the time, so up to
+ * sessions_max of them run at once and pick the next device when done.
+ * 0 if every device was flashed.
+ */
+static int run_sessions(std::vector<session>& sessions, shared_ptr<Firmware>& fw) {
+    std::atomic<uint32_t> next(0);
+    std::vector<std::thread> workers;
+    uint32_t nworkers = sessions.size();
+    uint32_t failed = 0;
+    auto begin = std::chrono::steady_clock::now();
+
+    if (config.sessions_max && config.sessions_max < nworkers) nworkers = config.sessions_max;
+
+    {
+        // every line a session logs tells which one it is
+        SessionLog log;
+
+        for (uint32_t t = 0; t < nworkers; t++) {
+            workers.emplace_back([&]() {
+                for (uint32_t i = next++; i < sessions.size(); i = next++) {
+                    auto start = std::chrono::steady_clock::now();
+
+                    log.setTag(sessions[i].name);
+                    sessions[i].result = do_update(sessions[i].cfg, fw, sessions[i].name);
+                    sessions[i].ms = ms(std::chrono::steady_clock::now() - start);
+                }
+                log.setTag("");
+            });
+        }
+        for (auto& w : workers) w.join();
+    }
+
+    for (auto& s : sessions) {
+        cerr << s.name << " " << s.cfg.device_id << " " << s.cfg.device << ": " << (s.result ? "fail" : "success")
+             << " in " << s.ms << " ms" << endl;
+        if (s.result) failed++;
+    }
+    cerr << sessions.size() - failed << "/" << sessions.size() << " devices flashed in "
+         << ms(std::chrono::steady_clock::now() - begin) << " ms, " << nworkers << " at once" << endl;
+
+    return failed ? -1 : 0;
+}
+
 int main(int argc, char** argv) {
     int opt;
     string config_path;
     int longidx = 0;
     bool flag_list_device = false;
-    shared_ptr<USBStream> us;
+    shared_ptr<Firmware> fw;
 
     if (argc < 2) flag_list_device = true;
 
@@ -271,6 +525,15 @@ int main(int argc, char** argv) {
                 break;
             }
 
+            case 'P':
+                config.pipeline_depth = atoi(optarg);
+                break;
+            case 'w':
+                config.midst_window = atoi(optarg);
+                break;
+            case 'j':
+                config.sessions_max = atoi(optarg);
+                break;
             case 'h':
             default:
                 usage(argv[0]);
@@ -280,27 +543,32 @@ int main(int argc, char** argv) {
 
     if (flag_list_device) {
         Device dev;
-        dev.scan(config.usb_physical_port);
+        dev.scan(multi_device(config.usb_physical_port) ? "" : config.usb_physical_port);
         return 0;
     }
 
     if (!config.pac_path.empty() && is_dir(config.pac_path)) auto_find_pac(config.pac_path);
 
+    // several devices, one pac parsed for all of them
+    if (config.device.empty() && multi_device(config.usb_physical_port)) {
+        auto sessions = find_devs(config.usb_physical_port);
+
+        cerr << "choose pac: " << config.pac_path << endl;
+        if (sessions.empty() || access(config.pac_path.c_str(), F_OK) || !(fw = load_pac(config.pac_path))) {
+            cerr << "find no support device or no pac file" << endl;
+            return -1;
+        }
+        return run_sessions(sessions, fw);
+    }
+
     if (config.device.empty()) auto_find_dev(config.usb_physical_port);
 
     cerr << "choose device: " << config.device << endl;
     cerr << "choose pac: " << config.pac_path << endl;
 
-    if (!config.device.empty()) {
-        if (config.device.find("/dev/bus/usb") != std::string::npos)
-            us.reset(new USBFS(config.device, config.interface_no, config.endpoint_in, config.endpoint_out));
-        else
-            us.reset(new SerialPort(config.device));
-    }
-
     if (!config.device.empty() && !access(config.device.c_str(), F_OK) && !config.pac_path.empty() &&
-        !access(config.pac_path.c_str(), F_OK))
-        return do_update(us);
+        !access(config.pac_path.c_str(), F_OK) && (fw = load_pac(config.pac_path)))
+        return do_update(config, fw, "");
 
     cerr << "find no support device or no pac file" << endl;
     return -1;
@@ -0,0 +1,356 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-17 14:02:18
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-17 14:02:18
+ * @Description: 0x7e/0x7d escape codec of bootcode and fdl frames
+ */
+#include <algorithm>
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "escape.hpp"
+
+#define ONES64 0x0101010101010101ULL
+#define HIGHS64 0x8080808080808080ULL
+#define HASZERO64(v) (((v)-ONES64) & ~(v)&HIGHS64)
+
+static inline uint32_t first_bit(uint64_t v) { return __builtin_ctzll(v); }
+
+template <bool with_7d>
+static const uint8_t *scan(const uint8_t *src, const uint8_t *end) {
+#if defined(__SSE2__)
+    const __m128i m7e = _mm_set1_epi8(MAGIC_7e);
+    const __m128i m7d = _mm_set1_epi8(MAGIC_7d);
+
+    for (; end - src >= 32; src += 32) {
+        __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16));
+        __m128i c0 = _mm_cmpeq_epi8(v0, m7e);
+        __m128i c1 = _mm_cmpeq_epi8(v1, m7e);
+        if (with_7d) {
+            c0 = _mm_or_si128(c0, _mm_cmpeq_epi8(v0, m7d));
+            c1 = _mm_or_si128(c1, _mm_cmpeq_epi8(v1, m7d));
+        }
+
+        uint32_t mask = _mm_movemask_epi8(c0) | (_mm_movemask_epi8(c1) << 16);
+        if (mask) return src + first_bit(mask);
+    }
+
+    for (; end - src >= 16; src += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        __m128i c = _mm_cmpeq_epi8(v, m7e);
+        if (with_7d) c = _mm_or_si128(c, _mm_cmpeq_epi8(v, m7d));
+
+        uint32_t mask = _mm_movemask_epi8(c);
+        if (mask) return src + first_bit(mask);
+    }
+#else
+    // 8 bytes at a time, a byte matches if v ^ magic has a zero byte
+    for (; end - src >= 8; src += 8) {
+        uint64_t v;
+        uint64_t hit;
+
+        memcpy(&v, src, sizeof(v));
+        hit = HASZERO64(v ^ (ONES64 * MAGIC_7e));
+        if (with_7d) hit |= HASZERO64(v ^ (ONES64 * MAGIC_7d));
+        if (hit) break;
+    }
+#endif
+
+    for (; src < end; src++) {
+        if (*src == MAGIC_7e || (with_7d && *src == MAGIC_7d)) return src;
+    }
+
+    return end;
+}
+
+/**
+ * call on_hit for every 0x7e/0x7d in [src, end) in order, stop early if it
+ * returns false. bits of a block mask are consumed one by one, so sparse
+ * input never rescans a block. a block with many hits is handed to
+ * on_dense as a whole, which is cheaper to walk bytewise.
+ */
+#define ESCAPE_DENSE_HITS 4
+template <typename F, typename D>
+static void walk(const uint8_t *src, const uint8_t *end, F on_hit, D on_dense) {
+#if defined(__SSE2__)
+    const __m128i m7e = _mm_set1_epi8(MAGIC_7e);
+    const __m128i m7d = _mm_set1_epi8(MAGIC_7d);
+
+    for (; end - src >= 16; src += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+        uint32_t mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, m7e), _mm_cmpeq_epi8(v, m7d)));
+
+        if (__builtin_popcount(mask) >= ESCAPE_DENSE_HITS) {
+            if (!on_dense(src, src + 16)) return;
+            continue;
+        }
+
+        for (; mask; mask &= mask - 1) {
+            if (!on_hit(src + first_bit(mask))) return;
+        }
+    }
+#endif
+
+    on_dense(src, end);
+}
+
+const uint8_t *EscapeCodec::find(const uint8_t *src, const uint8_t *end) { return scan<true>(src, end); }
+
+const uint8_t *EscapeCodec::findFlag(const uint8_t *src, const uint8_t *end) { return scan<false>(src, end); }
+
+uint32_t EscapeCodec::count(const uint8_t *src, uint32_t len) {
+    const uint8_t *end = src + len;
+    uint32_t n = 0;
+
+    for (src = find(src, end); src < end; src = find(src + 1, end)) n++;
+
+    return n;
+}
+
+// escape [from, to) bytewise, return the end of output
+static uint8_t *escape_bytewise(const uint8_t *from, const uint8_t *to, uint8_t *out) {
+    for (; from < to; from++) {
+        uint8_t ch = *from;
+
+        if (ch == MAGIC_7e || ch == MAGIC_7d) {
+            *out++ = MAGIC_7d;
+            *out++ = ch ^ 0x20;
+        } else {
+            *out++ = ch;
+        }
+    }
+
+    return out;
+}
+
+uint32_t EscapeCodec::escape(const uint8_t *src, uint32_t len, uint8_t *dst) {
+    const uint8_t *end = src + len;
+    uint8_t *out = dst;
+
+    walk(
+        src, end,
+        [&](const uint8_t *hit) {
+            memcpy(out, src, hit - src);
+            out += hit - src;
+            *out++ = MAGIC_7d;
+            *out++ = *hit ^ 0x20;
+            src = hit + 1;
+            return true;
+        },
+        [&](const uint8_t *from, const uint8_t *to) {
+            memcpy(out, src, from - src);
+            out = escape_bytewise(from, to, out + (from - src));
+            src = to;
+            return true;
+        });
+
+    return out - dst;
+}
+
+/*************************** ENCODER ***************************/
+EscapeEncoder::EscapeEncoder() : used(0), total(0), dirty(false) {}
+
+void EscapeEncoder::reset() {
+    segments.clear();
+    used = 0;
+    total = 0;
+    dirty = true;
+}
+
+uint8_t *EscapeEncoder::reserve(uint32_t len) {
+    if (!len) return scratch.data() + used;
+
+    if (scratch.size() < used + len) scratch.resize(std::max<size_t>(scratch.size() * 2, used + len));
+
+    if (segments.empty() || segments.back().ref)
+        segments.push_back(segment{nullptr, used, len});
+    else
+        segments.back().len += len;
+
+    used += len;
+    total += len;
+    dirty = true;
+
+    return scratch.data() + used - len;
+}
+
+void EscapeEncoder::copy(const uint8_t *src, uint32_t len) {
+    if (len) memcpy(reserve(len), src, len);
+}
+
+void EscapeEncoder::reference(const uint8_t *src, uint32_t len) {
+    if (!len) return;
+
+    segments.push_back(segment{src, 0, len});
+    total += len;
+    dirty = true;
+}
+
+void EscapeEncoder::append(const uint8_t *src, uint32_t len) { copy(src, len); }
+
+void EscapeEncoder::appendRef(const uint8_t *src, uint32_t len) {
+    if (len < ESCAPE_REF_MIN)
+        copy(src, len);
+    else
+        reference(src, len);
+}
+
+void EscapeEncoder::escape(const uint8_t *src, uint32_t len) {
+    const uint8_t *end = src + len;
+
+    // short runs go to scratch along with the escape sequences
+    auto run = [&](const uint8_t *to, uint32_t extra) {
+        uint32_t n = to - src;
+
+        if (n >= ESCAPE_REF_MIN) {
+            reference(src, n);
+            n = 0;
+        }
+
+        uint8_t *out = reserve(n + extra);
+        if (n) memcpy(out, src, n);
+        return out + n;
+    };
+
+    walk(
+        src, end,
+        [&](const uint8_t *hit) {
+            uint8_t *out = run(hit, 2);
+            out[0] = MAGIC_7d;
+            out[1] = *hit ^ 0x20;
+            src = hit + 1;
+            return true;
+        },
+        [&](const uint8_t *from, const uint8_t *to) {
+            uint32_t worst = 2 * (to - from);
+            uint8_t *out = run(from, worst);
+            uint32_t unused = worst - (escape_bytewise(from, to, out) - out);
+
+            // give back what the worst case did not use
+            if (unused) {
+                used -= unused;
+                total -= unused;
+                segments.back().len -= unused;
+            }
+            src = to;
+            return true;
+        });
+}
+
+const struct iovec *EscapeEncoder::iov() {
+    if (!dirty) return iovs.data();
+
+    // scratch may move while growing, so resolve addresses at the end
+    iovs.clear();
+    for (auto &seg : segments) {
+        const uint8_t *base = seg.ref ? seg.ref : scratch.data() + seg.offset;
+        iovs.push_back(iovec{const_cast<uint8_t *>(base), seg.len});
+    }
+    dirty = false;
+
+    return iovs.data();
+}
+
+int EscapeEncoder::iovcnt() {
+    iov();
+    return iovs.size();
+}
+
+uint32_t EscapeEncoder::length() { return total; }
+
+const uint8_t *EscapeEncoder::flatten() {
+    auto v = iov();
+
+    if (iovs.size() == 1) return reinterpret_cast<const uint8_t *>(v[0].iov_base);
+
+    flat.resize(total);
+    for (uint32_t i = 0, pos = 0; i < iovs.size(); pos += v[i].iov_len, i++)
+        memcpy(flat.data() + pos, v[i].iov_base, v[i].iov_len);
+
+    return flat.data();
+}
+
+/*************************** DECODER ***************************/
+uint32_t EscapeDecoder::decode(const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t &used) {
+    const uint8_t *begin = src;
+    const uint8_t *end = src + len;
+    uint8_t *out = dst;
+
+    // return false to stop at src
+    auto unescape = [&](const uint8_t *hit) {
+        memcpy(out, src, hit - src);
+        out += hit - src;
+        src = hit;
+
+        if (*hit == MAGIC_7e) return false;
+
+        // 0x7d, the escaped byte may be in the next chunk
+        if (hit + 1 == end) {
+            pending = true;
+            src = end;
+            return false;
+        }
+
+        // malformed, let the caller resync on the flag
+        if (hit[1] == MAGIC_7e) {
+            src = hit + 1;
+            return false;
+        }
+
+        *out++ = hit[1] ^ 0x20;
+        src = hit + 2;
+        return true;
+    };
+
+    if (pending && src < end) {
+        pending = false;
+        if (*src != MAGIC_7e) *out++ = *src++ ^ 0x20;
+    }
+
+    walk(
+        src, end,
+        [&](const uint8_t *hit) {
+            // the escaped byte of a malformed 7d 7d pair
+            if (hit < src) return true;
+            return unescape(hit);
+        },
+        [&](const uint8_t *from, const uint8_t *to) {
+            if (src < from) {
+                memcpy(out, src, from - src);
+                out += from - src;
+                src = from;
+            }
+
+            // src may run one byte past to, the escaped byte of a trailing 0x7d
+            while (src < to) {
+                uint8_t ch = *src;
+
+                if (ch == MAGIC_7e) return false;
+
+                if (ch != MAGIC_7d) {
+                    *out++ = ch;
+                    src++;
+                } else if (src + 1 == end) {
+                    pending = true;
+                    src = end;
+                    return false;
+                } else if (src[1] == MAGIC_7e) {
+                    src++;
+                    return false;
+                } else {
+                    *out++ = src[1] ^ 0x20;
+                    src += 2;
+                }
+            }
+            return true;
+        });
+
+    used = src - begin;
+    return out - dst;
+}
@@ -5,22 +5,53 @@
  * @LastEditTime: 2021-02-26 15:41:44
  * @Description: file content
  */
+#include <algorithm>
 #include <iostream>
 #include <string>
 
 #include <cstring>
 
+#include "crc.hpp"
 #include "fdl.hpp"
+#include "frame.hpp"
 
-static REQTYPE __request_type = REQTYPE::BSL_CMD_CONNECT;
+static frame_encode_t frame_encoder(CRC_MODLE mod, bool data_es_flag, bool crc_es_flag) {
+    static const frame_encode_t encoders[2][2][2] = {
+        {{FrameEncoder<CRC_MODLE::CRC_BOOTCODE, false, false>::encode,
+          FrameEncoder<CRC_MODLE::CRC_BOOTCODE, false, true>::encode},
+         {FrameEncoder<CRC_MODLE::CRC_BOOTCODE, true, false>::encode,
+          FrameEncoder<CRC_MODLE::CRC_BOOTCODE, true, true>::encode}},
+        {{FrameEncoder<CRC_MODLE::CRC_FDL, false, false>::encode, FrameEncoder<CRC_MODLE::CRC_FDL, false, true>::encode},
+         {FrameEncoder<CRC_MODLE::CRC_FDL, true, false>::encode, FrameEncoder<CRC_MODLE::CRC_FDL, true, true>::encode}},
+    };
+
+    return encoders[mod == CRC_MODLE::CRC_FDL][data_es_flag][crc_es_flag];
+}
+
+template <REQTYPE T>
+static const const_frame& const_frame_of(CRC_MODLE mod, bool data_es_flag, bool crc_es_flag) {
+    static const const_frame* frames[2][2][2] = {
+        {{&ConstFrame<T, CRC_MODLE::CRC_BOOTCODE, false, false>::frame,
+          &ConstFrame<T, CRC_MODLE::CRC_BOOTCODE, false, true>::frame},
+         {&ConstFrame<T, CRC_MODLE::CRC_BOOTCODE, true, false>::frame,
+          &ConstFrame<T, CRC_MODLE::CRC_BOOTCODE, true, true>::frame}},
+        {{&ConstFrame<T, CRC_MODLE::CRC_FDL, false, false>::frame, &ConstFrame<T, CRC_MODLE::CRC_FDL, false, true>::frame},
+         {&ConstFrame<T, CRC_MODLE::CRC_FDL, true, false>::frame, &ConstFrame<T, CRC_MODLE::CRC_FDL, true, true>::frame}},
+    };
+
+    return *frames[mod == CRC_MODLE::CRC_FDL][data_es_flag][crc_es_flag];
+}
 
 FDLRequest::FDLRequest()
     : CMDRequest(PROTOCOL::PROTO_FDL),
       _reallen(0),
+      _payload(nullptr),
+      _payloadlen(0),
       crc_modle(CRC_MODLE::CRC_BOOTCODE),
       crc_escape_flag(true),
       data_escape_flag(true) {
     _data = new (std::nothrow) uint8_t[MAX_DATA_LEN]();
+    _encode = frame_encoder(crc_modle, data_escape_flag, crc_escape_flag);
 }
 
 FDLRequest::~FDLRequest() {
@@ -30,6 +61,9 @@ FDLRequest::~FDLRequest() {
 
 REQTYPE FDLRequest::type() {
     cmd_header* hdr = FRAMEHDR(_data);
+
+    // a lone 0x7e, the header is left from the frame before
+    if (_reallen == 1) return REQTYPE::BSL_CMD_CHECK_BAUD;
     return static_cast<REQTYPE>(be16toh(hdr->cmd_type));
 }
 
@@ -78,18 +112,34 @@ std::string FDLRequest::argString() { return _argstr; }
 
 void FDLRequest::setArgString(const std::string& argstr) { _argstr = argstr; }
 
-uint8_t* FDLRequest::data() { return _data + sizeof(cmd_header); }
+uint8_t* FDLRequest::data() { return _payload ? const_cast<uint8_t*>(_payload) : _data + sizeof(cmd_header); }
 
 uint32_t FDLRequest::dataLen() {
     auto hdr = FRAMEHDR(_data);
     return be16toh(hdr->data_length);
 }
 
-uint8_t* FDLRequest::rawData() { return _data; }
+uint8_t* FDLRequest::rawData() { return const_cast<uint8_t*>(encoder.flatten()); }
+
+uint32_t FDLRequest::rawDataLen() { return encoder.length(); }
+
+const struct iovec* FDLRequest::rawIov() { return encoder.iov(); }
 
-uint32_t FDLRequest::rawDataLen() { return _reallen; }
+int FDLRequest::rawIovCnt() { return encoder.iovcnt(); }
 
-bool FDLRequest::isDuplicate() { return type() == __request_type; }
+// read replies carry the size asked for, others are not known ahead
+uint32_t FDLRequest::replyLength() {
+    uint32_t len;
+
+    if (type() == REQTYPE::BSL_CMD_READ_MIDST)
+        len = le32toh(*FRAMEDATA(_data, sizeof(cmd_header), uint32_t));
+    else if (type() == REQTYPE::BSL_CMD_READ_FLASH)
+        len = be32toh(*FRAMEDATA(_data, sizeof(cmd_header) + 4, uint32_t));
+    else
+        return 0;
+
+    return sizeof(cmd_header) + len + sizeof(cmd_tail);
+}
 
 bool FDLRequest::onWrite() { return type() == REQTYPE::BSL_CMD_MIDST_DATA; }
 
@@ -98,197 +148,83 @@ bool FDLRequest::onRead() { return type() == REQTYPE::BSL_CMD_READ_MIDST || type
 void FDLRequest::setEscapeFlag(bool data_es_flag, bool crc_es_flag) {
     this->data_escape_flag = data_es_flag;
     this->crc_escape_flag = crc_es_flag;
+    _encode = frame_encoder(crc_modle, data_escape_flag, crc_escape_flag);
 }
 
-void FDLRequest::setCrcModle(CRC_MODLE mod) { crc_modle = mod; }
-
-uint16_t FDLRequest::crc16BootCode(const char* src, uint32_t len) {
-#define CRC_16_POLYNOMIAL 0x1021
-#define CRC_16_L_POLYNOMIAL 0x8000
-#define CRC_16_L_SEED 0x80
-#define CRC_16_L_OK 0x00
-#define CRC_CHECK_SIZE 0x02
-
-    unsigned int i;
-    uint16_t crc = 0;
-    while (len-- != 0) {
-        for (i = CRC_16_L_SEED; i != 0; i = i >> 1) {
-            if ((crc & CRC_16_L_POLYNOMIAL) != 0) {
-                crc = crc << 1;
-                crc = crc ^ CRC_16_POLYNOMIAL;
-            } else
-                crc = crc << 1;
-            if ((*src & i) != 0) crc = crc ^ CRC_16_POLYNOMIAL;
-        }
-        src++;
-    }
-    return (crc);
-}
-
-uint16_t FDLRequest::crc16FDL(const uint16_t* src, uint32_t len) {
-    unsigned int sum = 0;
-    uint16_t SourceValue, DestValue;
-    uint16_t lowSourceValue, hiSourceValue;
-    /* Get sum value of the source.*/
-    while (len > 1) {
-        SourceValue = *src++;
-        DestValue = 0;
-        lowSourceValue = (SourceValue & 0xFF00) >> 8;
-        hiSourceValue = (SourceValue & 0x00FF) << 8;
-        DestValue = lowSourceValue | hiSourceValue;
-        sum += DestValue;
-        len -= 2;
-    }
-    if (len == 1) {
-        sum += *((unsigned char*)src);
-    }
-
-    sum = (sum >> 16) + (sum & 0x0FFFF);
-    sum += (sum >> 16);
-
-    return (~sum);
-}
-
-uint16_t FDLRequest::crc16NV(uint16_t crc, const uint8_t* buffer, uint32_t len) {
-    /** CRC table for the CRC-16. The poly is 0x8005 (x^16 + x^15 + x^2 + 1) */
-    uint16_t const crc16_table[256] = {
-        0x0000, 0xC0C1, 0xC181, 0x0140, 0xC301, 0x03C0, 0x0280, 0xC241, 0xC601, 0x06C0, 0x0780, 0xC741, 0x0500, 0xC5C1,
-        0xC481, 0x0440, 0xCC01, 0x0CC0, 0x0D80, 0xCD41, 0x0F00, 0xCFC1, 0xCE81, 0x0E40, 0x0A00, 0xCAC1, 0xCB81, 0x0B40,
-        0xC901, 0x09C0, 0x0880, 0xC841, 0xD801, 0x18C0, 0x1980, 0xD941, 0x1B00, 0xDBC1, 0xDA81, 0x1A40, 0x1E00, 0xDEC1,
-        0xDF81, 0x1F40, 0xDD01, 0x1DC0, 0x1C80, 0xDC41, 0x1400, 0xD4C1, 0xD581, 0x1540, 0xD701, 0x17C0, 0x1680, 0xD641,
-        0xD201, 0x12C0, 0x1380, 0xD341, 0x1100, 0xD1C1, 0xD081, 0x1040, 0xF001, 0x30C0, 0x3180, 0xF141, 0x3300, 0xF3C1,
-        0xF281, 0x3240, 0x3600, 0xF6C1, 0xF781, 0x3740, 0xF501, 0x35C0, 0x3480, 0xF441, 0x3C00, 0xFCC1, 0xFD81, 0x3D40,
-        0xFF01, 0x3FC0, 0x3E80, 0xFE41, 0xFA01, 0x3AC0, 0x3B80, 0xFB41, 0x3900, 0xF9C1, 0xF881, 0x3840, 0x2800, 0xE8C1,
-        0xE981, 0x2940, 0xEB01, 0x2BC0, 0x2A80, 0xEA41, 0xEE01, 0x2EC0, 0x2F80, 0xEF41, 0x2D00, 0xEDC1, 0xEC81, 0x2C40,
-        0xE401, 0x24C0, 0x2580, 0xE541, 0x2700, 0xE7C1, 0xE681, 0x2640, 0x2200, 0xE2C1, 0xE381, 0x2340, 0xE101, 0x21C0,
-        0x2080, 0xE041, 0xA001, 0x60C0, 0x6180, 0xA141, 0x6300, 0xA3C1, 0xA281, 0x6240, 0x6600, 0xA6C1, 0xA781, 0x6740,
-        0xA501, 0x65C0, 0x6480, 0xA441, 0x6C00, 0xACC1, 0xAD81, 0x6D40, 0xAF01, 0x6FC0, 0x6E80, 0xAE41, 0xAA01, 0x6AC0,
-        0x6B80, 0xAB41, 0x6900, 0xA9C1, 0xA881, 0x6840, 0x7800, 0xB8C1, 0xB981, 0x7940, 0xBB01, 0x7BC0, 0x7A80, 0xBA41,
-        0xBE01, 0x7EC0, 0x7F80, 0xBF41, 0x7D00, 0xBDC1, 0xBC81, 0x7C40, 0xB401, 0x74C0, 0x7580, 0xB541, 0x7700, 0xB7C1,
-        0xB681, 0x7640, 0x7200, 0xB2C1, 0xB381, 0x7340, 0xB101, 0x71C0, 0x7080, 0xB041, 0x5000, 0x90C1, 0x9181, 0x5140,
-        0x9301, 0x53C0, 0x5280, 0x9241, 0x9601, 0x56C0, 0x5780, 0x9741, 0x5500, 0x95C1, 0x9481, 0x5440, 0x9C01, 0x5CC0,
-        0x5D80, 0x9D41, 0x5F00, 0x9FC1, 0x9E81, 0x5E40, 0x5A00, 0x9AC1, 0x9B81, 0x5B40, 0x9901, 0x59C0, 0x5880, 0x9841,
-        0x8801, 0x48C0, 0x4980, 0x8941, 0x4B00, 0x8BC1, 0x8A81, 0x4A40, 0x4E00, 0x8EC1, 0x8F81, 0x4F40, 0x8D01, 0x4DC0,
-        0x4C80, 0x8C41, 0x4400, 0x84C1, 0x8581, 0x4540, 0x8701, 0x47C0, 0x4680, 0x8641, 0x8201, 0x42C0, 0x4380, 0x8341,
-        0x4100, 0x81C1, 0x8081, 0x4040};
-
-    while (len--) crc = (uint16_t)((crc >> 8) ^ (crc16_table[(crc ^ (*buffer++)) & 0xff]));
-    return crc;
+void FDLRequest::setCrcModle(CRC_MODLE mod) {
+    crc_modle = mod;
+    _encode = frame_encoder(crc_modle, data_escape_flag, crc_escape_flag);
 }
 
 void FDLRequest::reinit(REQTYPE req) {
     cmd_header* hdr = FRAMEHDR(_data);
 
-    if (_reallen == 1)
-        __request_type = REQTYPE::BSL_CMD_CHECK_BAUD;
-    else
-        __request_type = type();
-
-    memset(_data, 0, MAX_DATA_LEN);
-
+    // every byte of a frame is written by push_back, no need to clear
     hdr->magic = MAGIC_7e;
     hdr->cmd_type = htobe16(static_cast<uint16_t>(req));
     hdr->data_length = 0;
 
     _reallen = sizeof(cmd_header);
+    _payload = nullptr;
+    _payloadlen = 0;
 }
 
-uint32_t _num_escape(uint8_t* src, uint32_t len) {
-    uint32_t magic_num = 0;
-    for (uint32_t pos = 0; pos < len; pos++) {
-        if (src[pos] == MAGIC_7e || src[pos] == MAGIC_7d) magic_num++;
-    }
-
-    return magic_num;
-}
-
-void _do_escape(uint8_t* src, uint32_t srclen, uint32_t magic_num) {
-    for (uint32_t pos_l = srclen - 1, pos_r = srclen + magic_num - 1; pos_l >= 0; pos_l--) {
-        if (src[pos_l] == MAGIC_7e) {
-            src[pos_r--] = MAGIC_5e;
-            src[pos_r--] = MAGIC_7d;
-            magic_num--;
-        } else if (src[pos_l] == MAGIC_7d) {
-            src[pos_r--] = MAGIC_5d;
-            src[pos_r--] = MAGIC_7d;
-            magic_num--;
-        } else {
-            src[pos_r--] = src[pos_l];
-        }
-
-        if (magic_num == 0) break;
-    }
-}
-
+/**
+ * the crc covers everything between the two 0x7e, the midst payload is
+ * fed in place and the frame is handed out as a gather list.
+ */
 void FDLRequest::finishup() {
-    uint16_t crc16 = 0;
-    uint32_t magic_num = 0;
-
-    if (!(_reallen % 2)) push_back(uint8_t(0));
+    cmd_header* hdr = FRAMEHDR(_data);
+    bool padded = false;
 
-    if (crc_modle == CRC_MODLE::CRC_BOOTCODE)
-        crc16 = crc16BootCode(reinterpret_cast<char*>(_data + 1), _reallen - 1);
-    else
-        crc16 = crc16FDL(reinterpret_cast<uint16_t*>(_data + 1), _reallen - 1);
-
-    // no escape
-    if (!data_escape_flag) {
-        cmd_tail* tail = FRAMETAIL(_data, _reallen);
-        tail->crc16 = htobe16(crc16);
-        tail->magic = MAGIC_7e;
-        _reallen += sizeof(cmd_tail);
-        return;
-    }
+    if (!_payload && !(_reallen % 2)) push_back(uint8_t(0));
 
-    // do escape
-    if (crc_escape_flag) {
-        cmd_tail* tail = FRAMETAIL(_data, _reallen);
-        tail->crc16 = htobe16(crc16);
-        _reallen += sizeof(cmd_tail) - 1;
+    if (_payload) {
+        padded = !((_reallen + _payloadlen) % 2);
+        hdr->data_length = htobe16(_reallen + _payloadlen + padded - sizeof(cmd_header));
     }
 
-    magic_num = _num_escape(_data + 1, _reallen - 1);
-    if (magic_num) _do_escape(_data + 1, _reallen - 1, magic_num);
-
-    // update length
-    _reallen += magic_num;
-
-    if (crc_escape_flag) {
-        _data[_reallen++] = MAGIC_7e;
-    } else {
-        cmd_tail* tail = FRAMETAIL(_data, _reallen);
-        tail->crc16 = htobe16(crc16);
-        tail->magic = MAGIC_7e;
-        _reallen += sizeof(cmd_tail);
-    }
+    _encode(encoder, _data, _reallen, _payload, _payloadlen, padded);
 }
 
-template <typename T>
-void FDLRequest::push_back(T val) {
-    cmd_header* hdr = FRAMEHDR(_data);
+void FDLRequest::constframe(REQTYPE req) {
+    const const_frame* frame = nullptr;
 
-    switch (sizeof(T)) {
-        case 1:
-            *FRAMEDATA(_data, _reallen, T) = val;
-            break;
+    reinit(req);
 
-        case 2:
-            *FRAMEDATA(_data, _reallen, T) = val;
+    switch (req) {
+        case REQTYPE::BSL_CMD_CONNECT:
+            frame = &const_frame_of<REQTYPE::BSL_CMD_CONNECT>(crc_modle, data_escape_flag, crc_escape_flag);
             break;
-
-        case 4:
-            *FRAMEDATA(_data, _reallen, T) = val;
+        case REQTYPE::BSL_CMD_END_DATA:
+            frame = &const_frame_of<REQTYPE::BSL_CMD_END_DATA>(crc_modle, data_escape_flag, crc_escape_flag);
             break;
-
-        case 8:
-            *FRAMEDATA(_data, _reallen, T) = val;
+        case REQTYPE::BSL_CMD_EXEC_DATA:
+            frame = &const_frame_of<REQTYPE::BSL_CMD_EXEC_DATA>(crc_modle, data_escape_flag, crc_escape_flag);
             break;
-
-        default:
-            std::cerr << "unknow type with sizeof " << sizeof(T) << std::endl;
+        case REQTYPE::BSL_CMD_NORMAL_RESET:
+            frame = &const_frame_of<REQTYPE::BSL_CMD_NORMAL_RESET>(crc_modle, data_escape_flag, crc_escape_flag);
+            break;
+        case REQTYPE::BSL_CMD_END_READ:
+            frame = &const_frame_of<REQTYPE::BSL_CMD_END_READ>(crc_modle, data_escape_flag, crc_escape_flag);
+            break;
+        case REQTYPE::BSL_CMD_EXEC_NAND_INIT:
+            frame = &const_frame_of<REQTYPE::BSL_CMD_EXEC_NAND_INIT>(crc_modle, data_escape_flag, crc_escape_flag);
             break;
+        default:
+            finishup();
+            return;
     }
 
+    encoder.reset();
+    encoder.append(frame->bytes, frame->len);
+}
+
+template <typename T>
+void FDLRequest::push_back(T val) {
+    cmd_header* hdr = FRAMEHDR(_data);
+
+    memcpy(_data + _reallen, &val, sizeof(T));
     _reallen += sizeof(T);
     hdr->data_length = htobe16(_reallen - sizeof(cmd_header));
 }
@@ -305,11 +241,15 @@ void FDLRequest::push_back(std::string val) {
 void FDLRequest::newCheckBaud() {
     _data[0] = 0x7e;
     _reallen = 1;
+    _payload = nullptr;
+    _payloadlen = 0;
+
+    encoder.reset();
+    encoder.append(_data, _reallen);
 }
 
 void FDLRequest::newConnect() {
-    reinit(REQTYPE::BSL_CMD_CONNECT);
-    finishup();
+    constframe(REQTYPE::BSL_CMD_CONNECT);
 }
 
 void FDLRequest::newStartData(uint32_t addr, uint32_t len, uint32_t cs) {
@@ -321,46 +261,39 @@ void FDLRequest::newStartData(uint32_t addr, uint32_t len, uint32_t cs) {
     finishup();
 }
 
-void FDLRequest::newStartData(const std::string& partition, uint32_t len, uint32_t cs) {
+void FDLRequest::newStartData(const std::string& partition, uint64_t len, uint32_t cs) {
     reinit(REQTYPE::BSL_CMD_START_DATA);
 
     push_back(partition);
-    push_back(htole32(len));
-    if (cs) push_back(htole32(cs));
+    push_back(htole32(static_cast<uint32_t>(len)));
+    if (len >> 32) {
+        push_back(htole32(static_cast<uint32_t>(len >> 32)));
+        push_back(uint64_t(0));
+    } else if (cs) {
+        push_back(htole32(cs));
+    }
 
     finishup();
 }
 
-/**
- * 7e -> 7d 5e
- * 7d -> 7d 5d
- */
-void FDLRequest::newMidstData(uint8_t* buf, uint32_t len) {
-    cmd_header* hdr = FRAMEHDR(_data);
-    uint8_t* dataptr = FRAMEDATAHDR(_data);
-
+void FDLRequest::newMidstData(const uint8_t* buf, uint32_t len) {
     reinit(REQTYPE::BSL_CMD_MIDST_DATA);
 
-    std::copy(buf, buf + len, dataptr);
-    _reallen += len;
-
-    hdr->data_length = htobe16(_reallen - sizeof(cmd_header));
+    _payload = buf;
+    _payloadlen = len;
     finishup();
 }
 
 void FDLRequest::newEndData() {
-    reinit(REQTYPE::BSL_CMD_END_DATA);
-    finishup();
+    constframe(REQTYPE::BSL_CMD_END_DATA);
 }
 
 void FDLRequest::newExecData() {
-    reinit(REQTYPE::BSL_CMD_EXEC_DATA);
-    finishup();
+    constframe(REQTYPE::BSL_CMD_EXEC_DATA);
 }
 
 void FDLRequest::newNormalReset() {
-    reinit(REQTYPE::BSL_CMD_NORMAL_RESET);
-    finishup();
+    constframe(REQTYPE::BSL_CMD_NORMAL_RESET);
 }
 
 void FDLRequest::newReadFlash(uint32_t addr, uint32_t size, uint32_t offset) {
@@ -402,45 +335,61 @@ void FDLRequest::newRePartition(const std::vector<partition_info>& table) {
 
 void FDLRequest::newChangeBaud(BAUD baud) {
     reinit(REQTYPE::BSL_CMD_CHANGE_BAUD);
-    push_back(htobe32(static_cast<uint32_t>(baud)));
+    push_back(htobe32(static_cast<uint32_t>(SerialPort::BaudARR[static_cast<int>(baud)])));
     finishup();
 }
 
-void FDLRequest::newStartRead(const std::string& partition, uint32_t len) {
+void FDLRequest::newStartRead(const std::string& partition, uint64_t len) {
     reinit(REQTYPE::BSL_CMD_START_READ);
     push_back(partition);
-    push_back(htole32(len));
+    push_back(htole32(static_cast<uint32_t>(len)));
+    if (len >> 32) {
+        push_back(htole32(static_cast<uint32_t>(len >> 32)));
+        push_back(uint64_t(0));
+    }
 
     finishup();
 }
 
-void FDLRequest::newReadMidst(uint32_t rxsz, uint32_t offset) {
+void FDLRequest::newReadMidst(uint32_t rxsz, uint64_t offset) {
     reinit(REQTYPE::BSL_CMD_READ_MIDST);
     push_back(htole32(rxsz));
-    push_back(htole32(offset));
+    push_back(htole32(static_cast<uint32_t>(offset)));
+    if (offset >> 32) push_back(htole32(static_cast<uint32_t>(offset >> 32)));
     finishup();
 }
 
 void FDLRequest::newEndRead() {
-    reinit(REQTYPE::BSL_CMD_END_READ);
-    finishup();
+    constframe(REQTYPE::BSL_CMD_END_READ);
 }
 
 void FDLRequest::newExecNandInit() {
-    reinit(REQTYPE::BSL_CMD_EXEC_NAND_INIT);
-    finishup();
+    constframe(REQTYPE::BSL_CMD_EXEC_NAND_INIT);
 }
 
 /*************************** RESPONSE ***************************/
 /*************************** RESPONSE ***************************/
 /*************************** RESPONSE ***************************/
-FDLResponse::FDLResponse() : CMDResponse(PROTOCOL::PROTO_FDL), _reallen(0) {
+FDLResponse::FDLResponse()
+    : CMDResponse(PROTOCOL::PROTO_FDL),
+      _reallen(0),
+      _leftlen(0),
+      _need(0),
+      stage(DEFRAME_STAGE::DEFRAME_HUNT),
+      crc_modle(CRC_MODLE::CRC_BOOTCODE),
+      crc_fallback(false),
+      crc_escape_flag(true),
+      data_escape_flag(true) {
     _data = new (std::nothrow) uint8_t[MAX_DATA_LEN]();
+    _left = new (std::nothrow) uint8_t[MAX_DATA_LEN];
 }
 
 FDLResponse ::~FDLResponse() {
     if (_data) delete[] _data;
     _data = nullptr;
+
+    if (_left) delete[] _left;
+    _left = nullptr;
 }
 
 REPTYPE FDLResponse::type() {
@@ -494,38 +443,186 @@ std::string FDLResponse::toString() {
 }
 
 void FDLResponse::reset() {
-    memset(_data, 0, MAX_DATA_LEN);
     _reallen = 0;
+    _need = 0;
+    stage = DEFRAME_STAGE::DEFRAME_HUNT;
+    decoder.reset();
+}
+
+void FDLResponse::discard() {
+    reset();
+    _leftlen = 0;
+}
+
+void FDLResponse::setEscapeFlag(bool data_es_flag, bool crc_es_flag) {
+    this->data_escape_flag = data_es_flag;
+    this->crc_escape_flag = crc_es_flag;
+}
+
+void FDLResponse::setCrcModle(CRC_MODLE mod) { crc_modle = mod; }
+
+void FDLResponse::setCrcFallback(bool on) { crc_fallback = on; }
+
+void FDLResponse::keep(const uint8_t* d, uint32_t len) {
+    if (_leftlen + len > MAX_DATA_LEN) {
+        std::cerr << "drop " << _leftlen << " bytes left behind last response" << std::endl;
+        _leftlen = 0;
+    }
+
+    // nothing sane is this long, keep the newest
+    if (len > MAX_DATA_LEN) {
+        d += len - MAX_DATA_LEN;
+        len = MAX_DATA_LEN;
+    }
+
+    memcpy(_left + _leftlen, d, len);
+    _leftlen += len;
+}
+
+RESP_STATE FDLResponse::push_back(uint8_t* d, uint32_t len) {
+    RESP_STATE state = RESP_STATE::RESP_STATE_INCOMPLETE;
+    uint32_t used = 0;
+
+    // bytes behind last frame come first
+    if (_leftlen) {
+        state = deframe(_left, _leftlen, used);
+        _leftlen -= used;
+        memmove(_left, _left + used, _leftlen);
+
+        if (state != RESP_STATE::RESP_STATE_INCOMPLETE) {
+            if (d && len) keep(d, len);
+            return state;
+        }
+    }
+
+    if (!d || !len) return state;
+
+    state = deframe(d, len, used);
+    if (used < len) keep(d + used, len - used);
+
+    return state;
 }
 
 /**
- * 7d 5e -> 7e
- * 7d 5d -> 7d
+ * a byte driven state machine, chunks may end anywhere in a frame.
+ * used is set to the bytes consumed, which stops right after the trailing
+ * 0x7e or before the byte a malformed frame is detected on.
  */
-void FDLResponse::push_back(uint8_t* d, uint32_t len) {
-    std::copy(d, d + len, _data + _reallen);
-    _reallen += len;
-}
+RESP_STATE FDLResponse::deframe(const uint8_t* d, uint32_t len, uint32_t& used) {
+    const uint8_t* p = d;
+    const uint8_t* end = d + len;
+    uint32_t n, consumed;
+    bool escaped;
+
+    while (p < end) {
+        switch (stage) {
+            case DEFRAME_STAGE::DEFRAME_HUNT:
+                p = EscapeCodec::findFlag(p, end);
+                if (p == end) break;
+
+                _data[0] = *p++;
+                _reallen = 1;
+                _need = sizeof(cmd_header) - 1;
+                stage = DEFRAME_STAGE::DEFRAME_HEADER;
+                decoder.reset();
+                break;
+
+            case DEFRAME_STAGE::DEFRAME_HEADER:
+            case DEFRAME_STAGE::DEFRAME_DATA:
+            case DEFRAME_STAGE::DEFRAME_CRC:
+                escaped = data_escape_flag && (stage != DEFRAME_STAGE::DEFRAME_CRC || crc_escape_flag);
+
+                // flags in a row, the last one opens the frame
+                if (*p == MAGIC_7e && _reallen == 1 && !decoder.isPending()) {
+                    p++;
+                    break;
+                }
+
+                if (escaped && *p == MAGIC_7e && !decoder.isPending()) {
+                    std::cerr << "truncated response with " << _reallen << " bytes" << std::endl;
+                    stage = DEFRAME_STAGE::DEFRAME_HUNT;
+                    used = p - d;
+                    return RESP_STATE::RESP_STATE_MALFORMED;
+                }
+
+                // each output byte takes at least one input byte, never overrun stage
+                n = std::min<uint32_t>(end - p, _need);
+                if (escaped)
+                    n = decoder.decode(p, n, _data + _reallen, consumed);
+                else
+                    memcpy(_data + _reallen, p, consumed = n);
+
+                p += consumed;
+                _reallen += n;
+                _need -= n;
+                if (_need) break;
+
+                if (stage == DEFRAME_STAGE::DEFRAME_HEADER) {
+                    _need = be16toh(FRAMEHDR(_data)->data_length);
+                    if (_need > MAX_DATA_LEN - sizeof(cmd_header) - sizeof(cmd_tail)) {
+                        std::cerr << "response too long, data_length=" << _need << std::endl;
+                        stage = DEFRAME_STAGE::DEFRAME_HUNT;
+                        used = p - d;
+                        return RESP_STATE::RESP_STATE_MALFORMED;
+                    }
+                    stage = DEFRAME_STAGE::DEFRAME_DATA;
+                }
+
+                if (stage == DEFRAME_STAGE::DEFRAME_DATA && !_need) {
+                    _need = sizeof(uint16_t);
+                    stage = DEFRAME_STAGE::DEFRAME_CRC;
+                } else if (stage == DEFRAME_STAGE::DEFRAME_CRC && !_need) {
+                    stage = DEFRAME_STAGE::DEFRAME_TAIL;
+                }
+                break;
+
+            case DEFRAME_STAGE::DEFRAME_TAIL:
+                stage = DEFRAME_STAGE::DEFRAME_HUNT;
+                if (*p != MAGIC_7e) {
+                    std::cerr << "response not end with 0x7e but 0x" << std::hex << int(*p) << std::dec << std::endl;
+                    used = p - d;
+                    return RESP_STATE::RESP_STATE_MALFORMED;
+                }
+
+                _data[_reallen++] = *p++;
+                used = p - d;
+                return verify();
+        }
+    }
 
-uint8_t* FDLResponse::data() { return _data + sizeof(cmd_header); }
+    used = len;
+    return RESP_STATE::RESP_STATE_INCOMPLETE;
+}
 
 /**
- * NOTICE: in BOOTCODE mode, crc is also escaped
- * but in FDL, crc is not escaped, we can ignore it
+ * checked with the modle of the request. bootcode and fdl1 are known to
+ * answer with the other crc at times, only there it is tried as well,
+ * with a line in the log, each modle alone misses half as many errors.
  */
-uint32_t FDLResponse::dataLen() { return _reallen - sizeof(cmd_header) - sizeof(cmd_tail); }
+RESP_STATE FDLResponse::verify() {
+    uint32_t len = _reallen - 1 - sizeof(cmd_tail);
+    uint16_t crc16 = be16toh(FRAMETAIL(_data, len + 1)->crc16);
 
-uint8_t* FDLResponse::rawData() { return _data; }
+    auto calc = [&](CRC_MODLE mod) {
+        return mod == CRC_MODLE::CRC_BOOTCODE ? CRC16::bootcode(_data + 1, len) : CRC16::fdl(_data + 1, len);
+    };
 
-uint32_t FDLResponse::rawDataLen() { return _reallen; }
+    if (calc(crc_modle) == crc16) return RESP_STATE::RESP_STATE_OK;
 
-uint32_t FDLResponse::expectLength() {
-    auto hdr = FRAMEHDR(_data);
+    if (crc_fallback &&
+        calc(crc_modle == CRC_MODLE::CRC_BOOTCODE ? CRC_MODLE::CRC_FDL : CRC_MODLE::CRC_BOOTCODE) == crc16) {
+        std::cerr << toString() << " has the crc of the other modle, taken" << std::endl;
+        return RESP_STATE::RESP_STATE_OK;
+    }
 
-    if (_reallen >= sizeof(cmd_header))
-        return be16toh(hdr->data_length) + sizeof(cmd_header) + sizeof(cmd_tail);
-    else
-        return 0;
+    std::cerr << "crc mismatch in " << toString() << ", crc=0x" << std::hex << crc16 << std::dec << std::endl;
+    return RESP_STATE::RESP_STATE_VARIFY_FAIL;
 }
 
-uint32_t FDLResponse::minLength() { return sizeof(cmd_header); }
\ No newline at end of file
+uint8_t* FDLResponse::data() { return _data + sizeof(cmd_header); }
+
+uint32_t FDLResponse::dataLen() { return _reallen - sizeof(cmd_header) - sizeof(cmd_tail); }
+
+uint8_t* FDLResponse::rawData() { return _data; }
+
+uint32_t FDLResponse::rawDataLen() { return _reallen; }
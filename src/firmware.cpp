@@ -10,21 +10,96 @@
 #include <fstream>
 #include <functional>
 #include <algorithm>
+#include <limits>
 
+#include <cstddef>
 #include <cstring>
 
 extern "C" {
+#include <errno.h>
+#include <strings.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
 }
 
-#include "tinyxml2/tinyxml2.h"
-
+#include "crc.hpp"
 #include "scopeguard.hpp"
 #include "firmware.hpp"
 
+bool FileMap::map(const std::string& path) {
+    static const uint8_t empty = 0;
+    void* p;
+    int fd;
+
+    unmap();
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st)) {
+        std::cerr << "fail to open " << path << ", error=" << strerror(errno) << std::endl;
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+
+    // a 32-bit process cannot map a pac of 4 GB or more
+    if (static_cast<uint64_t>(st.st_size) > std::numeric_limits<size_t>::max()) {
+        std::cerr << path << " is too large to map, " << st.st_size << " bytes" << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    // nothing to map, but an empty file is still a file
+    if (st.st_size == 0) {
+        ::close(fd);
+        base = &empty;
+        return true;
+    }
+
+    p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        std::cerr << "fail to mmap " << path << ", error=" << strerror(errno) << std::endl;
+        return false;
+    }
+
+    base = static_cast<const uint8_t*>(p);
+    len = st.st_size;
+    return true;
+}
+
+void FileMap::unmap() {
+    if (base && len) munmap(const_cast<uint8_t*>(base), len);
+    base = nullptr;
+    len = 0;
+}
+
+byte_span FileMap::span(uint64_t off, uint64_t sz) const {
+    long pagesz = sysconf(_SC_PAGESIZE);
+    uintptr_t start;
+    uint64_t ahead = sz < MAP_WINDOW ? sz : MAP_WINDOW;
+
+    if (!base || off > len || sz > len - off) return byte_span();
+    if (!sz) return byte_span(base + off, 0);
+
+    // pages are shared with other sessions, hints only, nothing is dropped.
+    // a member of some GB is not read in whole ahead, readahead follows the sender
+    start = reinterpret_cast<uintptr_t>(base + off) & ~(pagesz - 1);
+    madvise(reinterpret_cast<void*>(start), reinterpret_cast<uintptr_t>(base + off + sz) - start, MADV_SEQUENTIAL);
+    madvise(reinterpret_cast<void*>(start), reinterpret_cast<uintptr_t>(base + off + ahead) - start, MADV_WILLNEED);
+
+    return byte_span(base + off, sz);
+}
+
+void FileMap::drop(const uint8_t* from, const uint8_t* to) {
+    uintptr_t pagesz = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (reinterpret_cast<uintptr_t>(from) + pagesz - 1) & ~(pagesz - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(to) & ~(pagesz - 1);
+
+    // a member of some GB would otherwise stay mapped in whole until the pac is unmapped
+    if (start < end) madvise(reinterpret_cast<void*>(start), end - start, MADV_DONTNEED);
+}
+
 Firmware::Firmware(const std::string pacf) : pac_file(pacf), pachdr(nullptr), binhdr(nullptr) {
     pachdr = new (std::nothrow) pac_header_t;
 }
@@ -52,87 +127,105 @@ std::string Firmware::wcharToChar(uint16_t* pBuf, int nSize) {
 }
 
 int Firmware::pacparser() {
-    std::ifstream fin(pac_file, std::ios::binary);
+    if (!pachdr || !pacmap.map(pac_file)) return -1;
 
-    if (!fin.is_open()) {
-        std::cerr << "fail to open " << pac_file << std::endl;
+    std::cerr << pac_file << " has size in bytes " << pacmap.size() << std::endl;
+    if (pacmap.size() < sizeof(*pachdr)) {
+        std::cerr << pac_file << " is too small for a pac" << std::endl;
         return -1;
     }
 
-    ON_SCOPE_EXIT {
-        if (fin.is_open()) fin.close();
-    };
-
-    fin.seekg(0, std::ios::end);
-    std::cerr << pac_file << " has size in bytes " << fin.tellg() << std::endl;
-    fin.seekg(0, std::ios::beg);
+    memcpy(pachdr, pacmap.data(), sizeof(*pachdr));
+    if (pacmap.size() < sizeof(*pachdr) + static_cast<uint64_t>(pachdr->nFileCount) * sizeof(bin_header_t)) {
+        std::cerr << pac_file << " is cut short, " << pachdr->nFileCount << " files do not fit" << std::endl;
+        return -1;
+    }
 
-    fin.read(reinterpret_cast<char*>(pachdr), sizeof(*pachdr));
+    product_name = WCHARSTR(pachdr->szPrdName);
+    product_version = WCHARSTR(pachdr->szPrdVersion);
     std::cerr << std::dec << "FileCount: " << pachdr->nFileCount << std::endl;
-    std::cerr << "ProductName: " << WCHARSTR(pachdr->szPrdName) << std::endl;
-    std::cerr << "ProductVersion: " << WCHARSTR(pachdr->szPrdVersion) << std::endl;
+    if ((pachdr->dwHiSize || pachdr->dwLoSize) &&
+        ((uint64_t(pachdr->dwHiSize) << 32) | pachdr->dwLoSize) != pacmap.size())
+        std::cerr << "warnning, pac header says " << ((uint64_t(pachdr->dwHiSize) << 32) | pachdr->dwLoSize)
+                  << " bytes" << std::endl;
+    std::cerr << "ProductName: " << product_name << std::endl;
+    std::cerr << "ProductVersion: " << product_version << std::endl;
     std::cerr << "ProductAlias: " << WCHARSTR(pachdr->szPrdAlias) << std::endl;
     std::cerr << "Version: " << WCHARSTR(pachdr->szVersion) << std::endl;
 
+    if (binhdr) delete[] binhdr;
     binhdr = new (std::nothrow) bin_header_t[pachdr->nFileCount];
-    for (uint32_t i = 0; i < pachdr->nFileCount; i++) {
-        fin.read(reinterpret_cast<char*>(&binhdr[i]), sizeof(bin_header_t));
-        uint64_t filesz = binhdr[i].dwLoFileSize;
-        std::cerr << "idx: " << i << ", FileID: " << WCHARSTR(binhdr[i].szFileID)
-                  << ", FileName: " << WCHARSTR(binhdr[i].szFileName) << std::dec << ", Size: " << filesz << std::endl;
+    if (!binhdr) return -1;
+
+    memcpy(binhdr, pacmap.data() + sizeof(*pachdr), sizeof(bin_header_t) * pachdr->nFileCount);
+    build_index();
+    for (uint32_t i = 0; i < members.size(); i++) {
+        std::cerr << "idx: " << i << ", FileID: " << members[i].fileid << ", FileName: " << members[i].filename
+                  << std::dec << ", Size: " << members[i].size << std::endl;
+        if (members[i].offset > pacmap.size() || members[i].size > pacmap.size() - members[i].offset)
+            std::cerr << "warnning, " << members[i].fileid << " lies beyond the end of " << pac_file << std::endl;
     }
 
     return 0;
 }
 
-uint32_t Firmware::pac_file_count() { return pachdr->nFileCount; }
+static std::string upper(const std::string& s) {
+    std::string u(s);
 
-const std::string Firmware::productName() { return WCHARSTR(pachdr->szPrdName); }
+    std::transform(u.begin(), u.end(), u.begin(), [](unsigned char c) { return toupper(c); });
+    return u;
+}
 
-const std::string Firmware::productVersion() { return WCHARSTR(pachdr->szPrdVersion); }
+void Firmware::build_index() {
+    // where data starts if the packer left the offsets out
+    uint64_t packed = sizeof(pac_header_t) + sizeof(bin_header_t) * uint64_t(pachdr->nFileCount);
+
+    members.clear();
+    id_index.clear();
+    members.reserve(pachdr->nFileCount);
+    for (uint32_t i = 0; i < pachdr->nFileCount; i++) {
+        member_info m;
+        uint64_t off = (uint64_t(binhdr[i].dwHiDataOffset) << 32) | binhdr[i].dwLoDataOffset;
+
+        m.fileid = WCHARSTR(binhdr[i].szFileID);
+        m.filename = WCHARSTR(binhdr[i].szFileName);
+        m.size = (uint64_t(binhdr[i].dwHiFileSize) << 32) | binhdr[i].dwLoFileSize;
+        // no data lives at 0, the pac header does
+        m.offset = off ? off : packed;
+        packed += m.size;
+
+        if (!m.fileid.empty()) id_index.emplace(upper(m.fileid), i);
+        members.push_back(m);
+    }
+}
+
+uint32_t Firmware::pac_file_count() { return pachdr->nFileCount; }
 
 int Firmware::unpack(int idx, const std::string& extdir) {
     std::ofstream fout;
-    char buff[4 * 1024];
-    uint64_t filesz;
     std::string fpath;
-    std::ifstream fin(pac_file, std::ios::binary);
+    byte_span src = member(idx);
 
-    if (!fin.is_open()) {
-        std::cerr << "fail to open " << pac_file << std::endl;
-        return -1;
-    }
+    if (!src.data) return -1;
 
     ON_SCOPE_EXIT {
-        if (fin.is_open()) fin.close();
-
         if (fout.is_open()) fout.close();
     };
 
-    filesz = member_file_size(idx);
-    fpath = extdir + "/" + WCHARSTR(binhdr[idx].szFileName);
-    if (filesz == 0) return 0;
+    fpath = extdir + "/" + members[idx].filename;
+    if (src.size == 0) return 0;
 
-    std::cerr << "Unpack idx: " << idx << ", FileID: " << WCHARSTR(binhdr[idx].szFileID) << ", FileName: " << fpath
-              << std::endl;
+    std::cerr << "Unpack idx: " << idx << ", FileID: " << members[idx].fileid << ", FileName: " << fpath << std::endl;
     fout.open(fpath, std::ios::binary | std::ios::trunc);
     if (!fout.is_open()) {
         std::cerr << "fail to open " << fpath << " for write" << std::endl;
         return -1;
     }
 
-    fin.seekg(member_file_offset(idx), std::ios::beg);
-    while (filesz > 0) {
-        size_t sz = filesz > sizeof(buff) ? sizeof(buff) : filesz;
-
-        fin.read(buff, sz);
-        fout.write(buff, sz);
-        filesz -= sz;
-    };
-    fin.close();
+    fout.write(reinterpret_cast<const char*>(src.data), src.size);
     fout.close();
 
-    return 0;
+    return fout.fail() ? -1 : 0;
 }
 
 int Firmware::unpack(const std::string& idstr, const std::string& extdir) {
@@ -153,126 +246,105 @@ int Firmware::unpack_all(const std::string& extdir) {
     return 0;
 }
 
-tinyxml2::XMLNode* Firmware::xmltree_find_node(tinyxml2::XMLNode* root, const std::string& nm) {
-    if (!root || root->NoChildren()) return nullptr;
-
-    if (std::string(root->Value()) == nm) return root;
-
-    for (auto n = root->FirstChild(); n; n = n->NextSibling()) {
-        auto r = xmltree_find_node(n, nm);
-        if (r) return r;
+/**
+ * first element of a name in preorder that has children, as a dom walk would
+ * find it. whether it has any is only known at the token after its start, the
+ * candidate waits for that one, its first child
+ */
+struct xml_find {
+    std::string name;
+    uint32_t level;  // of the candidate, then of the match
+    bool pending;
+    bool found;
+    std::string value;  // of the first child, text, comment or element name
+    std::string attr;   // first attribute of the match, empty if none
+
+    xml_find(const char* nm) : name(nm), level(0), pending(false), found(false) {}
+
+    void reset() {
+        pending = false;
+        found = false;
+        value.clear();
+        attr.clear();
     }
 
-    return nullptr;
-};
+    // true if t is the first child of the match
+    bool feed(const XMLScanner& xs, XMLTOKEN t) {
+        if (found) return false;
 
-#define CONSTCHARTOINT(p) (p ? atoi(p) : 0)
-#define CONSTCHARTOXINT(p) (p ? strtoul(p, NULL, 16) : 0)
-int Firmware::xmlparser_file(tinyxml2::XMLNode* node) {
-    auto filenode = node->FirstChild();
-    if (std::string(filenode->Value()) != "File") {
-        std::cerr << __func__ << " error" << std::endl;
-        return -1;
-    }
+        if (pending) {
+            pending = false;
+            if (t != XMLTOKEN::XML_END || xs.level() != level) {
+                found = true;
+                value = (t == XMLTOKEN::XML_START) ? xs.name() : xs.text();
+                return true;
+            }
+        }
 
-    std::cerr << __func__ << " try to farser file info" << std::endl;
-    for (; filenode; filenode = filenode->NextSibling()) {
-        int idx = 0;
-        XMLFileInfo info;
-        tinyxml2::XMLNode* n = nullptr;
-        const char* backup = "0";
+        if (t == XMLTOKEN::XML_START && xs.name() == name) {
+            pending = true;
+            level = xs.level();
+            attr = xs.attrCount() ? xs.attrValue(0) : "";
+        }
+        return false;
+    }
+};
 
-        if (filenode->ToElement() && filenode->ToElement()->FirstAttribute())
-            backup = filenode->ToElement()->FirstAttribute()->Value();
-        info.isBackup = bool(CONSTCHARTOINT(backup));
+enum { XML_ID, XML_BLOCK, XML_TYPE, XML_BASE, XML_SIZE, XML_FLAG, XML_CHECKFLAG };  // fields of a file, in order
 
-        n = xmltree_find_node(filenode, "ID");
-        if (n) info.fileid = n->FirstChild()->Value();
+#define CONSTCHARTOINT(p) (p ? atoi(p) : 0)
+#define CONSTCHARTOXINT(p) (p ? strtoull(p, NULL, 16) : 0)
+int Firmware::xmlparser_file(xml_find* fields, const std::string& backup, std::vector<XMLFileInfo>& fvec) {
+    XMLFileInfo info;
+    int idx;
 
-        if (info.fileid.empty()) continue;
+    info.isBackup = bool(CONSTCHARTOINT(backup.c_str()));
 
-        idx = fileid_to_index(info.fileid);
-        if (idx < 0) continue;
+    if (fields[XML_ID].found) info.fileid = fields[XML_ID].value;
+    if (info.fileid.empty()) return -1;
 
-        n = xmltree_find_node(filenode, "Block");
-        if (n && n->ToElement() && n->ToElement()->FirstAttribute())
-            info.blockid = n->ToElement()->FirstAttribute()->Value();
+    idx = fileid_to_index(info.fileid);
+    if (idx < 0) return -1;
 
-        n = xmltree_find_node(filenode, "Type");
-        if (n) info.type = n->FirstChild()->Value();
+    if (fields[XML_BLOCK].found) info.blockid = fields[XML_BLOCK].attr;
+    if (fields[XML_TYPE].found) info.type = fields[XML_TYPE].value;
+    if (fields[XML_BASE].found) info.base = CONSTCHARTOXINT(fields[XML_BASE].value.c_str());
+    if (fields[XML_SIZE].found) info.size = CONSTCHARTOXINT(fields[XML_SIZE].value.c_str());
+    if (fields[XML_FLAG].found) info.flag = CONSTCHARTOINT(fields[XML_FLAG].value.c_str());
+    if (fields[XML_CHECKFLAG].found) info.checkflag = CONSTCHARTOINT(fields[XML_CHECKFLAG].value.c_str());
 
-        n = xmltree_find_node(filenode, "Base");
-        if (n) info.base = CONSTCHARTOXINT(n->FirstChild()->Value());
+    info.realsize = member_file_size(idx);
+    if (!strcasecmp(info.type.c_str(), "NV") || !strcasecmp(info.type.c_str(), "NV_COMM")) nv_checksum(info, idx);
+    fvec.push_back(info);
 
-        n = xmltree_find_node(filenode, "Size");
-        if (n) info.size = CONSTCHARTOXINT(n->FirstChild()->Value());
+    return idx;
+}
 
-        n = xmltree_find_node(filenode, "Flag");
-        if (n) info.flag = CONSTCHARTOINT(n->FirstChild()->Value());
+void Firmware::xmlparser_partition(const XMLScanner& xs, std::vector<partition_info>& pvec) {
+    partition_info info;
 
-        n = xmltree_find_node(filenode, "CheckFlag");
-        if (n) info.checkflag = CONSTCHARTOINT(n->FirstChild()->Value());
+    for (uint32_t i = 0; i < xs.attrCount(); i++) {
+        const std::string& a = xs.attrValue(i);
 
-        info.realsize = member_file_size(idx);
-        xmlfilevec.push_back(info);
-        std::cerr << "idx: " << idx << ", FILEID: "
-                  << info.fileid
-                  //   << ", IDAlias: " << info.fileid_alias
-                  << ", Type: " << info.type << ", BlockID: " << info.blockid << ", Base: 0x" << std::hex << info.base
-                  << ", Size: 0x" << std::hex << info.size << ", RealSize: 0x" << std::hex
-                  << info.realsize
-                  //   << ", Flag: " << info.flag
-                  //   << ", CheckFlag: " << info.checkflag
-                  << ", isBackup: " << info.isBackup << std::dec << std::endl;
-    }
-    std::cerr << __func__ << " parser file info end" << std::endl;
-
-    return 0;
-}
-
-int Firmware::xmlparser_partition(tinyxml2::XMLNode* partitions) {
-    for (auto partition = partitions->FirstChild(); partition; partition = partition->NextSibling()) {
-        if (partition->ToElement() && partition->ToElement()->FirstAttribute()) {
-            partition_info info;
-
-            for (auto a = partition->ToElement()->FirstAttribute(); a; a = a->Next()) {
-                if (!a->Name()) continue;
-
-                if (std::string(a->Name()) == "id")
-                    info.partition = a->Value();
-                else if (std::string(a->Name()) == "size" && a->Value()) {
-                    if (std::string(a->Value()).substr(0, 2) == "0x" || std::string(a->Value()).substr(0, 2) == "0X")
-                        info.size = CONSTCHARTOXINT(a->Value());
-                    else
-                        info.size = CONSTCHARTOINT(a->Value());
-                }
-
-                if (!info.partition.empty() && info.size) {
-                    xmlpartitonvec.push_back(info);
-                    std::cerr << "BlockID: " << info.partition << ", Size: " << info.size << std::dec << std::endl;
-                }
-            }
+        if (xs.attrName(i) == "id")
+            info.partition = a;
+        else if (xs.attrName(i) == "size") {
+            if (a.substr(0, 2) == "0x" || a.substr(0, 2) == "0X")
+                info.size = CONSTCHARTOXINT(a.c_str());
+            else
+                info.size = CONSTCHARTOINT(a.c_str());
         }
-    }
 
-    std::cerr << __func__ << " parser partition info end" << std::endl;
-    return 0;
+        if (!info.partition.empty() && info.size) pvec.push_back(info);
+    }
 }
 
 int Firmware::xmlparser() {
-    char* xmlbuf = nullptr;
-    tinyxml2::XMLDocument doc;
-    tinyxml2::XMLError xmlerr;
+    byte_span xml;
     int xmlidx = -1;
 
-    ON_SCOPE_EXIT {
-        doc.Clear();
-        if (xmlbuf) delete[] xmlbuf;
-        xmlbuf = nullptr;
-    };
-
-    for (uint32_t i = 0; i < pachdr->nFileCount; i++) {
-        if (WCHARSTR(binhdr[i].szFileName).find(".xml") != std::string::npos) {
+    for (uint32_t i = 0; i < members.size(); i++) {
+        if (members[i].filename.find(".xml") != std::string::npos) {
             xmlidx = i;
             break;
         }
@@ -281,130 +353,416 @@ int Firmware::xmlparser() {
     if (!is_index_valid(xmlidx)) {
         std::cerr << __func__ << " invalid index error" << std::endl;
         return -1;
+    }
+
+    xml = member(xmlidx);
+    if (!xml.data) return -1;
+    std::cerr << "load xml data from pac file, size:" << std::dec << xml.size << " offset:" << (xml.data - pacmap.data())
+              << std::endl;
+
+    // one pass over the mapping, no document. scheme and partitions are looked
+    // for under the first top element, files are direct children of scheme
+    XMLScanner xs(reinterpret_cast<const char*>(xml.data), xml.size);
+    XMLTOKEN t;
+    xml_find scheme("Scheme");
+    xml_find partitions("Partitions");
+    xml_find fields[] = {"ID", "Block", "Type", "Base", "Size", "Flag", "CheckFlag"};
+    // kept aside until the whole xml is read, nothing is taken from a broken one
+    std::vector<XMLFileInfo> fvec;
+    std::vector<int> fidx;
+    std::vector<partition_info> pvec;
+    std::string backup;
+    bool inroot = false, rootdone = false;
+    bool schemedone = false, partsdone = false;
+    bool infile = false, badscheme = false;
+
+    while ((t = xs.next()) != XMLTOKEN::XML_EOF && t != XMLTOKEN::XML_ERROR) {
+        if (rootdone) continue;
+        if (!inroot) {
+            if (t != XMLTOKEN::XML_START) continue;
+            inroot = true;
+        }
+
+        if (scheme.feed(xs, t) && scheme.value != "File") badscheme = true;
+        partitions.feed(xs, t);
+
+        if (scheme.found && !schemedone && !badscheme) {
+            if (t == XMLTOKEN::XML_START && xs.level() == scheme.level + 1) {
+                infile = true;
+                backup = xs.attrCount() ? xs.attrValue(0) : "0";
+                for (auto& f : fields) f.reset();
+            }
+
+            if (infile)
+                for (auto& f : fields) f.feed(xs, t);
+
+            if (t == XMLTOKEN::XML_END && xs.level() == scheme.level + 1) {
+                int idx = xmlparser_file(fields, backup, fvec);
+
+                infile = false;
+                if (idx >= 0) fidx.push_back(idx);
+            } else if (t == XMLTOKEN::XML_END && xs.level() == scheme.level)
+                schemedone = true;
+        }
+
+        if (partitions.found && !partsdone) {
+            if (t == XMLTOKEN::XML_START && xs.level() == partitions.level + 1)
+                xmlparser_partition(xs, pvec);
+            else if (t == XMLTOKEN::XML_END && xs.level() == partitions.level)
+                partsdone = true;
+        }
+
+        if (t == XMLTOKEN::XML_END && xs.level() == 1) rootdone = true;
+    }
+
+    if (t == XMLTOKEN::XML_ERROR) {
+        std::cerr << std::string(reinterpret_cast<const char*>(xml.data), xml.size) << std::endl;
+        std::cerr << "cannot parser xml for Parse failed, err=" << xs.error() << std::endl;
+        return -1;
+    }
+
+    if (!scheme.found) return -1;
+    if (badscheme) {
+        std::cerr << "xmlparser_file error" << std::endl;
+        return -1;
+    }
+
+    std::cerr << "xmlparser_file try to farser file info" << std::endl;
+    for (size_t i = 0; i < fvec.size(); i++) {
+        const XMLFileInfo& info = fvec[i];
+
+        std::cerr << "idx: " << fidx[i] << ", FILEID: "
+                  << info.fileid
+                  //   << ", IDAlias: " << info.fileid_alias
+                  << ", Type: " << info.type << ", BlockID: " << info.blockid << ", Base: 0x" << std::hex << info.base
+                  << ", Size: 0x" << std::hex << info.size << ", RealSize: 0x" << std::hex
+                  << info.realsize
+                  //   << ", Flag: " << info.flag
+                  //   << ", CheckFlag: " << info.checkflag
+                  << ", isBackup: " << info.isBackup << std::dec << std::endl;
+    }
+    std::cerr << "xmlparser_file parser file info end" << std::endl;
+    xmlfilevec.insert(xmlfilevec.end(), fvec.begin(), fvec.end());
+
+    if (!partitions.found) {
+        std::cerr << __func__ << " warnning, xml contains no partition info" << std::endl;
     } else {
-        size_t filesz = 0;
-        size_t fileoffset = 0;
-        std::ifstream fin(pac_file);
-
-        filesz = member_file_size(xmlidx);
-        fileoffset = member_file_offset(xmlidx);
-        xmlbuf = new (std::nothrow) char[filesz + 1]();
-        memset(xmlbuf, 0, filesz + 1);
-
-        fin.seekg(fileoffset, std::ios::beg);
-        fin.read(xmlbuf, filesz);
-        fin.close();
-        std::cerr << "load xml data from pac file, size:" << std::dec << filesz << " offset:" << fileoffset
-                  << std::endl;
-    }
-
-    xmlerr = doc.Parse(xmlbuf);
-    if (xmlerr == tinyxml2::XML_SUCCESS) {
-        tinyxml2::XMLNode* scheme = xmltree_find_node(doc.RootElement(), "Scheme");
-        tinyxml2::XMLNode* partitions = xmltree_find_node(doc.RootElement(), "Partitions");
-        if (!scheme || xmlparser_file(scheme)) return -1;
-
-        if (!partitions)
-            std::cerr << __func__ << " warnning, xml contains no partition info" << std::endl;
-        else
-            xmlparser_partition(partitions);
-
-        std::cerr << __func__ << " parser xml finish" << std::endl;
-        return 0;
+        for (auto& info : pvec) std::cerr << "BlockID: " << info.partition << ", Size: " << info.size << std::endl;
+        std::cerr << "xmlparser_partition parser partition info end" << std::endl;
+        xmlpartitonvec.insert(xmlpartitonvec.end(), pvec.begin(), pvec.end());
     }
 
-    std::cerr << xmlbuf << std::endl;
-    std::cerr << "cannot parser xml for Parse failed, err=" << xmlerr << std::endl;
-    return -1;
+    std::cerr << __func__ << " parser xml finish" << std::endl;
+    return 0;
 }
 
 const std::vector<XMLFileInfo>& Firmware::get_file_vec() const { return xmlfilevec; }
 
 const std::vector<partition_info>& Firmware::get_partition_vec() const { return xmlpartitonvec; }
 
-bool Firmware::is_index_valid(int idx) { return (idx >= 0 && idx < int(pachdr->nFileCount)); }
+bool Firmware::is_index_valid(int idx) { return (idx >= 0 && idx < int(members.size())); }
 
 int Firmware::fileid_to_index(const std::string& idstr) {
-    std::string idstr_upper(idstr);
-    std::transform(idstr.begin(), idstr.end(), idstr_upper.begin(), toupper);
-    for (uint32_t idx = 0; idx < pachdr->nFileCount; idx++) {
-        std::string fileid_upper(WCHARSTR(binhdr[idx].szFileID));
-        std::transform(fileid_upper.begin(), fileid_upper.end(), fileid_upper.begin(), toupper);
-        if (!idstr.empty() && idstr_upper == fileid_upper) return idx;
-    }
+    auto it = id_index.find(upper(idstr));
+
+    if (it != id_index.end()) return it->second;
 
     std::cerr << __func__ << " invalid file id: " << idstr << std::endl;
     return -1;
 }
 
-size_t Firmware::member_file_size(int idx) {
+uint64_t Firmware::member_file_size(int idx) {
     if (!is_index_valid(idx)) {
         std::cerr << __func__ << " invalid index error" << std::endl;
         return 0;
     }
 
-    return binhdr[idx].dwLoFileSize;
+    return members[idx].size;
 }
 
-size_t Firmware::member_file_size(const std::string& idstr) { return member_file_size(fileid_to_index(idstr)); }
+uint64_t Firmware::member_file_size(const std::string& idstr) { return member_file_size(fileid_to_index(idstr)); }
 
-size_t Firmware::member_file_offset(int idx) {
-    size_t offset = sizeof(pac_header_t) + sizeof(bin_header_t) * pachdr->nFileCount;
+uint64_t Firmware::member_file_offset(int idx) {
     if (!is_index_valid(idx)) {
         std::cerr << __func__ << " invalid index error" << std::endl;
         return 0;
     }
 
-    for (uint32_t i = 0; i < pachdr->nFileCount; i++) {
-        if (i == uint32_t(idx)) break;
-        offset += binhdr[i].dwLoFileSize;
-    }
-
-    return offset;
+    return members[idx].offset;
 }
 
-size_t Firmware::member_file_offset(const std::string& idstr) { return member_file_offset(fileid_to_index(idstr)); }
+uint64_t Firmware::member_file_offset(const std::string& idstr) { return member_file_offset(fileid_to_index(idstr)); }
 
-std::ifstream Firmware::open_pac(const std::string& idstr) {
-    std::ifstream fin(pac_file, std::ios::binary);
-    int idx = fileid_to_index(idstr);
+byte_span Firmware::member(int idx) {
     if (!is_index_valid(idx)) {
-        fin.close();
         std::cerr << __func__ << " invalid index error" << std::endl;
+        return byte_span();
     }
 
-    fin.seekg(member_file_offset(idx), std::ios::beg);
-    return fin;
+    return pacmap.span(member_file_offset(idx), member_file_size(idx));
 }
 
-std::ifstream Firmware::open_file(const std::string& fpath) {
-    std::ifstream fin(pac_file, std::ios::binary);
+byte_span Firmware::member(const std::string& idstr) { return member(fileid_to_index(idstr)); }
+
+void Firmware::nv_checksum(XMLFileInfo& info, int idx) {
+    byte_span nv = member(idx);
+    uint16_t crc = 0;
+    uint32_t cs = 0;
+    uint64_t skip = 2;
+
+    // the first 2 bytes are where the crc goes
+    if (nv.data && nv.size > skip) {
+        crc = CRC16::nv(crc, nv.data + skip, nv.size - skip);
+        for (uint64_t i = skip; i < nv.size; i++) cs += nv.data[i];
+    }
+
+    cs += (crc & 0xff);
+    cs += (crc & 0xff00) >> 8;
+    info.checksum = cs;
+    info.crc16 = crc;
+}
+
+/**
+ * a manifest is manifest_head and the body: product name and version, then
+ * members, files and partitions, each a count and its records. strings are
+ * a 32-bit length and the bytes. it is native endian, the magic tells a
+ * foreign one apart, and any change of layout takes a new version.
+ */
+#define MANIFEST_MAGIC 0x464d4c44  // "DLMF"
+#define MANIFEST_VERSION 1
+
+struct manifest_head {
+    uint32_t magic;
+    uint32_t version;
+    // the pac it is made from
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t hdrcrc;  // crc16 of pac_header_t and all bin_header_t
+    uint32_t bodylen;
+    uint32_t bodycrc;  // crc16 of the body
+    uint32_t reserved;
+};
+
+// what the manifest of pac should start with, false if it is no pac
+static bool manifest_head_of(const FileMap& pac, manifest_head& head) {
+    uint32_t count;
+    uint64_t hdrlen;
 
-    return fin;
+    memset(&head, 0, sizeof(head));
+    if (pac.size() < sizeof(pac_header_t)) return false;
+
+    memcpy(&count, pac.data() + offsetof(pac_header_t, nFileCount), sizeof(count));
+    hdrlen = sizeof(pac_header_t) + uint64_t(count) * sizeof(bin_header_t);
+    if (pac.size() < hdrlen || (hdrlen >> 32)) return false;
+
+    head.magic = MANIFEST_MAGIC;
+    head.version = MANIFEST_VERSION;
+    head.dev = pac.status().st_dev;
+    head.ino = pac.status().st_ino;
+    head.size = pac.size();
+    head.mtime_sec = pac.status().st_mtim.tv_sec;
+    head.mtime_nsec = pac.status().st_mtim.tv_nsec;
+    head.hdrcrc = CRC16::nv(0, pac.data(), hdrlen);
+
+    return true;
 }
 
-void Firmware::close(std::ifstream& fin) {
-    if (fin.is_open()) fin.close();
+template <typename T>
+static void put(std::string& out, const T& v) {
+    out.append(reinterpret_cast<const char*>(&v), sizeof(T));
 }
 
-bool Firmware::read(std::ifstream& fin, uint8_t* buf, uint32_t sz) {
-    if (!fin.is_open()) {
-        std::cerr << __func__ << " pac file is not open" << std::endl;
-        return false;
+static void put(std::string& out, const std::string& s) {
+    put(out, uint32_t(s.size()));
+    out.append(s);
+}
+
+// ok turns false at the first read past the end, everything after reads 0
+struct manifest_reader {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool ok;
+
+    template <typename T>
+    T get() {
+        T v = T();
+
+        if (!ok || static_cast<size_t>(end - p) < sizeof(T)) {
+            ok = false;
+            return v;
+        }
+        memcpy(&v, p, sizeof(T));
+        p += sizeof(T);
+        return v;
     }
 
-    fin.read(reinterpret_cast<char*>(buf), sz);
+    std::string str() {
+        uint32_t n = get<uint32_t>();
 
-    return true;
+        if (!ok || static_cast<size_t>(end - p) < n) {
+            ok = false;
+            return "";
+        }
+        p += n;
+        return std::string(reinterpret_cast<const char*>(p - n), n);
+    }
+};
+
+int Firmware::manifest_load(const std::string& path) {
+    FileMap cache;
+    manifest_head want;
+    manifest_head head;
+    manifest_reader rd;
+    std::string name, version;
+    std::vector<member_info> mvec;
+    std::vector<XMLFileInfo> fvec;
+    std::vector<partition_info> pvec;
+    uint32_t n;
+
+    // none yet, it is saved after this parse
+    if (!pachdr || access(path.c_str(), F_OK) || !cache.map(path)) return -1;
+    if (!pacmap.map(pac_file) || !manifest_head_of(pacmap, want)) return -1;
+
+    if (cache.size() < sizeof(head)) goto _stale;
+    memcpy(&head, cache.data(), sizeof(head));
+    if (memcmp(&head, &want, offsetof(manifest_head, bodylen)) || head.bodylen != cache.size() - sizeof(head) ||
+        CRC16::nv(0, cache.data() + sizeof(head), head.bodylen) != head.bodycrc)
+        goto _stale;
+
+    rd.p = cache.data() + sizeof(head);
+    rd.end = rd.p + head.bodylen;
+    rd.ok = true;
+
+    name = rd.str();
+    version = rd.str();
+
+    n = rd.get<uint32_t>();
+    for (uint32_t i = 0; rd.ok && i < n; i++) {
+        member_info m;
+
+        m.fileid = rd.str();
+        m.filename = rd.str();
+        m.offset = rd.get<uint64_t>();
+        m.size = rd.get<uint64_t>();
+        mvec.push_back(m);
+    }
+
+    n = rd.get<uint32_t>();
+    for (uint32_t i = 0; rd.ok && i < n; i++) {
+        XMLFileInfo f;
+
+        f.fileid = rd.str();
+        f.blockid = rd.str();
+        f.type = rd.str();
+        f.fpath = rd.str();
+        f.base = rd.get<uint32_t>();
+        f.size = rd.get<uint64_t>();
+        f.realsize = rd.get<uint64_t>();
+        f.flag = rd.get<uint32_t>();
+        f.checkflag = rd.get<uint32_t>();
+        f.checksum = rd.get<uint32_t>();
+        f.crc16 = rd.get<uint16_t>();
+        f.use_pac_file = rd.get<uint8_t>();
+        f.use_old_proto = rd.get<uint8_t>();
+        f.isBackup = rd.get<uint8_t>();
+        fvec.push_back(f);
+    }
+
+    n = rd.get<uint32_t>();
+    for (uint32_t i = 0; rd.ok && i < n; i++) {
+        partition_info p;
+
+        p.partition = rd.str();
+        p.size = rd.get<uint32_t>();
+        pvec.push_back(p);
+    }
+
+    memcpy(pachdr, pacmap.data(), sizeof(*pachdr));
+    if (!rd.ok || rd.p != rd.end || mvec.size() != pachdr->nFileCount) goto _stale;
+
+    product_name.swap(name);
+    product_version.swap(version);
+    members.swap(mvec);
+    xmlfilevec.swap(fvec);
+    xmlpartitonvec.swap(pvec);
+    id_index.clear();
+    for (uint32_t i = 0; i < members.size(); i++)
+        if (!members[i].fileid.empty()) id_index.emplace(upper(members[i].fileid), i);
+
+    std::cerr << "load manifest " << path << ", " << xmlfilevec.size() << " files and " << xmlpartitonvec.size()
+              << " partitions of " << product_name << std::endl;
+    return 0;
+
+_stale:
+    std::cerr << "manifest " << path << " is not of " << pac_file << " as it is now, parse it again" << std::endl;
+    return -1;
 }
 
-uint32_t Firmware::local_file_size(const std::string& fpath) {
-    uint32_t sz = 0;
-    std::ifstream fin(fpath, std::ios::binary);
+int Firmware::manifest_save(const std::string& path) {
+    manifest_head head;
+    std::string body;
+    // other processes may save theirs at the same time
+    std::string tmp(path + "." + std::to_string(getpid()) + ".tmp");
+
+    if (!manifest_head_of(pacmap, head)) return -1;
+
+    put(body, product_name);
+    put(body, product_version);
+
+    put(body, uint32_t(members.size()));
+    for (auto& m : members) {
+        put(body, m.fileid);
+        put(body, m.filename);
+        put(body, m.offset);
+        put(body, m.size);
+    }
+
+    put(body, uint32_t(xmlfilevec.size()));
+    for (auto& f : xmlfilevec) {
+        put(body, f.fileid);
+        put(body, f.blockid);
+        put(body, f.type);
+        put(body, f.fpath);
+        put(body, f.base);
+        put(body, f.size);
+        put(body, f.realsize);
+        put(body, f.flag);
+        put(body, f.checkflag);
+        put(body, f.checksum);
+        put(body, f.crc16);
+        put(body, uint8_t(f.use_pac_file));
+        put(body, uint8_t(f.use_old_proto));
+        put(body, uint8_t(f.isBackup));
+    }
+
+    put(body, uint32_t(xmlpartitonvec.size()));
+    for (auto& p : xmlpartitonvec) {
+        put(body, p.partition);
+        put(body, p.size);
+    }
+
+    head.bodylen = body.size();
+    head.bodycrc = CRC16::nv(0, reinterpret_cast<const uint8_t*>(body.data()), body.size());
 
-    fin.seekg(0, std::ios::end);
-    sz = fin.tellg();
-    fin.close();
+    // renamed over the old one, a reader never sees half a file
+    std::ofstream fout(tmp, std::ios::binary | std::ios::trunc);
+    if (!fout.is_open()) {
+        std::cerr << __func__ << " cannot open(write) " << tmp << std::endl;
+        return -1;
+    }
 
-    return sz;
-}
\ No newline at end of file
+    fout.write(reinterpret_cast<const char*>(&head), sizeof(head));
+    fout.write(body.data(), body.size());
+    fout.close();
+    if (fout.fail() || rename(tmp.c_str(), path.c_str())) {
+        std::cerr << __func__ << " cannot write " << path << std::endl;
+        remove(tmp.c_str());
+        return -1;
+    }
+
+    std::cerr << "manifest of " << pac_file << " saved to " << path << std::endl;
+    return 0;
+}
@@ -10,9 +10,7 @@
 
 #include "pdl.hpp"
 
-static PDLREQ __request_type = PDLREQ::PDL_CMD_CONNECT;
-
-PDLRequest::PDLRequest() : CMDRequest(PROTOCOL::PROTO_PDL), _reallen(0) {
+PDLRequest::PDLRequest() : CMDRequest(PROTOCOL::PROTO_PDL), _reallen(0), midst_index(0) {
     _data = new (std::nothrow) uint8_t[PDL_MAX_DATA_LEN];
 }
 
@@ -25,7 +23,6 @@ void PDLRequest::reinit(PDLREQ cmd) {
     auto hdr = PDLHEADER(_data);
     auto tag = PDLTAG(_data);
 
-    __request_type = type();
     memset(_data, 0, PDL_MAX_DATA_LEN);
 
     hdr->ucTag = 0xae;
@@ -38,7 +35,7 @@ void PDLRequest::reinit(PDLREQ cmd) {
     _reallen = sizeof(pdl_pkt_header) + sizeof(pdl_pkt_tag);
 }
 
-void PDLRequest::push_back(uint8_t* data, uint32_t len) {
+void PDLRequest::push_back(const uint8_t* data, uint32_t len) {
     auto hdr = PDLHEADER(_data);
 
     std::copy(data, data + len, _data + _reallen);
@@ -54,18 +51,18 @@ void PDLRequest::newPDLStart(uint32_t addr, uint32_t size) {
     uint8_t d[] = {'P', 'D', 'L', '1', 0};
 
     reinit(PDLREQ::PDL_CMD_START_DATA);
+    midst_index = 0;
     tag->dwDataAddr = htole32(addr);
     tag->dwDataSize = htole32(size);
 
     push_back(d, sizeof(d));
 }
 
-void PDLRequest::newPDLMidst(uint8_t* data, uint32_t len) {
-    static int index = 0;
+void PDLRequest::newPDLMidst(const uint8_t* data, uint32_t len) {
     auto tag = PDLTAG(_data);
 
     reinit(PDLREQ::PDL_CMD_MID_DATA);
-    tag->dwDataAddr = htole32(index++);
+    tag->dwDataAddr = htole32(midst_index++);
     tag->dwDataSize = htole32(len);
 
     push_back(data, len);
@@ -84,6 +81,19 @@ uint8_t* PDLRequest::rawData() { return _data; }
 
 uint32_t PDLRequest::rawDataLen() { return _reallen; }
 
+const struct iovec* PDLRequest::rawIov() {
+    _iov[0].iov_base = _data;
+    _iov[0].iov_len = sizeof(pdl_pkt_header);
+    _iov[1].iov_base = _data + sizeof(pdl_pkt_header);
+    _iov[1].iov_len = sizeof(pdl_pkt_tag);
+    _iov[2].iov_base = _data + sizeof(pdl_pkt_header) + sizeof(pdl_pkt_tag);
+    _iov[2].iov_len = _reallen - sizeof(pdl_pkt_header) - sizeof(pdl_pkt_tag);
+
+    return _iov;
+}
+
+int PDLRequest::rawIovCnt() { return _reallen > sizeof(pdl_pkt_header) + sizeof(pdl_pkt_tag) ? 3 : 2; }
+
 PDLREQ PDLRequest::type() {
     auto tag = PDLTAG(_data);
     return static_cast<PDLREQ>(le32toh(tag->dwCmdType));
@@ -134,8 +144,6 @@ std::string PDLRequest::toString() {
 
 std::string PDLRequest::argString() { return "PDL1"; }
 
-bool PDLRequest::isDuplicate() { return type() == __request_type; }
-
 bool PDLRequest::onWrite() { return type() == PDLREQ::PDL_CMD_MID_DATA; }
 
 bool PDLRequest::onRead() { return type() == PDLREQ::PDL_CMD_READ_FLASH; }
@@ -216,7 +224,18 @@ void PDLResponse::reset() {
     memset(_data, 0, PDL_MAX_DATA_LEN);
 }
 
-void PDLResponse::push_back(uint8_t* d, uint32_t len) {
+// pdl answers are never split across responses, nothing is kept
+RESP_STATE PDLResponse::push_back(uint8_t* d, uint32_t len) {
+    if (!d || !len) return RESP_STATE::RESP_STATE_INCOMPLETE;
+
+    if (_reallen + len > PDL_MAX_DATA_LEN) {
+        std::cerr << "response too long, drop " << len << " bytes" << std::endl;
+        return RESP_STATE::RESP_STATE_MALFORMED;
+    }
+
     std::copy(d, d + len, _data + _reallen);
     _reallen += len;
+
+    if (_reallen < minLength() || _reallen < expectLength()) return RESP_STATE::RESP_STATE_INCOMPLETE;
+    return RESP_STATE::RESP_STATE_OK;
 }
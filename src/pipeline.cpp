@@ -0,0 +1,147 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-17 17:05:31
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-17 17:05:31
+ * @Description: encode midst frames ahead of the link
+ */
+#include <cstring>
+#include <iostream>
+
+#include "pipeline.hpp"
+
+TransferPipeline::TransferPipeline(uint32_t depth)
+    : depth(depth),
+      first(nullptr),
+      firstsz(0),
+      maxlen(0),
+      crc16(0),
+      chunks(0),
+      handed(0),
+      sent(0),
+      head(0),
+      cursor(0),
+      aborted(false),
+      crc_modle(CRC_MODLE::CRC_FDL),
+      data_escape_flag(false),
+      crc_escape_flag(false) {
+    slots = new (std::nothrow) slot[depth];
+}
+
+TransferPipeline::~TransferPipeline() {
+    stop();
+
+    if (slots) delete[] slots;
+    slots = nullptr;
+    if (first) delete[] first;
+    first = nullptr;
+}
+
+void TransferPipeline::setFrameModle(CRC_MODLE mod, bool data_es_flag, bool crc_es_flag) {
+    crc_modle = mod;
+    data_escape_flag = data_es_flag;
+    crc_escape_flag = crc_es_flag;
+}
+
+void TransferPipeline::setArgString(const std::string &arg) { argstr = arg; }
+
+bool TransferPipeline::wait(uint32_t i, SLOT_STATE state) {
+    std::unique_lock<std::mutex> l(lock);
+
+    cond.wait(l, [&] { return aborted || slots[i].state == state; });
+    return !aborted;
+}
+
+void TransferPipeline::moveon(uint32_t i, SLOT_STATE state) {
+    std::lock_guard<std::mutex> l(lock);
+
+    slots[i].state = state;
+    cond.notify_all();
+}
+
+void TransferPipeline::encode_loop() {
+    uint64_t left = src.size;
+
+    for (uint32_t n = 0; n < chunks; n++) {
+        slot &s = slots[n % depth];
+        const uint8_t *data = src.data + (src.size - left);
+        uint32_t len = (left > maxlen) ? maxlen : left;
+
+        if (!wait(n % depth, SLOT_STATE::SLOT_FREE)) return;
+
+        // the mapping is read-only, the one chunk to change is copied
+        if (n == 0 && crc16) {
+            memcpy(first, data, len);
+            *reinterpret_cast<uint16_t *>(first) = htobe16(crc16);
+            data = first;
+        }
+
+        s.request.newMidstData(data, len);
+        s.request.setArgString(argstr);
+        left -= len;
+        moveon(n % depth, SLOT_STATE::SLOT_READY);
+    }
+}
+
+bool TransferPipeline::start(const byte_span &src, uint32_t maxlen, uint16_t crc16) {
+    stop();
+
+    if (!slots || !src.data) return false;
+
+    if (crc16 && maxlen > firstsz) {
+        if (first) delete[] first;
+        first = new (std::nothrow) uint8_t[maxlen];
+        firstsz = first ? maxlen : 0;
+        if (!first) return false;
+    }
+
+    for (uint32_t i = 0; i < depth; i++) {
+        slots[i].state = SLOT_STATE::SLOT_FREE;
+        slots[i].request.setCrcModle(crc_modle);
+        slots[i].request.setEscapeFlag(data_escape_flag, crc_escape_flag);
+    }
+
+    this->src = src;
+    this->maxlen = maxlen;
+    this->crc16 = crc16;
+    // an empty file still goes as one empty frame, like transfer() does
+    chunks = src.size ? static_cast<uint32_t>((src.size + maxlen - 1) / maxlen) : 1;
+    handed = 0;
+    sent = 0;
+    head = 0;
+    cursor = 0;
+    aborted = false;
+
+    encoder = std::thread(&TransferPipeline::encode_loop, this);
+
+    return true;
+}
+
+FDLRequest *TransferPipeline::next() {
+    uint32_t i = cursor;
+
+    // all slots are out, would wait forever
+    if (handed == chunks || handed - sent >= depth || !wait(i, SLOT_STATE::SLOT_READY)) return nullptr;
+
+    moveon(i, SLOT_STATE::SLOT_INFLIGHT);
+    cursor = (cursor + 1) % depth;
+    handed++;
+
+    return &slots[i].request;
+}
+
+void TransferPipeline::release() {
+    moveon(head, SLOT_STATE::SLOT_FREE);
+    head = (head + 1) % depth;
+    sent++;
+}
+
+void TransferPipeline::stop() {
+    {
+        std::lock_guard<std::mutex> l(lock);
+        aborted = true;
+        cond.notify_all();
+    }
+
+    if (encoder.joinable()) encoder.join();
+}
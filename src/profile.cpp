@@ -0,0 +1,94 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-17 18:12:44
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-17 18:12:44
+ * @Description: link parameters learned per device, kept on disk
+ */
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+
+extern "C" {
+#include <unistd.h>
+}
+
+#include "profile.hpp"
+
+// sessions of one process save one after another
+static std::mutex save_lock;
+
+static bool read_values(const std::string &path, std::map<std::string, std::string> &values) {
+    std::ifstream fin(path);
+    std::string line;
+
+    if (!fin.is_open()) return false;
+
+    while (std::getline(fin, line)) {
+        if (line.empty() || line[0] == '#' || line.find('=') == std::string::npos) continue;
+
+        values[line.substr(0, line.find_first_of('='))] = line.substr(line.find_first_of('=') + 1);
+    }
+
+    return true;
+}
+
+Profile::Profile(const std::string &path) : path(path) {}
+
+void Profile::setPath(const std::string &path) { this->path = path; }
+
+bool Profile::load() {
+    values.clear();
+    changed.clear();
+
+    return read_values(path, values);
+}
+
+bool Profile::save() {
+    std::lock_guard<std::mutex> l(save_lock);
+    std::map<std::string, std::string> merged;
+    // other processes may save the same profile at the same time
+    std::string tmp(path + "." + std::to_string(getpid()) + ".tmp");
+
+    if (changed.empty()) return true;
+
+    read_values(path, merged);
+    for (auto &key : changed) merged[key] = values[key];
+
+    // renamed over the old one, a reader never sees half a file
+    std::ofstream fout(tmp, std::ios::trunc);
+    if (!fout.is_open()) {
+        std::cerr << __func__ << " cannot open(write) " << tmp << std::endl;
+        return false;
+    }
+
+    fout << "# learned by dloader, safe to delete" << std::endl;
+    for (auto &kv : merged) fout << kv.first << "=" << kv.second << std::endl;
+    fout.close();
+    if (fout.fail() || rename(tmp.c_str(), path.c_str())) {
+        std::cerr << __func__ << " cannot write " << path << std::endl;
+        remove(tmp.c_str());
+        return false;
+    }
+
+    values = merged;
+    changed.clear();
+
+    return true;
+}
+
+int Profile::get(const std::string &dev, const std::string &key, int defval) {
+    auto iter = values.find(dev + "." + key);
+
+    return iter == values.end() ? defval : strtol(iter->second.c_str(), nullptr, 0);
+}
+
+void Profile::set(const std::string &dev, const std::string &key, int val) {
+    std::string v = std::to_string(val);
+    std::string &old = values[dev + "." + key];
+
+    if (old != v) changed.insert(dev + "." + key);
+    old = v;
+}
@@ -8,13 +8,21 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
 #include <cstring>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
 
 extern "C" {
 #include <fcntl.h>
 #include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
 #include <sys/epoll.h>
 #include <unistd.h>
+#include <linux/serial.h>
 }
 
 #include "serial.hpp"
@@ -27,7 +35,36 @@ const int SerialPort::BaudARR[] = {_VALUES};
 const char* SerialPort::BaudARRSTR[] = {_VALUES};
 #undef _VAL
 
-SerialPort::SerialPort(const std::string& tty) : USBStream(tty, USBLINK::USBLINK_TTY), ttyfd(-1), epfd(-1) {
+// termios takes Bxxx constants, not the rate itself
+#define _VAL(v) B##v
+const speed_t SerialPort::BaudSPEED[] = {_VALUES};
+#undef _VAL
+
+BAUD SerialPort::fromRate(uint32_t rate) {
+    int i = sizeof(BaudARR) / sizeof(BaudARR[0]) - 1;
+
+    while (i > 0 && static_cast<uint32_t>(BaudARR[i]) > rate) i--;
+    return static_cast<BAUD>(i);
+}
+
+SerialPort::SerialPort(const std::string& tty) : SerialPort(tty, USBLINK::USBLINK_TTY) {}
+
+SerialPort::SerialPort(const std::string& tty, USBLINK phy)
+    : USBStream(tty, phy),
+      ttyfd(-1),
+      epfd(-1),
+      cur_baud(BAUD::BAUD115200),
+      tx_bytes(0),
+      tx_stalls(0),
+      tx_time(0),
+      rxbuf(nullptr),
+      rx_bytes(0),
+      rx_reads(0),
+      rx_rate(0),
+      saved_flags(-1) {
+    rxbuf = new (std::nothrow) uint8_t[SERIAL_RX_BUF];
+    _rxdata = rxbuf;
+
     std::cerr << "serial try open " << usb_device << std::endl;
     ttyfd = open(usb_device.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
     if (ttyfd > 0) {
@@ -45,6 +82,9 @@ SerialPort::SerialPort(const std::string& tty) : USBStream(tty, USBLINK::USBLINK
 }
 
 SerialPort::~SerialPort() {
+    // leave the tty and the device as they were found
+    if (ttyfd > 0 && (saved_flags >= 0 || !power_control.empty())) setLowLatency(false);
+
     if (epfd > 0) {
         struct epoll_event ev;
         ev.data.fd = ttyfd;
@@ -59,92 +99,300 @@ SerialPort::~SerialPort() {
         close(ttyfd);
         ttyfd = -1;
     }
+
+    if (rxbuf) delete[] rxbuf;
+    rxbuf = nullptr;
 }
 
-bool SerialPort::isOpened() { return ttyfd > 0; }
+bool SerialPort::isOpened() { return ttyfd > 0 && rxbuf; }
 
 void SerialPort::setBaud(BAUD baud) {
-    struct termios tio;
     struct termios settings;
 
-    memset(&tio, 0, sizeof(tio));
-    tio.c_iflag = 0;
-    tio.c_oflag = 0;
-    tio.c_cflag = CS8 | CREAD | CLOCAL;  // 8n1, see termios.h for more information
-    tio.c_lflag = 0;
-    tio.c_cc[VMIN] = 1;
-    tio.c_cc[VTIME] = 5;
-    cfsetospeed(&tio, BaudARR[static_cast<int>(baud)]);
-    cfsetispeed(&tio, BaudARR[static_cast<int>(baud)]);
-    tcsetattr(ttyfd, TCSANOW, &tio);
-
+    // raw 8n1, the speed must go in the same settings or it is reset to B0
     memset(&settings, 0, sizeof(settings));
     cfmakeraw(&settings);
-    settings.c_cflag |= CREAD | CLOCAL;
+    settings.c_cflag |= CS8 | CREAD | CLOCAL;
+    // reads are O_NONBLOCK and n_tty wakes epoll on any byte, VMIN/VTIME do
+    // not batch anything here. recvAtLeast does it instead
+    settings.c_cc[VMIN] = 1;
+    settings.c_cc[VTIME] = 0;
+    cfsetospeed(&settings, BaudSPEED[static_cast<int>(baud)]);
+    cfsetispeed(&settings, BaudSPEED[static_cast<int>(baud)]);
     tcflush(ttyfd, TCIOFLUSH);
-    tcsetattr(ttyfd, TCSANOW, &settings);
+    if (tcsetattr(ttyfd, TCSANOW, &settings))
+        std::cerr << "tcsetattr " << BaudARRSTR[static_cast<int>(baud)] << " fails, error=" << strerror(errno)
+                  << std::endl;
+    else
+        cur_baud = baud;
 }
 
 void SerialPort::init() {}
 
+// power/control of the usb device the tty hangs off, empty if it is not on usb
+static std::string usb_power_control(const std::string& tty) {
+    char path[PATH_MAX];
+
+    if (!realpath(tty.c_str(), path)) return "";
+
+    std::string name = strrchr(path, '/') + 1;
+    if (!realpath(("/sys/class/tty/" + name + "/device").c_str(), path)) return "";
+
+    // the tty is under an interface, the device is the first parent with idVendor
+    for (std::string dir = path; dir.size() > strlen("/sys/devices/"); dir = dir.substr(0, dir.find_last_of('/'))) {
+        if (!access((dir + "/idVendor").c_str(), F_OK)) return dir + "/power/control";
+    }
+
+    return "";
+}
+
+bool SerialPort::keepAwake(bool on) {
+    if (on) {
+        if (power_control.empty()) {
+            std::string path = usb_power_control(usb_device);
+            std::ifstream fin(path);
+
+            if (path.empty() || !fin.is_open() || !std::getline(fin, saved_power)) {
+                std::cerr << "no usb power control for " << usb_device << std::endl;
+                return false;
+            }
+            power_control = path;
+        }
+
+        if (saved_power == "on") return true;
+    } else if (power_control.empty() || saved_power == "on") {
+        power_control.clear();
+        return true;
+    }
+
+    std::ofstream fout(power_control);
+    if (!fout.is_open() || !(fout << (on ? "on" : saved_power) << std::endl)) {
+        std::cerr << "cannot write " << power_control << ", error=" << strerror(errno) << std::endl;
+        return false;
+    }
+
+    if (!on) power_control.clear();
+    return true;
+}
+
+/**
+ * with ASYNC_LOW_LATENCY the driver hands received bytes to the line
+ * discipline at once instead of from a work queue, and a resume from
+ * autosuspend costs more than a whole small frame round trip.
+ */
+bool SerialPort::setLowLatency(bool on) {
+    struct serial_struct ss;
+    bool ok = true;
+
+    if (!isOpened()) return false;
+
+    // what is queued goes out before the driver changes its mind
+    tcdrain(ttyfd);
+
+    memset(&ss, 0, sizeof(ss));
+    if (ioctl(ttyfd, TIOCGSERIAL, &ss)) {
+        if (on) std::cerr << "TIOCGSERIAL on " << usb_device << " fails, error=" << strerror(errno) << std::endl;
+        ok = !on;
+    } else if (on || saved_flags >= 0) {
+        if (saved_flags < 0) saved_flags = ss.flags;
+        ss.flags = on ? (ss.flags | ASYNC_LOW_LATENCY) : saved_flags;
+        if (ioctl(ttyfd, TIOCSSERIAL, &ss)) {
+            std::cerr << "TIOCSSERIAL on " << usb_device << " fails, error=" << strerror(errno) << std::endl;
+            ok = false;
+        } else if (!on) {
+            saved_flags = -1;
+        }
+    }
+
+    if (!keepAwake(on)) ok = false;
+
+    // nothing is asked for now, what came in meanwhile is stale
+    tcflush(ttyfd, TCIFLUSH);
+
+    return ok;
+}
+
 bool SerialPort::sendSync(uint8_t* data, uint32_t len, uint32_t timeout) {
-    uint32_t totallen = len;
+    struct iovec iov = {data, len};
+
+    return sendvSync(&iov, 1, timeout);
+}
+
+bool SerialPort::wait_writable(int timeout) {
+    struct epoll_event event;
+    struct epoll_event ready;
+    int num;
+
+    memset(&event, 0, sizeof(event));
+    event.data.fd = ttyfd;
+    event.events = EPOLLOUT | EPOLLRDHUP;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, ttyfd, &event);
+
+    num = epoll_wait(epfd, &ready, 1, timeout);
+
+    event.events = EPOLLIN | EPOLLRDHUP;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, ttyfd, &event);
+
+    return num > 0 && !(ready.events & (EPOLLRDHUP | EPOLLERR | EPOLLHUP));
+}
+
+/**
+ * header, payload and tail go out in one writev. if the tty buffer is full
+ * wait for it to drain, but not past timeout ms in total.
+ */
+bool SerialPort::sendvSync(const struct iovec* iov, int iovcnt, uint32_t timeout) {
+    std::vector<struct iovec> vec(iov, iov + iovcnt);
+    auto begin = std::chrono::steady_clock::now();
+    auto deadline = begin + std::chrono::milliseconds(timeout);
+    uint32_t totallen = 0;
+    uint32_t sent = 0;
+    int i = 0;
 
     if (!isOpened()) return false;
 
-    do {
-        ssize_t ret = write(ttyfd, data, len);
+    for (auto& v : vec) totallen += v.iov_len;
+
+    while (i < iovcnt) {
+        ssize_t ret = writev(ttyfd, &vec[i], iovcnt - i);
         if (ret < 0) {
             if (errno == EAGAIN) {
-                usleep(100);
-                continue;
+                auto left = deadline - std::chrono::steady_clock::now();
+                int ms = std::chrono::duration_cast<std::chrono::milliseconds>(left).count();
+
+                tx_stalls++;
+                if (left.count() > 0 && wait_writable(ms ? ms : 1)) continue;
+
+                std::cerr << "write timeout(" << timeout << "ms), write " << std::dec << sent << "/" << totallen
+                          << " bytes" << std::endl;
             } else {
-                std::cerr << "write data failed, write " << std::dec << (totallen - len) << "/" << totallen
-                          << " bytes, for " << strerror(errno) << std::endl;
-                return false;
+                std::cerr << "writev data failed, write " << std::dec << sent << "/" << totallen << " bytes, for "
+                          << strerror(errno) << std::endl;
             }
+
+            tx_bytes += sent;
+            tx_time += std::chrono::steady_clock::now() - begin;
+            return false;
         }
 
-        len -= ret;
-        data += ret;
-    } while (len > 0);
+        // skip what is written, the tty may take part of a segment
+        sent += ret;
+        for (; i < iovcnt && static_cast<size_t>(ret) >= vec[i].iov_len; i++) ret -= vec[i].iov_len;
+        if (i < iovcnt) {
+            vec[i].iov_base = static_cast<uint8_t*>(vec[i].iov_base) + ret;
+            vec[i].iov_len -= ret;
+        }
+    }
 
+    tx_bytes += sent;
+    tx_time += std::chrono::steady_clock::now() - begin;
     return true;
 }
 
-bool SerialPort::recvSync(uint32_t timeout) {
+void SerialPort::reportIo() {
+    double sec = std::chrono::duration_cast<std::chrono::microseconds>(tx_time).count() / 1e6;
+
+    if (sec > 0)
+        std::cerr << "serial tx " << tx_bytes / 1024 << " KB at " << static_cast<uint64_t>(tx_bytes / sec / 1024)
+                  << " KB/s, " << tx_stalls << " stalls" << std::endl;
+    if (rx_reads)
+        std::cerr << "serial rx " << rx_bytes / 1024 << " KB in " << rx_reads << " reads, " << rx_bytes / rx_reads
+                  << " bytes each" << std::endl;
+}
+
+bool SerialPort::recvSync(uint32_t timeout) { return recvAtLeast(1, timeout); }
+
+/**
+ * each wakeup takes all the tty has in one read, a short read means it is
+ * drained. with a reply partly in, sleep until about SERIAL_RX_BATCH more
+ * bytes are due at the rate seen so far instead of waking on every urb. once
+ * some bytes are in, only wait SERIAL_RX_IDLE ms for more, so a reply shorter
+ * than asked for (an error in place of data) is not held back until timeout.
+ */
+bool SerialPort::recvAtLeast(uint32_t len, uint32_t timeout) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+    std::chrono::steady_clock::time_point last;
     struct epoll_event events[10];
-    int num;
+    bool paced = false;
 
     if (!isOpened()) return false;
 
+    _rxdata = rxbuf;
     _reallen = 0;
-    num = epoll_wait(epfd, events, 10, timeout);
-    if (num > 0) {
-        for (int i = 0; i < num; i++) {
-            // serial closed?
-            if ((events[i].events & EPOLLRDHUP) || (events[i].events & (EPOLLERR | EPOLLHUP))) {
-                std::cerr << "get event: 0x" << std::hex << events[i].events << std::endl;
+    if (len > SERIAL_RX_BUF) len = SERIAL_RX_BUF;
+
+    while (_reallen < len) {
+        auto now = std::chrono::steady_clock::now();
+
+        if (!paced) {
+            int ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+            bool readable = false;
+
+            if (ms < 0) ms = 0;
+            if (_reallen && ms > SERIAL_RX_IDLE) ms = SERIAL_RX_IDLE;
+
+            int num = epoll_wait(epfd, events, 10, ms);
+            if (num < 0 && errno == EINTR) continue;
+            if (num < 0) {
+                std::cerr << "epoll fail for " << strerror(errno) << std::endl;
                 return false;
             }
 
-            if (events[i].events & EPOLLIN) {
-                memset(_data, 0, max_buf_size);
-                ssize_t len = read(ttyfd, _data, max_buf_size);
-                if (len <= 0)
-                    std::cerr << __func__ << " read " << std::dec << len << " bytes, err " << strerror(errno)
-                              << std::endl;
-                _reallen = (len <= 0) ? 0 : len;
-                return (_reallen > 0);
+            // quiet for long enough, take what is in
+            if (num == 0) break;
+
+            for (int i = 0; i < num; i++) {
+                // serial closed?
+                if ((events[i].events & EPOLLRDHUP) || (events[i].events & (EPOLLERR | EPOLLHUP))) {
+                    std::cerr << "get event: 0x" << std::hex << events[i].events << std::dec << std::endl;
+                    return false;
+                }
+
+                if (events[i].events & EPOLLIN) readable = true;
             }
+
+            if (!readable) continue;
         }
-    }
 
-    if (num == 0) {
-        std::cerr << "epoll timeout(" << timeout << "ms)" << std::endl;
-        return false;
-    } else {
-        std::cerr << "epoll fail for " << strerror(errno) << std::endl;
-        return false;
+        ssize_t n = read(ttyfd, rxbuf + _reallen, SERIAL_RX_BUF - _reallen);
+        if (n <= 0 && !(n < 0 && errno == EAGAIN)) {
+            std::cerr << __func__ << " read " << std::dec << n << " bytes, err " << strerror(errno) << std::endl;
+            return false;
+        }
+
+        now = std::chrono::steady_clock::now();
+        if (n > 0) {
+            // the first read of a reply tells nothing about the rate
+            if (_reallen) {
+                double us = std::chrono::duration_cast<std::chrono::microseconds>(now - last).count();
+                double r = n / (us > 1 ? us : 1);
+                rx_rate = rx_rate > 0 ? (rx_rate * 3 + r) / 4 : r;
+            }
+
+            last = now;
+            _reallen += n;
+            rx_bytes += n;
+            rx_reads++;
+        }
+
+        // sleep through the next batch, a paced read finding nothing falls back to epoll
+        paced = n > 0 && rx_rate > 0 && _reallen < len && _reallen < SERIAL_RX_BUF;
+        if (paced) {
+            uint32_t batch = len - _reallen > SERIAL_RX_BATCH ? SERIAL_RX_BATCH : len - _reallen;
+            int64_t us = batch / rx_rate;
+
+            // a sleep shorter than the timer slack costs more than the wakeups it saves
+            if (us > SERIAL_RX_IDLE * 1000) us = SERIAL_RX_IDLE * 1000;
+            if (us < 200 || now + std::chrono::microseconds(us) > deadline) {
+                paced = false;
+                continue;
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(us));
+        }
+
+        if (_reallen == SERIAL_RX_BUF) break;
     }
+
+    if (_reallen == 0) std::cerr << "epoll timeout(" << timeout << "ms)" << std::endl;
+
+    return _reallen > 0;
 }
@@ -0,0 +1,66 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 07:20:05
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 07:20:05
+ * @Description: std::cerr shared by sessions, whole lines tagged with the session
+ */
+#include <cstring>
+#include <iostream>
+
+#include "sessionlog.hpp"
+
+// a thread logs to one SessionLog at a time
+static thread_local std::string thread_tag;
+static thread_local std::string thread_line;
+
+SessionLog::SessionLog() : out(std::cerr.rdbuf(this)) {}
+
+SessionLog::~SessionLog() {
+    setTag("");
+    std::cerr.rdbuf(out);
+}
+
+std::string &SessionLog::line() {
+    if (thread_line.empty() && !thread_tag.empty()) thread_line = "[" + thread_tag + "] ";
+    return thread_line;
+}
+
+void SessionLog::put(std::string &l) {
+    std::lock_guard<std::mutex> g(lock);
+
+    out->sputn(l.data(), l.size());
+    out->pubsync();
+    l.clear();
+}
+
+SessionLog::int_type SessionLog::overflow(int_type c) {
+    if (traits_type::eq_int_type(c, traits_type::eof())) return traits_type::not_eof(c);
+
+    std::string &l = line();
+    l += traits_type::to_char_type(c);
+    if (c == '\n') put(l);
+    return c;
+}
+
+std::streamsize SessionLog::xsputn(const char *s, std::streamsize n) {
+    for (std::streamsize i = 0; i < n;) {
+        const char *nl = static_cast<const char *>(memchr(s + i, '\n', n - i));
+        std::streamsize len = nl ? nl - (s + i) + 1 : n - i;
+        std::string &l = line();
+
+        l.append(s + i, len);
+        if (nl) put(l);
+        i += len;
+    }
+    return n;
+}
+
+void SessionLog::setTag(const std::string &tag) {
+    // what is left of the line goes out under the tag it was written with
+    if (!thread_line.empty()) {
+        thread_line += '\n';
+        put(thread_line);
+    }
+    thread_tag = tag;
+}
@@ -7,7 +7,11 @@
  */
 
 #include <string>
+#include <vector>
 #include <algorithm>
+#include <chrono>
+
+#include <cstring>
 
 extern "C" {
 #include <unistd.h>
@@ -29,10 +33,26 @@ bool string_case_cmp(const std::string& s1, const std::string& s2) {
     return s1_upper == s2_upper;
 }
 
-UpgradeManager::UpgradeManager(const std::string& tty, const std::string& pac, std::shared_ptr<USBStream>& us)
-    : usbstream(us), firmware(pac), pac(pac) {
-    int maxlen = FRAMESZ_DATA > FRAMESZ_FDL ? FRAMESZ_DATA : FRAMESZ_FDL;
-    _data = new (std::nothrow) uint8_t[maxlen];
+UpgradeManager::UpgradeManager(const std::string& tty, std::shared_ptr<Firmware>& fw, std::shared_ptr<USBStream>& us)
+    : usbstream(us),
+      fwref(fw),
+      firmware(*fw),
+      window_max(1),
+      window_ceiling(1),
+      window(1),
+      midst_size(FRAMESZ_DATA),
+      midst_size_fail(0),
+      read_size(FRAMESZ_DATA),
+      read_size_fail(0),
+      framesz_probe(false),
+      baud_max(BAUD::BAUD115200),
+      pdl_split(false),
+      low_latency(false),
+      latency_tuned(false),
+      last_posted(UINT32_MAX),
+      folding(false) {
+    _datalen = FRAMESZ_DATA > FRAMESZ_FDL ? FRAMESZ_DATA : FRAMESZ_FDL;
+    _data = new (std::nothrow) uint8_t[_datalen];
 }
 
 UpgradeManager::~UpgradeManager() {
@@ -40,10 +60,244 @@ UpgradeManager::~UpgradeManager() {
     _data = nullptr;
 }
 
+void UpgradeManager::setPipelineDepth(uint32_t depth) {
+    if (depth < 2)
+        pipeline.reset();
+    else
+        pipeline.reset(new TransferPipeline(depth));
+}
+
+void UpgradeManager::setMidstWindow(uint32_t max) {
+    window_max = max ? max : 1;
+
+    // frames in the window are kept in pipeline slots until acked
+    if (window_max > 1 && (!pipeline || pipeline->size() <= window_max)) setPipelineDepth(window_max + 1);
+}
+
+void UpgradeManager::setProfile(const std::string& path) {
+    profile.setPath(path);
+    profile.load();
+}
+
+void UpgradeManager::setDeviceId(const std::string& id) { device_id = id; }
+
+void UpgradeManager::setBaudCeiling(uint32_t rate) { baud_max = SerialPort::fromRate(rate); }
+
+void UpgradeManager::setFrameProbe(bool on) { framesz_probe = on; }
+
+void UpgradeManager::setLowLatency(bool on) { low_latency = on; }
+
+void UpgradeManager::setBackupTag(const std::string& tag) { backup_tag = tag; }
+
+bool UpgradeManager::reserve(uint32_t len) {
+    if (_data && len <= _datalen) return true;
+
+    if (_data) delete[] _data;
+    _data = new (std::nothrow) uint8_t[len];
+    _datalen = _data ? len : 0;
+
+    return !!_data;
+}
+
+std::string UpgradeManager::profile_key() {
+    return device_id.empty() ? firmware.productName() : device_id + "/" + firmware.productName();
+}
+
+/**
+ * fdl2 of the same chipset may take larger frames than FRAMESZ_DATA, but
+ * nothing tells how large. sizes negotiate_framesz found to work or fail on
+ * this device are kept, a broken profile falls back to FRAMESZ_DATA.
+ */
+void UpgradeManager::init_framesz() {
+    std::string key = profile_key();
+
+    midst_size = profile.get(key, "midst_size", FRAMESZ_DATA);
+    midst_size_fail = profile.get(key, "midst_size_fail", 0);
+    if (midst_size < FRAMESZ_DATA || midst_size > FRAMESZ_MAX || (midst_size_fail && midst_size >= midst_size_fail))
+        midst_size = FRAMESZ_DATA;
+
+    read_size = profile.get(key, "read_size", FRAMESZ_DATA);
+    read_size_fail = profile.get(key, "read_size_fail", 0);
+    if (read_size < FRAMESZ_DATA || read_size > FRAMESZ_MAX || (read_size_fail && read_size >= read_size_fail))
+        read_size = FRAMESZ_DATA;
+
+    std::cerr << "frame size midst 0x" << std::hex << midst_size << ", read 0x" << read_size << std::dec << " for "
+              << key << std::endl;
+}
+
+uint32_t UpgradeManager::probe_framesz(uint32_t good, uint32_t fail) {
+    uint32_t next = good + FRAMESZ_STEP < FRAMESZ_MAX ? good + FRAMESZ_STEP : FRAMESZ_MAX;
+
+    return (fail && next >= fail) ? good : next;
+}
+
+void UpgradeManager::drain() {
+    while (usbstream->recvSync(200)) {
+    }
+    response.discard();
+}
+
+/**
+ * one step larger each time, reads first and then writes, until the device
+ * refuses one. only BSL_REP_DOWN_SIZE_ERROR marks a size as failed, any
+ * other failure just ends probing and nothing is learned from it. the
+ * partitions themselves are always sent at a size known to work.
+ */
+int UpgradeManager::negotiate_framesz(const std::vector<XMLFileInfo>& filevec) {
+    const XMLFileInfo* target = nullptr;
+
+    if (!framesz_probe) return 0;
+
+    // a partition of the update that is written as a whole right after, never nv
+    for (auto& info : filevec) {
+        if (!string_case_cmp(info.type, "CODE2") && !string_case_cmp(info.type, "YAFFS_IMG2") &&
+            !string_case_cmp(info.type, "UBOOT_LOADER2"))
+            continue;
+        if (string_case_cmp(info.fileid, "PhaseCheck") || string_case_cmp(info.fileid, "ProdNV")) continue;
+        if (info.blockid.empty() || !info.use_pac_file || info.size < FRAMESZ_MAX) continue;
+        if (firmware.member(info.fileid).size < FRAMESZ_MAX) continue;
+
+        target = &info;
+        break;
+    }
+    if (!target) {
+        std::cerr << __func__ << " no partition to probe frame sizes on" << std::endl;
+        return 0;
+    }
+
+    setFrameModle(CRC_MODLE::CRC_FDL, false, false);
+    if (probe_read_size(*target) || probe_midst_size(*target)) return -1;
+
+    std::cerr << __func__ << " midst 0x" << std::hex << midst_size << ", read 0x" << read_size << std::dec << " on "
+              << target->fileid << std::endl;
+    return 0;
+}
+
+int UpgradeManager::probe_read_size(const XMLFileInfo& info) {
+    uint32_t sz;
+
+    if ((sz = probe_framesz(read_size, read_size_fail)) == read_size) return 0;
+
+    request.newStartRead(info.blockid, info.size);
+    request.setArgString(info.fileid);
+    if (!talk(&request, &response) || response.type() != REPTYPE::BSL_REP_ACK) goto _exit;
+
+    for (; sz != read_size; sz = probe_framesz(read_size, read_size_fail)) {
+        request.newReadMidst(sz, 0);
+        request.setArgString(info.fileid);
+        if (!talk(&request, &response)) {
+            drain();
+            break;
+        }
+
+        if (response.type() == REPTYPE::BSL_REP_DOWN_SIZE_ERROR) {
+            read_size_fail = sz;
+            profile.set(profile_key(), "read_size_fail", sz);
+            break;
+        }
+        if (response.type() != REPTYPE::BSL_REP_READ_FLASH || response.dataLen() != sz) break;
+
+        read_size = sz;
+        profile.set(profile_key(), "read_size", sz);
+    }
+
+    request.newEndRead();
+    if (!talk(&request, &response) || response.type() != REPTYPE::BSL_REP_ACK) goto _exit;
+
+    return 0;
+_exit:
+    std::cerr << __func__ << " " << request.toString() << " get unexpect response " << response.toString() << std::endl;
+    return -1;
+}
+
+/**
+ * each size is a whole download of its own, START_DATA for just that many
+ * bytes of the image, one MIDST_DATA and END_DATA. the partition is flashed
+ * in full later on, until then it holds only those bytes, see framesz_probe
+ * in dloader.conf.
+ */
+int UpgradeManager::probe_midst_size(const XMLFileInfo& info) {
+    byte_span src = firmware.member(info.fileid);
+    uint32_t sz;
+
+    for (; (sz = probe_framesz(midst_size, midst_size_fail)) != midst_size;) {
+        bool ok;
+
+        request.newStartData(info.blockid, sz, 0);
+        request.setArgString(info.fileid);
+        if (!talk(&request, &response) || response.type() != REPTYPE::BSL_REP_ACK) goto _exit;
+
+        request.newMidstData(src.data, sz);
+        request.setArgString(info.fileid);
+        ok = talk(&request, &response);
+        if (!ok) drain();
+
+        if (ok && response.type() == REPTYPE::BSL_REP_DOWN_SIZE_ERROR) {
+            midst_size_fail = sz;
+            profile.set(profile_key(), "midst_size_fail", sz);
+        }
+        ok = ok && response.type() == REPTYPE::BSL_REP_ACK;
+
+        // a refused frame leaves the download open, it is ended either way
+        request.newEndData();
+        if (!talk(&request, &response, 30000) || (ok && response.type() != REPTYPE::BSL_REP_ACK)) goto _exit;
+        if (!ok) break;
+
+        midst_size = sz;
+        profile.set(profile_key(), "midst_size", sz);
+    }
+
+    return 0;
+_exit:
+    std::cerr << __func__ << " " << request.toString() << " get unexpect response " << response.toString() << std::endl;
+    return -1;
+}
+
+/**
+ * start from the largest window known to work on this chipset, and never
+ * probe up to one that failed before.
+ */
+void UpgradeManager::init_window() {
+    uint32_t good = profile.get(firmware.productName(), "midst_window", 1);
+    uint32_t fail = profile.get(firmware.productName(), "midst_window_fail", 0);
+
+    window_ceiling = window_max;
+    if (fail > 1 && fail <= window_ceiling) window_ceiling = fail - 1;
+
+    window = good < window_ceiling ? good : window_ceiling;
+    if (window_max > 1)
+        std::cerr << "midst window " << window << ", up to " << window_ceiling << " for " << firmware.productName()
+                  << std::endl;
+}
+
+void UpgradeManager::report_window() {
+    if (window_max < 2) return;
+
+    for (auto& kv : window_stats) {
+        double sec = std::chrono::duration_cast<std::chrono::microseconds>(kv.second.second).count() / 1e6;
+
+        if (sec > 0)
+            std::cerr << "midst window " << kv.first << ": " << kv.second.first / 1024 << " KB at "
+                      << static_cast<uint64_t>(kv.second.first / sec / 1024) << " KB/s" << std::endl;
+    }
+}
+
+SerialPort* UpgradeManager::tty() {
+    auto link = usbstream->physicalLink();
+
+    if (link == USBLINK::USBLINK_TTY || link == USBLINK::USBLINK_TTY_URING)
+        return static_cast<SerialPort*>(usbstream.get());
+    return nullptr;
+}
+
+void UpgradeManager::report_tty() {
+    if (tty()) tty()->reportIo();
+}
+
 bool UpgradeManager::prepare() {
-    if (firmware.pacparser()) return false;
+    if (firmware.get_file_vec().empty()) return false;
 
-    if (firmware.xmlparser()) return false;
+    profile.load();
 
     return true;
 }
@@ -72,20 +326,22 @@ void UpgradeManager::hexdump(const std::string& prefix, uint8_t* buf, uint32_t l
 }
 
 void UpgradeManager::verbose(CMDRequest* req) {
-    static bool _is_duplicate = false;
     bool verbose_log = !!getenv("VERBOSE");
+    uint32_t posted = (static_cast<uint32_t>(req->protocol()) << 16) | (req->value() & 0xffff);
+    bool duplicate = posted == last_posted;
 
-    if (_is_duplicate && !req->isDuplicate()) std::cerr << std::endl;
+    if (folding && !duplicate) std::cerr << std::endl;
 
-    if (req->isDuplicate() && req->onWrite() && !verbose_log)
+    if (duplicate && req->onWrite() && !verbose_log)
         std::cerr << ">";
-    else if (req->isDuplicate() && req->onRead() && !verbose_log)
+    else if (duplicate && req->onRead() && !verbose_log)
         std::cerr << "<";
     else
         std::cerr << ">>> " << req->toString() << " " << req->argString() << " (" << req->rawDataLen() << ") "
                   << std::endl;
 
-    _is_duplicate = req->isDuplicate();
+    last_posted = posted;
+    folding = duplicate;
 
     if (verbose_log) hexdump(">>>", req->rawData(), req->rawDataLen());
 }
@@ -97,57 +353,70 @@ void UpgradeManager::verbose(CMDResponse* resp, bool ondata) {
     if (verbose_log) hexdump("<<<", resp->rawData(), resp->rawDataLen());
 }
 
-bool UpgradeManager::talk(CMDRequest* req, CMDResponse* resp, int rx_timeout, int tx_timeout) {
-    if (resp) resp->reset();
+void UpgradeManager::setFrameModle(CRC_MODLE mod, bool data_es_flag, bool crc_es_flag, bool crc_fallback) {
+    request.setCrcModle(mod);
+    request.setEscapeFlag(data_es_flag, crc_es_flag);
+    response.setCrcModle(mod);
+    response.setCrcFallback(crc_fallback);
+    response.setEscapeFlag(data_es_flag, crc_es_flag);
+    if (pipeline) pipeline->setFrameModle(mod, data_es_flag, crc_es_flag);
+}
+
+bool UpgradeManager::post(CMDRequest* req, int tx_timeout) {
+    const struct iovec* iov = req->rawIov();
+    bool ok = true;
 
     verbose(req);
-    if (req->protocol() == PROTOCOL::PROTO_FDL) {
-        if (!usbstream->sendSync(req->rawData(), req->rawDataLen(), tx_timeout)) {
-            std::cerr << "sendSync failed, req=" << req->toString() << std::endl;
-            return false;
-        }
+    if (req->protocol() == PROTOCOL::PROTO_PDL && pdl_split) {
+        for (int i = 0; ok && i < req->rawIovCnt(); i++)
+            ok = usbstream->sendSync(static_cast<uint8_t*>(iov[i].iov_base), iov[i].iov_len, tx_timeout);
     } else {
-        uint32_t txlen = 0;
+        ok = usbstream->sendvSync(iov, req->rawIovCnt(), tx_timeout);
+    }
 
-        if (!usbstream->sendSync(req->rawData() + txlen, sizeof(pdl_pkt_header), tx_timeout)) {
-            std::cerr << "sendSync failed, req=" << req->toString() << std::endl;
-            return false;
-        }
+    if (!ok) std::cerr << "sendSync failed, req=" << req->toString() << std::endl;
+    return ok;
+}
 
-        txlen += sizeof(pdl_pkt_header);
-        if (!usbstream->sendSync(req->rawData() + txlen, sizeof(pdl_pkt_tag), tx_timeout)) {
-            std::cerr << "sendSync failed, req=" << req->toString() << std::endl;
-            return false;
-        }
+bool UpgradeManager::wait(CMDRequest* req, CMDResponse* resp, int rx_timeout) {
+    uint32_t expect = req->replyLength();
+    uint32_t got = 0;
 
-        txlen += sizeof(pdl_pkt_tag);
-        if (txlen < req->rawDataLen() &&
-            !usbstream->sendSync(req->rawData() + txlen, req->rawDataLen() - txlen, tx_timeout)) {
-            std::cerr << "sendSync failed, req=" << req->toString() << std::endl;
+    resp->reset();
+
+    // the answer may already be left behind the last one
+    for (auto state = resp->push_back(nullptr, 0); state != RESP_STATE::RESP_STATE_OK;) {
+        if (state == RESP_STATE::RESP_STATE_VARIFY_FAIL) {
+            std::cerr << "bad response, req=" << req->toString() << std::endl;
             return false;
         }
-    }
 
-    if (!resp) return true;
+        // resync on whatever follows
+        if (state == RESP_STATE::RESP_STATE_MALFORMED) {
+            state = resp->push_back(nullptr, 0);
+            continue;
+        }
 
-    do {
-        if (!usbstream->recvSync(rx_timeout)) {
+        // read replies are taken in as few wakeups as the link allows
+        if (!usbstream->recvAtLeast(expect > got ? expect - got : 1, rx_timeout)) {
             std::cerr << "recvSync failed, req=" << req->toString() << std::endl;
             return false;
         }
-        resp->push_back(usbstream->data(), usbstream->datalen());
-
-        if (resp->rawDataLen() < resp->minLength()) continue;
-
-        // real length may much longgger if crc is escaped
-        if (resp->expectLength() <= resp->rawDataLen()) break;
-    } while (1);
+        got += usbstream->datalen();
+        state = resp->push_back(usbstream->data(), usbstream->datalen());
+    }
 
     verbose(resp, req->onWrite() || req->onRead());
 
     return true;
 }
 
+bool UpgradeManager::talk(CMDRequest* req, CMDResponse* resp, int rx_timeout, int tx_timeout) {
+    if (!post(req, tx_timeout)) return false;
+
+    return resp ? wait(req, resp, rx_timeout) : true;
+}
+
 int UpgradeManager::connect() {
     int max_try = 5;
 
@@ -167,6 +436,8 @@ int UpgradeManager::connect() {
     request.newConnect();
     if (!talk(&request, &response) || response.type() != REPTYPE::BSL_REP_ACK) goto _exit;
 
+    if (low_latency && !latency_tuned) tune_latency();
+
     return 0;
 
 _exit:
@@ -174,15 +445,167 @@ _exit:
     return -1;
 }
 
-int UpgradeManager::transfer(const XMLFileInfo& info, uint32_t maxlen) {
-    uint32_t filesz = info.use_pac_file ? firmware.member_file_size(info.fileid) : firmware.local_file_size(info.fpath);
-    std::ifstream fin = info.use_pac_file ? firmware.open_pac(info.fileid) : firmware.open_file(info.fpath);
+/**
+ * link idle is the time not spent in talk(), that is reading the pac and
+ * building frames when stop-and-wait, or waiting on the pipeline.
+ */
+static void report_link(const std::string& fileid, uint64_t filesz, std::chrono::steady_clock::duration total,
+                        std::chrono::steady_clock::duration busy) {
+    auto ms = [](std::chrono::steady_clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(d).count() / 1000.0;
+    };
 
+    if (total.count() <= 0) return;
+    std::cerr << fileid << ": " << filesz << " bytes in " << ms(total) << " ms, "
+              << static_cast<uint64_t>(filesz / (ms(total) / 1000.0) / 1024) << " KB/s, link idle " << ms(total - busy)
+              << " ms (" << static_cast<int>(100.0 * (total - busy).count() / total.count()) << "%)" << std::endl;
+}
+
+/**
+ * with a window, up to window frames are sent before the oldest ack is in.
+ * acks carry no sequence, they are matched to frames in order. the window
+ * doubles after WINDOW_PROBE_ACKS acks in a row up to the ceiling, it
+ * drops back to 1 for the rest of the session on any error.
+ */
+int UpgradeManager::transfer_pipelined(const XMLFileInfo& info, const byte_span& src, uint32_t maxlen, bool windowed,
+                                       bool& queued) {
+    uint64_t filesz = src.size;
+    auto begin = std::chrono::steady_clock::now();
+    auto last = begin;
+    std::chrono::steady_clock::duration busy(0);
+    FDLRequest* req = nullptr;
+    FDLRequest* posted = nullptr;
+    uint32_t cap = windowed ? window : 1;
+    uint32_t inflight = 0;
+    uint32_t acks = 0;
+    uint64_t acked = 0;
+    uint64_t dropped = 0;  // acked bytes already unmapped
+    bool ok = true;
+
+    queued = false;
+    pipeline->setArgString(info.fileid);
+    if (!pipeline->start(src, maxlen, info.crc16)) {
+        std::cerr << __func__ << " cannot start pipeline for " << info.fileid << std::endl;
+        return -1;
+    }
+
+    do {
+        auto t = std::chrono::steady_clock::now();
+
+        while (ok && inflight < cap && (req = pipeline->next())) {
+            ok = post(req);
+            posted = req;
+            inflight++;
+        }
+        if (!ok || !inflight) break;
+
+        ok = wait(posted, &response) && response.type() == REPTYPE::BSL_REP_ACK;
+        busy += std::chrono::steady_clock::now() - t;
+        if (!ok) break;
+
+        pipeline->release();
+        inflight--;
+
+        auto now = std::chrono::steady_clock::now();
+        uint32_t len = (filesz - acked > maxlen) ? maxlen : filesz - acked;
+        window_stats[cap].first += len;
+        window_stats[cap].second += now - last;
+        acked += len;
+        last = now;
+        if (acked - dropped >= MAP_WINDOW) {
+            FileMap::drop(src.data + dropped, src.data + acked);
+            dropped = acked;
+        }
+
+        if (windowed && ++acks >= WINDOW_PROBE_ACKS && cap < window_ceiling) {
+            cap = (cap * 2 > window_ceiling) ? window_ceiling : cap * 2;
+            window = cap;
+            acks = 0;
+        }
+    } while (1);
+
+    if (!ok) {
+        std::cerr << __func__ << " " << (posted ? posted->toString() : "") << " get unexpect response "
+                  << response.toString() << std::endl;
+
+        if (inflight > 1) {
+            uint32_t queued_acks = 0;
+            uint32_t lost = 0;
+
+            std::cerr << __func__ << " window " << cap << " failed, fall back to stop-and-wait" << std::endl;
+            profile.set(firmware.productName(), "midst_window_fail", cap);
+            window = window_ceiling = 1;
+            queued = true;
+
+            // frames still queued are answered too, see what the device made of them
+            for (; inflight > 1; inflight--) {
+                if (!wait(posted, &response, 1000)) {
+                    lost = inflight - 1;
+                    break;
+                }
+                if (response.type() == REPTYPE::BSL_REP_ACK)
+                    queued_acks++;
+                else
+                    std::cerr << __func__ << " queued frame answered " << response.toString() << std::endl;
+            }
+            if (lost) drain();
+
+            std::cerr << __func__ << " " << queued_acks << " queued frames acked, " << lost << " unanswered"
+                      << std::endl;
+        }
+
+        pipeline->stop();
+        return -1;
+    }
+
+    pipeline->stop();
+
+    if (windowed && cap > static_cast<uint32_t>(profile.get(firmware.productName(), "midst_window", 1)))
+        profile.set(firmware.productName(), "midst_window", cap);
+
+    report_link(info.fileid, filesz, std::chrono::steady_clock::now() - begin, busy);
+    return 0;
+}
+
+int UpgradeManager::transfer(const XMLFileInfo& info, uint32_t maxlen, bool windowed) {
+    bool queued = false;
+    int ret = transfer_once(info, maxlen, windowed, queued);
+
+    // the device may have dropped any of the queued frames, start over one by one
+    if (ret && queued) {
+        std::cerr << __func__ << " retry " << info.fileid << " without window" << std::endl;
+        ret = transfer_once(info, maxlen, false, queued);
+    }
+
+    return ret;
+}
+
+int UpgradeManager::transfer_once(const XMLFileInfo& info, uint32_t maxlen, bool windowed, bool& queued) {
+    FileMap local;  // info.fpath, if it is not in the pac
+    byte_span src;
     bool nv_replace_byte = false;
+    auto begin = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::duration busy(0);
+
+    if (info.use_pac_file)
+        src = firmware.member(info.fileid);
+    else if (local.map(info.fpath))
+        src = local.span(0, local.size());
+    if (!src.data) {
+        std::cerr << __func__ << " cannot read " << info.fileid << std::endl;
+        return -1;
+    }
 
-    ON_SCOPE_EXIT {
-        if (fin.is_open()) fin.close();
-    };
+    // addresses and lengths are 32-bit there, only partition names take the 64-bit form
+    if (info.use_old_proto && (src.size >> 32)) {
+        std::cerr << __func__ << " " << info.fileid << " has " << src.size << " bytes, too large to send by address" << std::endl;
+        return -1;
+    }
+
+    if (!pipeline && !reserve(maxlen)) {
+        std::cerr << __func__ << " no memory for frames of " << maxlen << std::endl;
+        return -1;
+    }
 
     if (info.use_old_proto)
         request.newStartData(info.base, info.realsize, info.checksum);
@@ -191,21 +614,59 @@ int UpgradeManager::transfer(const XMLFileInfo& info, uint32_t maxlen) {
 
     if (!talk(&request, &response) || response.type() != REPTYPE::BSL_REP_ACK) goto _exit;
 
-    do {
-        uint32_t txlen = (filesz > maxlen) ? maxlen : filesz;
-        firmware.read(fin, _data, txlen);
-        if (!nv_replace_byte && info.crc16) {
-            *reinterpret_cast<uint16_t*>(_data) = htobe16(info.crc16);
-            nv_replace_byte = true;
+    if (pipeline) {
+        if (transfer_pipelined(info, src, maxlen, windowed && window_ceiling > 1, queued)) {
+            if (!queued) return -1;
+
+            /**
+             * the download is still open on the device and fdl refuses a second
+             * START_DATA with BSL_REP_DOWN_MUTI_START, so end it before it is sent
+             * over. a short download is answered BSL_REP_DOWN_EARLY_END or an
+             * error, any answer closes it. with none its state is unknown, no retry
+             */
+            request.newEndData();
+            if (!talk(&request, &response, 30000)) {
+                drain();
+                queued = false;
+                goto _exit;
+            }
+            std::cerr << __func__ << " " << info.fileid << " ended early, " << response.toString() << std::endl;
+            return -1;
         }
-
-        request.newMidstData(_data, txlen);
-        request.setArgString(info.fileid);
-        if (!talk(&request, &response) || response.type() != REPTYPE::BSL_REP_ACK) goto _exit;
-
-        filesz -= txlen;
-    } while (filesz > 0);
-    firmware.close(fin);
+    } else {
+        uint64_t filesz = src.size;
+        const uint8_t* p = src.data;
+        const uint8_t* dropped = p;
+
+        do {
+            uint32_t txlen = (filesz > maxlen) ? maxlen : filesz;
+            const uint8_t* chunk = p;
+
+            // frames go straight from the mapping, only the chunk to change is copied
+            if (!nv_replace_byte && info.crc16) {
+                memcpy(_data, p, txlen);
+                *reinterpret_cast<uint16_t*>(_data) = htobe16(info.crc16);
+                chunk = _data;
+                nv_replace_byte = true;
+            }
+
+            request.newMidstData(chunk, txlen);
+            request.setArgString(info.fileid);
+
+            auto t = std::chrono::steady_clock::now();
+            if (!talk(&request, &response) || response.type() != REPTYPE::BSL_REP_ACK) goto _exit;
+            busy += std::chrono::steady_clock::now() - t;
+
+            p += txlen;
+            filesz -= txlen;
+            if (static_cast<uint64_t>(p - dropped) >= MAP_WINDOW) {
+                FileMap::drop(dropped, p);
+                dropped = p;
+            }
+        } while (filesz > 0);
+
+        report_link(info.fileid, src.size, std::chrono::steady_clock::now() - begin, busy);
+    }
 
     // this operation may take much more time, so set a much longger timeout
     request.newEndData();
@@ -218,43 +679,97 @@ _exit:
     return -1;
 }
 
-int UpgradeManager::exec() {
-    request.newExecData();
-    if (!talk(&request, &response) || response.type() != REPTYPE::BSL_REP_ACK) {
-        std::cerr << __func__ << " " << request.toString() << " get unexpect response " << response.toString()
-                  << std::endl;
-        return -1;
+/**
+ * fdl1 acks CHANGE_BAUD at the old rate and then switches, fdl2 keeps it.
+ * a CONNECT at the new rate tells if both sides agree, if not go back and
+ * try a slower one. BSL_REP_NOT_SUPPORT_BAUDRATE also moves on to the next.
+ */
+int UpgradeManager::change_baud() {
+    auto p = tty();
+    if (!p) return 0;
+
+    BAUD old = p->baud();
+
+    for (int b = static_cast<int>(baud_max); b > static_cast<int>(old); b--) {
+        bool answered = false;
+
+        request.newChangeBaud(static_cast<BAUD>(b));
+        request.setArgString(SerialPort::BaudARRSTR[b]);
+        answered = talk(&request, &response);
+        if (answered && response.type() == REPTYPE::BSL_REP_NOT_SUPPORT_BAUDRATE) continue;
+
+        // no answer may still mean it switched, so the new rate is checked anyway
+        if (answered && response.type() != REPTYPE::BSL_REP_ACK) {
+            std::cerr << __func__ << " not supported, keep " << SerialPort::BaudARRSTR[static_cast<int>(old)]
+                      << std::endl;
+            return 0;
+        }
+
+        p->setBaud(static_cast<BAUD>(b));
+        request.newConnect();
+        request.setArgString(SerialPort::BaudARRSTR[b]);
+        if (talk(&request, &response, 1000) && response.type() == REPTYPE::BSL_REP_ACK) {
+            std::cerr << __func__ << " to " << SerialPort::BaudARRSTR[b] << std::endl;
+            return 0;
+        }
+
+        p->setBaud(old);
+        request.newConnect();
+        request.setArgString(SerialPort::BaudARRSTR[static_cast<int>(old)]);
+        if (!talk(&request, &response, 1000) || response.type() != REPTYPE::BSL_REP_ACK) {
+            std::cerr << __func__ << " lost fdl1 at " << SerialPort::BaudARRSTR[b] << std::endl;
+            return -1;
+        }
     }
 
     return 0;
 }
 
-// NV should be processed specially
-void UpgradeManager::checksum(XMLFileInfo& info) {
-    auto fin = firmware.open_pac(info.fileid);
-    uint32_t fsz = firmware.member_file_size(info.fileid);
-    uint16_t crc = 0;
-    uint32_t cs = 0;
-    uint32_t skip = 2;
+uint32_t UpgradeManager::measure_rtt() {
+    std::vector<uint32_t> rtt;
 
-    firmware.read(fin, _data, skip);
-    fsz -= skip;
+    for (int i = 0; i < RTT_PROBES; i++) {
+        auto begin = std::chrono::steady_clock::now();
 
-    do {
-        uint32_t sz = (fsz > 4096) ? 4096 : fsz;
-        firmware.read(fin, _data, sz);
-        crc = request.crc16NV(crc, _data, sz);
+        request.newConnect();
+        if (!talk(&request, &response, 1000) || response.type() != REPTYPE::BSL_REP_ACK) return 0;
+        rtt.push_back(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin)
+                          .count());
+    }
+
+    std::sort(rtt.begin(), rtt.end());
+    return rtt[rtt.size() / 2];
+}
 
-        for (uint32_t i = 0; i < sz; i++) cs += _data[i];
+/**
+ * small frames such as fdl1 at FRAMESZ_BOOTCODE are bound by the ack round
+ * trip, not by the baud rate. connect is harmless to repeat at any stage.
+ */
+void UpgradeManager::tune_latency() {
+    auto p = tty();
+    uint32_t before, after;
 
-        fsz -= sz;
-    } while (fsz > 0);
-    firmware.close(fin);
+    if (!p) return;
+
+    latency_tuned = true;
+    before = measure_rtt();
+    if (!p->setLowLatency(true)) std::cerr << __func__ << " low latency profile only partly applied" << std::endl;
+    after = measure_rtt();
+
+    if (before && after)
+        std::cerr << __func__ << " connect round trip " << before << " us, " << after << " us with low latency"
+                  << std::endl;
+}
+
+int UpgradeManager::exec() {
+    request.newExecData();
+    if (!talk(&request, &response) || response.type() != REPTYPE::BSL_REP_ACK) {
+        std::cerr << __func__ << " " << request.toString() << " get unexpect response " << response.toString()
+                  << std::endl;
+        return -1;
+    }
 
-    cs += (crc & 0xff);
-    cs += (crc & 0xff00) >> 8;
-    info.checksum = cs;
-    info.crc16 = crc;
+    return 0;
 }
 
 std::string get_real_path(const std::string& pac) {
@@ -265,13 +780,14 @@ std::string get_real_path(const std::string& pac) {
 }
 
 int UpgradeManager::backup_partition(XMLFileInfo& info) {
-    uint32_t totalsz = 0;
-    uint32_t partitionsz = info.size;
-    std::string name = get_real_path(pac) + "/" + info.fileid + ".bak";
+    uint64_t totalsz = 0;
+    uint64_t partitionsz = info.size;
+    uint32_t framesz = info.use_old_proto ? FRAMESZ_DATA : read_size;
+    std::string name = get_real_path(firmware.pacPath()) + "/" + info.fileid +
+                       (backup_tag.empty() ? "" : "." + backup_tag) + ".bak";
     std::ofstream fout(name, std::ios::trunc);
 
-    request.setCrcModle(CRC_MODLE::CRC_FDL);
-    request.setEscapeFlag(false, false);
+    setFrameModle(CRC_MODLE::CRC_FDL, false, false);
     if (!fout.is_open()) {
         std::cerr << __func__ << " cannot backup partition " << info.fileid << "(" << info.blockid
                   << ") for fail to open(write) " << name << std::endl;
@@ -281,6 +797,11 @@ int UpgradeManager::backup_partition(XMLFileInfo& info) {
 
     ON_SCOPE_EXIT { fout.close(); };
 
+    if (info.use_old_proto && (partitionsz >> 32)) {
+        std::cerr << __func__ << " " << info.blockid << " is too large to read by address" << std::endl;
+        goto _exit;
+    }
+
     request.setArgString(info.fileid);
     if (!info.use_old_proto) {
         request.newStartRead(info.blockid, info.size);
@@ -289,7 +810,7 @@ int UpgradeManager::backup_partition(XMLFileInfo& info) {
     }
 
     do {
-        uint32_t sz = (partitionsz > FRAMESZ_DATA) ? FRAMESZ_DATA : partitionsz;
+        uint32_t sz = (partitionsz > framesz) ? framesz : partitionsz;
 
         if (info.use_old_proto)
             request.newReadFlash(info.base, sz, totalsz);
@@ -298,6 +819,13 @@ int UpgradeManager::backup_partition(XMLFileInfo& info) {
         request.setArgString(info.fileid);
         if (!talk(&request, &response) || response.type() != REPTYPE::BSL_REP_READ_FLASH) goto _exit;
 
+        // the backup is what nv is restored from, a short answer is no backup
+        if (response.dataLen() != sz) {
+            std::cerr << __func__ << " asked " << sz << " bytes at " << totalsz << ", got " << response.dataLen()
+                      << std::endl;
+            goto _exit;
+        }
+
         fout.write(reinterpret_cast<char*>(response.data()), response.dataLen());
         partitionsz -= sz;
         totalsz += sz;
@@ -317,23 +845,35 @@ _exit:
 int UpgradeManager::flash_pdl(const XMLFileInfo& info) {
     PDLRequest req;
     PDLResponse resp;
-    uint32_t filesz = info.realsize;
-    std::ifstream fin = firmware.open_pac(info.fileid);
+    byte_span src = firmware.member(info.fileid);
+    uint64_t filesz = info.realsize;
+    const uint8_t* p = src.data;
 
-    ON_SCOPE_EXIT { firmware.close(fin); };
+    // pdl takes a 32-bit size, and is never near that large
+    if (!src.data || src.size < filesz || (filesz >> 32)) goto _exit;
 
+    // a whole frame in one submission, unless this chipset is known to want it split
+    pdl_split = !!profile.get(firmware.productName(), "pdl_split", 0);
     req.newPDLConnect();
-    if (!talk(&req, &resp, 15000, 15000) || resp.type() != PDLREP::PDL_RSP_ACK) goto _exit;
+    if (!talk(&req, &resp, 15000, 15000)) {
+        if (pdl_split) goto _exit;
+
+        std::cerr << __func__ << " no answer, send pdl frames split" << std::endl;
+        pdl_split = true;
+        if (!talk(&req, &resp, 15000, 15000)) goto _exit;
+        profile.set(firmware.productName(), "pdl_split", 1);
+    }
+    if (resp.type() != PDLREP::PDL_RSP_ACK) goto _exit;
 
     req.newPDLStart(info.base, info.realsize);
     if (!talk(&req, &resp) || resp.type() != PDLREP::PDL_RSP_ACK) goto _exit;
 
     do {
         uint32_t txlen = (filesz > FRAMESZ_PDL) ? FRAMESZ_PDL : filesz;
-        firmware.read(fin, _data, txlen);
-        req.newPDLMidst(_data, txlen);
+        req.newPDLMidst(p, txlen);
         if (!talk(&req, &resp) || resp.type() != PDLREP::PDL_RSP_ACK) goto _exit;
 
+        p += txlen;
         filesz -= txlen;
     } while (filesz > 0);
 
@@ -351,8 +891,7 @@ _exit:
 }
 
 int UpgradeManager::flash_fdl(const XMLFileInfo& info) {
-    request.setCrcModle(CRC_MODLE::CRC_BOOTCODE);
-    request.setEscapeFlag(true, true);
+    setFrameModle(CRC_MODLE::CRC_BOOTCODE, true, true, true);
 
     if (connect()) goto _exit;
 
@@ -368,15 +907,18 @@ _exit:
 int UpgradeManager::flash_nand_fdl(const XMLFileInfo& info) {
     int ret;
 
-    request.setCrcModle(CRC_MODLE::CRC_FDL);
-    request.setEscapeFlag(true, true);
+    setFrameModle(CRC_MODLE::CRC_FDL, true, true, true);
 
     if (connect()) goto _exit;
+    if (change_baud()) goto _exit;
 
     request.setArgString(info.fileid);
     if (transfer(info, FRAMESZ_FDL)) goto _exit;
 
     ret = exec();
+
+    // fdl2 answers from here on, with its own crc only
+    setFrameModle(CRC_MODLE::CRC_FDL, true, true);
     if (!ret) return 0;
 
     request.setArgString("");
@@ -393,16 +935,16 @@ _exit:
 }
 
 int UpgradeManager::flash_partition(const XMLFileInfo& info) {
-    request.setCrcModle(CRC_MODLE::CRC_FDL);
-    request.setEscapeFlag(info.use_old_proto, info.use_old_proto);
+    setFrameModle(CRC_MODLE::CRC_FDL, info.use_old_proto, info.use_old_proto);
     request.setArgString(info.fileid);
 
-    return transfer(info, info.use_old_proto ? FRAMESZ_PDL : FRAMESZ_DATA);
+    if (info.use_old_proto) return transfer(info, FRAMESZ_PDL, true);
+
+    return transfer(info, midst_size, true);
 }
 
 int UpgradeManager::erase_partition(const XMLFileInfo& info) {
-    request.setCrcModle(CRC_MODLE::CRC_FDL);
-    request.setEscapeFlag(info.use_old_proto, info.use_old_proto);
+    setFrameModle(CRC_MODLE::CRC_FDL, info.use_old_proto, info.use_old_proto);
 
     if (info.use_old_proto)
         request.newErasePartition(info.base);
@@ -421,15 +963,15 @@ int UpgradeManager::upgrade(bool backup) {
         goto _exit;
     }
 
-    if (usbstream->physicalLink() == USBLINK::USBLINK_TTY) {
-        auto p = reinterpret_cast<SerialPort*>(usbstream.get());
-        p->setBaud(BAUD::BAUD115200);
+    if (tty()) {
+        tty()->setBaud(BAUD::BAUD115200);
     } else {
-        auto p = reinterpret_cast<USBFS*>(usbstream.get());
+        auto p = static_cast<USBFS*>(usbstream.get());
         if (firmware.productName() == "UIX8910_MODEM") p->setInterface();
 
         if (firmware.productName() == "UDX710_MODEM") p->sciu2sMessage();
     }
+    init_window();
 
     // FDL
     for (auto iter = filevec.begin(); iter != filevec.end();) {
@@ -449,6 +991,8 @@ int UpgradeManager::upgrade(bool backup) {
             iter++;
         }
     }
+    init_framesz();
+    if (negotiate_framesz(filevec)) goto _exit;
 
     // Bakeup
     for (auto iter = filevec.begin(); iter != filevec.end(); iter++) {
@@ -481,11 +1025,9 @@ int UpgradeManager::upgrade(bool backup) {
             if (erase_partition(*iter)) goto _exit;
         } else if (string_case_cmp(iter->type, "NV_COMM")) {
             iter->use_old_proto = false;
-            checksum(*iter);
             if (flash_partition(*iter)) goto _exit;
         } else if (string_case_cmp(iter->type, "NV")) {
             iter->use_old_proto = true;
-            checksum(*iter);
             if (flash_partition(*iter)) goto _exit;
         } else if (string_case_cmp(iter->type, "CODE")) {
             if (string_case_cmp(iter->fileid, "PhaseCheck")) continue;
@@ -506,10 +1048,16 @@ int UpgradeManager::upgrade(bool backup) {
     request.newNormalReset();
     talk(&request, &response);
 
+    report_window();
+    report_tty();
+    profile.save();
     std::cerr << __func__ << " success" << std::endl;
     return 0;
 
 _exit:
+    report_window();
+    report_tty();
+    profile.save();
     std::cerr << __func__ << " fail" << std::endl;
     return -1;
 }
@@ -0,0 +1,282 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-17 21:40:12
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-17 21:40:12
+ * @Description: tty driven through io_uring
+ */
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+extern "C" {
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+}
+
+#include "uring.hpp"
+
+// user_data of the sqes, timeouts are only reaped
+#define TAG_WRITE 1
+#define TAG_READ 2
+#define TAG_TIMEOUT 3
+
+UringPort::UringPort(const std::string &tty)
+    : SerialPort(tty, USBLINK::USBLINK_TTY_URING),
+      ringfd(-1),
+      fixed(false),
+      sqmap(MAP_FAILED),
+      sqmap_sz(0),
+      cqmap(MAP_FAILED),
+      cqmap_sz(0),
+      sqes(static_cast<struct io_uring_sqe *>(MAP_FAILED)),
+      sqes_sz(0),
+      txbuf(nullptr),
+      txlen(0),
+      to_submit(0),
+      inflight(0),
+      tx_res(0),
+      rx_res(0),
+      enters(0) {
+    txbuf = new (std::nothrow) uint8_t[URING_TXBUF];
+    if (!isOpened() || !txbuf || !setup()) {
+        teardown();
+        std::cerr << "io_uring not available, " << usb_device << " falls back to epoll" << std::endl;
+        return;
+    }
+
+    // the ring waits for the tty itself, with O_NONBLOCK reads would end in EAGAIN
+    fcntl(ttyfd, F_SETFL, fcntl(ttyfd, F_GETFL) & ~O_NONBLOCK);
+    std::cerr << "serial " << usb_device << " on io_uring" << (fixed ? ", registered buffers" : "") << std::endl;
+}
+
+UringPort::~UringPort() {
+    // the last frame may still be queued
+    flush();
+    teardown();
+
+    if (txbuf) delete[] txbuf;
+    txbuf = nullptr;
+}
+
+bool UringPort::setup() {
+    struct io_uring_params params;
+    struct iovec bufs[2];
+
+    memset(&params, 0, sizeof(params));
+    ringfd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ringfd < 0) {
+        std::cerr << "io_uring_setup fails, error=" << strerror(errno) << std::endl;
+        return false;
+    }
+
+    sqmap_sz = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    cqmap_sz = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) sqmap_sz = cqmap_sz = std::max(sqmap_sz, cqmap_sz);
+
+    sqmap = mmap(nullptr, sqmap_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+    if (sqmap == MAP_FAILED) goto _exit;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        cqmap = sqmap;
+    else
+        cqmap = mmap(nullptr, cqmap_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_CQ_RING);
+    if (cqmap == MAP_FAILED) goto _exit;
+
+    sqes_sz = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes = static_cast<struct io_uring_sqe *>(
+        mmap(nullptr, sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQES));
+    if (sqes == MAP_FAILED) goto _exit;
+
+    sq_tail = reinterpret_cast<uint32_t *>(static_cast<uint8_t *>(sqmap) + params.sq_off.tail);
+    sq_mask = reinterpret_cast<uint32_t *>(static_cast<uint8_t *>(sqmap) + params.sq_off.ring_mask);
+    sq_array = reinterpret_cast<uint32_t *>(static_cast<uint8_t *>(sqmap) + params.sq_off.array);
+    cq_head = reinterpret_cast<uint32_t *>(static_cast<uint8_t *>(cqmap) + params.cq_off.head);
+    cq_tail = reinterpret_cast<uint32_t *>(static_cast<uint8_t *>(cqmap) + params.cq_off.tail);
+    cq_mask = reinterpret_cast<uint32_t *>(static_cast<uint8_t *>(cqmap) + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<struct io_uring_cqe *>(static_cast<uint8_t *>(cqmap) + params.cq_off.cqes);
+
+    // pinned once instead of on every read and write, plain ones do if it is refused
+    bufs[0].iov_base = rxbuf;
+    bufs[0].iov_len = SERIAL_RX_BUF;
+    bufs[1].iov_base = txbuf;
+    bufs[1].iov_len = URING_TXBUF;
+    fixed = !syscall(__NR_io_uring_register, ringfd, IORING_REGISTER_BUFFERS, bufs, 2);
+    if (!fixed) std::cerr << "io_uring buffers not registered, error=" << strerror(errno) << std::endl;
+
+    return true;
+
+_exit:
+    std::cerr << "io_uring mmap fails, error=" << strerror(errno) << std::endl;
+    return false;
+}
+
+void UringPort::teardown() {
+    if (sqes != MAP_FAILED) munmap(sqes, sqes_sz);
+    if (cqmap != MAP_FAILED && cqmap != sqmap) munmap(cqmap, cqmap_sz);
+    if (sqmap != MAP_FAILED) munmap(sqmap, sqmap_sz);
+    sqes = static_cast<struct io_uring_sqe *>(MAP_FAILED);
+    cqmap = sqmap = MAP_FAILED;
+
+    if (ringfd >= 0) close(ringfd);
+    ringfd = -1;
+}
+
+// at most a write and a read, each with its timeout, are prepared at once
+struct io_uring_sqe *UringPort::prep(uint8_t op, uint64_t tag) {
+    uint32_t tail = *sq_tail;
+    uint32_t i = tail & *sq_mask;
+    struct io_uring_sqe *sqe = &sqes[i];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->user_data = tag;
+    sq_array[i] = i;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    to_submit++;
+
+    return sqe;
+}
+
+void UringPort::prep_timed(uint8_t op, uint64_t tag, uint8_t *buf, uint32_t len, int bufidx,
+                           struct __kernel_timespec *ts, uint32_t ms) {
+    struct io_uring_sqe *sqe;
+
+    if (fixed) op = (op == IORING_OP_READ) ? IORING_OP_READ_FIXED : IORING_OP_WRITE_FIXED;
+
+    sqe = prep(op, tag);
+    sqe->fd = ttyfd;
+    sqe->addr = reinterpret_cast<uint64_t>(buf);
+    sqe->len = len;
+    sqe->buf_index = fixed ? bufidx : 0;
+    sqe->flags = IOSQE_IO_LINK;
+
+    ts->tv_sec = ms / 1000;
+    ts->tv_nsec = (ms % 1000) * 1000000LL;
+    sqe = prep(IORING_OP_LINK_TIMEOUT, TAG_TIMEOUT);
+    sqe->addr = reinterpret_cast<uint64_t>(ts);
+    sqe->len = 1;
+}
+
+bool UringPort::enter() {
+    while (to_submit || inflight) {
+        int ret = syscall(__NR_io_uring_enter, ringfd, to_submit, to_submit + inflight, IORING_ENTER_GETEVENTS,
+                          nullptr, 0);
+
+        enters++;
+        if (ret < 0 && errno != EINTR) {
+            std::cerr << "io_uring_enter fails, error=" << strerror(errno) << std::endl;
+            return false;
+        }
+
+        if (ret > 0) {
+            to_submit -= ret;
+            inflight += ret;
+        }
+
+        uint32_t head = *cq_head;
+        uint32_t tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &cqes[head & *cq_mask];
+
+            if (cqe->user_data == TAG_WRITE) tx_res = cqe->res;
+            if (cqe->user_data == TAG_READ) rx_res = cqe->res;
+            inflight--;
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return true;
+}
+
+bool UringPort::flush() {
+    bool ok;
+
+    if (!txlen) return true;
+
+    ok = enter() && tx_res == static_cast<int>(txlen);
+    if (!ok)
+        std::cerr << "uring write failed, write " << std::dec << (tx_res > 0 ? tx_res : 0) << "/" << txlen
+                  << " bytes, for " << (tx_res == -ECANCELED ? "timeout" : strerror(-tx_res)) << std::endl;
+
+    tx_bytes += tx_res > 0 ? tx_res : 0;
+    txlen = 0;
+    return ok;
+}
+
+bool UringPort::sendvSync(const struct iovec *iov, int iovcnt, uint32_t timeout) {
+    uint32_t total = 0;
+
+    if (ringfd < 0) return SerialPort::sendvSync(iov, iovcnt, timeout);
+
+    // txbuf is the kernel's until the last write is reaped
+    if (!flush()) return false;
+
+    for (int i = 0; i < iovcnt; i++) total += iov[i].iov_len;
+    if (total == 0) return true;
+    if (total > URING_TXBUF) return SerialPort::sendvSync(iov, iovcnt, timeout);
+
+    total = 0;
+    for (int i = 0; i < iovcnt; total += iov[i].iov_len, i++) memcpy(txbuf + total, iov[i].iov_base, iov[i].iov_len);
+
+    txlen = total;
+    tx_res = 0;
+    prep_timed(IORING_OP_WRITE, TAG_WRITE, txbuf, total, 1, &tx_ts, timeout);
+
+    return true;
+}
+
+/**
+ * same as SerialPort::recvAtLeast, the wait is the read itself. a read cut
+ * by its timeout means the line was quiet for long enough.
+ */
+bool UringPort::recvAtLeast(uint32_t len, uint32_t timeout) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+    if (ringfd < 0) return SerialPort::recvAtLeast(len, timeout);
+
+    _rxdata = rxbuf;
+    _reallen = 0;
+    if (len > SERIAL_RX_BUF) len = SERIAL_RX_BUF;
+
+    while (_reallen < len) {
+        auto left = deadline - std::chrono::steady_clock::now();
+        int ms = std::chrono::duration_cast<std::chrono::milliseconds>(left).count();
+
+        if (ms < 0) ms = 0;
+        if (_reallen && ms > SERIAL_RX_IDLE) ms = SERIAL_RX_IDLE;
+
+        rx_res = 0;
+        prep_timed(IORING_OP_READ, TAG_READ, rxbuf + _reallen, SERIAL_RX_BUF - _reallen, 0, &rx_ts, ms);
+        if (!enter()) return false;
+
+        // the write went in with the first read
+        if (txlen && !flush()) return false;
+
+        if (rx_res == -ECANCELED || rx_res == -EINTR) break;
+        if (rx_res <= 0) {
+            std::cerr << __func__ << " read " << std::dec << rx_res << " bytes, err "
+                      << (rx_res ? strerror(-rx_res) : "hangup") << std::endl;
+            return false;
+        }
+
+        _reallen += rx_res;
+        rx_bytes += rx_res;
+        rx_reads++;
+    }
+
+    if (_reallen == 0) std::cerr << "uring read timeout(" << timeout << "ms)" << std::endl;
+
+    return _reallen > 0;
+}
+
+void UringPort::reportIo() {
+    SerialPort::reportIo();
+
+    if (ringfd >= 0)
+        std::cerr << "uring tx " << tx_bytes / 1024 << " KB, " << enters << " io_uring_enter in all" << std::endl;
+}
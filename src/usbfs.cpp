@@ -6,10 +6,13 @@
  * @Description: file content
  */
 #include <iostream>
+#include <algorithm>
 
 extern "C" {
 #include <unistd.h>
+#include <sys/epoll.h>
 #include <sys/fcntl.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <errno.h>
 #include <string.h>
@@ -26,7 +29,19 @@ extern "C" {
 #include "usbfs.hpp"
 
 USBFS::USBFS(const std::string &devpath, int ifno, int epin, int epout)
-    : USBStream(devpath, USBLINK::USBLINK_USBFS), interface_no(ifno), endpoint_in(epin), endpoint_out(epout) {
+    : USBStream(devpath, USBLINK::USBLINK_USBFS),
+      interface_no(ifno),
+      endpoint_in(epin),
+      endpoint_out(epout),
+      epfd(-1),
+      nout(0),
+      nin(0),
+      urbs(nullptr),
+      urbmem(nullptr),
+      urbmem_mapped(false),
+      in_lent(nullptr),
+      pending(0),
+      urb_failed(false) {
     usbfd = open(devpath.c_str(), O_RDWR | O_NOCTTY);
     if (usbfd < 0) return;
 
@@ -40,6 +55,8 @@ USBFS::USBFS(const std::string &devpath, int ifno, int epin, int epout)
 }
 
 USBFS::~USBFS() {
+    async_stop();
+
     if (usbfd > 0) {
         usbfs_release_interface();
         close(usbfd);
@@ -99,6 +116,12 @@ bool USBFS::sendSync(uint8_t *data, uint32_t len, uint32_t timeout) {
 
     if (!isOpened()) return false;
 
+    if (nout && !urbs) async_start();
+    if (nout) {
+        struct iovec iov = {data, len};
+        return sendvSync(&iov, 1, timeout);
+    }
+
     do {
         int sz = (len > MAX_USBFS_BULK_SIZE) ? MAX_USBFS_BULK_SIZE : len;
         struct usbdevfs_bulktransfer bulk;
@@ -121,6 +144,49 @@ bool USBFS::sendSync(uint8_t *data, uint32_t len, uint32_t timeout) {
     return true;
 }
 
+/**
+ * the frame is copied into OUT urbs of up to MAX_USBFS_BULK_SIZE, all but
+ * the first are bulk continuations, so the device sees one transfer and
+ * the rest is cancelled if one fails.
+ */
+bool USBFS::sendvSync(const struct iovec *iov, int iovcnt, uint32_t timeout) {
+    int i = 0;
+    size_t off = 0;
+    bool first = true;
+
+    if (nout && !urbs) async_start();
+    if (!nout) return USBStream::sendvSync(iov, iovcnt, timeout);
+    if (!isOpened()) return false;
+
+    do {
+        struct usbdevfs_urb *urb;
+        int len = 0;
+
+        while (out_free.empty())
+            if (!reap(timeout)) return false;
+        urb = out_free.front();
+        out_free.pop_front();
+
+        for (; i < iovcnt && len < MAX_USBFS_BULK_SIZE; off = 0, i++) {
+            size_t n = std::min<size_t>(iov[i].iov_len - off, MAX_USBFS_BULK_SIZE - len);
+
+            memcpy(static_cast<uint8_t *>(urb->buffer) + len, static_cast<uint8_t *>(iov[i].iov_base) + off, n);
+            len += n;
+            off += n;
+            if (off < iov[i].iov_len) break;
+        }
+        // nothing but empty segments left, they need no urb
+        while (i < iovcnt && !off && !iov[i].iov_len) i++;
+
+        urb->buffer_length = len;
+        urb->flags = first ? 0 : USBDEVFS_URB_BULK_CONTINUATION;
+        first = false;
+        if (!submit(urb)) return false;
+    } while (i < iovcnt);
+
+    return true;
+}
+
 bool USBFS::recvSync(uint32_t timeout) {
     struct usbdevfs_bulktransfer bulk;
     int n;
@@ -128,6 +194,25 @@ bool USBFS::recvSync(uint32_t timeout) {
 
     if (!isOpened()) return false;
 
+    if (nin && !urbs) async_start();
+    if (nin) {
+        // data() is lent from the urb, not copied, so it goes back only now
+        if (in_lent && !submit(in_lent)) urb_failed = true;
+        in_lent = nullptr;
+        _rxdata = _data;
+        _reallen = 0;
+
+        while (in_done.empty())
+            if (!reap(timeout)) return false;
+
+        in_lent = in_done.front();
+        in_done.pop_front();
+        _rxdata = static_cast<uint8_t *>(in_lent->buffer);
+        _reallen = in_lent->actual_length;
+
+        return true;
+    }
+
     bulk.ep = endpoint_in;
     bulk.len = sz;
     bulk.data = _data;
@@ -174,4 +259,156 @@ int USBFS::usbfs_claim_interface() { return ioctl(usbfd, USBDEVFS_CLAIMINTERFACE
 
 int USBFS::usbfs_release_interface() { return ioctl(usbfd, USBDEVFS_CLAIMINTERFACE, &interface_no); }
 
-int USBFS::usbfs_max_packet_len() { return MAX_USBFS_BULK_SIZE; }
\ No newline at end of file
+int USBFS::usbfs_max_packet_len() { return MAX_USBFS_BULK_SIZE; }
+
+bool USBFS::submit(struct usbdevfs_urb *urb) {
+    urb->status = 0;
+    urb->actual_length = 0;
+    if (ioctl(usbfd, USBDEVFS_SUBMITURB, urb) < 0) {
+        std::cerr << __func__ << " ep 0x" << std::hex << static_cast<int>(urb->endpoint) << std::dec << " fail, for "
+                  << strerror(errno) << std::endl;
+        return false;
+    }
+
+    pending++;
+    return true;
+}
+
+bool USBFS::reap(uint32_t timeout) {
+    struct usbdevfs_urb *urb = nullptr;
+    struct epoll_event event;
+    int num = epoll_wait(epfd, &event, 1, timeout);
+    bool ok = true;
+
+    if (num == 0) {
+        std::cerr << __func__ << " timeout(" << timeout << "ms)" << std::endl;
+        return false;
+    } else if (num < 0) {
+        std::cerr << __func__ << " epoll fail for " << strerror(errno) << std::endl;
+        return false;
+    } else if (event.events & (EPOLLERR | EPOLLHUP)) {
+        std::cerr << __func__ << " usbfs gone, events 0x" << std::hex << event.events << std::dec << std::endl;
+        return false;
+    }
+
+    while (ioctl(usbfd, USBDEVFS_REAPURBNDELAY, &urb) == 0) {
+        pending--;
+
+        // continuations behind a failed OUT urb come back cancelled, the failed one is reported already
+        if (urb->status && !((urb->flags & USBDEVFS_URB_BULK_CONTINUATION) &&
+                             (urb->status == -EREMOTEIO || urb->status == -ECONNRESET))) {
+            std::cerr << __func__ << " ep 0x" << std::hex << static_cast<int>(urb->endpoint) << std::dec
+                      << " status " << urb->status << std::endl;
+            ok = false;
+        }
+
+        // a halted endpoint completes no urb until cleared
+        if (urb->status == -EPIPE) {
+            unsigned int ep = urb->endpoint;
+            ioctl(usbfd, USBDEVFS_CLEAR_HALT, &ep);
+        }
+
+        if (!(urb->endpoint & USB_DIR_IN)) {
+            out_free.push_back(urb);
+        } else if (urb->status || !urb->actual_length) {
+            // failed or zlp, nothing to hand out. it goes back, or IN urbs run out
+            if (!submit(urb)) urb_failed = true;
+        } else {
+            in_done.push_back(urb);
+        }
+    }
+
+    if (urb_failed) ok = false;
+    urb_failed = false;
+
+    return ok;
+}
+
+void USBFS::setAsync(uint32_t outurbs, uint32_t inurbs) {
+    async_stop();
+    nout = outurbs;
+    nin = inurbs;
+}
+
+void USBFS::async_start() {
+    struct epoll_event event;
+
+    if (urbs || !isOpened()) return;
+
+    epfd = epoll_create(1);
+    memset(&event, 0, sizeof(event));
+    event.data.fd = usbfd;
+    event.events = EPOLLOUT;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, usbfd, &event)) {
+        std::cerr << "epoll_ctl EPOLL_CTL_ADD fails, usbfd=" << usbfd << ", error=" << strerror(errno) << std::endl;
+        goto _exit;
+    }
+
+    urbs = new (std::nothrow) struct usbdevfs_urb[nout + nin];
+    if (!urbs) goto _exit;
+    memset(urbs, 0, sizeof(*urbs) * (nout + nin));
+
+    /**
+     * memory mapped from usbfd is DMA-able, urbs in it are not copied by the
+     * kernel. before linux 4.6 mmap fails and the buffers come from heap.
+     */
+    urbmem = static_cast<uint8_t *>(
+        mmap(nullptr, (nout + nin) * MAX_USBFS_BULK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, usbfd, 0));
+    urbmem_mapped = urbmem != MAP_FAILED;
+    if (!urbmem_mapped) {
+        std::cerr << "usbfs mmap fail for " << strerror(errno) << ", urbs will be copied" << std::endl;
+        urbmem = new (std::nothrow) uint8_t[(nout + nin) * MAX_USBFS_BULK_SIZE];
+        if (!urbmem) goto _exit;
+    }
+
+    for (uint32_t i = 0; i < nout + nin; i++) {
+        urbs[i].type = USBDEVFS_URB_TYPE_BULK;
+        urbs[i].endpoint = i < nout ? endpoint_out : endpoint_in;
+        urbs[i].buffer = urbmem + i * MAX_USBFS_BULK_SIZE;
+        urbs[i].buffer_length = MAX_USBFS_BULK_SIZE;
+    }
+
+    for (uint32_t i = 0; i < nout; i++) out_free.push_back(&urbs[i]);
+    // IN urbs stay queued all the time, so the device never waits for us
+    for (uint32_t i = nout; i < nout + nin; i++)
+        if (!submit(&urbs[i])) goto _exit;
+
+    std::cerr << "usbfs async, " << nout << " OUT and " << nin << " IN urbs" << (urbmem_mapped ? ", zero-copy" : "")
+              << std::endl;
+    return;
+
+_exit:
+    std::cerr << __func__ << " fail, back to blocking transfers" << std::endl;
+    setAsync(0, 0);
+}
+
+void USBFS::async_stop() {
+    struct usbdevfs_urb *urb = nullptr;
+
+    if (urbs) {
+        // not submitted ones just get EINVAL
+        for (uint32_t i = 0; i < nout + nin; i++) ioctl(usbfd, USBDEVFS_DISCARDURB, &urbs[i]);
+        for (; pending > 0; pending--)
+            if (ioctl(usbfd, USBDEVFS_REAPURB, &urb) < 0) break;
+
+        delete[] urbs;
+        urbs = nullptr;
+    }
+
+    if (urbmem && urbmem_mapped)
+        munmap(urbmem, (nout + nin) * MAX_USBFS_BULK_SIZE);
+    else if (urbmem)
+        delete[] urbmem;
+    urbmem = nullptr;
+    urbmem_mapped = false;
+
+    pending = 0;
+    in_lent = nullptr;
+    _rxdata = _data;
+    urb_failed = false;
+    out_free.clear();
+    in_done.clear();
+
+    if (epfd > 0) close(epfd);
+    epfd = -1;
+}
\ No newline at end of file
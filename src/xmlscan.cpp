@@ -0,0 +1,283 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-17 22:10:05
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-17 22:10:05
+ * @Description: xml read token by token, no document is built
+ */
+#include <cstddef>
+#include <cstring>
+
+#include "xmlscan.hpp"
+
+// what isspace and isalpha take in the c locale, without the calls
+static inline bool is_space(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+
+static inline bool is_name_start(char c) {
+    unsigned char ch = static_cast<unsigned char>(c);
+    return ch >= 0x80 || ((ch | 0x20) >= 'a' && (ch | 0x20) <= 'z') || ch == ':' || ch == '_';
+}
+
+static inline bool is_name_char(char c) { return is_name_start(c) || (c >= '0' && c <= '9') || c == '.' || c == '-'; }
+
+static const char *find(const char *from, const char *to, const char *marker) {
+    size_t n = strlen(marker);
+
+    for (; to - from >= static_cast<ptrdiff_t>(n); from++)
+        if (*from == *marker && !memcmp(from, marker, n)) return from;
+    return nullptr;
+}
+
+static void append_utf8(unsigned long ucs, std::string &out) {
+    if (ucs < 0x80) {
+        out += static_cast<char>(ucs);
+    } else if (ucs < 0x800) {
+        out += static_cast<char>(0xc0 | (ucs >> 6));
+        out += static_cast<char>(0x80 | (ucs & 0x3f));
+    } else if (ucs < 0x10000) {
+        out += static_cast<char>(0xe0 | (ucs >> 12));
+        out += static_cast<char>(0x80 | ((ucs >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (ucs & 0x3f));
+    } else if (ucs < 0x200000) {
+        out += static_cast<char>(0xf0 | (ucs >> 18));
+        out += static_cast<char>(0x80 | ((ucs >> 12) & 0x3f));
+        out += static_cast<char>(0x80 | ((ucs >> 6) & 0x3f));
+        out += static_cast<char>(0x80 | (ucs & 0x3f));
+    }
+}
+
+// &#nn; or &#xhh; at p, the byte after it, nullptr if it is none
+static const char *char_ref(const char *p, const char *to, std::string &out) {
+    const char *semi = static_cast<const char *>(memchr(p, ';', to - p));
+    bool hex = p + 2 < to && p[2] == 'x';
+    unsigned long ucs = 0;
+
+    if (!semi || p + 2 >= to) return nullptr;
+
+    for (const char *q = p + (hex ? 3 : 2); q < semi; q++) {
+        if (*q >= '0' && *q <= '9')
+            ucs = ucs * (hex ? 16 : 10) + (*q - '0');
+        else if (hex && *q >= 'a' && *q <= 'f')
+            ucs = ucs * 16 + (*q - 'a' + 10);
+        else if (hex && *q >= 'A' && *q <= 'F')
+            ucs = ucs * 16 + (*q - 'A' + 10);
+        else
+            return nullptr;
+    }
+
+    append_utf8(ucs, out);
+    return semi + 1;
+}
+
+XMLScanner::XMLScanner(const char *data, size_t len)
+    : p(data),
+      end(data + len),
+      nattrs(0),
+      depth(0),
+      _level(0),
+      closing(false),
+      prolog(true) {
+    // tinyxml2 stops at the first 0 too, a member may be padded with them
+    const char *nul = len ? static_cast<const char *>(memchr(data, 0, len)) : nullptr;
+    if (nul) end = nul;
+
+    while (p < end && is_space(*p)) p++;
+    if (end - p >= 3 && !memcmp(p, "\xef\xbb\xbf", 3)) p += 3;
+    if (p >= end) _error = "empty document";
+}
+
+XMLTOKEN XMLScanner::fail(const std::string &why) {
+    _error = why + ", at byte " + std::to_string(end - p) + " from the end";
+    p = end;
+    depth = 0;
+    return XMLTOKEN::XML_ERROR;
+}
+
+bool XMLScanner::name(std::string &out) {
+    const char *start = p;
+
+    if (p >= end || !is_name_start(*p)) return false;
+    while (p < end && is_name_char(*p)) p++;
+    out.assign(start, p);
+    return true;
+}
+
+void XMLScanner::decode(const char *from, const char *to, std::string &out, bool entities) {
+    static const struct {
+        const char *pattern;
+        size_t len;
+        char value;
+    } table[] = {{"quot", 4, '"'}, {"amp", 3, '&'}, {"apos", 4, '\''}, {"lt", 2, '<'}, {"gt", 2, '>'}};
+
+    out.clear();
+    while (from < to) {
+        const char *q = from;
+
+        // plain runs go in one append
+        while (q < to && *q != '\r' && *q != '\n' && (*q != '&' || !entities)) q++;
+        out.append(from, q);
+        if (q == to) break;
+        from = q;
+
+        if (*from == '\r' || *from == '\n') {
+            // crlf, lfcr and a lone cr are all lf
+            char other = (*from == '\r') ? '\n' : '\r';
+            from += (from + 1 < to && from[1] == other) ? 2 : 1;
+            out += '\n';
+            continue;
+        }
+
+        if (from + 1 < to && from[1] == '#') {
+            const char *next = char_ref(from, to, out);
+            if (next) {
+                from = next;
+                continue;
+            }
+        } else {
+            bool found = false;
+            for (auto &e : table) {
+                if (static_cast<size_t>(to - from) > e.len + 1 && !memcmp(from + 1, e.pattern, e.len) &&
+                    from[e.len + 1] == ';') {
+                    out += e.value;
+                    from += e.len + 2;
+                    found = true;
+                    break;
+                }
+            }
+            if (found) continue;
+        }
+
+        // unknown, kept as is
+        out += *from++;
+    }
+}
+
+XMLTOKEN XMLScanner::markup(const char *open_marker, const char *close_marker, XMLTOKEN token) {
+    const char *from = p + strlen(open_marker);
+    const char *stop = find(from, end, close_marker);
+
+    if (!stop) return fail(std::string("no ") + close_marker + " after " + open_marker);
+
+    // entities are left alone here, cdata included
+    decode(from, stop, _text, false);
+    p = stop + strlen(close_marker);
+    _level = depth;
+
+    return token;
+}
+
+XMLTOKEN XMLScanner::element() {
+    bool endtag = false;
+
+    p++;
+    while (p < end && is_space(*p)) p++;
+    if (p < end && *p == '/') {
+        endtag = true;
+        p++;
+    }
+    if (!name(_name)) return fail("bad element name");
+
+    nattrs = 0;
+    while (1) {
+        while (p < end && is_space(*p)) p++;
+        if (p >= end) return fail("element " + _name + " is not closed");
+
+        if (*p == '>') {
+            p++;
+            break;
+        }
+
+        // </name/> is taken for <name/>, tinyxml2 does so
+        if (*p == '/' && p + 1 < end && p[1] == '>') {
+            p += 2;
+            endtag = false;
+            closing = true;
+            break;
+        }
+
+        if (!is_name_start(*p)) return fail("bad attribute of " + _name);
+
+        if (_attrs.size() <= nattrs) _attrs.resize(nattrs + 1);
+        auto &attr = _attrs[nattrs];
+        name(attr.first);
+
+        while (p < end && is_space(*p)) p++;
+        if (p >= end || *p != '=') return fail("attribute " + attr.first + " has no value");
+        p++;
+        while (p < end && is_space(*p)) p++;
+        if (p >= end || (*p != '"' && *p != '\'')) return fail("attribute " + attr.first + " is not quoted");
+
+        const char *stop = static_cast<const char *>(memchr(p + 1, *p, end - p - 1));
+        if (!stop) return fail("attribute " + attr.first + " is not closed");
+        decode(p + 1, stop, attr.second, true);
+        p = stop + 1;
+
+        for (uint32_t i = 0; i < nattrs; i++)
+            if (_attrs[i].first == attr.first) return fail("attribute " + attr.first + " given twice");
+        nattrs++;
+    }
+
+    if (endtag) {
+        // a stray one at the top ends the document, not an error to tinyxml2
+        if (!depth) {
+            p = end;
+            return XMLTOKEN::XML_EOF;
+        }
+        if (open[depth - 1] != _name) return fail("end tag " + _name + " does not match");
+        nattrs = 0;
+        _level = depth--;
+        return XMLTOKEN::XML_END;
+    }
+
+    // counted as tinyxml2 does, the document is a level and empty elements are none
+    if (!closing && depth + 2 >= XMLSCAN_MAX_DEPTH) return fail("elements nested too deep");
+    if (open.size() <= depth) open.resize(depth + 1);
+    open[depth++] = _name;
+    _level = depth;
+
+    return XMLTOKEN::XML_START;
+}
+
+XMLTOKEN XMLScanner::next() {
+    const char *start = p;
+
+    nattrs = 0;
+
+    if (closing) {
+        closing = false;
+        _level = depth--;
+        return XMLTOKEN::XML_END;
+    }
+
+    while (p < end && is_space(*p)) p++;
+    if (p >= end) {
+        if (depth) return fail("element " + open[depth - 1] + " is not closed");
+        // an error stays, so does an empty document
+        return _error.empty() ? XMLTOKEN::XML_EOF : XMLTOKEN::XML_ERROR;
+    }
+
+    if (*p != '<') {
+        // text counts from the end of the markup before, leading spaces too
+        const char *stop = static_cast<const char *>(memchr(p, '<', end - p));
+        if (!stop) return fail("text is not closed");
+
+        decode(start, stop, _text, true);
+        p = stop;
+        prolog = false;
+        _level = depth;
+        return XMLTOKEN::XML_TEXT;
+    }
+
+    if (end - p >= 2 && p[1] == '?') {
+        // declarations go before anything else
+        if (depth || !prolog) return fail("declaration out of place");
+        return markup("<?", "?>", XMLTOKEN::XML_OTHER);
+    }
+    prolog = false;
+
+    if (end - p >= 4 && !memcmp(p, "<!--", 4)) return markup("<!--", "-->", XMLTOKEN::XML_OTHER);
+    if (end - p >= 9 && !memcmp(p, "<![CDATA[", 9)) return markup("<![CDATA[", "]]>", XMLTOKEN::XML_TEXT);
+    if (end - p >= 2 && p[1] == '!') return markup("<!", ">", XMLTOKEN::XML_OTHER);
+
+    return element();
+}
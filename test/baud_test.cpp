@@ -0,0 +1,82 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 06:58:12
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 06:58:12
+ * @Description: change_baud against an fdl1 that takes any rate, refuses high ones or acks them and stays
+ */
+#include <cstdio>
+#include <memory>
+
+#include "upgrade_manager.hpp"
+#include "serial.hpp"
+#include "fakepty.hpp"
+#include "pacgen.hpp"
+#include "check.hpp"
+
+struct device {
+    const char *name;
+    uint32_t max;  // highest rate fdl1 goes to, 0 any
+    bool refuse;   // above it answer NOT_SUPPORT_BAUDRATE, else ack and stay
+    uint32_t expect;
+};
+
+// upgrade() starts at 115200, and asks up to 576000 of fdl1
+static const device devices[] = {
+    {"any rate", 0, false, 576000},
+    {"refuses above 460800", 460800, true, 460800},
+    {"acks and stays above 460800", 460800, false, 460800},
+    {"refuses all", 115200, true, 115200},
+    {"acks and stays on all", 115200, false, 115200},
+};
+
+static void upgrade(std::shared_ptr<Firmware> &fw, const device &d) {
+    FakePty pty(0, 0, false);
+    TempPath profile(".profile");
+    std::shared_ptr<USBStream> us;
+    SerialPort *port;
+    FakeFDL st;
+    int ret;
+
+    CHECK(pty.isOpened());
+    pty.setBaud(d.max, d.refuse);
+    port = new SerialPort(pty.path());
+    us.reset(port);
+    {
+        UpgradeManager upmgr(pty.path(), fw, us);
+
+        upmgr.setProfile(profile.str());
+        CHECK(upmgr.prepare());
+        upmgr.setBaudCeiling(576000);
+        ret = upmgr.upgrade(false);
+    }
+    st = pty.state();
+
+    printf("%-28s upgrade %s at %u, device at %u\n", d.name, ret ? "failed" : "done",
+           SerialPort::BaudARR[static_cast<int>(port->baud())], st.baud);
+    CHECK(ret == 0 && st.written.size() == 3);
+    CHECK(static_cast<uint32_t>(SerialPort::BaudARR[static_cast<int>(port->baud())]) == d.expect);
+    CHECK(st.baud == d.expect);
+}
+
+int main() {
+    TempPath pac(".pac");
+    PacWriter w("BAUD_MODEM");
+    std::shared_ptr<Firmware> fw;
+
+    w.addRandom("FDL", "fdl1.bin", 0x2000, 1);
+    w.addRandom("FDL2", "fdl2.bin", 0x4000, 2);
+    w.addRandom("system", "system.img", 0x10000, 3);
+    w.file("FDL", "FDL", "0x5000", 0x2000, 0x5000);
+    w.file("FDL2", "NAND_FDL", "0x9efffe00", 0x4000, 0x9efffe00);
+    w.file("system", "CODE2", "system", 0x10000);
+    CHECK(w.write(pac.str()) == 0);
+
+    fw.reset(new Firmware(pac.str()));
+    CHECK(fw->pacparser() == 0 && fw->xmlparser() == 0);
+    if (check_failures()) return 1;
+
+    for (auto &d : devices) upgrade(fw, d);
+
+    return check_failures() ? 1 : 0;
+}
@@ -0,0 +1,120 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 04:05:37
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 04:05:37
+ * @Description: a sparse pac with a member past 4 GB, sizes, offsets, 64-bit frames and the manifest
+ */
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include "firmware.hpp"
+#include "fdl.hpp"
+#include "pacgen.hpp"
+#include "check.hpp"
+
+#define SYSTEM_SIZE ((5ull << 30) + 123)
+#define NV_SIZE 0x20000
+
+static const uint64_t marks[] = {0, 0xfffffff0ull, 1ull << 32, SYSTEM_SIZE - 16};
+
+static std::string mark(uint64_t off) {
+    char buf[17];
+
+    snprintf(buf, sizeof(buf), "MARK%011llx", static_cast<unsigned long long>(off));
+    return std::string(buf, 16);
+}
+
+static uint32_t le32(const uint8_t *p) { return p[0] | p[1] << 8 | p[2] << 16 | static_cast<uint32_t>(p[3]) << 24; }
+
+// what the pac holds, however it was loaded
+static void members(Firmware &fw, uint64_t system_off) {
+    const XMLFileInfo *system = nullptr, *nv = nullptr;
+    byte_span span;
+
+    CHECK(fw.member_file_size("system") == SYSTEM_SIZE);
+    CHECK(fw.member_file_offset("system") == system_off);
+    CHECK(fw.member_file_size("after") == 4096);
+    CHECK(fw.member_file_offset("after") == system_off + SYSTEM_SIZE);
+
+    for (auto &info : fw.get_file_vec()) {
+        if (info.fileid == "system") system = &info;
+        if (info.fileid == "NV") nv = &info;
+    }
+    CHECK(system && system->size == 0x180000000ull && system->realsize == SYSTEM_SIZE);
+    CHECK(nv && nv->size == NV_SIZE && nv->realsize == NV_SIZE);
+
+    span = fw.member("system");
+    CHECK(span.data && span.size == SYSTEM_SIZE);
+    if (span.data)
+        for (auto m : marks) CHECK(!memcmp(span.data + m, mark(m).data(), 16));
+
+    span = fw.member("after");
+    CHECK(span.data && !memcmp(span.data, "after the hole", 14));
+}
+
+// start frames switch to the 64-bit form at 4 GB, read_midst offsets take a high half
+static void frames() {
+    FDLRequest req;
+
+    req.setCrcModle(CRC_MODLE::CRC_FDL);
+    req.setEscapeFlag(false, false);
+
+    req.newStartData("nv", NV_SIZE, 0x1234);
+    CHECK(req.dataLen() == 0x48 + 8);
+    CHECK(le32(req.data() + 0x48) == NV_SIZE && le32(req.data() + 0x4c) == 0x1234);
+
+    req.newStartData("system", SYSTEM_SIZE);
+    CHECK(req.dataLen() == 0x48 + 16);
+    CHECK(le32(req.data() + 0x48) == static_cast<uint32_t>(SYSTEM_SIZE) && le32(req.data() + 0x4c) == 1);
+    CHECK(le32(req.data() + 0x50) == 0 && le32(req.data() + 0x54) == 0);
+
+    req.newStartRead("system", SYSTEM_SIZE);
+    CHECK(req.dataLen() == 0x48 + 16 && le32(req.data() + 0x4c) == 1);
+    req.newStartRead("nv", NV_SIZE);
+    CHECK(req.dataLen() == 0x48 + 4);
+
+    req.newReadMidst(0x3000, 0xfffff000ull);
+    CHECK(req.dataLen() == 8 && le32(req.data() + 4) == 0xfffff000u);
+    req.newReadMidst(0x3000, (1ull << 32) + 0x3000);
+    CHECK(req.dataLen() == 12 && le32(req.data() + 4) == 0x3000 && le32(req.data() + 8) == 1);
+}
+
+int main() {
+    TempPath pac(".pac");
+    TempPath manifest(".manifest");
+    PacWriter w("BENCH_MODEM");
+    std::unique_ptr<Firmware> fw;
+    std::string after("after the hole");
+    uint64_t system_off;
+
+    // xml, NV, then system, the rest of system is a hole
+    w.addRandom("NV", "nv.bin", NV_SIZE, 7);
+    w.add("system", "system.img", SYSTEM_SIZE);
+    for (auto m : marks) w.put(m, mark(m));
+    w.add("after", "after.bin", 4096);
+    w.put(0, after);
+    w.file("NV", "NV_COMM", "nv", NV_SIZE);
+    w.file("system", "CODE2", "system", 0x180000000ull);
+    w.file("after", "CODE2", "after", 4096);
+    CHECK(w.write(pac.str()) == 0);
+    if (check_failures()) return 1;
+
+    fw.reset(new Firmware(pac.str()));
+    CHECK(fw->pacparser() == 0 && fw->xmlparser() == 0);
+    system_off = fw->member_file_offset("NV") + NV_SIZE;
+    members(*fw, system_off);
+    CHECK(fw->manifest_save(manifest.str()) == 0);
+
+    // the same pac from its manifest, nothing parsed
+    fw.reset(new Firmware(pac.str()));
+    CHECK(fw->manifest_load(manifest.str()) == 0);
+    members(*fw, system_off);
+
+    frames();
+    printf("%llu byte member at %llu, sizes, offsets, markers, 64-bit frames and manifest checked\n",
+           static_cast<unsigned long long>(SYSTEM_SIZE), static_cast<unsigned long long>(system_off));
+
+    return check_failures() ? 1 : 0;
+}
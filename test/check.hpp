@@ -0,0 +1,67 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-17 23:05:12
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-17 23:05:12
+ * @Description: what tests and benchmarks share, no framework
+ */
+#ifndef __CHECK__
+#define __CHECK__
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+// failed checks so far, main returns it
+inline int &check_failures() {
+    static int n = 0;
+    return n;
+}
+
+#define CHECK(cond)                                                                            \
+    do {                                                                                       \
+        if (!(cond)) {                                                                         \
+            std::cerr << __FILE__ << ":" << __LINE__ << " check failed: " #cond << std::endl; \
+            check_failures()++;                                                                \
+        }                                                                                      \
+    } while (0)
+
+// seconds since start
+inline double elapsed(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() /
+           1e6;
+}
+
+/**
+ * fn is called again and again for about ms milliseconds, it handles bytes
+ * each time. GB/s
+ */
+template <typename F>
+double throughput(F fn, uint64_t bytes, int ms = 50) {
+    auto start = std::chrono::steady_clock::now();
+    uint64_t calls = 0;
+    double sec;
+
+    do {
+        for (int i = 0; i < 16; i++) fn();
+        calls += 16;
+    } while ((sec = elapsed(start)) < ms / 1000.0);
+
+    return calls * bytes / sec / 1e9;
+}
+
+// keeps results of benchmarked calls from being optimized out
+inline void keep(uint64_t v) {
+    static volatile uint64_t sink;
+    sink = sink + v;
+}
+
+// xorshift, the same bytes on every run
+inline uint64_t pseudo_random(uint64_t &state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+#endif  //__CHECK__
@@ -0,0 +1,113 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-17 23:05:12
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-17 23:05:12
+ * @Description: every CRC_IMPL and SUM_IMPL against the loops they replaced, and GB/s of each
+ */
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "crc.hpp"
+#include "check.hpp"
+#include "legacy.hpp"
+
+static const CRC_IMPL crc_impls[] = {CRC_IMPL::CRC_IMPL_BITWISE, CRC_IMPL::CRC_IMPL_TABLE, CRC_IMPL::CRC_IMPL_SLICE8,
+                                     CRC_IMPL::CRC_IMPL_CLMUL};
+static const SUM_IMPL sum_impls[] = {SUM_IMPL::SUM_IMPL_SCALAR, SUM_IMPL::SUM_IMPL_SWAR, SUM_IMPL::SUM_IMPL_SSE2,
+                                     SUM_IMPL::SUM_IMPL_AVX2};
+
+#define MAXLEN 0x4100  // past MAX_DATA_LEN, for tails of every kind
+#define ROUNDS 300
+
+// random lengths at random offsets from a 64 byte boundary, plus the short ones in full
+static void golden(std::vector<uint8_t> &buf) {
+    uint64_t seed = 0x243f6a8885a308d3ull;
+
+    for (int r = 0; r < ROUNDS; r++) {
+        uint32_t off = pseudo_random(seed) % 64;
+        uint32_t len = r < 64 ? r : pseudo_random(seed) % MAXLEN;
+        uint16_t init = pseudo_random(seed);
+        const uint8_t *p = buf.data() + off;
+        uint16_t want_boot = old_bootcode(p, len);
+        uint16_t want_nv = old_nv(init, p, len);
+        uint16_t want_fdl = old_fdl(p, len);
+
+        for (auto impl : crc_impls) {
+            if (!CRC16::supported(impl)) continue;
+            CHECK(CRC16::bootcode(impl, p, len) == want_boot);
+            CHECK(CRC16::nv(impl, init, p, len) == want_nv);
+        }
+        for (auto impl : sum_impls) {
+            if (!CRC16::supported(impl)) continue;
+            CHECK(CRC16::fdl(impl, p, len) == want_fdl);
+        }
+
+        // what finishup takes, whichever got selected
+        CHECK(CRC16::bootcode(p, len) == want_boot);
+        CHECK(CRC16::nv(init, p, len) == want_nv);
+        CHECK(CRC16::fdl(p, len) == want_fdl);
+
+        // sums of parts split at an even offset add up
+        uint32_t half = (len / 2) & ~1u;
+        CHECK(CRC16::fdlFold(CRC16::fdlSum(p, half) + CRC16::fdlSum(p + half, len - half)) == want_fdl);
+    }
+
+    // worst case for the sum carries
+    std::vector<uint8_t> ones(MAXLEN, 0xff);
+    for (auto impl : sum_impls)
+        if (CRC16::supported(impl))
+            CHECK(CRC16::fdl(impl, ones.data() + 1, MAXLEN - 1) == old_fdl(ones.data() + 1, MAXLEN - 1));
+}
+
+// against the old loop if old is given
+static void report(const char *sum, const char *impl, double gbps, double old = 0) {
+    printf("%-10s %-8s %6.2f GB/s", sum, impl, gbps);
+    if (old > 0) printf(", %.1fx old", gbps / old);
+    printf("\n");
+}
+
+// over a midst frame, what every frame of a partition costs. old is the loop replaced
+static void bench(std::vector<uint8_t> &buf) {
+    const uint8_t *p = buf.data() + 1;
+    uint32_t len = 0x3000;
+
+    report("bootcode", "old", throughput([&] { keep(old_bootcode(p, len)); }, len));
+    for (auto impl : crc_impls)
+        if (CRC16::supported(impl))
+            report("bootcode", CRC16::toString(impl), throughput([&] { keep(CRC16::bootcode(impl, p, len)); }, len));
+
+    report("nv", "old", throughput([&] { keep(old_nv(0, p, len)); }, len));
+    for (auto impl : crc_impls)
+        if (CRC16::supported(impl))
+            report("nv", CRC16::toString(impl), throughput([&] { keep(CRC16::nv(impl, 0, p, len)); }, len));
+
+    // the sum at each frame size in use, bootcode, fdl1 and midst. frames start at _data + 1
+    for (uint32_t framesz : {0x210, 0x840, 0x3000}) {
+        char name[16];
+        double old = throughput([&] { keep(old_fdl(p, framesz)); }, framesz);
+
+        snprintf(name, sizeof(name), "fdl %#x", framesz);
+        report(name, "old", old);
+        for (auto impl : sum_impls) {
+            if (!CRC16::supported(impl)) continue;
+
+            report(name, CRC16::toString(impl), throughput([&] { keep(CRC16::fdl(impl, p, framesz)); }, framesz), old);
+        }
+    }
+
+    printf("selected %s and %s\n", CRC16::toString(CRC16::selected()), CRC16::toString(CRC16::selectedSum()));
+}
+
+int main() {
+    std::vector<uint8_t> buf(MAXLEN + 64);
+    uint64_t seed = 0x13198a2e03707344ull;
+
+    for (auto &b : buf) b = pseudo_random(seed);
+
+    golden(buf);
+    bench(buf);
+
+    return check_failures() ? 1 : 0;
+}
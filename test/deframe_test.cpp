@@ -0,0 +1,313 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 05:10:26
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 05:10:26
+ * @Description: FDLResponse on responses cut at every offset, flags in a row, truncated, too long and bad crc
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "crc.hpp"
+#include "escape.hpp"
+#include "fdl.hpp"
+#include "check.hpp"
+
+typedef std::vector<uint8_t> bytes;
+
+struct modle {
+    const char *name;
+    CRC_MODLE crc;
+    bool data_es;
+    bool crc_es;
+};
+
+// as flash_fdl, flash_nand_fdl and flash_partition set them up
+static const modle modles[] = {
+    {"bootcode", CRC_MODLE::CRC_BOOTCODE, true, true},
+    {"fdl1", CRC_MODLE::CRC_FDL, true, true},
+    {"fdl2", CRC_MODLE::CRC_FDL, false, false},
+};
+
+static uint16_t crc(CRC_MODLE mod, const uint8_t *p, uint32_t len) {
+    return mod == CRC_MODLE::CRC_BOOTCODE ? CRC16::bootcode(p, len) : CRC16::fdl(p, len);
+}
+
+// a response as the device frames it, crc taken with crcmod
+static bytes encode(const modle &m, uint16_t type, const bytes &data, CRC_MODLE crcmod) {
+    bytes raw = {static_cast<uint8_t>(type >> 8), static_cast<uint8_t>(type), static_cast<uint8_t>(data.size() >> 8),
+                 static_cast<uint8_t>(data.size())};
+    bytes out(1, MAGIC_7e);
+    bytes esc;
+    uint16_t c;
+
+    raw.insert(raw.end(), data.begin(), data.end());
+    c = crc(crcmod, raw.data(), raw.size());
+    if (m.crc_es) {
+        raw.push_back(c >> 8);
+        raw.push_back(c);
+    }
+
+    if (m.data_es) {
+        esc.resize(2 * raw.size());
+        esc.resize(EscapeCodec::escape(raw.data(), raw.size(), esc.data()));
+    } else {
+        esc = raw;
+    }
+    out.insert(out.end(), esc.begin(), esc.end());
+
+    if (!m.crc_es) {
+        out.push_back(c >> 8);
+        out.push_back(c);
+    }
+    out.push_back(MAGIC_7e);
+    return out;
+}
+
+static bytes encode(const modle &m, uint16_t type, const bytes &data) { return encode(m, type, data, m.crc); }
+
+// type and data of a frame, as compared
+static std::string frame(uint16_t type, const bytes &data) {
+    return std::string(1, static_cast<char>(type >> 8)) + static_cast<char>(type) +
+           std::string(data.begin(), data.end());
+}
+
+static std::string frame(FDLResponse &resp) {
+    uint8_t *raw = resp.rawData();
+
+    return std::string(1, static_cast<char>(raw[1])) + static_cast<char>(raw[2]) +
+           std::string(reinterpret_cast<char *>(resp.data()), resp.dataLen());
+}
+
+struct outcome {
+    std::vector<std::string> frames;
+    int malformed;
+    int bad;
+
+    outcome() : malformed(0), bad(0) {}
+};
+
+/**
+ * chunks go in as wait() takes them from recvSync, a frame that is done
+ * is taken and the next one looked for in what is left, before reading on
+ */
+static outcome replay(FDLResponse &resp, std::vector<bytes> chunks) {
+    outcome o;
+    size_t next = 0;
+    RESP_STATE state;
+
+    resp.discard();
+    state = resp.push_back(nullptr, 0);
+    while (1) {
+        if (state == RESP_STATE::RESP_STATE_OK) {
+            o.frames.push_back(frame(resp));
+            resp.reset();
+        } else if (state == RESP_STATE::RESP_STATE_MALFORMED) {
+            o.malformed++;
+        } else if (state == RESP_STATE::RESP_STATE_VARIFY_FAIL) {
+            o.bad++;
+            resp.reset();
+        } else if (next == chunks.size()) {
+            break;
+        } else {
+            state = resp.push_back(chunks[next].data(), chunks[next].size());
+            next++;
+            continue;
+        }
+        state = resp.push_back(nullptr, 0);
+    }
+
+    return o;
+}
+
+static FDLResponse &response(const modle &m) {
+    static FDLResponse resp;
+
+    resp.setCrcModle(m.crc);
+    resp.setEscapeFlag(m.data_es, m.crc_es);
+    resp.setCrcFallback(false);
+    return resp;
+}
+
+static bytes cat(std::initializer_list<bytes> parts) {
+    bytes out;
+
+    for (auto &p : parts) out.insert(out.end(), p.begin(), p.end());
+    return out;
+}
+
+// one in four a 0x7e or 0x7d, so escapes come in runs and end up on chunk edges
+static bytes payload(uint32_t len, uint64_t &seed) {
+    bytes buf(len);
+
+    for (auto &c : buf) {
+        uint64_t k = pseudo_random(seed);
+        c = (k & 7) == 0 ? 0x7e : (k & 7) == 1 ? 0x7d : k >> 8;
+    }
+    return buf;
+}
+
+/**
+ * an ack, a read_flash full of flags and a version, sent in one piece, in
+ * two cut at every offset, and a byte at a time
+ */
+static void cuts(const modle &m) {
+    uint64_t seed = 0x13198a2e03707344ull;
+    bytes data = payload(300, seed);
+    bytes ver = {'F', 'D', 'L', '1'};
+    bytes stream = cat({encode(m, 0x80, bytes()), encode(m, 0x93, data), encode(m, 0x81, ver)});
+    std::vector<std::string> expect = {frame(0x80, bytes()), frame(0x93, data), frame(0x81, ver)};
+    std::vector<bytes> bytewise;
+    int wrong = 0;
+
+    // escaped, pairs of 0x7d and the byte after are split by some cut below
+    if (m.data_es) CHECK(std::count(stream.begin(), stream.end(), MAGIC_7d) > 50);
+
+    for (size_t k = 0; k <= stream.size(); k++) {
+        bytes head(stream.begin(), stream.begin() + k), tail(stream.begin() + k, stream.end());
+        outcome o = replay(response(m), {head, tail});
+
+        if (o.frames != expect || o.malformed || o.bad) wrong++;
+    }
+    CHECK(wrong == 0);
+
+    for (auto c : stream) bytewise.push_back(bytes(1, c));
+    outcome o = replay(response(m), bytewise);
+    CHECK(o.frames == expect && !o.malformed && !o.bad);
+}
+
+// frames behind the one asked for stay in _left, the next wait() gets them with no read
+static void left(const modle &m) {
+    FDLResponse &resp = response(m);
+    bytes stream;
+    std::vector<std::string> expect;
+
+    for (uint16_t i = 0; i < 5; i++) {
+        bytes data(i * 7, static_cast<uint8_t>(0x7d + i % 2));
+
+        stream = cat({stream, encode(m, 0x93, data)});
+        expect.push_back(frame(0x93, data));
+    }
+
+    resp.discard();
+    CHECK(resp.push_back(stream.data(), stream.size()) == RESP_STATE::RESP_STATE_OK);
+    CHECK(frame(resp) == expect[0]);
+    for (size_t i = 1; i < expect.size(); i++) {
+        resp.reset();
+        CHECK(resp.push_back(nullptr, 0) == RESP_STATE::RESP_STATE_OK);
+        CHECK(frame(resp) == expect[i]);
+    }
+    resp.reset();
+    CHECK(resp.push_back(nullptr, 0) == RESP_STATE::RESP_STATE_INCOMPLETE);
+}
+
+// the last flag of a run opens the frame, between and around frames they are noise
+static void flags(const modle &m) {
+    bytes run(4, MAGIC_7e);
+    bytes ack = encode(m, 0x80, bytes());
+    bytes ver = encode(m, 0x81, bytes{'v', '1'});
+    outcome o = replay(response(m), {cat({run, ack, run, run, ver, run})});
+
+    CHECK(o.frames.size() == 2 && !o.malformed && !o.bad);
+}
+
+/**
+ * escaped, a flag inside a frame tells it is cut short, the next is taken.
+ * unescaped, frames are cut by length, a short one waits for more
+ */
+static void truncated(const modle &m) {
+    uint64_t seed = 0xa4093822299f31d0ull;
+    bytes data = payload(40, seed);
+    bytes whole = encode(m, 0x93, data);
+    bytes ack = encode(m, 0x80, bytes());
+
+    for (size_t cut = 2; cut < whole.size() - 1; cut++) {
+        bytes shortone(whole.begin(), whole.begin() + cut);
+        FDLResponse &resp = response(m);
+        outcome o;
+
+        if (m.data_es) {
+            o = replay(resp, {shortone, ack});
+            CHECK(o.frames == std::vector<std::string>{frame(0x80, bytes())});
+            CHECK(o.malformed == 1 && !o.bad);
+        } else {
+            o = replay(resp, {shortone});
+            CHECK(o.frames.empty() && !o.malformed && !o.bad);
+
+            // a late reply is dropped along with it, see UpgradeManager::drain
+            resp.discard();
+            o = replay(resp, {ack});
+            CHECK(o.frames.size() == 1);
+        }
+    }
+}
+
+// data_length beyond MAX_DATA_LEN is refused at the header, before anything is buffered
+static void oversized(const modle &m) {
+    uint32_t max = MAX_DATA_LEN - sizeof(cmd_header) - sizeof(cmd_tail);
+    bytes big(max, 0x5a);
+    bytes bogus = {MAGIC_7e, 0x00, 0x93, static_cast<uint8_t>((max + 1) >> 8), static_cast<uint8_t>(max + 1)};
+    bytes ack = encode(m, 0x80, bytes());
+    outcome o;
+
+    o = replay(response(m), {encode(m, 0x93, big)});
+    CHECK(o.frames == std::vector<std::string>{frame(0x93, big)});
+
+    o = replay(response(m), {cat({bogus, bytes(1, MAGIC_7e), ack})});
+    CHECK(o.malformed == 1 && o.frames == std::vector<std::string>{frame(0x80, bytes())});
+
+    bogus[3] = bogus[4] = 0xff;
+    o = replay(response(m), {cat({bogus, bytes(1, MAGIC_7e), ack})});
+    CHECK(o.malformed == 1 && o.frames.size() == 1);
+}
+
+// any flipped bit fails, the other crc modle only when fallback is on
+static void badcrc(const modle &m) {
+    bytes data = {1, 2, 3, 4, 5, 6, 7};
+    bytes good = encode(m, 0x93, data);
+    CRC_MODLE other = m.crc == CRC_MODLE::CRC_BOOTCODE ? CRC_MODLE::CRC_FDL : CRC_MODLE::CRC_BOOTCODE;
+    bytes foreign = encode(m, 0x93, data, other);
+    FDLResponse &resp = response(m);
+    outcome o;
+
+    for (size_t i = 1; i + 1 < good.size(); i++) {
+        bytes flipped = good;
+
+        // unescaped data_length is not covered here, that is cut by length
+        if (!m.data_es && (i == 3 || i == 4)) continue;
+        flipped[i] ^= 0x01;
+        if (flipped[i] == MAGIC_7e || flipped[i] == MAGIC_7d || good[i] == MAGIC_7d) continue;
+
+        o = replay(resp, {flipped});
+        CHECK(o.frames.empty() && (o.bad == 1 || o.malformed));
+    }
+
+    o = replay(resp, {foreign});
+    CHECK(o.frames.empty() && o.bad == 1);
+
+    resp.setCrcFallback(true);
+    o = replay(resp, {foreign});
+    CHECK(o.frames.size() == 1 && !o.bad);
+    o = replay(resp, {good});
+    CHECK(o.frames.size() == 1 && !o.bad);
+    resp.setCrcFallback(false);
+}
+
+int main() {
+    for (auto &m : modles) {
+        int before = check_failures();
+
+        cuts(m);
+        left(m);
+        flags(m);
+        truncated(m);
+        oversized(m);
+        badcrc(m);
+        printf("%-8s %s\n", m.name, check_failures() == before ? "ok" : "FAILED");
+    }
+
+    return check_failures() ? 1 : 0;
+}
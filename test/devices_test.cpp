@@ -0,0 +1,182 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 02:58:10
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 02:58:10
+ * @Description: Device scan of a made up sysfs, what it finds, and how long scan and lookups take
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <ftw.h>
+#include <sys/stat.h>
+#include <unistd.h>
+}
+
+#include "devices.hpp"
+#include "check.hpp"
+
+#define DEVICES 64
+#define IFACES 8
+#define VID 0x1782
+#define PID(n) (0x4d00 + (n))
+
+static void mkdirs(const std::string &path) {
+    for (size_t pos = path.find('/', 1); pos != std::string::npos; pos = path.find('/', pos + 1))
+        mkdir(path.substr(0, pos).c_str(), 0755);
+    mkdir(path.c_str(), 0755);
+}
+
+static void attr(const std::string &dir, const char *name, const std::string &value) {
+    FILE *fp = fopen((dir + "/" + name).c_str(), "w");
+
+    if (!fp) return;
+    fprintf(fp, "%s\n", value.c_str());
+    fclose(fp);
+}
+
+static std::string hex(int v, int width) {
+    char buf[16];
+
+    snprintf(buf, sizeof(buf), "%0*x", width, v);
+    return buf;
+}
+
+/**
+ * devices 1-1 to 1-DEVICES on bus 1, IFACES interfaces each. even interfaces
+ * have a ttyUSB right in them, odd ones a ttyACM below tty/. a root hub, the
+ * interfaces sysfs lists next to the devices and a device without ids go
+ * with them, none of those is a device found
+ */
+static void make_sysfs(const std::string &root) {
+    std::string devices = root + "/bus/usb/devices";
+
+    mkdirs(devices + "/usb1");
+    attr(devices + "/usb1", "idVendor", "1d6b");
+    attr(devices + "/usb1", "idProduct", "0002");
+    mkdirs(devices + "/1-0:1.0");
+    attr(devices + "/1-0:1.0", "bInterfaceClass", "09");
+    mkdirs(devices + "/1-99");
+    attr(devices + "/1-99", "devpath", "99");
+
+    for (int n = 1; n <= DEVICES; n++) {
+        std::string dev = devices + "/1-" + std::to_string(n);
+
+        mkdirs(dev);
+        attr(dev, "devpath", std::to_string(n));
+        attr(dev, "idVendor", hex(VID, 4));
+        attr(dev, "idProduct", hex(PID(n), 4));
+        attr(dev, "busnum", "1");
+        attr(dev, "devnum", std::to_string(n + 1));
+        mkdirs(dev + "/power");
+
+        for (int i = 0; i < IFACES; i++) {
+            std::string ifname = "1-" + std::to_string(n) + ":1." + std::to_string(i);
+            std::string iface = dev + "/" + ifname;
+            std::string tty = std::to_string(n * IFACES + i);
+
+            mkdirs(iface);
+            mkdirs(devices + "/" + ifname);
+            attr(iface, "bInterfaceClass", i ? "ff" : "02");
+            attr(iface, "bInterfaceSubClass", hex(i, 2));
+            attr(iface, "bInterfaceProtocol", hex(i + 1, 2));
+            attr(iface, "bInterfaceNumber", hex(i, 2));
+            attr(iface, "modalias", "usb:v1782p" + hex(PID(n), 4) + "d0000");
+            mkdirs(iface + "/ep_" + hex(0x81 + i, 2));
+            mkdirs(iface + "/ep_" + hex(0x01 + i, 2));
+            if (i % 2)
+                mkdirs(iface + "/tty/ttyACM" + tty);
+            else
+                mkdirs(iface + "/ttyUSB" + tty);
+        }
+    }
+}
+
+static int remove_one(const char *path, const struct stat *, int, struct FTW *) { return remove(path); }
+
+static void found(Device &dev, const std::string &root) {
+    std::string devices = root + "/bus/usb/devices";
+
+    CHECK(dev.scan("") == 0);
+    CHECK(dev.devices().size() == DEVICES);
+    CHECK(!dev.exist(0x1d6b, 0x0002));
+
+    for (int n = 1; n <= DEVICES; n++) {
+        auto udev = dev.get_usbdevice(VID, PID(n));
+
+        CHECK(udev && udev == dev.get_usbdevice(std::to_string(n)));
+        if (!udev) continue;
+        CHECK(udev->busno == 1 && udev->devno == n + 1);
+        CHECK(udev->devpath == devices + "/1-" + std::to_string(n));
+        CHECK(udev->ifaces.size() == IFACES);
+
+        for (int i = 0; i < IFACES; i++) {
+            auto iface = dev.get_interface(VID, PID(n), i);
+            std::string tty = (i % 2 ? "ttyACM" : "ttyUSB") + std::to_string(n * IFACES + i);
+
+            CHECK(iface && iface->interface_no == i);
+            if (!iface) continue;
+            CHECK(iface->cls == (i ? 0xff : 0x02) && iface->subcls == i && iface->proto == i + 1);
+            CHECK(iface->endpoint_in == 0x81 + i && iface->endpoint_out == 0x01 + i);
+            CHECK(iface->ttyusb == tty);
+            CHECK(iface == dev.get_interface(VID, PID(n), iface->cls, i, i + 1));
+        }
+    }
+
+    CHECK(!dev.exist(VID, PID(DEVICES + 1)) && !dev.exist(VID, PID(1), IFACES));
+    CHECK(!dev.get_usbdevice("99") && !dev.get_interface(VID, PID(1), 0xff, 0, 0));
+
+    // only the port asked for
+    dev.reset();
+    CHECK(dev.scan("5") == 0);
+    CHECK(dev.devices().size() == 1 && dev.exist(VID, PID(5)) && !dev.exist(VID, PID(4)));
+}
+
+static void timing(Device &dev) {
+    double best = 1e9;
+    const interface *iface = nullptr;
+    int n = 0;
+
+    for (int i = 0; i < 20; i++) {
+        auto start = std::chrono::steady_clock::now();
+
+        dev.reset();
+        dev.scan("");
+        best = std::min(best, elapsed(start));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 1000000; i++) {
+        iface = dev.get_interface(VID, PID(i % DEVICES + 1), i % IFACES);
+        n += iface != nullptr;
+    }
+    double sec = elapsed(start);
+
+    CHECK(n == 1000000);
+    printf("%d devices of %d interfaces: scan %.2f ms best of 20, get_interface %.1f ns\n", DEVICES, IFACES,
+           best * 1e3, sec * 1e9 / 1000000);
+}
+
+int main() {
+    const char *tmpdir = getenv("TMPDIR");
+    std::string path = std::string(tmpdir ? tmpdir : "/tmp") + "/dloader.sysfs.XXXXXX";
+    std::vector<char> name(path.begin(), path.end());
+
+    name.push_back(0);
+    if (!mkdtemp(name.data())) return 1;
+    std::string root(name.data());
+
+    make_sysfs(root);
+    {
+        Device dev(root);
+
+        found(dev, root);
+        timing(dev);
+    }
+    nftw(root.c_str(), remove_one, 16, FTW_DEPTH | FTW_PHYS);
+
+    return check_failures() ? 1 : 0;
+}
@@ -0,0 +1,117 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-17 23:20:41
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-17 23:20:41
+ * @Description: escape codec against the two pass escape it replaced, and GB/s on random and all 0x7e payloads
+ */
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "escape.hpp"
+#include "check.hpp"
+#include "legacy.hpp"
+
+#define FRAMESZ 0x3000
+
+// payloads with one byte in four a flag or escape, cut at random into chunks to decode
+static void roundtrip() {
+    std::vector<uint8_t> in(FRAMESZ + 64), old(2 * FRAMESZ + 64), out(2 * FRAMESZ), dec(FRAMESZ);
+    EscapeEncoder enc;
+    EscapeDecoder decoder;
+    uint64_t seed = 0xa4093822299f31d0ull;
+
+    for (int r = 0; r < 500; r++) {
+        uint32_t off = pseudo_random(seed) % 64;
+        uint32_t n = r < 8 ? r : pseudo_random(seed) % FRAMESZ;
+        uint8_t *src = in.data() + off;
+
+        for (uint32_t i = 0; i < n; i++) {
+            uint64_t k = pseudo_random(seed);
+            src[i] = (k & 3) == 0 ? 0x7e : (k & 3) == 1 ? 0x7d : k >> 8;
+        }
+
+        memcpy(old.data(), src, n);
+        uint32_t want = old_escape(old.data(), n);
+
+        uint32_t m = EscapeCodec::escape(src, n, out.data());
+        CHECK(m == want && !memcmp(out.data(), old.data(), m));
+        CHECK(m == n + EscapeCodec::count(src, n));
+        CHECK(EscapeCodec::findFlag(out.data(), out.data() + m) == out.data() + m);
+
+        // runs of every length, some copied and some referenced
+        enc.reset();
+        enc.escape(src, n);
+        CHECK(enc.length() == want && (!m || !memcmp(enc.flatten(), old.data(), m)));
+
+        uint32_t pos = 0, got = 0;
+        decoder.reset();
+        while (pos < m) {
+            uint32_t chunk = 1 + pseudo_random(seed) % 100;
+            uint32_t used = 0;
+
+            if (chunk > m - pos) chunk = m - pos;
+            got += decoder.decode(out.data() + pos, chunk, dec.data() + got, used);
+            CHECK(used == chunk);
+            pos += chunk;
+        }
+        CHECK(!decoder.isPending());
+        CHECK(got == n && !memcmp(dec.data(), src, n));
+    }
+
+    // decoding stops before a flag, it ends the frame
+    uint8_t framed[] = {0x01, 0x7d, 0x5e, 0x7e, 0x02};
+    uint8_t plain[sizeof(framed)];
+    uint32_t used = 0;
+    decoder.reset();
+    CHECK(decoder.decode(framed, sizeof(framed), plain, used) == 2 && used == 3 && plain[1] == 0x7e);
+}
+
+static void bench(const char *kind, const std::vector<uint8_t> &in) {
+    std::vector<uint8_t> work(2 * FRAMESZ), out(2 * FRAMESZ), dec(FRAMESZ);
+    EscapeEncoder enc;
+    EscapeDecoder decoder;
+    uint32_t m = EscapeCodec::escape(in.data(), FRAMESZ, out.data());
+
+    double old = throughput(
+        [&] {
+            memcpy(work.data(), in.data(), FRAMESZ);
+            keep(old_escape(work.data(), FRAMESZ));
+        },
+        FRAMESZ);
+    double iovec = throughput(
+        [&] {
+            enc.reset();
+            enc.escape(in.data(), FRAMESZ);
+            keep(enc.iovcnt());
+        },
+        FRAMESZ);
+    double contiguous = throughput([&] { keep(EscapeCodec::escape(in.data(), FRAMESZ, out.data())); }, FRAMESZ);
+    double decode = throughput(
+        [&] {
+            uint32_t used;
+            decoder.reset();
+            keep(decoder.decode(out.data(), m, dec.data(), used));
+        },
+        FRAMESZ);
+
+    printf("%-8s old copy and two passes %6.2f GB/s\n", kind, old);
+    printf("%-8s encoder, iovec          %6.2f GB/s\n", kind, iovec);
+    printf("%-8s escape, contiguous      %6.2f GB/s\n", kind, contiguous);
+    printf("%-8s decode                  %6.2f GB/s\n", kind, decode);
+}
+
+int main() {
+    std::vector<uint8_t> in(FRAMESZ);
+    uint64_t seed = 0x082efa98ec4e6c89ull;
+
+    roundtrip();
+
+    for (auto &b : in) b = pseudo_random(seed);
+    bench("random", in);
+    memset(in.data(), 0x7e, FRAMESZ);
+    bench("all 7e", in);
+
+    return check_failures() ? 1 : 0;
+}
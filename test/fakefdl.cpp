@@ -0,0 +1,248 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 00:12:30
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 00:12:30
+ * @Description: device side of bootcode and fdl, as much as tests and benchmarks need
+ */
+#include <algorithm>
+#include <cstring>
+
+#include "crc.hpp"
+#include "escape.hpp"
+#include "fdl.hpp"
+#include "fakefdl.hpp"
+
+static uint32_t fnv(uint32_t h, const uint8_t *p, uint64_t len) {
+    for (uint64_t i = 0; i < len; i++) h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+FakeFDL::FakeFDL(bool fdl)
+    : stage(fdl ? 2 : 0),
+      open(false),
+      expect(0),
+      got(0),
+      sum(0),
+      midsts(0),
+      frames(0),
+      bytes(0),
+      hash(2166136261u),
+      baud(0),
+      baud_max(0),
+      baud_refuse(false),
+      fail_midst(0),
+      nested(0),
+      early_ends(0) {}
+
+void FakeFDL::reply(uint16_t type, const uint8_t *data, uint32_t len, bool escaped, std::vector<uint8_t> &out) {
+    std::vector<uint8_t> raw = {static_cast<uint8_t>(type >> 8), static_cast<uint8_t>(type),
+                                static_cast<uint8_t>(len >> 8), static_cast<uint8_t>(len)};
+    uint16_t crc;
+
+    raw.insert(raw.end(), data, data + len);
+    crc = stage ? CRC16::fdl(raw.data(), raw.size()) : CRC16::bootcode(raw.data(), raw.size());
+    raw.push_back(crc >> 8);
+    raw.push_back(crc);
+
+    out.push_back(MAGIC_7e);
+    for (auto c : raw) {
+        if (escaped && (c == MAGIC_7e || c == MAGIC_7d)) {
+            out.push_back(MAGIC_7d);
+            out.push_back(c ^ 0x20);
+        } else {
+            out.push_back(c);
+        }
+    }
+    out.push_back(MAGIC_7e);
+}
+
+void FakeFDL::handle(const uint8_t *frame, uint32_t len, std::vector<uint8_t> &out) {
+    uint32_t datalen = len >= 5 ? frame[3] << 8 | frame[4] : 0;
+    std::vector<uint8_t> plain;
+
+    frames++;
+    bytes += len;
+    hash = fnv(hash, frame, len);
+
+    // a frame as long as its header says is taken as is, escaped or not it reads the same
+    if (len < 3 || sizeof(cmd_header) + datalen + sizeof(cmd_tail) == len) {
+        request(frame, len, false, out);
+        return;
+    }
+
+    for (uint32_t i = 0; i < len; i++) {
+        if (frame[i] == MAGIC_7d && i + 1 < len)
+            plain.push_back(frame[++i] ^ 0x20);
+        else
+            plain.push_back(frame[i]);
+    }
+    request(plain.data(), plain.size(), true, out);
+}
+
+void FakeFDL::request(const uint8_t *frame, uint32_t len, bool escaped, std::vector<uint8_t> &out) {
+    static const uint8_t version[] = "FakeFDL 1.0";
+    uint16_t type = len >= 3 ? frame[1] << 8 | frame[2] : static_cast<uint16_t>(REQTYPE::BSL_CMD_CHECK_BAUD);
+    uint32_t datalen = len >= 5 ? frame[3] << 8 | frame[4] : 0;
+    const uint8_t *data = frame + sizeof(cmd_header);
+    uint16_t rep = static_cast<uint16_t>(REPTYPE::BSL_REP_ACK);
+    uint32_t rxsz = 0;
+    uint64_t offset = 0;
+
+    escaped = escaped || stage < 2;
+    if (len < sizeof(cmd_header) + datalen) datalen = len > sizeof(cmd_header) ? len - sizeof(cmd_header) : 0;
+
+    switch (static_cast<REQTYPE>(type)) {
+        case REQTYPE::BSL_CMD_CHECK_BAUD:
+            reply(static_cast<uint16_t>(REPTYPE::BSL_REP_VER), version, sizeof(version) - 1, escaped, out);
+            return;
+
+        case REQTYPE::BSL_CMD_START_DATA:
+            if (open) {
+                nested++;
+                rep = static_cast<uint16_t>(REPTYPE::BSL_REP_DOWN_MUTI_START);
+                break;
+            }
+
+            // by address the length is big endian after it, by name little endian after 0x48 bytes of it
+            expect = 0;
+            if (datalen >= 8 && datalen < 0x4c) {
+                for (int i = 0; i < 4; i++) expect = expect << 8 | data[4 + i];
+            } else if (datalen >= 0x4c) {
+                for (int i = 3; i >= 0; i--) expect = expect << 8 | data[0x48 + i];
+                if (datalen >= 0x58)
+                    for (int i = 3; i >= 0; i--) expect |= static_cast<uint64_t>(data[0x4c + i]) << (32 + 8 * i);
+            }
+            open = true;
+            got = 0;
+            sum = 2166136261u;
+            break;
+
+        case REQTYPE::BSL_CMD_MIDST_DATA:
+            if (++midsts == fail_midst) {
+                rep = static_cast<uint16_t>(REPTYPE::BSL_REP_VERIFY_ERROR);
+                break;
+            }
+            if (!open) {
+                rep = static_cast<uint16_t>(REPTYPE::BSL_REP_DOWN_NOT_START);
+                break;
+            }
+
+            // an odd payload is padded, the pad is past the length of the download
+            rxsz = datalen < expect - got ? datalen : expect - got;
+            sum = fnv(sum, data, rxsz);
+            got += rxsz;
+            rxsz = 0;
+            break;
+
+        case REQTYPE::BSL_CMD_END_DATA:
+            if (!open) {
+                rep = static_cast<uint16_t>(REPTYPE::BSL_REP_DOWN_NOT_START);
+                break;
+            }
+
+            open = false;
+            if (got < expect) {
+                early_ends++;
+                rep = static_cast<uint16_t>(REPTYPE::BSL_REP_DOWN_EARLY_END);
+                break;
+            }
+            written.push_back(sum);
+            break;
+
+        case REQTYPE::BSL_CMD_EXEC_DATA:
+            reply(rep, nullptr, 0, escaped, out);
+            if (stage < 2) stage++;
+            return;
+
+        case REQTYPE::BSL_CMD_CHANGE_BAUD: {
+            uint32_t rate = 0;
+
+            // acked at the old rate, switched right after
+            for (int i = 0; i < 4 && i < static_cast<int>(datalen); i++) rate = rate << 8 | data[i];
+            if (baud_max && rate > baud_max) {
+                if (baud_refuse) rep = static_cast<uint16_t>(REPTYPE::BSL_REP_NOT_SUPPORT_BAUDRATE);
+                break;
+            }
+            reply(rep, nullptr, 0, escaped, out);
+            if (baud) baud = rate;
+            return;
+        }
+
+        case REQTYPE::BSL_CMD_READ_MIDST:
+            // size and offset little endian, offset takes a high half from 4 GB on
+            if (datalen < 8) break;
+            for (int i = 3; i >= 0; i--) rxsz = rxsz << 8 | data[i];
+            for (int i = 3; i >= 0; i--) offset = offset << 8 | data[4 + i];
+            if (datalen >= 12) {
+                uint64_t hi = 0;
+                for (int i = 3; i >= 0; i--) hi = hi << 8 | data[8 + i];
+                offset |= hi << 32;
+            }
+            break;
+
+        case REQTYPE::BSL_CMD_READ_FLASH:
+            // address, size and offset big endian
+            if (datalen < 12) break;
+            for (int i = 0; i < 4; i++) rxsz = rxsz << 8 | data[4 + i];
+            for (int i = 0; i < 4; i++) offset = offset << 8 | data[8 + i];
+            break;
+
+        default:
+            break;
+    }
+
+    if (rxsz && rxsz <= MAX_DATA_LEN) {
+        std::vector<uint8_t> buf(rxsz);
+
+        for (uint32_t i = 0; i < rxsz; i++) buf[i] = flash(offset + i);
+        reply(static_cast<uint16_t>(REPTYPE::BSL_REP_READ_FLASH), buf.data(), rxsz, escaped, out);
+        return;
+    }
+
+    reply(rep, nullptr, 0, escaped, out);
+}
+
+uint32_t FakeFDL::flagged(size_t off) {
+    for (size_t i = off + 1; i < pending.size(); i++)
+        if (pending[i] == MAGIC_7e) return i - off + 1;
+    return 0;
+}
+
+void FakeFDL::feed(const uint8_t *data, uint32_t len, std::vector<uint8_t> &out) {
+    size_t used = 0;
+
+    pending.insert(pending.end(), data, data + len);
+
+    // flags and nothing else, bootcode and fdl1 answer that with their version
+    if (stage < 2 && pending.size() == len && std::all_of(data, data + len, [](uint8_t c) { return c == MAGIC_7e; })) {
+        handle(data, 1, out);
+        pending.clear();
+        return;
+    }
+
+    while (used < pending.size()) {
+        uint32_t n = 0;
+
+        // noise before a frame, or the first of two flags in a row
+        if (pending[used] != MAGIC_7e || (stage < 2 && used + 1 < pending.size() && pending[used + 1] == MAGIC_7e)) {
+            used++;
+            continue;
+        }
+
+        if (stage < 2) {
+            n = flagged(used);
+        } else if (pending.size() - used >= sizeof(cmd_header)) {
+            uint32_t datalen = pending[used + 3] << 8 | pending[used + 4];
+            uint32_t framelen = sizeof(cmd_header) + datalen + sizeof(cmd_tail);
+
+            if (pending.size() - used >= framelen)
+                n = pending[used + framelen - 1] == MAGIC_7e ? framelen : flagged(used);
+        }
+        if (!n) break;
+
+        handle(&pending[used], n, out);
+        used += n;
+    }
+    pending.erase(pending.begin(), pending.begin() + used);
+}
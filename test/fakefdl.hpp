@@ -0,0 +1,65 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 00:12:30
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 00:12:30
+ * @Description: device side of bootcode and fdl, as much as tests and benchmarks need
+ */
+#ifndef __FAKEFDL__
+#define __FAKEFDL__
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * every request is acked, CHECK_BAUD gets a version and READ_MIDST or
+ * READ_FLASH as many bytes of flash() as asked. crc is bootcode's up to the
+ * first EXEC_DATA and fdl's after it, replies are escaped up to the second
+ * one, and after it only if the request was. a download is tracked from
+ * START_DATA to END_DATA, as much as fdl checks of it.
+ */
+class FakeFDL {
+   private:
+    std::vector<uint8_t> pending;  // stream bytes not a whole frame yet
+    int stage;                     // 0 bootcode, 1 fdl1, 2 fdl2, one up on each EXEC_DATA
+    bool open;                     // a download is started and not ended
+    uint64_t expect;               // its length
+    uint64_t got;                  // bytes of it in so far
+    uint32_t sum;                  // fnv-1a of them
+    uint32_t midsts;               // MIDST_DATA so far
+
+    void reply(uint16_t type, const uint8_t *data, uint32_t len, bool escaped, std::vector<uint8_t> &out);
+    void request(const uint8_t *frame, uint32_t len, bool escaped, std::vector<uint8_t> &out);
+    // a frame delimited by flags, escaped or not, from pending at off. its length, 0 if not whole yet
+    uint32_t flagged(size_t off);
+
+   public:
+    uint32_t frames;
+    uint64_t bytes;  // of requests, raw
+    uint32_t hash;   // fnv-1a of requests as received, raw
+
+    uint32_t baud;        // rate it is at, CHANGE_BAUD moves it. 0 to leave that to the link
+    uint32_t baud_max;    // highest rate it takes, 0 any
+    bool baud_refuse;     // above baud_max answer NOT_SUPPORT_BAUDRATE, else ack and stay
+    uint32_t fail_midst;  // the nth MIDST_DATA gets VERIFY_ERROR and is not written, 0 none
+    uint32_t nested;      // START_DATA while a download was open, refused
+    uint32_t early_ends;  // END_DATA before all bytes of the download came
+    std::vector<uint32_t> written;  // fnv-1a of each download that ended whole
+
+    // fdl is up already, its crc and no escape from the first reply on
+    explicit FakeFDL(bool fdl = false);
+
+    // byte at off of the flash read back
+    static uint8_t flash(uint64_t off) { return static_cast<uint8_t>((off * 131) ^ (off >> 11)); }
+
+    // one whole request, escaped or not, its reply is appended to out
+    void handle(const uint8_t *frame, uint32_t len, std::vector<uint8_t> &out);
+    /**
+     * a byte stream of frames as a tty takes them. escaped up to fdl2 and
+     * cut at flags, a lone flag is CHECK_BAUD. from fdl2 on they are cut by
+     * their length, those that do not end there are escaped ones
+     */
+    void feed(const uint8_t *data, uint32_t len, std::vector<uint8_t> &out);
+};
+
+#endif  //__FAKEFDL__
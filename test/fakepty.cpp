@@ -0,0 +1,131 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 01:46:20
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 01:46:20
+ * @Description: bootcode or fdl2 at the far end of a pty
+ */
+#include <cstdlib>
+#include <vector>
+
+extern "C" {
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+}
+
+#include "serial.hpp"
+#include "fakepty.hpp"
+
+FakePty::FakePty(uint32_t chunk, uint32_t gap, bool fdl)
+    : master(-1), chunk(chunk), gap(gap), device(fdl), quit(false) {
+    struct termios tio;
+    char *name;
+
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0) return;
+
+    if (grantpt(master) || unlockpt(master) || !(name = ptsname(master))) {
+        close(master);
+        master = -1;
+        return;
+    }
+    slave = name;
+
+    // raw both ways before the link sets it, nothing is echoed back meanwhile
+    if (!tcgetattr(master, &tio)) {
+        cfmakeraw(&tio);
+        tcsetattr(master, TCSANOW, &tio);
+    }
+
+    th = std::thread(&FakePty::run, this);
+}
+
+FakePty::~FakePty() {
+    if (th.joinable()) {
+        {
+            std::lock_guard<std::mutex> l(m);
+            quit = true;
+        }
+        th.join();
+    }
+    if (master >= 0) close(master);
+}
+
+uint64_t FakePty::bytes() {
+    std::lock_guard<std::mutex> l(m);
+    return device.bytes;
+}
+
+uint32_t FakePty::hash() {
+    std::lock_guard<std::mutex> l(m);
+    return device.hash;
+}
+
+void FakePty::setBaud(uint32_t max, bool refuse) {
+    std::lock_guard<std::mutex> l(m);
+    device.baud = 115200;
+    device.baud_max = max;
+    device.baud_refuse = refuse;
+}
+
+void FakePty::failMidst(uint32_t nth) {
+    std::lock_guard<std::mutex> l(m);
+    device.fail_midst = nth;
+}
+
+FakeFDL FakePty::state() {
+    std::lock_guard<std::mutex> l(m);
+    return device;
+}
+
+// the rate the link last set, master and slave share one termios
+static uint32_t link_rate(int master) {
+    struct termios tio;
+    speed_t speed;
+
+    if (tcgetattr(master, &tio)) return 0;
+    speed = cfgetospeed(&tio);
+    for (int i = 0; i <= static_cast<int>(BAUD::BAUD4000000); i++)
+        if (SerialPort::BaudSPEED[i] == speed) return SerialPort::BaudARR[i];
+    return 0;
+}
+
+void FakePty::run() {
+    std::vector<uint8_t> in(64 * 1024);
+    std::vector<uint8_t> out;
+
+    while (1) {
+        struct pollfd pfd = {master, POLLIN, 0};
+        ssize_t n;
+
+        {
+            std::lock_guard<std::mutex> l(m);
+            if (quit) return;
+        }
+
+        // no one on the slave side yet or any more reads as POLLHUP
+        if (poll(&pfd, 1, 20) <= 0 || !(pfd.revents & POLLIN)) {
+            if (pfd.revents & POLLHUP) usleep(1000);
+            continue;
+        }
+        n = read(master, in.data(), in.size());
+        if (n <= 0) continue;
+
+        out.clear();
+        {
+            std::lock_guard<std::mutex> l(m);
+            if (!device.baud || device.baud == link_rate(master)) device.feed(in.data(), n, out);
+        }
+
+        for (size_t off = 0; off < out.size();) {
+            size_t len = (chunk && out.size() - off > chunk) ? chunk : out.size() - off;
+            ssize_t w = write(master, &out[off], len);
+
+            if (w <= 0) break;
+            off += w;
+            if (gap && off < out.size()) usleep(gap);
+        }
+    }
+}
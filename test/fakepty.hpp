@@ -0,0 +1,55 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 01:46:20
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 01:46:20
+ * @Description: bootcode or fdl2 at the far end of a pty
+ */
+#ifndef __FAKEPTY__
+#define __FAKEPTY__
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "fakefdl.hpp"
+
+/**
+ * a FakeFDL on the master of a pty, past fdl2 or from bootcode on. a link
+ * opens path() as it would the modem tty. replies go out in chunk byte
+ * writes gap us apart, as a usb serial driver hands over urbs, or in one
+ * write if chunk is 0. with setBaud, what the link sends at another rate
+ * than the device is at is lost
+ */
+class FakePty {
+   private:
+    int master;
+    std::string slave;
+    uint32_t chunk;
+    uint32_t gap;
+    std::mutex m;
+    FakeFDL device;
+    std::thread th;
+    bool quit;
+
+    void run();
+
+   public:
+    explicit FakePty(uint32_t chunk = 0, uint32_t gap = 0, bool fdl = true);
+    ~FakePty();
+
+    bool isOpened() const { return master >= 0; }
+    const std::string &path() const { return slave; }
+    // requests so far, raw, and their fnv-1a
+    uint64_t bytes();
+    uint32_t hash();
+    // the device starts at 115200 and goes up to max, see FakeFDL::baud_refuse
+    void setBaud(uint32_t max, bool refuse);
+    // see FakeFDL::fail_midst
+    void failMidst(uint32_t nth);
+    // a copy of the device as it is now
+    FakeFDL state();
+};
+
+#endif  //__FAKEPTY__
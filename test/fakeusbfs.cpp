@@ -0,0 +1,298 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 00:40:12
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 00:40:12
+ * @Description: usbfs without a device, ioctl, mmap and epoll_wait answered in process
+ */
+#include <cerrno>
+#include <cstdarg>
+#include <cstring>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/usbdevice_fs.h>
+}
+
+#include "usbfs.hpp"
+#include "fakeusbfs.hpp"
+
+#define URB_MAX (16 * 1024)
+
+using clk = std::chrono::steady_clock;
+using usec = std::chrono::microseconds;
+
+static FakeUSB *active = nullptr;
+
+extern "C" int ioctl(int fd, unsigned long req, ...) {
+    va_list ap;
+    void *arg;
+
+    va_start(ap, req);
+    arg = va_arg(ap, void *);
+    va_end(ap);
+
+    if (active && fd == active->fd) return active->ioctl(req, arg);
+    return syscall(SYS_ioctl, fd, req, arg);
+}
+
+extern "C" void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off) {
+    if (active && fd >= 0 && fd == active->fd) return active->mmap(len);
+    return reinterpret_cast<void *>(syscall(SYS_mmap, addr, len, prot, flags, fd, off));
+}
+
+// usbfs is the only user of epoll in a binary linked with this
+extern "C" int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout) {
+    if (!active) return epoll_pwait(epfd, events, maxevents, timeout, nullptr);
+    if (!active->wait(timeout)) return 0;
+
+    events[0].events = EPOLLOUT;
+    events[0].data.fd = active->fd;
+    return 1;
+}
+
+FakeUSB::FakeUSB(uint32_t sched, uint32_t bw, uint32_t reply)
+    : sched(sched), bw(bw), delay(reply), node(".usb"), quit(false), nout(0), nin(0), fail_out(0), fail_in(0),
+      lost(false), fd(-1) {
+    memset(&st, 0, sizeof(st));
+    mkfifo(node.str().c_str(), 0600);
+    th = std::thread(&FakeUSB::bus, this);
+    active = this;
+}
+
+FakeUSB::~FakeUSB() {
+    {
+        std::lock_guard<std::mutex> l(m);
+        quit = true;
+    }
+    cv.notify_all();
+    th.join();
+    active = nullptr;
+}
+
+USBFS *FakeUSB::open() {
+    // the lowest free fd is the one USBFS will get
+    int probe = ::open(node.str().c_str(), O_RDWR);
+    USBFS *usbfs;
+
+    if (probe < 0) return nullptr;
+    close(probe);
+
+    fd = probe;
+    usbfs = new (std::nothrow) USBFS(node.str(), 0, 0x81, 0x01);
+    if (usbfs && usbfs->fd() != probe) {
+        delete usbfs;
+        usbfs = nullptr;
+    }
+    if (!usbfs) fd = -1;
+
+    return usbfs;
+}
+
+FakeUSBStats FakeUSB::stats() {
+    std::lock_guard<std::mutex> l(m);
+
+    st.bytes = device.bytes;
+    st.hash = device.hash;
+    return st;
+}
+
+void FakeUSB::complete() {
+    std::vector<uint8_t> reply;
+
+    st.transfers++;
+    device.handle(cur.data(), cur.size(), reply);
+    cur.clear();
+    if (!reply.empty()) replies.push_back(pending_reply{clk::now() + usec(delay), std::move(reply)});
+    cv.notify_all();
+}
+
+void FakeUSB::out(const uint8_t *data, uint32_t len, bool first) {
+    if (first) {
+        if (!cur.empty()) complete();
+        lost = false;
+    }
+    if (lost) return;
+
+    cur.insert(cur.end(), data, data + len);
+    if (len < URB_MAX) complete();
+}
+
+uint32_t FakeUSB::in(uint8_t *buf, uint32_t room) {
+    auto &r = replies.front();
+    uint32_t n = std::min<size_t>(room, r.data.size());
+
+    memcpy(buf, r.data.data(), n);
+    r.data.erase(r.data.begin(), r.data.begin() + n);
+    if (r.data.empty()) replies.pop_front();
+
+    return n;
+}
+
+void FakeUSB::bus() {
+    std::unique_lock<std::mutex> l(m);
+    bool busy = false;
+
+    while (!quit) {
+        auto now = clk::now();
+
+        // IN urbs are queued already, a reply goes as soon as it is ready
+        if (!inq.empty() && !replies.empty() && replies.front().ready <= now) {
+            auto urb = inq.front();
+
+            inq.pop_front();
+            urb->status = 0;
+            urb->actual_length = 0;
+            if (++nin == fail_in)
+                urb->status = -EPIPE;
+            else
+                urb->actual_length = in(static_cast<uint8_t *>(urb->buffer), urb->buffer_length);
+            done.push_back(urb);
+            cv.notify_all();
+            continue;
+        }
+
+        if (!outq.empty()) {
+            auto urb = outq.front();
+            bool first = !(urb->flags & USBDEVFS_URB_BULK_CONTINUATION);
+
+            outq.pop_front();
+            l.unlock();
+            std::this_thread::sleep_for(usec((busy ? 0 : sched) + urb->buffer_length / bw));
+            l.lock();
+
+            st.urbs++;
+            if (!first) st.continued++;
+            urb->status = 0;
+            urb->actual_length = urb->buffer_length;
+            if (++nout == fail_out) {
+                urb->status = -EPROTO;
+                urb->actual_length = 0;
+                cur.clear();
+                lost = true;
+            } else {
+                out(static_cast<uint8_t *>(urb->buffer), urb->buffer_length, first);
+            }
+            done.push_back(urb);
+            cv.notify_all();
+            busy = !outq.empty();
+            continue;
+        }
+
+        busy = false;
+        cv.wait_until(l, replies.empty() ? now + std::chrono::milliseconds(1) : replies.front().ready);
+    }
+}
+
+int FakeUSB::ioctl(unsigned long req, void *arg) {
+    std::unique_lock<std::mutex> l(m);
+
+    switch (req) {
+        case USBDEVFS_GETDRIVER:
+            errno = ENODATA;
+            return -1;
+
+        case USBDEVFS_BULK: {
+            auto bulk = static_cast<struct usbdevfs_bulktransfer *>(arg);
+            auto deadline = clk::now() + std::chrono::milliseconds(bulk->timeout);
+            clk::time_point ready;
+
+            if (!(bulk->ep & 0x80)) {
+                l.unlock();
+                std::this_thread::sleep_for(usec(sched + bulk->len / bw));
+                l.lock();
+                st.urbs++;
+                out(static_cast<uint8_t *>(bulk->data), bulk->len, false);
+                return bulk->len;
+            }
+
+            // 0 waits forever, as the kernel does
+            while (replies.empty()) {
+                if (!bulk->timeout)
+                    cv.wait(l);
+                else if (cv.wait_until(l, deadline) == std::cv_status::timeout && replies.empty())
+                    break;
+            }
+            if (replies.empty()) {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+
+            // the IN token is scheduled once the reply is there
+            ready = replies.front().ready;
+            l.unlock();
+            std::this_thread::sleep_until(ready + usec(sched));
+            l.lock();
+            return in(static_cast<uint8_t *>(bulk->data), bulk->len);
+        }
+
+        case USBDEVFS_SUBMITURB: {
+            auto urb = static_cast<struct usbdevfs_urb *>(arg);
+
+            (urb->endpoint & 0x80 ? inq : outq).push_back(urb);
+            cv.notify_all();
+            return 0;
+        }
+
+        case USBDEVFS_REAPURB:
+            cv.wait(l, [this] { return !done.empty(); });
+            // fall through
+        case USBDEVFS_REAPURBNDELAY:
+            if (done.empty()) {
+                errno = EAGAIN;
+                return -1;
+            }
+            *static_cast<struct usbdevfs_urb **>(arg) = done.front();
+            done.pop_front();
+            return 0;
+
+        case USBDEVFS_DISCARDURB: {
+            auto urb = static_cast<struct usbdevfs_urb *>(arg);
+
+            for (auto q : {&outq, &inq}) {
+                for (auto it = q->begin(); it != q->end(); it++) {
+                    if (*it != urb) continue;
+                    q->erase(it);
+                    urb->status = -ENOENT;
+                    done.push_back(urb);
+                    cv.notify_all();
+                    return 0;
+                }
+            }
+            errno = EINVAL;
+            return -1;
+        }
+
+        case USBDEVFS_CLEAR_HALT:
+            st.halts++;
+            return 0;
+
+        default:
+            return 0;
+    }
+}
+
+void *FakeUSB::mmap(size_t len) {
+    std::lock_guard<std::mutex> l(m);
+
+    st.mapped = len;
+    return reinterpret_cast<void *>(syscall(SYS_mmap, nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                                            -1, 0));
+}
+
+int FakeUSB::wait(int timeout) {
+    std::unique_lock<std::mutex> l(m);
+    auto ready = [this] { return !done.empty(); };
+
+    if (timeout < 0) {
+        cv.wait(l, ready);
+        return 1;
+    }
+    return cv.wait_for(l, std::chrono::milliseconds(timeout), ready) ? 1 : 0;
+}
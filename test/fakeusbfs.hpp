@@ -0,0 +1,90 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 00:40:12
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 00:40:12
+ * @Description: usbfs without a device, ioctl, mmap and epoll_wait answered in process
+ */
+#ifndef __FAKEUSBFS__
+#define __FAKEUSBFS__
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "fakefdl.hpp"
+#include "pacgen.hpp"
+
+struct usbdevfs_urb;
+class USBFS;
+
+struct FakeUSBStats {
+    uint32_t transfers;
+    uint32_t urbs;       // OUT ones
+    uint32_t continued;  // of them with USBDEVFS_URB_BULK_CONTINUATION
+    uint32_t halts;      // USBDEVFS_CLEAR_HALT asked
+    size_t mapped;       // bytes of urb memory mmap'd
+    uint64_t bytes;      // of requests
+    uint32_t hash;       // fnv-1a of requests
+};
+
+/**
+ * a linked binary gets ioctl, mmap and epoll_wait from here, for the fd of
+ * the USBFS made by open() they act as a bus and a FakeFDL behind it, for
+ * any other fd they are the real calls. a transfer waits sched us to be
+ * scheduled unless it queues behind another, moves bw bytes per us, and the
+ * device replies reply us after a request is whole. an urb short of 16 KB
+ * ends a transfer. one at a time, it outlives the USBFS.
+ */
+class FakeUSB {
+   private:
+    struct pending_reply {
+        std::chrono::steady_clock::time_point ready;
+        std::vector<uint8_t> data;
+    };
+
+    uint32_t sched, bw, delay;
+    TempPath node;  // a fifo for USBFS to open, epoll takes it
+    std::mutex m;
+    std::condition_variable cv;
+    std::thread th;
+    bool quit;
+    std::deque<struct usbdevfs_urb *> outq, inq, done;
+    std::deque<pending_reply> replies;
+    std::vector<uint8_t> cur;  // request transfer so far
+    uint32_t nout, nin;        // urbs completed, for failures asked
+    uint32_t fail_out, fail_in;
+    bool lost;  // the transfer had an urb fail, its continuations go nowhere
+    FakeFDL device;
+    FakeUSBStats st;
+
+    void bus();
+    void out(const uint8_t *data, uint32_t len, bool first);
+    void complete();
+    uint32_t in(uint8_t *buf, uint32_t room);
+
+   public:
+    int fd;
+
+    FakeUSB(uint32_t sched = 125, uint32_t bw = 40, uint32_t reply = 200);
+    ~FakeUSB();
+
+    // a USBFS on this bus, nullptr if its fd is not the one expected
+    USBFS *open();
+    // the nth OUT urb completes with -EPROTO and its transfer is lost, 0 never
+    void failOut(uint32_t nth) { fail_out = nth; }
+    // the nth IN urb completes with -EPIPE, the reply comes with the next one
+    void failIn(uint32_t nth) { fail_in = nth; }
+    FakeUSBStats stats();
+
+    // what the calls on fd do
+    int ioctl(unsigned long req, void *arg);
+    void *mmap(size_t len);
+    int wait(int timeout);
+};
+
+#endif  //__FAKEUSBFS__
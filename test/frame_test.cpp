@@ -0,0 +1,293 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-17 23:36:09
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-17 23:36:09
+ * @Description: FDLRequest frames against the runtime branching encoder it replaced, and frames/s of both
+ */
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "fdl.hpp"
+#include "check.hpp"
+#include "legacy.hpp"
+
+/**
+ * FDLRequest as it was: a 16 KB memset per frame, arguments pushed one by
+ * one, crc and escape picked at runtime and the frame escaped in place
+ */
+class OldRequest {
+   private:
+    std::vector<uint8_t> _data;
+    uint32_t _reallen;
+
+   public:
+    CRC_MODLE crc_modle;
+    bool data_escape_flag;
+    bool crc_escape_flag;
+
+    OldRequest() : _data(2 * MAX_DATA_LEN + 8), _reallen(0) {}
+
+    const uint8_t *rawData() { return _data.data(); }
+    uint32_t rawDataLen() { return _reallen; }
+
+    void reinit(REQTYPE req) {
+        memset(_data.data(), 0, MAX_DATA_LEN);
+        _data[0] = MAGIC_7e;
+        _data[1] = static_cast<uint16_t>(req) >> 8;
+        _data[2] = static_cast<uint16_t>(req);
+        _reallen = sizeof(cmd_header);
+    }
+
+    void push_back(const void *d, uint32_t len) {
+        memcpy(&_data[_reallen], d, len);
+        _reallen += len;
+        _data[3] = (_reallen - sizeof(cmd_header)) >> 8;
+        _data[4] = _reallen - sizeof(cmd_header);
+    }
+
+    template <typename T>
+    void push_back(T val) {
+        push_back(&val, sizeof(val));
+    }
+
+    void push_back(const std::string &val) {
+        uint32_t padlen = 0x48 - val.size() * 2;
+
+        for (auto ch : val) push_back(htole16(ch));
+        for (; padlen > 0; padlen--) push_back(uint8_t(0));
+    }
+
+    void finishup() {
+        uint16_t crc16;
+        uint32_t n;
+
+        if (!(_reallen % 2)) push_back(uint8_t(0));
+
+        if (crc_modle == CRC_MODLE::CRC_BOOTCODE)
+            crc16 = old_bootcode(&_data[1], _reallen - 1);
+        else
+            crc16 = old_fdl(&_data[1], _reallen - 1);
+
+        if (data_escape_flag && crc_escape_flag) {
+            _data[_reallen++] = crc16 >> 8;
+            _data[_reallen++] = crc16;
+        }
+        n = data_escape_flag ? old_escape(&_data[1], _reallen - 1) + 1 : _reallen;
+        _reallen = n;
+
+        if (!data_escape_flag || !crc_escape_flag) {
+            _data[_reallen++] = crc16 >> 8;
+            _data[_reallen++] = crc16;
+        }
+        _data[_reallen++] = MAGIC_7e;
+    }
+
+    void frame(REQTYPE req) {
+        reinit(req);
+        finishup();
+    }
+};
+
+static bool same(FDLRequest &r, OldRequest &o) {
+    std::vector<uint8_t> gathered;
+
+    // what goes on the wire, the iovec list, must be the flat frame too
+    for (int i = 0; i < r.rawIovCnt(); i++) {
+        auto p = static_cast<const uint8_t *>(r.rawIov()[i].iov_base);
+        gathered.insert(gathered.end(), p, p + r.rawIov()[i].iov_len);
+    }
+
+    return r.rawDataLen() == o.rawDataLen() && !memcmp(r.rawData(), o.rawData(), o.rawDataLen()) &&
+           gathered.size() == o.rawDataLen() && !memcmp(gathered.data(), o.rawData(), o.rawDataLen());
+}
+
+// payload of len bytes, one in eight a 0x7e or 0x7d
+static void payload(std::vector<uint8_t> &buf, uint32_t len, uint64_t &seed) {
+    for (uint32_t i = 0; i < len; i++) {
+        uint64_t k = pseudo_random(seed);
+        buf[i] = (k & 7) == 0 ? 0x7e : (k & 7) == 1 ? 0x7d : k >> 8;
+    }
+}
+
+static void golden(CRC_MODLE mod, bool data_es, bool crc_es) {
+    FDLRequest r;
+    OldRequest o;
+    std::vector<uint8_t> buf(MAX_DATA_LEN);
+    uint64_t seed = 0x452821e638d01377ull;
+    std::vector<partition_info> table(3);
+
+    r.setCrcModle(mod);
+    r.setEscapeFlag(data_es, crc_es);
+    o.crc_modle = mod;
+    o.data_escape_flag = data_es;
+    o.crc_escape_flag = crc_es;
+
+    // the constant frames, built at compile time now
+    for (auto req : {REQTYPE::BSL_CMD_CONNECT, REQTYPE::BSL_CMD_END_DATA, REQTYPE::BSL_CMD_EXEC_DATA,
+                     REQTYPE::BSL_CMD_NORMAL_RESET, REQTYPE::BSL_CMD_END_READ, REQTYPE::BSL_CMD_EXEC_NAND_INIT}) {
+        o.frame(req);
+        switch (req) {
+            case REQTYPE::BSL_CMD_CONNECT:
+                r.newConnect();
+                break;
+            case REQTYPE::BSL_CMD_END_DATA:
+                r.newEndData();
+                break;
+            case REQTYPE::BSL_CMD_EXEC_DATA:
+                r.newExecData();
+                break;
+            case REQTYPE::BSL_CMD_NORMAL_RESET:
+                r.newNormalReset();
+                break;
+            case REQTYPE::BSL_CMD_END_READ:
+                r.newEndRead();
+                break;
+            default:
+                r.newExecNandInit();
+                break;
+        }
+        CHECK(same(r, o));
+    }
+
+    // midst of every size up to a full frame, payload is referenced rather than copied now
+    for (int t = 0; t < 200; t++) {
+        uint32_t len = t < 64 ? t : pseudo_random(seed) % (MAX_DATA_LEN - 0x100);
+
+        payload(buf, len, seed);
+        r.newMidstData(buf.data(), len);
+        o.reinit(REQTYPE::BSL_CMD_MIDST_DATA);
+        o.push_back(buf.data(), len);
+        o.finishup();
+        CHECK(same(r, o));
+    }
+
+    r.newStartData(0x7e7d0000, 0x12345, 0x7e7e);
+    o.reinit(REQTYPE::BSL_CMD_START_DATA);
+    o.push_back(htobe32(0x7e7d0000));
+    o.push_back(htobe32(0x12345));
+    o.push_back(htobe32(0x7e7e));
+    o.finishup();
+    CHECK(same(r, o));
+
+    r.newStartData("FDL2", 0x7d7d, 0);
+    o.reinit(REQTYPE::BSL_CMD_START_DATA);
+    o.push_back(std::string("FDL2"));
+    o.push_back(htole32(0x7d7d));
+    o.finishup();
+    CHECK(same(r, o));
+
+    r.newReadFlash(0x7e, 0x3000, 0x7d00);
+    o.reinit(REQTYPE::BSL_CMD_READ_FLASH);
+    o.push_back(htobe32(0x7e));
+    o.push_back(htobe32(0x3000));
+    o.push_back(htobe32(0x7d00));
+    o.finishup();
+    CHECK(same(r, o));
+
+    r.newErasePartition(0x7e, 0x7d);
+    o.reinit(REQTYPE::BSL_CMD_ERASE_FLASH);
+    o.push_back(htobe32(0x7e));
+    o.push_back(htobe32(0x7d));
+    o.finishup();
+    CHECK(same(r, o));
+
+    r.newErasePartition("NV");
+    o.reinit(REQTYPE::BSL_CMD_ERASE_FLASH);
+    o.push_back(std::string("NV"));
+    o.push_back(uint32_t(0));
+    o.finishup();
+    CHECK(same(r, o));
+
+    table[0].partition = "a";
+    table[0].size = 0x7e;
+    table[1].partition = "system";
+    table[1].size = 100;
+    table[2].partition = "x";
+    table[2].size = 0x7d7d;
+    r.newRePartition(table);
+    o.reinit(REQTYPE::BSL_CMD_REPARTITION);
+    for (auto &p : table) {
+        o.push_back(p.partition);
+        o.push_back(htole32(p.size));
+    }
+    o.finishup();
+    CHECK(same(r, o));
+
+    r.newChangeBaud(BAUD::BAUD921600);
+    o.reinit(REQTYPE::BSL_CMD_CHANGE_BAUD);
+    o.push_back(htobe32(921600));
+    o.finishup();
+    CHECK(same(r, o));
+
+    r.newStartRead("NV", 0x7e);
+    o.reinit(REQTYPE::BSL_CMD_START_READ);
+    o.push_back(std::string("NV"));
+    o.push_back(htole32(0x7e));
+    o.finishup();
+    CHECK(same(r, o));
+
+    r.newReadMidst(0x3000, 0x7e00);
+    o.reinit(REQTYPE::BSL_CMD_READ_MIDST);
+    o.push_back(htole32(0x3000));
+    o.push_back(htole32(0x7e00));
+    o.finishup();
+    CHECK(same(r, o));
+}
+
+// frames/s for a midst frame of framesz and for END_DATA, old against new
+static void bench(const char *name, CRC_MODLE mod, bool data_es, bool crc_es, uint32_t framesz) {
+    FDLRequest r;
+    OldRequest o;
+    std::vector<uint8_t> buf(framesz);
+    uint64_t seed = 0xbe5466cf34e90c6cull;
+
+    payload(buf, framesz, seed);
+    r.setCrcModle(mod);
+    r.setEscapeFlag(data_es, crc_es);
+    o.crc_modle = mod;
+    o.data_escape_flag = data_es;
+    o.crc_escape_flag = crc_es;
+
+    auto midst_old = [&] {
+        o.reinit(REQTYPE::BSL_CMD_MIDST_DATA);
+        o.push_back(buf.data(), framesz);
+        o.finishup();
+        keep(o.rawDataLen());
+    };
+    auto midst_new = [&] {
+        r.newMidstData(buf.data(), framesz);
+        keep(r.rawIovCnt());
+    };
+    auto end_old = [&] {
+        o.frame(REQTYPE::BSL_CMD_END_DATA);
+        keep(o.rawDataLen());
+    };
+    auto end_new = [&] {
+        r.newEndData();
+        keep(r.rawIovCnt());
+    };
+
+    // throughput is GB/s of bytes, 1 byte per call gives calls per ns
+    printf("%-16s midst %#6x %10.0f -> %10.0f frames/s, END_DATA %10.0f -> %10.0f frames/s\n", name, framesz,
+           throughput(midst_old, 1) * 1e9, throughput(midst_new, 1) * 1e9, throughput(end_old, 1) * 1e9,
+           throughput(end_new, 1) * 1e9);
+}
+
+int main() {
+    for (auto mod : {CRC_MODLE::CRC_BOOTCODE, CRC_MODLE::CRC_FDL}) {
+        golden(mod, false, false);
+        golden(mod, true, false);
+        golden(mod, true, true);
+    }
+
+    // as flash_fdl, flash_nand_fdl and flash_partition set them up
+    bench("bootcode", CRC_MODLE::CRC_BOOTCODE, true, true, 0x210);
+    bench("fdl1", CRC_MODLE::CRC_FDL, true, true, 0x840);
+    bench("fdl2 old proto", CRC_MODLE::CRC_FDL, true, true, 0x800);
+    bench("fdl2", CRC_MODLE::CRC_FDL, false, false, 0x3000);
+
+    return check_failures() ? 1 : 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-17 23:36:09
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-17 23:36:09
+ * @Description: checksums and escape as FDLRequest had them before, what the new code must match
+ */
+#ifndef __LEGACY__
+#define __LEGACY__
+
+#include <cstdint>
+#include <cstring>
+
+// crc16BootCode, one bit per step
+inline uint16_t old_bootcode(const uint8_t *src, uint32_t len) {
+    uint16_t crc = 0;
+
+    while (len-- != 0) {
+        for (unsigned int i = 0x80; i != 0; i = i >> 1) {
+            if ((crc & 0x8000) != 0) {
+                crc = crc << 1;
+                crc = crc ^ 0x1021;
+            } else
+                crc = crc << 1;
+            if ((*src & i) != 0) crc = crc ^ 0x1021;
+        }
+        src++;
+    }
+    return crc;
+}
+
+// crc16NV, its table built here instead of spelled out
+inline uint16_t old_nv(uint16_t crc, const uint8_t *buffer, uint32_t len) {
+    uint16_t table[256];
+
+    for (int n = 0; n < 256; n++) {
+        uint16_t c = n;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? (c >> 1) ^ 0xA001 : c >> 1;
+        table[n] = c;
+    }
+
+    while (len--) crc = (uint16_t)((crc >> 8) ^ (table[(crc ^ (*buffer++)) & 0xff]));
+    return crc;
+}
+
+// crc16FDL, words read with memcpy where it took a misaligned uint16_t pointer
+inline uint16_t old_fdl(const uint8_t *src, uint32_t len) {
+    unsigned int sum = 0;
+
+    while (len > 1) {
+        uint16_t word;
+        memcpy(&word, src, 2);
+        sum += ((word & 0xFF00) >> 8) | ((word & 0x00FF) << 8);
+        src += 2;
+        len -= 2;
+    }
+    if (len == 1) sum += *src;
+
+    sum = (sum >> 16) + (sum & 0x0FFFF);
+    sum += (sum >> 16);
+
+    return (~sum);
+}
+
+// _num_escape and _do_escape, count and then shift backwards in place. src has room for the result
+inline uint32_t old_escape(uint8_t *src, uint32_t srclen) {
+    uint32_t magic_num = 0;
+
+    for (uint32_t p = 0; p < srclen; p++)
+        if (src[p] == 0x7e || src[p] == 0x7d) magic_num++;
+    if (!magic_num) return srclen;
+
+    uint32_t total = srclen + magic_num;
+    for (uint32_t pos_l = srclen - 1, pos_r = srclen + magic_num - 1;; pos_l--) {
+        if (src[pos_l] == 0x7e) {
+            src[pos_r--] = 0x5e;
+            src[pos_r--] = 0x7d;
+            magic_num--;
+        } else if (src[pos_l] == 0x7d) {
+            src[pos_r--] = 0x5d;
+            src[pos_r--] = 0x7d;
+            magic_num--;
+        } else {
+            src[pos_r--] = src[pos_l];
+        }
+        if (magic_num == 0) break;
+    }
+
+    return total;
+}
+
+#endif  //__LEGACY__
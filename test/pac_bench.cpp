@@ -0,0 +1,149 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 03:44:02
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 03:44:02
+ * @Description: member lookups in a pac of 1000 members, against the scans the index replaced
+ */
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+#include "firmware.hpp"
+#include "pacgen.hpp"
+#include "check.hpp"
+
+#define MEMBERS 1000
+#define ROUNDS 20
+
+/**
+ * lookups as Firmware did them before the index: every header decoded and
+ * upper cased per call, offsets summed over the members before
+ */
+class OldLookup {
+   private:
+    Firmware &fw;
+    pac_header_t hdr;
+    std::vector<bin_header_t> bins;
+
+   public:
+    OldLookup(Firmware &fw, const std::string &pac) : fw(fw) {
+        std::ifstream fin(pac, std::ios::binary);
+
+        fin.read(reinterpret_cast<char *>(&hdr), sizeof(hdr));
+        bins.resize(hdr.nFileCount);
+        fin.read(reinterpret_cast<char *>(bins.data()), sizeof(bin_header_t) * bins.size());
+    }
+
+    int fileid_to_index(const std::string &idstr) {
+        std::string idstr_upper(idstr);
+
+        std::transform(idstr.begin(), idstr.end(), idstr_upper.begin(), toupper);
+        for (uint32_t idx = 0; idx < hdr.nFileCount; idx++) {
+            std::string fileid_upper(fw.wcharToChar(bins[idx].szFileID, sizeof(bins[idx].szFileID)));
+
+            std::transform(fileid_upper.begin(), fileid_upper.end(), fileid_upper.begin(), toupper);
+            if (!idstr.empty() && idstr_upper == fileid_upper) return idx;
+        }
+        return -1;
+    }
+
+    uint64_t member_file_size(int idx) { return bins[idx].dwLoFileSize; }
+
+    uint64_t member_file_offset(int idx) {
+        uint64_t offset = sizeof(pac_header_t) + sizeof(bin_header_t) * hdr.nFileCount;
+
+        for (int i = 0; i < idx; i++) offset += bins[i].dwLoFileSize;
+        return offset;
+    }
+};
+
+static std::string id(int i) {
+    char buf[16];
+
+    snprintf(buf, sizeof(buf), "Part%04d", i);
+    return buf;
+}
+
+int main() {
+    TempPath pac(".pac");
+    PacWriter w("BENCH_MODEM");
+    std::vector<std::string> ids;
+    std::unique_ptr<Firmware> fw;
+    std::streambuf *saved = std::cerr.rdbuf();
+    std::ofstream devnull("/dev/null");
+    uint64_t sum = 0;
+    double sec;
+
+    // the xml is member 0, so Part%04d is member i + 1. the last one repeats the first, the first wins
+    for (int i = 0; i < MEMBERS - 1; i++) {
+        w.add(id(i), id(i) + ".bin", 64 + i * 7);
+        w.put(0, id(i));
+        ids.push_back(id(i));
+    }
+    w.add("PART0000", "again.bin", 16);
+    CHECK(w.write(pac.str()) == 0);
+
+    // parsing logs every member, timed with and without it
+    for (bool quiet : {false, true}) {
+        double best = 1e9;
+
+        for (int i = 0; i < 10; i++) {
+            auto start = std::chrono::steady_clock::now();
+
+            if (quiet) std::cerr.rdbuf(devnull.rdbuf());
+            fw.reset(new Firmware(pac.str()));
+            CHECK(fw->pacparser() == 0);
+            std::cerr.rdbuf(saved);
+            best = std::min(best, elapsed(start));
+        }
+        printf("pacparser of %d members%s: %.2f ms best of 10\n", MEMBERS, quiet ? ", log to /dev/null" : "",
+               best * 1e3);
+    }
+
+    OldLookup old(*fw, pac.str());
+
+    CHECK(fw->pac_file_count() == MEMBERS + 1);
+    for (int i = 0; i < MEMBERS - 1; i++) {
+        int idx = fw->fileid_to_index(ids[i]);
+        byte_span m = fw->member(ids[i]);
+
+        CHECK(idx == i + 1 && idx == old.fileid_to_index(ids[i]));
+        CHECK(fw->member_file_size(idx) == old.member_file_size(idx));
+        CHECK(fw->member_file_offset(idx) == old.member_file_offset(idx));
+        CHECK(m.data && m.size == 64u + i * 7 && !memcmp(m.data, ids[i].data(), ids[i].size()));
+    }
+    CHECK(fw->fileid_to_index("part0000") == 1 && fw->fileid_to_index("nothere") == -1);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (auto &s : ids) {
+            int idx = old.fileid_to_index(s);
+            sum += old.member_file_offset(idx) + old.member_file_size(idx);
+        }
+    }
+    sec = elapsed(start);
+    printf("lookup set before: %8.2f us\n", sec * 1e6 / ROUNDS / ids.size());
+
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (auto &s : ids) {
+            int idx = fw->fileid_to_index(s);
+            sum += fw->member_file_offset(idx) + fw->member_file_size(idx);
+        }
+    }
+    sec = elapsed(start);
+    printf("lookup set now:    %8.2f us\n", sec * 1e6 / ROUNDS / ids.size());
+
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < ROUNDS; r++)
+        for (auto &s : ids) sum += fw->member(s).size;
+    sec = elapsed(start);
+    printf("member() now:      %8.2f us\n", sec * 1e6 / ROUNDS / ids.size());
+
+    keep(sum);
+    return check_failures() ? 1 : 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 00:12:30
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 00:12:30
+ * @Description: pacs made up for tests and benchmarks
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+}
+
+#include "firmware.hpp"
+#include "pacgen.hpp"
+#include "check.hpp"
+
+static void wset(uint16_t *dst, size_t room, const std::string &s) {
+    for (size_t i = 0; i < s.size() && i < room - 1; i++) dst[i] = static_cast<uint8_t>(s[i]);
+}
+
+static std::string hex(uint64_t v) {
+    char buf[24];
+
+    snprintf(buf, sizeof(buf), "0x%llx", static_cast<unsigned long long>(v));
+    return buf;
+}
+
+PacWriter::PacWriter(const std::string &product) : product(product) {}
+
+void PacWriter::add(const std::string &fileid, const std::string &filename, uint64_t size) {
+    members.push_back(member{fileid, filename, size, {}});
+}
+
+void PacWriter::put(uint64_t off, const std::string &data) { members.back().chunks.emplace_back(off, data); }
+
+void PacWriter::addRandom(const std::string &fileid, const std::string &filename, uint64_t size, uint64_t seed) {
+    std::string data(size, 0);
+
+    seed |= 1;
+    for (auto &c : data) c = static_cast<char>(pseudo_random(seed));
+    add(fileid, filename, size);
+    put(0, data);
+}
+
+void PacWriter::file(const std::string &fileid, const std::string &type, const std::string &block, uint64_t size,
+                     uint64_t base, bool backup) {
+    files += "      <File backup=\"" + std::string(backup ? "1" : "0") + "\">\n";
+    files += "        <ID>" + fileid + "</ID>\n";
+    files += "        <Type>" + type + "</Type>\n";
+    files += "        <Block id=\"" + block + "\">\n";
+    files += "          <Base>" + hex(base) + "</Base>\n";
+    files += "          <Size>" + hex(size) + "</Size>\n";
+    files += "        </Block>\n";
+    files += "        <Flag>1</Flag>\n";
+    files += "        <CheckFlag>1</CheckFlag>\n";
+    files += "      </File>\n";
+}
+
+void PacWriter::partition(const std::string &id, uint32_t size) {
+    partitions += "        <Partition id=\"" + id + "\" size=\"" + std::to_string(size) + "\"/>\n";
+}
+
+void PacWriter::setXml(const std::string &x) { custom = x; }
+
+std::string PacWriter::xml() {
+    if (!custom.empty()) return custom;
+
+    std::string x = "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<BMAConfig>\n";
+
+    x += "  <ProductList>\n    <Product name=\"" + product + "\">\n";
+    x += "      <SchemeName>" + product + "</SchemeName>\n";
+    if (!partitions.empty()) x += "      <Partitions>\n" + partitions + "      </Partitions>\n";
+    x += "    </Product>\n  </ProductList>\n";
+    x += "  <SchemeList>\n    <Scheme name=\"" + product + "\">\n" + files + "    </Scheme>\n  </SchemeList>\n";
+    x += "</BMAConfig>\n";
+
+    return x;
+}
+
+int PacWriter::write(const std::string &path) {
+    std::string x = xml();
+    std::vector<member> all;
+    pac_header_t hdr;
+    uint64_t off;
+    int fd;
+    bool ok = true;
+
+    all.push_back(member{"", product + ".xml", x.size(), {{0, x}}});
+    all.insert(all.end(), members.begin(), members.end());
+
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+
+    off = sizeof(pac_header_t) + all.size() * sizeof(bin_header_t);
+    for (size_t i = 0; i < all.size(); i++) {
+        bin_header_t bin;
+
+        memset(&bin, 0, sizeof(bin));
+        bin.dwSize = sizeof(bin);
+        wset(bin.szFileID, 256, all[i].fileid);
+        wset(bin.szFileName, 256, all[i].filename);
+        bin.dwLoFileSize = static_cast<uint32_t>(all[i].size);
+        bin.dwHiFileSize = static_cast<uint32_t>(all[i].size >> 32);
+        bin.dwLoDataOffset = static_cast<uint32_t>(off);
+        bin.dwHiDataOffset = static_cast<uint32_t>(off >> 32);
+        bin.nFileFlag = 1;
+        bin.nCheckFlag = 1;
+        ok = ok && pwrite(fd, &bin, sizeof(bin), sizeof(pac_header_t) + i * sizeof(bin)) == sizeof(bin);
+
+        for (auto &c : all[i].chunks)
+            ok = ok && pwrite(fd, c.second.data(), c.second.size(), off + c.first) == ssize_t(c.second.size());
+        off += all[i].size;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    wset(hdr.szVersion, 22, "BP_R1.0.0");
+    wset(hdr.szPrdName, 256, product);
+    wset(hdr.szPrdVersion, 256, "test");
+    hdr.dwHiSize = static_cast<uint32_t>(off >> 32);
+    hdr.dwLoSize = static_cast<uint32_t>(off);
+    hdr.nFileCount = all.size();
+    hdr.dwFileOffset = sizeof(pac_header_t);
+    ok = ok && pwrite(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr);
+    ok = ok && !ftruncate(fd, off);
+
+    close(fd);
+    return ok ? 0 : -1;
+}
+
+TempPath::TempPath(const std::string &suffix) {
+    const char *dir = getenv("TMPDIR");
+    std::string tmpl = std::string(dir ? dir : "/tmp") + "/dloader.XXXXXX";
+    std::vector<char> name(tmpl.begin(), tmpl.end());
+    int fd;
+
+    name.push_back(0);
+    fd = mkstemp(name.data());
+    if (fd >= 0) close(fd);
+    path = std::string(name.data()) + suffix;
+    if (!suffix.empty()) unlink(name.data());
+}
+
+TempPath::~TempPath() { unlink(path.c_str()); }
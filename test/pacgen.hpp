@@ -0,0 +1,67 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 00:12:30
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 00:12:30
+ * @Description: pacs made up for tests and benchmarks
+ */
+#ifndef __PACGEN__
+#define __PACGEN__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * members are written where they go and nothing else, the rest of them is
+ * a hole. a pac of many GB takes no disk and reads back as zeros there.
+ */
+class PacWriter {
+   private:
+    struct member {
+        std::string fileid;
+        std::string filename;
+        uint64_t size;
+        std::vector<std::pair<uint64_t, std::string>> chunks;  // offset in the member and bytes there
+    };
+
+    std::string product;
+    std::vector<member> members;
+    std::string files;       // File elements of the scheme
+    std::string partitions;  // Partition elements
+    std::string custom;      // the xml as is, if set
+
+   public:
+    explicit PacWriter(const std::string &product);
+
+    // a member of size bytes, a hole unless put into
+    void add(const std::string &fileid, const std::string &filename, uint64_t size);
+    // data at off of the member added last
+    void put(uint64_t off, const std::string &data);
+    // a member of size pseudo random bytes
+    void addRandom(const std::string &fileid, const std::string &filename, uint64_t size, uint64_t seed);
+
+    // a File element of the scheme, fileid should name a member
+    void file(const std::string &fileid, const std::string &type, const std::string &block, uint64_t size,
+              uint64_t base = 0, bool backup = false);
+    void partition(const std::string &id, uint32_t size);
+    // the xml goes as given instead of the one built from file() and partition()
+    void setXml(const std::string &x);
+    std::string xml();
+
+    // with the xml as its first member. 0 or -1
+    int write(const std::string &path);
+};
+
+// a name in the temp dir no one else has, removed with the object
+class TempPath {
+   private:
+    std::string path;
+
+   public:
+    explicit TempPath(const std::string &suffix = "");
+    ~TempPath();
+    const std::string &str() const { return path; }
+};
+
+#endif  //__PACGEN__
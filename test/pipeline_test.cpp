@@ -0,0 +1,210 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 06:31:40
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 06:31:40
+ * @Description: pipelined midst frames, handed out and released in order, and upgrades sent through it
+ */
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "pipeline.hpp"
+#include "upgrade_manager.hpp"
+#include "serial.hpp"
+#include "fakepty.hpp"
+#include "pacgen.hpp"
+#include "check.hpp"
+
+#define DEPTH 4
+#define FRAMESZ 0x840
+
+typedef std::vector<uint8_t> bytes;
+
+struct modle {
+    const char *name;
+    CRC_MODLE crc;
+    bool escaped;
+};
+
+static const modle modles[] = {
+    {"bootcode", CRC_MODLE::CRC_BOOTCODE, true},
+    {"fdl2", CRC_MODLE::CRC_FDL, false},
+};
+
+static bytes raw(FDLRequest *req) { return bytes(req->rawData(), req->rawData() + req->rawDataLen()); }
+
+// the frame transfer() builds for the same chunk, stop-and-wait
+static bytes standalone(const modle &m, const uint8_t *data, uint32_t len) {
+    FDLRequest req;
+
+    req.setCrcModle(m.crc);
+    req.setEscapeFlag(m.escaped, m.escaped);
+    req.newMidstData(data, len);
+    return raw(&req);
+}
+
+static bytes image(uint32_t len, uint64_t seed) {
+    bytes buf(len);
+
+    // 0x7e and 0x7d often, so escaped frames differ in length from the chunk
+    for (auto &c : buf) {
+        uint64_t k = pseudo_random(seed);
+        c = (k & 7) == 0 ? 0x7e : (k & 7) == 1 ? 0x7d : k >> 8;
+    }
+    return buf;
+}
+
+/**
+ * depth frames go out before the first is released, then one more for each
+ * release. every frame is the chunk it stands for, in order, and frames
+ * still in flight stay as they were while freed slots are filled behind them
+ */
+static void ordering(const modle &m) {
+    bytes src = image(10 * FRAMESZ + 123, 7);
+    uint32_t chunks = (src.size() + FRAMESZ - 1) / FRAMESZ;
+    TransferPipeline pipe(DEPTH);
+    std::vector<std::pair<FDLRequest *, bytes>> inflight;
+    uint32_t handed = 0, wrong = 0, stale = 0;
+
+    pipe.setFrameModle(m.crc, m.escaped, m.escaped);
+    CHECK(pipe.start(byte_span(src.data(), src.size()), FRAMESZ, 0));
+
+    while (handed < chunks || !inflight.empty()) {
+        FDLRequest *req;
+
+        while ((req = pipe.next())) {
+            uint32_t off = handed * FRAMESZ;
+            uint32_t len = src.size() - off > FRAMESZ ? FRAMESZ : src.size() - off;
+
+            if (raw(req) != standalone(m, &src[off], len)) wrong++;
+            inflight.push_back(std::make_pair(req, raw(req)));
+            handed++;
+        }
+
+        // no more than depth out, and none past the last chunk
+        CHECK(inflight.size() <= DEPTH);
+        CHECK(handed == chunks || inflight.size() == DEPTH);
+        if (inflight.empty()) break;
+
+        for (auto &f : inflight)
+            if (raw(f.first) != f.second) stale++;
+
+        // the ack of the oldest is in
+        pipe.release();
+        inflight.erase(inflight.begin());
+    }
+    pipe.stop();
+
+    CHECK(handed == chunks && wrong == 0 && stale == 0);
+    CHECK(pipe.next() == nullptr);
+}
+
+// crc16 goes over the first 2 bytes of the first chunk only, the mapping is left as it is
+static void firstchunk(const modle &m) {
+    bytes src = image(3 * FRAMESZ, 11);
+    bytes orig = src;
+    bytes patched(src.begin(), src.begin() + FRAMESZ);
+    TransferPipeline pipe(DEPTH);
+    FDLRequest *req;
+
+    patched[0] = 0x12;
+    patched[1] = 0x34;
+    pipe.setFrameModle(m.crc, m.escaped, m.escaped);
+    CHECK(pipe.start(byte_span(src.data(), src.size()), FRAMESZ, 0x1234));
+
+    CHECK((req = pipe.next()) && raw(req) == standalone(m, patched.data(), FRAMESZ));
+    CHECK((req = pipe.next()) && raw(req) == standalone(m, &src[FRAMESZ], FRAMESZ));
+    pipe.stop();
+    CHECK(src == orig);
+}
+
+// an empty file is one empty frame, as transfer() sends it
+static void empty(const modle &m) {
+    uint8_t nothing = 0;
+    TransferPipeline pipe(DEPTH);
+    FDLRequest *req;
+
+    pipe.setFrameModle(m.crc, m.escaped, m.escaped);
+    CHECK(pipe.start(byte_span(&nothing, 0), FRAMESZ, 0));
+    CHECK((req = pipe.next()) && raw(req) == standalone(m, &nothing, 0));
+    CHECK(pipe.next() == nullptr);
+    pipe.release();
+    CHECK(pipe.next() == nullptr);
+    pipe.stop();
+}
+
+static uint32_t fnv(const byte_span &s) {
+    uint32_t h = 2166136261u;
+
+    for (uint64_t i = 0; i < s.size; i++) h = (h ^ s.data[i]) * 16777619u;
+    return h;
+}
+
+/**
+ * a whole upgrade over a pty, acks matched to frames in order with the
+ * pipeline alone and with a window. the device gets every image as it is
+ */
+static void upgrade(std::shared_ptr<Firmware> &fw, uint32_t depth, uint32_t window) {
+    FakePty pty(0, 0, false);
+    TempPath profile(".profile");
+    FakeFDL st;
+    int ret;
+
+    CHECK(pty.isOpened());
+    {
+        std::shared_ptr<USBStream> us(new SerialPort(pty.path()));
+        UpgradeManager upmgr(pty.path(), fw, us);
+
+        upmgr.setProfile(profile.str());
+        CHECK(upmgr.prepare());
+        upmgr.setPipelineDepth(depth);
+        upmgr.setMidstWindow(window);
+        ret = upmgr.upgrade(false);
+    }
+    st = pty.state();
+
+    printf("pipeline %u window %u: upgrade %s, %zu downloads\n", depth, window, ret ? "failed" : "done",
+           st.written.size());
+    CHECK(ret == 0 && !st.nested && !st.early_ends);
+    CHECK(st.written.size() == 3);
+    if (st.written.size() == 3) {
+        CHECK(st.written[0] == fnv(fw->member("FDL")));
+        CHECK(st.written[1] == fnv(fw->member("FDL2")));
+        CHECK(st.written[2] == fnv(fw->member("system")));
+    }
+}
+
+int main() {
+    TempPath pac(".pac");
+    PacWriter w("PIPELINE_MODEM");
+    std::shared_ptr<Firmware> fw;
+
+    for (auto &m : modles) {
+        int before = check_failures();
+
+        ordering(m);
+        firstchunk(m);
+        empty(m);
+        printf("%-8s %s\n", m.name, check_failures() == before ? "ok" : "FAILED");
+    }
+
+    w.addRandom("FDL", "fdl1.bin", 0x6000 + 7, 1);
+    w.addRandom("FDL2", "fdl2.bin", 0x20000 + 3, 2);
+    w.addRandom("system", "system.img", 1024 * 1024 + 1, 3);
+    w.file("FDL", "FDL", "0x5000", 0x6000 + 7, 0x5000);
+    w.file("FDL2", "NAND_FDL", "0x9efffe00", 0x20000 + 3, 0x9efffe00);
+    w.file("system", "CODE2", "system", 1024 * 1024 + 1);
+    CHECK(w.write(pac.str()) == 0);
+
+    fw.reset(new Firmware(pac.str()));
+    CHECK(fw->pacparser() == 0 && fw->xmlparser() == 0);
+    if (check_failures()) return 1;
+
+    upgrade(fw, 0, 0);
+    upgrade(fw, 9, 0);
+    upgrade(fw, 9, 8);
+
+    return check_failures() ? 1 : 0;
+}
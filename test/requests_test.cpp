@@ -0,0 +1,131 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 03:20:41
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 03:20:41
+ * @Description: sessions of FDLRequest and PDLRequest frames built on many threads at once match a lone one
+ */
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <sys/uio.h>
+}
+
+#include "fdl.hpp"
+#include "pdl.hpp"
+#include "upgrade_manager.hpp"
+#include "check.hpp"
+
+#define THREADS 16
+#define SESSIONS 50
+
+static std::vector<uint8_t> image;  // read only, shared by every session as the pac is
+
+static void fnv(uint32_t &h, const struct iovec *iov, int iovcnt) {
+    for (int i = 0; i < iovcnt; i++) {
+        auto p = static_cast<const uint8_t *>(iov[i].iov_base);
+
+        for (size_t j = 0; j < iov[i].iov_len; j++) h = (h ^ p[j]) * 16777619u;
+    }
+}
+
+// host_fdl over pdl: connect, start, 48 midst, end and exec
+static void pdl_session(uint32_t &h) {
+    PDLRequest req;
+
+    req.newPDLConnect();
+    fnv(h, req.rawIov(), req.rawIovCnt());
+    req.newPDLStart(0x80000000, 48 * FRAMESZ_PDL);
+    fnv(h, req.rawIov(), req.rawIovCnt());
+    for (uint32_t i = 0; i < 48; i++) {
+        req.newPDLMidst(&image[i * FRAMESZ_PDL], FRAMESZ_PDL);
+        fnv(h, req.rawIov(), req.rawIovCnt());
+    }
+    req.newPDLEnd();
+    fnv(h, req.rawIov(), req.rawIovCnt());
+    req.newPDLExec();
+    fnv(h, req.rawIov(), req.rawIovCnt());
+}
+
+// fdl1 as bootcode takes it, then fdl2 writing one partition and reading another back
+static void fdl_session(uint32_t &h) {
+    FDLRequest req;
+
+    req.setCrcModle(CRC_MODLE::CRC_BOOTCODE);
+    req.setEscapeFlag(true, true);
+    req.newCheckBaud();
+    fnv(h, req.rawIov(), req.rawIovCnt());
+    req.newConnect();
+    fnv(h, req.rawIov(), req.rawIovCnt());
+    req.newStartData(0x5000, 8 * FRAMESZ_BOOTCODE);
+    fnv(h, req.rawIov(), req.rawIovCnt());
+    for (uint32_t i = 0; i < 8; i++) {
+        req.newMidstData(&image[i * FRAMESZ_BOOTCODE], FRAMESZ_BOOTCODE);
+        fnv(h, req.rawIov(), req.rawIovCnt());
+    }
+    req.newEndData();
+    fnv(h, req.rawIov(), req.rawIovCnt());
+    req.newExecData();
+    fnv(h, req.rawIov(), req.rawIovCnt());
+
+    req.setCrcModle(CRC_MODLE::CRC_FDL);
+    req.setEscapeFlag(false, false);
+    req.newStartData("system", 8 * FRAMESZ_DATA);
+    req.setArgString("system");
+    fnv(h, req.rawIov(), req.rawIovCnt());
+    for (uint32_t i = 0; i < 8; i++) {
+        req.newMidstData(&image[i * FRAMESZ_DATA], FRAMESZ_DATA);
+        fnv(h, req.rawIov(), req.rawIovCnt());
+    }
+    req.newEndData();
+    fnv(h, req.rawIov(), req.rawIovCnt());
+
+    req.newStartRead("nv", 4 * FRAMESZ_DATA);
+    fnv(h, req.rawIov(), req.rawIovCnt());
+    for (uint32_t i = 0; i < 4; i++) {
+        req.newReadMidst(FRAMESZ_DATA, i * FRAMESZ_DATA);
+        fnv(h, req.rawIov(), req.rawIovCnt());
+    }
+    req.newEndRead();
+    fnv(h, req.rawIov(), req.rawIovCnt());
+}
+
+static uint32_t session() {
+    uint32_t h = 2166136261u;
+
+    pdl_session(h);
+    fdl_session(h);
+    return h;
+}
+
+int main() {
+    uint64_t seed = 20;
+    uint32_t reference;
+    std::atomic<uint32_t> differ(0);
+    std::vector<std::thread> threads;
+
+    image.resize(48 * FRAMESZ_PDL);
+    for (auto &c : image) c = static_cast<uint8_t>(pseudo_random(seed));
+
+    // a second session in the same thread starts from scratch too
+    reference = session();
+    CHECK(session() == reference);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int t = 0; t < THREADS; t++) {
+        threads.emplace_back([&] {
+            for (int s = 0; s < SESSIONS; s++)
+                if (session() != reference) differ++;
+        });
+    }
+    for (auto &th : threads) th.join();
+
+    printf("%d threads x %d sessions: %u differ from the lone one, %.1f ms\n", THREADS, SESSIONS, differ.load(),
+           elapsed(start) * 1e3);
+    CHECK(differ == 0);
+
+    return check_failures() ? 1 : 0;
+}
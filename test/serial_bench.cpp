@@ -0,0 +1,100 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 02:05:33
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 02:05:33
+ * @Description: reads and epoll_waits per MB of backup over a pty, replies coming in pieces
+ */
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <memory>
+
+extern "C" {
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+}
+
+#include "upgrade_manager.hpp"
+#include "serial.hpp"
+#include "fakepty.hpp"
+#include "pacgen.hpp"
+#include "check.hpp"
+
+#define PARTITION_SIZE (1024 * 1024)
+
+// calls of the thread running the backup, the fake fdl on its own thread is left out
+static thread_local bool counting = false;
+static uint64_t reads = 0, waits = 0;
+
+extern "C" ssize_t read(int fd, void *buf, size_t count) {
+    if (counting) reads++;
+    return syscall(SYS_read, fd, buf, count);
+}
+
+extern "C" int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout) {
+    if (counting) waits++;
+    return epoll_pwait(epfd, events, maxevents, timeout, nullptr);
+}
+
+static void backup(std::shared_ptr<Firmware> &fw, uint32_t chunk, uint32_t gap) {
+    FakePty pty(chunk, gap);
+    TempPath bak(".bak");
+    TempPath profile(".profile");
+    std::shared_ptr<USBStream> us(new SerialPort(pty.path()));
+    UpgradeManager upmgr(pty.path(), fw, us);
+    XMLFileInfo info;
+    std::string name = bak.str().substr(0, bak.str().size() - 4);
+    std::chrono::steady_clock::time_point start;
+    double sec;
+    int ret;
+
+    CHECK(pty.isOpened() && us->isOpened());
+    upmgr.setProfile(profile.str());
+
+    // the backup goes to <pac dir>/<fileid>.bak, that is bak
+    info.fileid = name.substr(name.find_last_of('/') + 1);
+    info.blockid = "nv";
+    info.size = PARTITION_SIZE;
+    info.use_old_proto = false;
+
+    reads = waits = 0;
+    start = std::chrono::steady_clock::now();
+    counting = true;
+    ret = upmgr.backup_partition(info);
+    counting = false;
+    sec = elapsed(start);
+
+    CHECK(ret == 0);
+    if (!ret) {
+        std::ifstream fin(bak.str(), std::ios::binary);
+        std::string got((std::istreambuf_iterator<char>(fin)), std::istreambuf_iterator<char>());
+        bool same = got.size() == PARTITION_SIZE;
+
+        for (uint32_t i = 0; same && i < PARTITION_SIZE; i++) same = static_cast<uint8_t>(got[i]) == FakeFDL::flash(i);
+        CHECK(same);
+    }
+
+    printf("%5u B / %3u us: %6.0f read + %5.0f epoll_wait per MB, %6.1f ms\n", chunk, gap,
+           reads * 1048576.0 / PARTITION_SIZE, waits * 1048576.0 / PARTITION_SIZE, sec * 1e3);
+}
+
+int main() {
+    static const uint32_t cases[][2] = {{512, 0}, {512, 100}, {64, 20}, {32, 300}};
+    TempPath pac(".pac");
+    PacWriter w("BENCH_MODEM");
+    std::shared_ptr<Firmware> fw;
+
+    // only its directory matters, backups go next to it
+    w.add("FDL", "fdl1.bin", 16);
+    CHECK(w.write(pac.str()) == 0);
+    fw.reset(new Firmware(pac.str()));
+
+    printf("backup of %u KB by read_midst of 0x%x, each reply written in chunk byte pieces gap us apart.\n"
+           "the receive before batching took one read and one epoll_wait per piece that was in\n",
+           PARTITION_SIZE / 1024, FRAMESZ_DATA);
+    for (auto &c : cases) backup(fw, c[0], c[1]);
+
+    return check_failures() ? 1 : 0;
+}
@@ -0,0 +1,159 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 07:48:31
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 07:48:31
+ * @Description: SerialPort writes on a pty read slowly or not at all, partial writes and the timeout, low latency
+ */
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/uio.h>
+}
+
+#include "serial.hpp"
+#include "check.hpp"
+
+// a pty nothing answers on, the test reads its master as it likes
+struct pty {
+    int master;
+    std::string slave;
+
+    pty() : master(posix_openpt(O_RDWR | O_NOCTTY)) {
+        struct termios tio;
+        char *name;
+
+        if (master < 0) return;
+        if (grantpt(master) || unlockpt(master) || !(name = ptsname(master))) {
+            close(master);
+            master = -1;
+            return;
+        }
+        slave = name;
+        if (!tcgetattr(master, &tio)) {
+            cfmakeraw(&tio);
+            tcsetattr(master, TCSANOW, &tio);
+        }
+    }
+    ~pty() {
+        if (master >= 0) close(master);
+    }
+};
+
+static std::vector<uint8_t> random_bytes(uint32_t len, uint64_t seed) {
+    std::vector<uint8_t> buf(len);
+
+    for (auto &c : buf) c = static_cast<uint8_t>(pseudo_random(seed));
+    return buf;
+}
+
+// no one reads, the tty fills up and the write gives up at the timeout, not before and not much after
+static void timeout() {
+    pty p;
+    std::vector<uint8_t> big = random_bytes(1024 * 1024, 5);
+    std::chrono::steady_clock::time_point start;
+    double sec;
+    bool ok;
+
+    CHECK(p.master >= 0);
+    if (p.master < 0) return;
+    SerialPort port(p.slave);
+    CHECK(port.isOpened());
+
+    start = std::chrono::steady_clock::now();
+    ok = port.sendSync(big.data(), big.size(), 300);
+    sec = elapsed(start);
+
+    printf("1 MB to a tty no one reads: %s after %.0f ms, asked 300\n", ok ? "sent" : "timed out", sec * 1e3);
+    CHECK(!ok && sec >= 0.28 && sec < 1.0);
+}
+
+/**
+ * the reader takes a few KB at a time, so writev takes part of a segment
+ * each time and waits for room. the bytes come out whole and in order
+ */
+static void partial() {
+    pty p;
+    std::vector<uint8_t> head = random_bytes(5, 7), body = random_bytes(300000, 11), tail = random_bytes(3, 13);
+    std::vector<uint8_t> expect, got;
+    std::atomic<bool> done(false);
+    bool ok;
+
+    CHECK(p.master >= 0);
+    if (p.master < 0) return;
+    SerialPort port(p.slave);
+    CHECK(port.isOpened());
+
+    expect = head;
+    expect.insert(expect.end(), body.begin(), body.end());
+    expect.insert(expect.end(), tail.begin(), tail.end());
+
+    std::thread reader([&]() {
+        uint8_t buf[3000];
+
+        while (got.size() < expect.size() && !done) {
+            struct pollfd pfd = {p.master, POLLIN, 0};
+            ssize_t n;
+
+            if (poll(&pfd, 1, 20) <= 0) continue;
+            n = read(p.master, buf, sizeof(buf));
+            if (n > 0) got.insert(got.end(), buf, buf + n);
+            usleep(200);
+        }
+    });
+
+    struct iovec iov[3] = {{head.data(), head.size()}, {body.data(), body.size()}, {tail.data(), tail.size()}};
+    ok = port.sendvSync(iov, 3, 10000);
+
+    // what the tty holds still comes out after the write returns
+    for (int i = 0; i < 500 && got.size() < expect.size(); i++) usleep(1000);
+    done = true;
+    reader.join();
+
+    printf("%zu bytes in three segments to a slow reader: %s, %zu read back\n", expect.size(),
+           ok ? "sent" : "failed", got.size());
+    CHECK(ok && got == expect);
+}
+
+/**
+ * a pty has no serial_struct and no usb power control, so the low latency
+ * profile is not applied. that is told, and the link goes on as it was
+ */
+static void lowlatency() {
+    pty p;
+    uint8_t ping[] = {0x7e, 0x00, 0x00, 0x00, 0x00, 0x7e};
+    uint8_t buf[16];
+    bool on, off, echoed;
+
+    CHECK(p.master >= 0);
+    if (p.master < 0) return;
+    SerialPort port(p.slave);
+    CHECK(port.isOpened());
+
+    on = port.setLowLatency(true);
+    CHECK(port.sendSync(ping, sizeof(ping), 1000));
+    echoed = read(p.master, buf, sizeof(buf)) == sizeof(ping) && write(p.master, ping, sizeof(ping)) == sizeof(ping) &&
+             port.recvSync(1000) && port.datalen() == sizeof(ping);
+    off = port.setLowLatency(false);
+
+    printf("low latency on a pty: %s, link %s, off again: %s\n", on ? "applied" : "not applied",
+           echoed ? "goes on" : "lost", off ? "ok" : "failed");
+    CHECK(!on && echoed && off);
+}
+
+int main() {
+    timeout();
+    partial();
+    lowlatency();
+
+    return check_failures() ? 1 : 0;
+}
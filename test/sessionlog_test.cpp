@@ -0,0 +1,86 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 07:20:05
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 07:20:05
+ * @Description: lines of sessions logging at once come out whole, each with its tag
+ */
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sessionlog.hpp"
+#include "check.hpp"
+
+#define SESSIONS 8
+#define LINES 2000
+
+// a line as UpgradeManager writes them, in pieces, a folded run of '>' among them
+static void session(SessionLog &log, int id) {
+    log.setTag("1-" + std::to_string(id));
+    for (int i = 0; i < LINES; i++) {
+        if (i % 10 == 3) {
+            for (int k = 0; k < 20; k++) std::cerr << ">";
+            std::cerr << std::endl;
+        } else {
+            std::cerr << ">>> line " << i << " of " << id << " (" << 100 + i << ") " << std::endl;
+        }
+    }
+    std::cerr << "left open " << id;
+    log.setTag("");
+}
+
+int main() {
+    std::stringstream sink;
+    std::streambuf *orig = std::cerr.rdbuf(sink.rdbuf());
+    std::map<std::string, std::vector<std::string>> got;
+    std::string line;
+    int untagged = 0, wrong = 0;
+
+    {
+        SessionLog log;
+        std::vector<std::thread> th;
+
+        for (int id = 0; id < SESSIONS; id++) th.emplace_back(session, std::ref(log), id);
+        std::cerr << "main untagged" << std::endl;
+        for (auto &t : th) t.join();
+    }
+    std::cerr.rdbuf(orig);
+
+    while (std::getline(sink, line)) {
+        size_t end = line.find("] ");
+
+        if (line[0] != '[' || end == std::string::npos) {
+            untagged += line == "main untagged";
+            continue;
+        }
+        got[line.substr(1, end - 1)].push_back(line.substr(end + 2));
+    }
+
+    // every line of a session in order and whole, the one left open last
+    for (int id = 0; id < SESSIONS; id++) {
+        auto &lines = got["1-" + std::to_string(id)];
+
+        if (lines.size() != LINES + 1) {
+            wrong++;
+            continue;
+        }
+        for (int i = 0; i < LINES; i++) {
+            std::string expect = i % 10 == 3 ? std::string(20, '>')
+                                             : ">>> line " + std::to_string(i) + " of " + std::to_string(id) + " (" +
+                                                   std::to_string(100 + i) + ") ";
+            if (lines[i] != expect) wrong++;
+        }
+        if (lines[LINES] != "left open " + std::to_string(id)) wrong++;
+    }
+
+    printf("%d sessions of %d lines: %zu tags, %d lines wrong, %d untagged\n", SESSIONS, LINES, got.size(), wrong,
+           untagged);
+    CHECK(got.size() == SESSIONS && wrong == 0 && untagged == 1);
+
+    return check_failures() ? 1 : 0;
+}
@@ -0,0 +1,173 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 02:31:48
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 02:31:48
+ * @Description: round trips over a pty, UringPort against the epoll SerialPort
+ */
+#include <cstdarg>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+extern "C" {
+#include <dlfcn.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/uio.h>
+#include <unistd.h>
+}
+
+#include "upgrade_manager.hpp"
+#include "serial.hpp"
+#include "uring.hpp"
+#include "fakepty.hpp"
+#include "pacgen.hpp"
+#include "check.hpp"
+
+#define ROUND_TRIPS 2000
+#define PARTITION_SIZE (1024 * 1024)
+
+// calls of the thread on the link, the fake fdl on its own thread is left out
+static thread_local bool counting = false;
+static uint64_t calls = 0;
+
+template <typename F>
+static F real(F, const char *name) {
+    return reinterpret_cast<F>(dlsym(RTLD_NEXT, name));
+}
+
+extern "C" ssize_t read(int fd, void *buf, size_t count) {
+    static auto fn = real(&read, "read");
+    if (counting) calls++;
+    return fn(fd, buf, count);
+}
+
+extern "C" ssize_t write(int fd, const void *buf, size_t count) {
+    static auto fn = real(&write, "write");
+    if (counting) calls++;
+    return fn(fd, buf, count);
+}
+
+extern "C" ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
+    static auto fn = real(&writev, "writev");
+    if (counting) calls++;
+    return fn(fd, iov, iovcnt);
+}
+
+extern "C" int epoll_wait(int epfd, struct epoll_event *events, int maxevents, int timeout) {
+    static auto fn = real(&epoll_wait, "epoll_wait");
+    if (counting) calls++;
+    return fn(epfd, events, maxevents, timeout);
+}
+
+// io_uring_enter has no wrapper, the ring goes through syscall()
+extern "C" long syscall(long number, ...) {
+    static auto fn = reinterpret_cast<long (*)(long, ...)>(dlsym(RTLD_NEXT, "syscall"));
+    long a[6];
+    va_list ap;
+
+    va_start(ap, number);
+    for (auto &v : a) v = va_arg(ap, long);
+    va_end(ap);
+
+    if (counting) calls++;
+    return fn(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+}
+
+static long switches() {
+    struct rusage ru;
+
+    getrusage(RUSAGE_THREAD, &ru);
+    return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+static std::shared_ptr<USBStream> open_link(bool uring, const std::string &path) {
+    if (uring) return std::shared_ptr<USBStream>(new UringPort(path));
+    return std::shared_ptr<USBStream>(new SerialPort(path));
+}
+
+// a midst frame of framesz and its ack, as talk() does it
+static void round_trips(bool uring, uint32_t framesz) {
+    FakePty pty;
+    auto us = open_link(uring, pty.path());
+    std::vector<uint8_t> payload(framesz, 0x5a);
+    FDLRequest req;
+    uint32_t acked = 0;
+    std::chrono::steady_clock::time_point start;
+    long csw = 0;
+    double sec;
+
+    CHECK(pty.isOpened() && us->isOpened());
+    req.setCrcModle(CRC_MODLE::CRC_FDL);
+    req.setEscapeFlag(false, false);
+
+    // midst frames are refused until a download is started
+    req.newStartData(0x80000000, (ROUND_TRIPS + 50) * framesz);
+    CHECK(us->sendvSync(req.rawIov(), req.rawIovCnt(), 1000) && us->recvAtLeast(8, 1000) && us->datalen() >= 8 &&
+          us->data()[2] == 0x80);
+    req.newMidstData(payload.data(), framesz);
+
+    for (int i = -50; i < ROUND_TRIPS; i++) {
+        if (!i) {
+            calls = 0;
+            csw = switches();
+            start = std::chrono::steady_clock::now();
+            counting = true;
+        }
+        if (us->sendvSync(req.rawIov(), req.rawIovCnt(), 1000) && us->recvAtLeast(8, 1000) && us->datalen() >= 8 &&
+            us->data()[2] == 0x80)
+            acked += i >= 0;
+    }
+    counting = false;
+    sec = elapsed(start);
+    csw = switches() - csw;
+
+    CHECK(acked == ROUND_TRIPS);
+    printf("%-6s 0x%04x: %6.1f us, %4.2f syscalls, %5.2f context switches per round trip\n", uring ? "uring" : "serial",
+           framesz, sec * 1e6 / ROUND_TRIPS, 1.0 * calls / ROUND_TRIPS, 1.0 * csw / ROUND_TRIPS);
+}
+
+static void backup(bool uring, std::shared_ptr<Firmware> &fw) {
+    FakePty pty;
+    TempPath bak(".bak");
+    TempPath profile(".profile");
+    auto us = open_link(uring, pty.path());
+    UpgradeManager upmgr(pty.path(), fw, us);
+    XMLFileInfo info;
+    std::string name = bak.str().substr(0, bak.str().size() - 4);
+    std::chrono::steady_clock::time_point start;
+    int ret;
+
+    upmgr.setProfile(profile.str());
+    info.fileid = name.substr(name.find_last_of('/') + 1);
+    info.blockid = "nv";
+    info.size = PARTITION_SIZE;
+
+    calls = 0;
+    start = std::chrono::steady_clock::now();
+    counting = true;
+    ret = upmgr.backup_partition(info);
+    counting = false;
+
+    CHECK(ret == 0);
+    printf("%-6s backup of %u KB: %llu syscalls, %.1f ms\n", uring ? "uring" : "serial", PARTITION_SIZE / 1024,
+           static_cast<unsigned long long>(calls), elapsed(start) * 1e3);
+}
+
+int main() {
+    TempPath pac(".pac");
+    PacWriter w("BENCH_MODEM");
+    std::shared_ptr<Firmware> fw;
+
+    w.add("FDL", "fdl1.bin", 16);
+    CHECK(w.write(pac.str()) == 0);
+    fw.reset(new Firmware(pac.str()));
+
+    printf("a fake fdl2 acks on the other end of a pty, syscalls and context switches are the link thread's\n");
+    for (uint32_t framesz : {FRAMESZ_BOOTCODE, FRAMESZ_FDL, FRAMESZ_DATA})
+        for (bool uring : {false, true}) round_trips(uring, framesz);
+    for (bool uring : {false, true}) backup(uring, fw);
+
+    return check_failures() ? 1 : 0;
+}
@@ -0,0 +1,94 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 01:20:05
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 01:20:05
+ * @Description: a whole upgrade over the fake usbfs bus, blocking against async urbs
+ */
+#include <cstdio>
+#include <memory>
+
+#include "upgrade_manager.hpp"
+#include "usbfs.hpp"
+#include "fakeusbfs.hpp"
+#include "pacgen.hpp"
+#include "check.hpp"
+
+#define SYSTEM_SIZE (6 * 1024 * 1024)
+
+struct run {
+    const char *name;
+    uint32_t urbs;  // OUT and IN each, 0 blocking
+    uint32_t depth;
+    uint32_t window;
+};
+
+static uint32_t upgrade(std::shared_ptr<Firmware> &fw, const run &r) {
+    FakeUSB bus;
+    TempPath profile(".profile");
+    USBFS *usbfs = bus.open();
+    std::shared_ptr<USBStream> us(usbfs);
+    auto start = std::chrono::steady_clock::now();
+    FakeUSBStats st;
+    int ret;
+
+    CHECK(usbfs != nullptr);
+    if (!usbfs) return 0;
+    usbfs->setAsync(r.urbs, r.urbs);
+
+    {
+        UpgradeManager upmgr("", fw, us);
+
+        upmgr.setProfile(profile.str());
+        CHECK(upmgr.prepare());
+        upmgr.setPipelineDepth(r.depth);
+        upmgr.setMidstWindow(r.window);
+        ret = upmgr.upgrade(false);
+    }
+    double sec = elapsed(start);
+    us.reset();
+
+    st = bus.stats();
+    CHECK(ret == 0);
+    printf("%-28s %7.1f ms, %5.2f MB/s, %u transfers, stream %08x\n", r.name, sec * 1e3,
+           st.bytes / sec / 1024 / 1024, st.transfers, st.hash);
+    return st.hash;
+}
+
+int main() {
+    static const run runs[] = {
+        {"blocking, stop-and-wait", 0, 0, 0},
+        {"8 urbs, stop-and-wait", 8, 0, 0},
+        {"8 urbs, pipeline 9", 8, 9, 0},
+        {"8 urbs, pipeline 9 window 8", 8, 9, 8},
+    };
+    TempPath pac(".pac");
+    PacWriter w("BENCH_MODEM");
+    std::shared_ptr<Firmware> fw;
+    uint32_t first = 0;
+
+    w.addRandom("FDL", "fdl1.bin", 0x6000, 1);
+    w.addRandom("FDL2", "fdl2.bin", 0x20000, 2);
+    w.addRandom("system", "system.img", SYSTEM_SIZE, 3);
+    w.file("FDL", "FDL", "0x5000", 0x6000, 0x5000);
+    w.file("FDL2", "NAND_FDL", "0x9efffe00", 0x20000, 0x9efffe00);
+    w.file("system", "CODE2", "system", SYSTEM_SIZE);
+    w.partition("system", 64);
+    CHECK(w.write(pac.str()) == 0);
+
+    fw.reset(new Firmware(pac.str()));
+    CHECK(fw->pacparser() == 0 && fw->xmlparser() == 0);
+    if (check_failures()) return 1;
+
+    printf("upgrade of a %u KB system image, bus schedules in 125 us, moves 40 bytes/us, device replies in 200 us\n",
+           SYSTEM_SIZE / 1024);
+    for (auto &r : runs) {
+        uint32_t hash = upgrade(fw, r);
+
+        // the device sees the same requests however they are sent
+        if (!first) first = hash;
+        CHECK(hash == first);
+    }
+
+    return check_failures() ? 1 : 0;
+}
@@ -0,0 +1,118 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 00:58:40
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 00:58:40
+ * @Description: async usbfs on the fake bus, transfers as the device sees them and recovery from failed urbs
+ */
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+extern "C" {
+#include <sys/uio.h>
+}
+
+#include "usbfs.hpp"
+#include "fakeusbfs.hpp"
+#include "check.hpp"
+
+static uint32_t fnv(const std::vector<uint8_t> &v) {
+    uint32_t h = 2166136261u;
+
+    for (auto c : v) h = (h ^ c) * 16777619u;
+    return h;
+}
+
+static bool acked(USBFS *usbfs) { return usbfs->datalen() == 8 && usbfs->data()[2] == 0x80; }
+
+// a gather list over 16 KB goes out as one transfer of continued urbs
+static void gather() {
+    FakeUSB bus;
+    std::unique_ptr<USBFS> usbfs(bus.open());
+    std::vector<uint8_t> big(40000);
+    uint64_t seed = 11;
+    FakeUSBStats st;
+
+    CHECK(usbfs != nullptr);
+    if (!usbfs) return;
+    usbfs->setAsync(4, 4);
+
+    for (auto &c : big) c = static_cast<uint8_t>(pseudo_random(seed));
+    struct iovec iov[3] = {{&big[0], 5}, {&big[5], 39990}, {&big[39995], 5}};
+    CHECK(usbfs->sendvSync(iov, 3, 1000));
+    CHECK(usbfs->recvSync(1000) && acked(usbfs.get()));
+
+    st = bus.stats();
+    printf("40000 byte gather: %u transfer, %u urbs, %u continued, %zu bytes mapped\n", st.transfers, st.urbs,
+           st.continued, st.mapped);
+    CHECK(st.transfers == 1 && st.urbs == 3 && st.continued == 2);
+    CHECK(st.bytes == big.size() && st.hash == fnv(big));
+    CHECK(st.mapped == 8 * 16 * 1024);
+}
+
+/**
+ * an IN urb stalls and an OUT one fails, each fails one call and the session
+ * goes on. a send returns once submitted, its failure comes with the next reap
+ */
+static void recovery() {
+    FakeUSB bus;
+    std::unique_ptr<USBFS> usbfs(bus.open());
+    uint8_t frame[64] = {0x7e, 0x00, 0x00, 0x00, 0x00};  // connect, acked whenever
+    int send_fails = 0, recv_fails = 0;
+
+    CHECK(usbfs != nullptr);
+    if (!usbfs) return;
+    usbfs->setAsync(4, 4);
+    bus.failIn(3);
+    bus.failOut(6);
+
+    for (int i = 0; i < 10; i++) {
+        bool sent = usbfs->sendSync(frame, sizeof(frame), 1000);
+        bool got = usbfs->recvSync(300) && acked(usbfs.get());
+
+        send_fails += !sent;
+        recv_fails += !got;
+        if (i >= 7) CHECK(sent && got);
+    }
+
+    printf("failed urbs: %d send and %d recv failed, %u halt cleared\n", send_fails, recv_fails, bus.stats().halts);
+    CHECK(send_fails + recv_fails == 2);
+    CHECK(bus.stats().halts == 1);
+}
+
+// blocking and async transfers put the same bytes on the bus
+static FakeUSBStats sequence(uint32_t urbs) {
+    static const uint32_t sizes[] = {8, 100, 2112, 16383, 16385, 12296, 33000, 40000, 5};
+    FakeUSB bus;
+    std::unique_ptr<USBFS> usbfs(bus.open());
+    uint64_t seed = 29;
+
+    CHECK(usbfs != nullptr);
+    if (!usbfs) return bus.stats();
+    usbfs->setAsync(urbs, urbs);
+
+    for (auto sz : sizes) {
+        std::vector<uint8_t> frame(sz);
+
+        for (auto &c : frame) c = static_cast<uint8_t>(pseudo_random(seed));
+        CHECK(usbfs->sendSync(frame.data(), sz, 1000));
+        CHECK(usbfs->recvSync(1000) && acked(usbfs.get()));
+    }
+
+    return bus.stats();
+}
+
+int main() {
+    gather();
+    recovery();
+
+    auto sync = sequence(0);
+    auto async = sequence(4);
+    printf("blocking and async: %u and %u transfers, stream %08x and %08x\n", sync.transfers, async.transfers,
+           sync.hash, async.hash);
+    CHECK(sync.transfers == 9 && async.transfers == 9);
+    CHECK(sync.bytes == async.bytes && sync.hash == async.hash);
+
+    return check_failures() ? 1 : 0;
+}
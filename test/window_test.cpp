@@ -0,0 +1,88 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 06:02:17
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 06:02:17
+ * @Description: a midst window that fails half way, the download is ended and sent over one frame at a time
+ */
+#include <cstdio>
+#include <memory>
+
+#include "upgrade_manager.hpp"
+#include "serial.hpp"
+#include "profile.hpp"
+#include "fakepty.hpp"
+#include "pacgen.hpp"
+#include "check.hpp"
+
+#define SYSTEM_SIZE (2 * 1024 * 1024)
+#define WINDOW 8
+#define FAIL_AT 120  // midst frame of the system image refused, the window is up to WINDOW by then
+
+static uint32_t fnv(const byte_span &s) {
+    uint32_t h = 2166136261u;
+
+    for (uint64_t i = 0; i < s.size; i++) h = (h ^ s.data[i]) * 16777619u;
+    return h;
+}
+
+static uint32_t frames(uint64_t size, uint32_t framesz) { return (size + framesz - 1) / framesz; }
+
+int main() {
+    TempPath pac(".pac");
+    TempPath profile(".profile");
+    PacWriter w("WINDOW_MODEM");
+    std::shared_ptr<Firmware> fw;
+    FakePty pty(0, 0, false);
+    FakeFDL st;
+    Profile learned;
+    int ret;
+
+    w.addRandom("FDL", "fdl1.bin", 0x6000, 1);
+    w.addRandom("FDL2", "fdl2.bin", 0x20000, 2);
+    w.addRandom("system", "system.img", SYSTEM_SIZE, 3);
+    w.file("FDL", "FDL", "0x5000", 0x6000, 0x5000);
+    w.file("FDL2", "NAND_FDL", "0x9efffe00", 0x20000, 0x9efffe00);
+    w.file("system", "CODE2", "system", SYSTEM_SIZE);
+    w.partition("system", 64);
+    CHECK(w.write(pac.str()) == 0);
+
+    fw.reset(new Firmware(pac.str()));
+    CHECK(fw->pacparser() == 0 && fw->xmlparser() == 0);
+    CHECK(pty.isOpened());
+    if (check_failures()) return 1;
+
+    // window 1, 2 and 4 take 32 acks each before it doubles
+    CHECK(FAIL_AT > 3 * WINDOW_PROBE_ACKS + WINDOW);
+    pty.failMidst(frames(0x6000, FRAMESZ_BOOTCODE) + frames(0x20000, FRAMESZ_FDL) + FAIL_AT);
+
+    {
+        std::shared_ptr<USBStream> us(new SerialPort(pty.path()));
+        UpgradeManager upmgr(pty.path(), fw, us);
+
+        upmgr.setProfile(profile.str());
+        CHECK(upmgr.prepare());
+        upmgr.setMidstWindow(WINDOW);
+        ret = upmgr.upgrade(false);
+    }
+    st = pty.state();
+
+    printf("window %u failed at frame %u of system: upgrade %s, %u early end, %u nested start, %zu downloads\n",
+           WINDOW, FAIL_AT, ret ? "failed" : "done", st.early_ends, st.nested, st.written.size());
+    CHECK(ret == 0);
+
+    // the one that failed is ended before START_DATA is sent again, and never taken for whole
+    CHECK(st.nested == 0 && st.early_ends == 1);
+    CHECK(st.written.size() == 3);
+    if (st.written.size() == 3) {
+        CHECK(st.written[0] == fnv(fw->member("FDL")));
+        CHECK(st.written[1] == fnv(fw->member("FDL2")));
+        CHECK(st.written[2] == fnv(fw->member("system")));
+    }
+
+    learned.setPath(profile.str());
+    CHECK(learned.load());
+    CHECK(learned.get("WINDOW_MODEM", "midst_window_fail", 0) == WINDOW);
+
+    return check_failures() ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 04:26:15
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 04:26:15
+ * @Description: xmlparser on schemes of 100 to 10k entries, the fields it reads and the time it takes
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+#include "firmware.hpp"
+#include "xmlscan.hpp"
+#include "pacgen.hpp"
+#include "check.hpp"
+
+#define MEMBERS 100  // files of the scheme take turns on them
+
+static uint64_t allocs = 0;
+
+void *operator new(size_t sz) {
+    void *p = malloc(sz ? sz : 1);
+
+    if (!p) throw std::bad_alloc();
+    allocs++;
+    return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+
+static const char *types[] = {"CODE2", "YAFFS_IMG2", "EraseFlash2", "UBOOT_LOADER2"};
+
+static std::string id(int i) {
+    char buf[16];
+
+    snprintf(buf, sizeof(buf), "Part%04d", i % MEMBERS);
+    return buf;
+}
+
+static void bench(int entries) {
+    TempPath pac(".pac");
+    PacWriter w("BENCH_MODEM");
+    std::unique_ptr<Firmware> fw;
+    std::string xml;
+    double best[2] = {1e9, 1e9}, scan_best = 1e9;
+    uint64_t calls_allocs = 0;
+
+    for (int i = 0; i < MEMBERS; i++) w.add(id(i), id(i) + ".bin", 256);
+    for (int i = 0; i < entries; i++)
+        w.file(id(i), types[i % 4], "blk" + std::to_string(i), 0x1000 + i, 0x80000000u + i * 0x100, i % 5 == 0);
+    for (int i = 0; i < entries / 10; i++) w.partition("p" + std::to_string(i), i + 1);
+    xml = w.xml();
+    CHECK(w.write(pac.str()) == 0);
+
+    // it logs a line per file, timed with and without the log
+    for (int r = 0; r < 40; r++) {
+        std::streambuf *saved = std::cerr.rdbuf();
+        std::chrono::steady_clock::time_point start;
+        uint64_t before;
+
+        fw.reset(new Firmware(pac.str()));
+        CHECK(fw->pacparser() == 0);
+
+        if (r % 2) std::cerr.rdbuf(nullptr);
+        before = allocs;
+        start = std::chrono::steady_clock::now();
+        CHECK(fw->xmlparser() == 0);
+        best[r % 2] = std::min(best[r % 2], elapsed(start));
+        calls_allocs = allocs - before;
+        std::cerr.rdbuf(saved);
+        std::cerr.clear();
+    }
+
+    // what the last one read
+    auto &files = fw->get_file_vec();
+    auto &parts = fw->get_partition_vec();
+    CHECK(files.size() == static_cast<size_t>(entries));
+    for (size_t i = 0; i < files.size(); i++) {
+        auto &f = files[i];
+
+        CHECK(f.fileid == id(i) && f.type == types[i % 4] && f.blockid == "blk" + std::to_string(i));
+        CHECK(f.size == 0x1000 + i && f.base == 0x80000000u + i * 0x100 && f.realsize == 256);
+        CHECK(f.flag == 1 && f.checkflag == 1 && f.isBackup == (i % 5 == 0));
+    }
+    CHECK(parts.size() == static_cast<size_t>(entries / 10));
+    for (size_t i = 0; i < parts.size(); i++)
+        CHECK(parts[i].partition == "p" + std::to_string(i) && parts[i].size == i + 1);
+
+    // the tokens alone
+    for (int r = 0; r < 20; r++) {
+        auto start = std::chrono::steady_clock::now();
+        XMLScanner xs(xml.data(), xml.size());
+        XMLTOKEN t;
+
+        while ((t = xs.next()) != XMLTOKEN::XML_EOF && t != XMLTOKEN::XML_ERROR) {
+        }
+        CHECK(t == XMLTOKEN::XML_EOF);
+        scan_best = std::min(scan_best, elapsed(start));
+    }
+
+    printf("%6d entries, %5zu KB: xmlparser %6.2f ms, %6.2f ms log off, %3llu allocs, tokens alone %6.2f ms\n",
+           entries, xml.size() / 1024, best[0] * 1e3, best[1] * 1e3, static_cast<unsigned long long>(calls_allocs),
+           scan_best * 1e3);
+}
+
+int main() {
+    printf("best of 20 each, allocs of one xmlparser call with the log off\n");
+    for (int entries : {100, 1000, 10000}) bench(entries);
+
+    return check_failures() ? 1 : 0;
+}
@@ -0,0 +1,351 @@
+/*
+ * @Author: sinpo828
+ * @Date: 2026-10-18 05:42:18
+ * @LastEditors: sinpo828
+ * @LastEditTime: 2026-10-18 05:42:18
+ * @Description: XMLScanner tokens and what Firmware::xmlparser takes from schemes, broken ones included
+ */
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "firmware.hpp"
+#include "xmlscan.hpp"
+#include "pacgen.hpp"
+#include "check.hpp"
+
+/**
+ * tokens one after the other, <name a=v> for a start, </name> for an end,
+ * [text] for text and cdata, {text} for the others and ! for an error.
+ * the xml is copied to a buffer of its exact size, a read past it shows
+ * under a sanitizer
+ */
+static std::string tokens(const std::string &xml, std::string *error = nullptr) {
+    std::vector<char> buf(xml.begin(), xml.end());
+    XMLScanner xs(buf.data(), buf.size());
+    std::string out;
+    XMLTOKEN t;
+
+    while ((t = xs.next()) != XMLTOKEN::XML_EOF) {
+        if (t == XMLTOKEN::XML_ERROR) {
+            if (error) *error = xs.error();
+            return out + "!";
+        }
+
+        if (t == XMLTOKEN::XML_START) {
+            out += "<" + xs.name();
+            for (uint32_t i = 0; i < xs.attrCount(); i++) out += " " + xs.attrName(i) + "=" + xs.attrValue(i);
+            out += ">";
+        } else if (t == XMLTOKEN::XML_END) {
+            out += "</" + xs.name() + ">";
+        } else if (t == XMLTOKEN::XML_TEXT) {
+            out += "[" + xs.text() + "]";
+        } else {
+            out += "{" + xs.text() + "}";
+        }
+    }
+
+    return out;
+}
+
+#define TOKENS(xml, expect)                                                                         \
+    do {                                                                                            \
+        std::string got = tokens(xml);                                                              \
+        if (got != (expect)) std::cerr << "  " << (xml) << "\n  gave " << got << std::endl;         \
+        CHECK(got == (expect));                                                                     \
+    } while (0)
+
+static std::string sub(const std::string &s, const std::string &from, const std::string &to) {
+    std::string out = s;
+    size_t at = out.find(from);
+
+    if (at != std::string::npos) out.replace(at, from.size(), to);
+    return out;
+}
+
+static std::string rep(const std::string &s, int n) {
+    std::string out;
+
+    while (n-- > 0) out += s;
+    return out;
+}
+
+static void entities() {
+    TOKENS("<a>&lt;&gt;&amp;&quot;&apos;</a>", "<a>[<>&\"']</a>");
+    TOKENS("<a>&#70;&#x44;&#x4c;</a>", "<a>[FDL]</a>");
+    TOKENS("<a>&#xe9;&#x20AC;&#x10FFFF;</a>", "<a>[\xc3\xa9\xe2\x82\xac\xf4\x8f\xbf\xbf]</a>");
+    // not references, kept as they are
+    TOKENS("<a>&#12a;&#X46;&foo;&amp x</a>", "<a>[&#12a;&#X46;&foo;&amp x]</a>");
+    // crlf, lfcr and a lone cr are one lf each
+    TOKENS("<a>1\r\n2\r3\n\r4\n5</a>", "<a>[1\n2\n3\n4\n5]</a>");
+    // text is taken whole with its spaces, only whitespace alone is skipped
+    TOKENS("<a> x <b>  \n </b></a>", "<a>[ x ]<b></b></a>");
+    TOKENS("<a>x &gt; y</a>", "<a>[x > y]</a>");
+}
+
+static void markup() {
+    // cdata is text, taken as is up to the first ]]>
+    TOKENS("<a><![CDATA[<b>&amp;]]x]]></a>", "<a>[<b>&amp;]]x]</a>");
+    TOKENS("<a><![CDATA[]]></a>", "<a>[]</a>");
+    TOKENS("<?xml version=\"1.0\"?><!--top--><a><!-- in&amp; --><!DOCTYPE x></a>",
+           "{xml version=\"1.0\"}{top}<a>{ in&amp; }{DOCTYPE x}</a>");
+    TOKENS("<?xml?><?x?><a/>", "{xml}{x}<a></a>");
+
+    // declarations go before anything else
+    TOKENS("<!--c--><?xml?><a/>", "{c}!");
+    TOKENS("<a><?x?></a>", "<a>!");
+    TOKENS("<a/><?x?>", "<a></a>!");
+
+    TOKENS("<a><!-- x</a>", "<a>!");
+    TOKENS("<a><![CDATA[ x</a>", "<a>!");
+    TOKENS("<a><?x</a>", "<a>!");
+}
+
+// <a/> and <a></a> give the same tokens at the same levels
+static void empties() {
+    const char *xml = "<r><a/><b></b><c /><d x=\"1\"/></r>";
+    std::vector<char> buf(xml, xml + strlen(xml));
+    XMLScanner xs(buf.data(), buf.size());
+    std::vector<uint32_t> levels;
+    XMLTOKEN t;
+
+    TOKENS(xml, "<r><a></a><b></b><c></c><d x=1></d></r>");
+    while ((t = xs.next()) != XMLTOKEN::XML_EOF && t != XMLTOKEN::XML_ERROR) levels.push_back(xs.level());
+    CHECK(t == XMLTOKEN::XML_EOF);
+    CHECK((levels == std::vector<uint32_t>{1, 2, 2, 2, 2, 2, 2, 2, 2, 1}));
+
+    // an end tag with a slash is an empty element, one with attributes an end, as tinyxml2 takes them
+    TOKENS("<r><a></a/></r>", "<r><a><a></a>!");
+    TOKENS("<r><a></a x=\"1\"></r>", "<r><a></a></r>");
+    TOKENS("< r ><  a\n>x<  /a  ></r >", "<r><a>[x]</a></r>");
+}
+
+static void attributes() {
+    TOKENS("<a x=\"1\" y='2' z = \"it's\" w='say \"hi\"' e=\"\"/>", "<a x=1 y=2 z=it's w=say \"hi\" e=></a>");
+    TOKENS("<a n=\"&lt;b&#65;&#xa;\r\nc\"/>", "<a n=<bA\n\nc></a>");
+    TOKENS("<a x=\"1\"y='2'/>", "<a x=1 y=2></a>");
+    TOKENS("<a x \n=\t \"1\"></a>", "<a x=1></a>");
+
+    TOKENS("<a x=1/>", "!");
+    TOKENS("<a x \"1\"/>", "!");
+    TOKENS("<a x/>", "!");
+    TOKENS("<a x=\"1\" x=\"2\"/>", "!");
+    TOKENS("<a x=\"1/>", "!");
+    TOKENS("<a x='1\"/>", "!");
+    TOKENS("<a 1=\"1\"/>", "!");
+}
+
+static void malformed() {
+    std::string error;
+
+    TOKENS("", "!");
+    TOKENS(" \n\t", "!");
+    TOKENS(std::string("\0<a/>", 5), "!");
+    TOKENS("<1a/>", "!");
+    TOKENS("<a>x</b>", "<a>[x]!");
+    TOKENS("<a><b></a></b>", "<a><b>!");
+    TOKENS("<a><b></b>", "<a><b></b>!");
+    TOKENS("<a></a>tail", "<a></a>!");
+    TOKENS("<a>x < y</a>", "<a>[x ]!");
+    TOKENS("<a><b x=\"1\"</a>", "<a>!");
+
+    // what is behind the root, or a 0 in it, is not looked at
+    TOKENS(std::string("<a/>\0\0<<junk", 11), "<a></a>");
+    TOKENS("<a/></q><<junk", "<a></a>");
+    TOKENS("\xef\xbb\xbf <a/>", "<a></a>");
+
+    // 98 levels of elements are fine, 99 are not, one that is empty does not count
+    CHECK(tokens(rep("<a>", 98) + rep("</a>", 98)).back() != '!');
+    CHECK(tokens(rep("<a>", 99) + rep("</a>", 99), &error).back() == '!' && error.find("deep") != std::string::npos);
+    CHECK(tokens(rep("<a>", 98) + "<b/>" + rep("</a>", 98)).back() != '!');
+    CHECK(tokens(rep("<a>", 98) + "<b></b>" + rep("</a>", 98)).back() == '!');
+}
+
+// a document cut anywhere inside its root is an error, never a shorter document
+static void truncated() {
+    std::string xml =
+        "<?xml version=\"1.0\"?>\n<R a=\"1\" b='&amp;'>\n  <b>t&amp;x&#65;</b>\n  <![CDATA[<x>]]>\n"
+        "  <!-- c -->\n  <e/>\n  <f></f>\n</R>\n";
+    size_t root = xml.find("<R");
+    size_t end = xml.find("</R>") + 4;
+    int wrong = 0;
+
+    CHECK(tokens(xml).back() != '!');
+    for (size_t cut = root + 1; cut < end; cut++)
+        if (tokens(xml.substr(0, cut)).back() != '!') wrong++;
+    CHECK(wrong == 0);
+}
+
+static const std::string S =
+    "<Scheme><File backup=\"1\"><ID>FDL</ID><Type>NV</Type><Block id=\"b\"><Base>0x10</Base><Size>0x20</Size></Block>"
+    "</File></Scheme>";
+static const std::string P = "<Partitions><Partition id=\"p\" size=\"0x10\"/></Partitions>";
+
+struct scheme {
+    const char *name;
+    std::string xml;
+    int ret;
+    // id,block,type,base,size,backup of each file then id=size of each partition, ; between them
+    const char *expect;
+};
+
+/**
+ * the answers are what tinyxml2 and the xmltree_find_node walk gave on
+ * the same xml. fields are the first element of their name in preorder
+ * with children, their value the first child whatever it is
+ */
+static const scheme schemes[] = {
+    {"plain", "<R>" + S + P + "</R>", 0, "FDL,b,NV,10,20,1;p=16"},
+    {"bom", "\xef\xbb\xbf<R>" + S + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"wsbom", "  \n\xef\xbb\xbf<R>" + S + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"bomws", "\xef\xbb\xbf  <R>" + S + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"nulpad", "<R>" + S + std::string("</R>\0\0\0garbage<<<", 17), 0, "FDL,b,NV,10,20,1"},
+    {"nulmid", "<R>" + S + std::string("\0</R>", 5), -1, ""},
+    {"ws", "   \n ", -1, ""},
+    {"nul", std::string("\0<R>", 4) + S + "</R>", -1, ""},
+    {"declonly", "<?xml version=\"1.0\"?>", -1, ""},
+    {"decl2", "<?xml?><?x?><R>" + S + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"declafter", "<!--c--><?xml?><R>" + S + "</R>", -1, ""},
+    {"declin", "<R><?x?>" + S + "</R>", -1, ""},
+    {"declend", "<R>" + S + "</R><?x?>", -1, ""},
+    {"stray", "<R>" + S + "</R></Q><<garbage", 0, "FDL,b,NV,10,20,1"},
+    {"straytop", "</Q><R>" + S + "</R>", -1, ""},
+    {"toptext", "hello<R>" + S + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"texttail", "<R>" + S + "</R>tail", -1, ""},
+    {"textend", "<R>" + S + "</R>  ", 0, "FDL,b,NV,10,20,1"},
+    {"twoRoots", "<A/><R>" + S + "</R>", -1, ""},
+    {"twoRoots2", "<A>x</A><R>" + S + "</R>", -1, ""},
+    {"schemeIsRoot", S, 0, "FDL,b,NV,10,20,1"},
+    {"endattr", "<R>" + sub(S, "</File>", "</File a=\"1\">") + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"endslash", "<R>" + sub(S, "</File>", "</File/>") + "</R>", -1, ""},
+    {"ws_in_tags", "< R >" + sub(sub(S, "<ID>", "<  ID\n>"), "</ID>", "<  /ID  >") + "</R >", 0, "FDL,b,NV,10,20,1"},
+    {"entities", "<R>" + sub(S, "FDL", "&#70;&#x44;&#x4C;") + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"entX", "<R>" + sub(S, "FDL", "&#X46;DL") + "</R>", 0, ""},
+    {"entbad", "<R>" + sub(S, "FDL", "&#x;FDL") + "</R>", 0, ""},
+    {"entbad2", "<R>" + sub(S, "FDL", "&#12a;FDL") + "</R>", 0, ""},
+    {"entunk", "<R>" + sub(S, "FDL", "&foo;FDL") + "</R>", 0, ""},
+    {"entnosemi", "<R>" + sub(S, "FDL", "&ampFDL") + "</R>", 0, ""},
+    {"entbig", "<R>" + sub(S, "FDL", "&#x10FFFF;FDL") + "</R>", 0, ""},
+    {"entbig2", "<R>" + sub(S, "FDL", "&#x200000;FDL") + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"attrent", "<R>" + sub(S, "id=\"b\"", "id=\"&lt;b&#65;&#xa;\r\nc\"") + "</R>", 0, "FDL,<bA\n\nc,NV,10,20,1"},
+    {"attrsq", "<R>" + sub(S, "id=\"b\"", "id='b\"x'") + "</R>", 0, "FDL,b\"x,NV,10,20,1"},
+    {"attrdup", "<R>" + sub(S, "id=\"b\"", "id=\"b\" id=\"c\"") + "</R>", -1, ""},
+    {"attrnoq", "<R>" + sub(S, "id=\"b\"", "id=b") + "</R>", -1, ""},
+    {"attrnoeq", "<R>" + sub(S, "id=\"b\"", "id \"b\"") + "</R>", -1, ""},
+    {"attrsp", "<R>" + sub(S, "id=\"b\"", "id \n=\t \"b\"") + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"cr", "<R>" + sub(S, "FDL", "F\rD\r\nL\n\r") + "</R>", 0, ""},
+    {"cdata", "<R>" + sub(S, "FDL", "<![CDATA[FDL]]>") + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"cdataent", "<R>" + sub(S, "FDL", "<![CDATA[&#70;DL]]>") + "</R>", 0, ""},
+    {"comment1st", "<R>" + sub(S, "<ID>FDL", "<ID><!--FDL-->x") + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"unknown", "<R><!DOCTYPE x>" + S + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"unknownID", "<R>" + sub(S, "<ID>FDL", "<ID><!FDL>") + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"pi_in", "<R>" + sub(S, "<ID>FDL", "<ID><?FDL?>") + "</R>", -1, ""},
+    {"schemeText", "<R>" + sub(S, "<Scheme>", "<Scheme>File") + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"schemeComment", "<R>" + sub(S, "<Scheme>", "<Scheme><!--File-->") + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"schemeX", "<R>" + sub(S, "<Scheme>", "<Scheme><X/>") + "</R>", -1, ""},
+    {"schemeWS", "<R>" + sub(S, "<Scheme>", "<Scheme>\n  \n") + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"emptyScheme", "<R><Scheme/>" + S + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"emptyScheme2", "<R><Scheme></Scheme>" + S + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"nestedScheme", "<R><X><Scheme><File><ID>FDL2</ID></File></Scheme></X>" + S + "</R>", 0, "FDL2,,,0,0,0"},
+    {"idInFileName", "<R><Scheme><ID><ID>FDL</ID></ID></Scheme></R>", -1, ""},
+    {"fileIsID", "<R><Scheme><File><ID>FDL</ID></File><ID>NV</ID></Scheme></R>", 0, "FDL,,,0,0,0;NV,,,0,0,0"},
+    {"partsInScheme", "<R><Scheme><File><ID>FDL</ID>" + P + "</File></Scheme></R>", 0, "FDL,,,0,0,0;p=16"},
+    {"schemeInParts", "<R><Partitions><Partition id=\"a\" size=\"1\"/>" + S + "</Partitions></R>",
+     0, "FDL,b,NV,10,20,1;a=1"},
+    {"partsdup",
+     "<R>" + S +
+         "<Partitions><Partition size=\"5\" id=\"q\" id2=\"r\"/><Partition id=\"q\" size=\"5\" x=\"1\"/><P/>"
+         "<Q a=\"1\">t</Q></Partitions></R>",
+     0, "FDL,b,NV,10,20,1;q=5;q=5;q=5;q=5"},
+    {"partsEmpty", "<R>" + S + "<Partitions/></R>", 0, "FDL,b,NV,10,20,1"},
+    {"partsSecond", "<R>" + S + "<Partitions/>" + P + "</R>", 0, "FDL,b,NV,10,20,1;p=16"},
+    {"unclosed", "<R>" + S, -1, ""},
+    {"mismatch", "<R>" + S + "</Q>", -1, ""},
+    {"textunclosed", "<R>" + S + "</R>\nabc", -1, ""},
+    {"badname", "<R>" + S + "<1a/></R>", -1, ""},
+    {"ltspace", "<R>" + S + "< /R>", 0, "FDL,b,NV,10,20,1"},
+    {"commentunclosed", "<R>" + S + "</R><!-- x", -1, ""},
+    {"utf8name", "<R>" + sub(S, "<Type>NV</Type>", "<T\xc3\xa9>x</T\xc3\xa9>") + "</R>", 0, "FDL,b,,10,20,1"},
+    {"namechars", "<R>" + sub(S, "<Type>NV</Type>", "<a.b-c:d_1>x</a.b-c:d_1>") + "</R>", 0, "FDL,b,,10,20,1"},
+    {"deep98", "<R>" + rep("<a>", 97) + rep("</a>", 97) + S + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"deep99", "<R>" + rep("<a>", 98) + rep("</a>", 98) + S + "</R>", -1, ""},
+    {"deep100", "<R>" + rep("<a>", 99) + rep("</a>", 99) + S + "</R>", -1, ""},
+    {"deep99e", "<R>" + rep("<a>", 97) + "<b/>" + rep("</a>", 97) + S + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"deep100e", "<R>" + rep("<a>", 98) + "<b/>" + rep("</a>", 98) + S + "</R>", -1, ""},
+    {"deep100t", "<R>" + rep("<a>", 98) + "t" + rep("</a>", 98) + S + "</R>", -1, ""},
+    {"backupatoi", "<R>" + sub(S, "backup=\"1\"", "x=\"  7abc\"") + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"hexsize", "<R>" + sub(S, "0x20", "  0xffffffffffffffffff ") + "</R>", 0, "FDL,b,NV,10,ffffffffffffffff,1"},
+    {"lonelt", "<R>" + S + "a < b</R>", -1, ""},
+    {"gt", "<R>" + S + "a > b</R>", 0, "FDL,b,NV,10,20,1"},
+    {"cdataunclosed", "<R>" + S + "<![CDATA[ x</R>", -1, ""},
+    {"amp_ws", "<R>" + sub(S, "FDL", " FDL ") + "</R>", 0, ""},
+    {"lfcr", "<R>\n\r" + sub(S, "FDL", "F\n\rDL") + "</R>", 0, ""},
+    {"emptyattr", "<R>" + sub(S, "id=\"b\"", "id=\"\"") + "</R>", 0, "FDL,,NV,10,20,1"},
+    {"slashspace", "<R>" + sub(S, "<Partition", "") + "<Q / ></R>", -1, ""},
+    {"idNested", "<R>" + sub(S, "<ID>FDL</ID>", "<Block id=\"n\"><ID>NV</ID></Block><ID>FDL</ID>") + "</R>",
+     0, "NV,n,NV,10,20,1"},
+    {"idSelfClosing", "<R>" + sub(S, "<ID>FDL</ID>", "<ID/><ID>FDL</ID>") + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"idEmpty", "<R>" + sub(S, "<ID>FDL</ID>", "<ID></ID><ID>FDL</ID>") + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"idNestedEmpty", "<R>" + sub(S, "<ID>FDL</ID>", "<X><ID/><ID></ID></X><ID>FDL</ID>") + "</R>",
+     0, "FDL,b,NV,10,20,1"},
+    {"idElement", "<R>" + sub(S, "<ID>FDL</ID>", "<ID><FDL/>NV</ID>") + "</R>", 0, "FDL,b,NV,10,20,1"},
+    {"attrnospace", "<R>" + sub(S, "id=\"b\"", "id=\"b\"x=\"c\"") + "</R>", 0, "FDL,b,NV,10,20,1"},
+};
+
+static std::string parsed(Firmware &fw) {
+    std::string out;
+    char buf[64];
+
+    for (auto &f : fw.get_file_vec()) {
+        snprintf(buf, sizeof(buf), ",%x,%llx,%d", f.base, static_cast<unsigned long long>(f.size), f.isBackup);
+        out += (out.empty() ? "" : ";") + f.fileid + "," + f.blockid + "," + f.type + buf;
+    }
+    for (auto &p : fw.get_partition_vec())
+        out += (out.empty() ? "" : ";") + p.partition + "=" + std::to_string(p.size);
+    return out;
+}
+
+static void schemes_parsed() {
+    TempPath pac(".pac");
+    std::streambuf *log = std::cerr.rdbuf();
+    int wrong = 0;
+
+    for (auto &s : schemes) {
+        PacWriter w("XML_MODEM");
+        std::string got;
+        int ret;
+
+        w.addRandom("FDL", "fdl1.bin", 0x100, 1);
+        w.addRandom("FDL2", "fdl2.bin", 0x100, 2);
+        w.addRandom("NV", "nv.bin", 0x100, 3);
+        w.setXml(s.xml);
+        CHECK(w.write(pac.str()) == 0);
+
+        Firmware fw(pac.str());
+        std::cerr.rdbuf(nullptr);
+        ret = fw.pacparser() ? -2 : fw.xmlparser();
+        std::cerr.rdbuf(log);
+        std::cerr.clear();
+
+        got = parsed(fw);
+        if (ret != s.ret || got != s.expect) {
+            std::cerr << s.name << ": " << ret << " " << got << ", expected " << s.ret << " " << s.expect << std::endl;
+            wrong++;
+        }
+    }
+    CHECK(wrong == 0);
+    printf("%zu schemes parsed\n", sizeof(schemes) / sizeof(schemes[0]));
+}
+
+int main() {
+    entities();
+    markup();
+    empties();
+    attributes();
+    malformed();
+    truncated();
+    schemes_parsed();
+
+    return check_failures() ? 1 : 0;
+}